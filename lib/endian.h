@@ -0,0 +1,97 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef LIB_ENDIAN_H
+#define LIB_ENDIAN_H
+
+#include <cstdint>
+#include <type_traits>
+
+#include "absl/base/attributes.h"
+
+// Integer fields stored in a fixed byte order. SCSI structures are big endian
+// and NVMe structures little endian; declaring their fields with these types
+// makes the conversion part of the field, so translators cannot forget or
+// repeat a swap. The byte order of the host is known at compile time, so
+// loads and stores are a bswap/movbe or nothing.
+namespace endian {
+
+constexpr bool kHostIsLittleEndian =
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+
+template <typename T>
+constexpr T ByteSwap(T value) {
+  static_assert(std::is_unsigned_v<T>, "Only unsigned integers are swapped");
+  if constexpr (sizeof(T) == 1) {
+    return value;
+  } else if constexpr (sizeof(T) == 2) {
+    return __builtin_bswap16(value);
+  } else if constexpr (sizeof(T) == 4) {
+    return __builtin_bswap32(value);
+  } else {
+    static_assert(sizeof(T) == 8);
+    return __builtin_bswap64(value);
+  }
+}
+
+// Converts between host and big endian byte order. The conversion is its own
+// inverse
+template <typename T>
+constexpr T HostToBig(T value) {
+  return kHostIsLittleEndian ? ByteSwap(value) : value;
+}
+
+// Converts between host and little endian byte order. The conversion is its
+// own inverse
+template <typename T>
+constexpr T HostToLittle(T value) {
+  return kHostIsLittleEndian ? value : ByteSwap(value);
+}
+
+// A T stored big endian. Assigning a host value stores it swapped, value()
+// loads it back in host order
+template <typename T>
+class BigEndian {
+ public:
+  BigEndian() = default;
+  constexpr BigEndian(T value) : raw_(HostToBig(value)) {}
+
+  constexpr T value() const { return HostToBig(raw_); }
+
+ private:
+  T raw_;
+} ABSL_ATTRIBUTE_PACKED;
+
+// A T stored little endian. Assigning a host value stores it swapped on big
+// endian hosts, value() loads it back in host order
+template <typename T>
+class LittleEndian {
+ public:
+  LittleEndian() = default;
+  constexpr LittleEndian(T value) : raw_(HostToLittle(value)) {}
+
+  constexpr T value() const { return HostToLittle(raw_); }
+
+ private:
+  T raw_;
+} ABSL_ATTRIBUTE_PACKED;
+
+static_assert(sizeof(BigEndian<uint64_t>) == 8 &&
+              alignof(BigEndian<uint64_t>) == 1);
+static_assert(std::is_trivially_copyable_v<BigEndian<uint32_t>>);
+static_assert(std::is_trivially_copyable_v<LittleEndian<uint32_t>>);
+
+}  // namespace endian
+
+#endif
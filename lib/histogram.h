@@ -0,0 +1,70 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef LIB_HISTOGRAM_H
+#define LIB_HISTOGRAM_H
+
+#include <cstdint>
+
+// Bucketing for HDR style log-linear histograms. Values below 2^kSubBits get
+// a bucket each; every larger power of two is split into 2^kSubBits equal
+// buckets, so a bucket is never wider than 2^-kSubBits of its values.
+// Values of 2^kMaxBits and more share the last bucket.
+namespace histogram {
+
+template <uint32_t kSubBits, uint32_t kMaxBits>
+struct LogLinear {
+  static_assert(kSubBits < kMaxBits && kMaxBits < 64);
+
+  static constexpr uint32_t kSubBuckets = 1u << kSubBits;
+  static constexpr uint32_t kBucketCount =
+      (kMaxBits - kSubBits + 1) * kSubBuckets;
+
+  static constexpr uint32_t Bucket(uint64_t value) {
+    if (value < kSubBuckets) return value;
+    uint32_t msb = 63 - __builtin_clzll(value);
+    if (msb >= kMaxBits) return kBucketCount - 1;
+    uint32_t shift = msb - kSubBits;
+    return (shift + 1) * kSubBuckets + ((value >> shift) & (kSubBuckets - 1));
+  }
+
+  // Largest value counted in bucket
+  static constexpr uint64_t BucketLimit(uint32_t bucket) {
+    if (bucket < kSubBuckets) return bucket;
+    uint32_t shift = bucket / kSubBuckets - 1;
+    uint64_t sub = bucket % kSubBuckets;
+    return ((kSubBuckets + sub + 1) << shift) - 1;
+  }
+
+  // Returns the limit of the bucket holding the per_mille-th value of total
+  // values. count(bucket) returns the number of values in bucket
+  template <typename CountFn>
+  static uint64_t Percentile(CountFn count, uint64_t total,
+                             uint32_t per_mille) {
+    if (total == 0) return 0;
+    // Rank of the value, rounded up so that the 1000th per mille is the last
+    uint64_t rank = (total * per_mille + 999) / 1000;
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (uint32_t bucket = 0; bucket < kBucketCount; ++bucket) {
+      seen += count(bucket);
+      if (seen >= rank) return BucketLimit(bucket);
+    }
+    return BucketLimit(kBucketCount - 1);
+  }
+};
+
+}  // namespace histogram
+
+#endif
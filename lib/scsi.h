@@ -18,11 +18,15 @@
 #include <cstdint>
 
 #include "absl/base/attributes.h"
+#include "lib/endian.h"
 
 // The fields of structures in this namespace are arranged according to Big
-// Endian format.
+// Endian format. Multi-byte fields declared BigEndian convert on access; the
+// remaining ones are swapped by the translators.
 namespace scsi {
 
+using endian::BigEndian;
+
 using LunAddress = uint64_t;
 
 // SAM-4 Table 33
@@ -165,6 +169,7 @@ enum class OpCode : uint8_t {
   kWrite10 = 0x2a,
   kVerify10 = 0x2f,
   kSync10 = 0x35,
+  kWriteSame10 = 0x41,
   kUnmap = 0x42,
   kReadToc = 0x43,
   kModeSense10 = 0x5a,
@@ -453,11 +458,49 @@ static_assert(sizeof(ReadCapacity10Command) == 9);
 // SCSI Reference Manual Table 120
 // https://www.seagate.com/files/staticfiles/support/docs/manual/Interface%20manuals/100293068j.pdf
 struct ReadCapacity10Data {
-  uint32_t returned_logical_block_address : 32;
-  uint32_t block_length : 32;
+  BigEndian<uint32_t> returned_logical_block_address;
+  BigEndian<uint32_t> block_length;
 } ABSL_ATTRIBUTE_PACKED;
 static_assert(sizeof(ReadCapacity10Data) == 8);
 
+// SCSI Reference Manual, SERVICE ACTION IN (16) service actions
+// https://www.seagate.com/files/staticfiles/support/docs/manual/Interface%20manuals/100293068j.pdf
+enum class ServiceActionIn16 : uint8_t {
+  kReadCapacity16 = 0x10,
+};
+
+// SCSI Reference Manual, READ CAPACITY (16) command
+// https://www.seagate.com/files/staticfiles/support/docs/manual/Interface%20manuals/100293068j.pdf
+struct ReadCapacity16Command {
+  uint8_t service_action : 5;
+  uint8_t reserved_1 : 3;
+  BigEndian<uint64_t> logical_block_address;  // obsolete
+  BigEndian<uint32_t> alloc_length;
+  uint8_t reserved_2 : 8;  // obsolete PMI bit
+  ControlByte control_byte;
+} ABSL_ATTRIBUTE_PACKED;
+static_assert(sizeof(ReadCapacity16Command) == 15);
+
+// SCSI Reference Manual, READ CAPACITY (16) parameter data
+// https://www.seagate.com/files/staticfiles/support/docs/manual/Interface%20manuals/100293068j.pdf
+struct ReadCapacity16Data {
+  BigEndian<uint64_t> returned_logical_block_address;
+  BigEndian<uint32_t> block_length;
+  bool prot_en : 1;     // Protection enabled
+  uint8_t p_type : 3;   // Protection type, one less than the NVMe PIT
+  uint8_t rc_basis : 2;
+  uint8_t reserved_1 : 2;
+  // Logical blocks per physical block as a power of two
+  uint8_t logical_blocks_per_physical_block_exponent : 4;
+  uint8_t p_i_exponent : 4;
+  uint8_t lowest_aligned_logical_block_address_msb : 6;
+  bool lbprz : 1;  // Logical block provisioning read zeros
+  bool lbpme : 1;  // Logical block provisioning management enabled
+  uint8_t lowest_aligned_logical_block_address_lsb : 8;
+  uint8_t reserved_2[16];
+} ABSL_ATTRIBUTE_PACKED;
+static_assert(sizeof(ReadCapacity16Data) == 32);
+
 // Refer to
 // https://www.seagate.com/files/staticfiles/support/docs/manual/Interface%20manuals/100293068j.pdf
 // , Section 3.6 Table 58
@@ -628,7 +671,7 @@ static_assert(sizeof(ProParamList) == 24);
 struct Read6Command {
   uint8_t logical_block_address_1 : 5;
   uint8_t reserved : 3;
-  uint16_t logical_block_address_2 : 16;
+  BigEndian<uint16_t> logical_block_address_2;
   uint8_t transfer_length : 8;
   ControlByte control_byte;
 } ABSL_ATTRIBUTE_PACKED;
@@ -642,10 +685,10 @@ struct Read10Command {
   bool fua : 1;            // Forced Unit access bit
   bool dpo : 1;            // disable page output bit
   uint8_t rd_protect : 3;  // read protect bit
-  uint32_t logical_block_address : 32;
+  BigEndian<uint32_t> logical_block_address;
   uint8_t group_number : 5;
   uint8_t reserved : 3;
-  uint16_t transfer_length : 16;
+  BigEndian<uint16_t> transfer_length;
   ControlByte control_byte;
 } ABSL_ATTRIBUTE_PACKED;
 static_assert(sizeof(Read10Command) == 9);
@@ -658,8 +701,8 @@ struct Read12Command {
   bool fua : 1;   // Forced Unit access bit
   bool dpo : 1;   // disable page output bit
   uint8_t rd_protect : 3;
-  uint32_t logical_block_address : 32;
-  uint32_t transfer_length : 32;
+  BigEndian<uint32_t> logical_block_address;
+  BigEndian<uint32_t> transfer_length;
   uint8_t group_number : 5;
   uint8_t reserved : 2;
   bool restricted_mmc_6 : 1;
@@ -676,8 +719,8 @@ struct Read16Command {
   bool fua : 1;   // Forced Unit access bit
   bool dpo : 1;   // disable page output bit
   uint8_t rd_protect : 3;
-  uint64_t logical_block_address : 64;
-  uint32_t transfer_length : 32;
+  BigEndian<uint64_t> logical_block_address;
+  BigEndian<uint32_t> transfer_length;
   uint8_t group_number : 6;
   bool dld_0 : 1;
   bool dld_1 : 1;
@@ -690,7 +733,7 @@ static_assert(sizeof(Read16Command) == 15);
 struct Write6Command {
   uint8_t logical_block_address_1 : 5;
   uint8_t reserved : 3;
-  uint16_t logical_block_address_2 : 16;
+  BigEndian<uint16_t> logical_block_address_2;
   uint8_t transfer_length : 8;
   ControlByte control_byte;
 } ABSL_ATTRIBUTE_PACKED;
@@ -704,10 +747,10 @@ struct Write10Command {
   bool fua : 1;  // Forced Unit access bit
   bool dpo : 1;  // disable page output bit
   uint8_t wr_protect : 3;
-  uint32_t logical_block_address : 32;
+  BigEndian<uint32_t> logical_block_address;
   uint8_t group_number : 5;
   uint8_t reserved_2 : 3;
-  uint16_t transfer_length : 16;
+  BigEndian<uint16_t> transfer_length;
   ControlByte control_byte;
 } ABSL_ATTRIBUTE_PACKED;
 static_assert(sizeof(Write10Command) == 9);
@@ -720,8 +763,8 @@ struct Write12Command {
   bool fua : 1;  // Forced Unit access bit
   bool dpo : 1;  // disable page output bit
   uint8_t wr_protect : 3;
-  uint32_t logical_block_address : 32;
-  uint32_t transfer_length : 32;
+  BigEndian<uint32_t> logical_block_address;
+  BigEndian<uint32_t> transfer_length;
   uint8_t group_number : 5;
   uint8_t reserved_2 : 2;
   bool restricted_mmc_5 : 1;
@@ -738,8 +781,8 @@ struct Write16Command {
   bool fua : 1;  // Forced Unit access bit
   bool dpo : 1;  // disable page output bit
   uint8_t wr_protect : 3;
-  uint64_t logical_block_address : 64;
-  uint32_t transfer_length : 32;
+  BigEndian<uint64_t> logical_block_address;
+  BigEndian<uint32_t> transfer_length;
   uint8_t group_number : 6;
   bool dld_0 : 1;
   bool dld_1 : 1;
@@ -747,6 +790,40 @@ struct Write16Command {
 } ABSL_ATTRIBUTE_PACKED;
 static_assert(sizeof(Write16Command) == 15);
 
+// SCSI Reference Manual, WRITE SAME (10) command
+// https://www.seagate.com/files/staticfiles/support/docs/manual/Interface%20manuals/100293068j.pdf
+struct WriteSame10Command {
+  bool reserved_1 : 1;
+  bool lbdata : 1;  // Obsolete logical block data bit
+  bool pbdata : 1;  // Obsolete physical block data bit
+  bool unmap : 1;
+  bool anchor : 1;
+  uint8_t wr_protect : 3;
+  BigEndian<uint32_t> logical_block_address;
+  uint8_t group_number : 5;
+  uint8_t reserved_2 : 3;
+  BigEndian<uint16_t> number_of_logical_blocks;
+  ControlByte control_byte;
+} ABSL_ATTRIBUTE_PACKED;
+static_assert(sizeof(WriteSame10Command) == 9);
+
+// SCSI Reference Manual, WRITE SAME (16) command
+// https://www.seagate.com/files/staticfiles/support/docs/manual/Interface%20manuals/100293068j.pdf
+struct WriteSame16Command {
+  bool ndob : 1;    // No data-out buffer
+  bool lbdata : 1;  // Obsolete logical block data bit
+  bool pbdata : 1;  // Obsolete physical block data bit
+  bool unmap : 1;
+  bool anchor : 1;
+  uint8_t wr_protect : 3;
+  BigEndian<uint64_t> logical_block_address;
+  BigEndian<uint32_t> number_of_logical_blocks;
+  uint8_t group_number : 6;
+  uint8_t reserved : 2;
+  ControlByte control_byte;
+} ABSL_ATTRIBUTE_PACKED;
+static_assert(sizeof(WriteSame16Command) == 15);
+
 // SCSI Reference Manual Table 207
 // https://www.seagate.com/files/staticfiles/support/docs/manual/Interface%20manuals/100293068j.pdf
 struct Verify10Command {
@@ -755,11 +832,11 @@ struct Verify10Command {
   bool reserved_1 : 1;
   bool dpo : 1;  // disable page output bit
   uint8_t vr_protect : 3;
-  uint32_t logical_block_address : 32;
+  BigEndian<uint32_t> logical_block_address;
   uint8_t group_number : 5;
   uint8_t reserved_2 : 2;
   bool restricted_mmc_5 : 1;
-  uint16_t verification_length : 16;
+  BigEndian<uint16_t> verification_length;
   ControlByte control_byte;
 } ABSL_ATTRIBUTE_PACKED;
 static_assert(sizeof(Verify10Command) == 9);
@@ -772,8 +849,8 @@ struct Verify12Command {
   bool reserved_1 : 1;
   bool dpo : 1;  // disable page output bit
   uint8_t vr_protect : 3;
-  uint32_t logical_block_address : 32;
-  uint32_t verification_length : 32;
+  BigEndian<uint32_t> logical_block_address;
+  BigEndian<uint32_t> verification_length;
   uint8_t group_number : 5;
   uint8_t reserved_2 : 2;
   bool restricted_mmc_5 : 1;
@@ -789,8 +866,8 @@ struct Verify16Command {
   bool reserved_2 : 1;
   bool dpo : 1;  // disable page output bit
   uint8_t vr_protect : 3;
-  uint64_t logical_block_address : 64;
-  uint32_t verification_length : 32;
+  BigEndian<uint64_t> logical_block_address;
+  BigEndian<uint32_t> verification_length;
   uint8_t group_number : 5;
   uint8_t reserved_3 : 2;
   bool restricted_mmc_5 : 1;
@@ -805,10 +882,10 @@ struct SynchronizeCache10Command {
   bool immed : 1;  // Immediate bit
   bool obsolete_2 : 1;
   uint8_t reserved_1 : 5;
-  uint32_t logical_block_address : 32;
+  BigEndian<uint32_t> logical_block_address;
   uint8_t group_number : 5;
   uint8_t reserved_2 : 3;
-  uint16_t number_of_blocks : 16;
+  BigEndian<uint16_t> number_of_blocks;
   ControlByte control_byte;
 } ABSL_ATTRIBUTE_PACKED;
 static_assert(sizeof(SynchronizeCache10Command) == 9);
@@ -820,8 +897,8 @@ struct SynchronizeCache16Command {
   bool immed : 1;  // Immediate bit
   bool obsolete : 1;
   uint8_t reserved_2 : 5;
-  uint64_t logical_block_address : 64;
-  uint32_t number_of_blocks : 32;
+  BigEndian<uint64_t> logical_block_address;
+  BigEndian<uint32_t> number_of_blocks;
   uint8_t group_number : 5;
   uint8_t reserved_3 : 3;
   ControlByte control_byte;
@@ -1031,7 +1108,7 @@ struct UnmapCommand {
   uint32_t reserved_2 : 32;
   uint8_t group_number : 5;
   uint8_t reserved_3 : 3;
-  uint16_t param_list_length : 16;
+  BigEndian<uint16_t> param_list_length;
   ControlByte control_byte;
 } ABSL_ATTRIBUTE_PACKED;
 static_assert(sizeof(UnmapCommand) == 9);
@@ -1040,8 +1117,8 @@ static_assert(sizeof(UnmapCommand) == 9);
 // https://www.seagate.com/files/staticfiles/support/docs/manual/Interface%20manuals/100293068j.pdf
 // This struct is a header for variable length data
 struct UnmapParamList {
-  uint16_t data_length : 16;
-  uint16_t block_desc_data_length : 16;
+  BigEndian<uint16_t> data_length;
+  BigEndian<uint16_t> block_desc_data_length;
   uint32_t reserved_1 : 32;
 } ABSL_ATTRIBUTE_PACKED;
 static_assert(sizeof(UnmapParamList) == 8);
@@ -1049,8 +1126,8 @@ static_assert(sizeof(UnmapParamList) == 8);
 // SCSI Reference Manual Table 206
 // https://www.seagate.com/files/staticfiles/support/docs/manual/Interface%20manuals/100293068j.pdf
 struct UnmapBlockDescriptor {
-  uint64_t logical_block_addr : 64;
-  uint32_t logical_block_count : 32;
+  BigEndian<uint64_t> logical_block_addr;
+  BigEndian<uint32_t> logical_block_count;
   uint32_t reserved_1 : 32;
 } ABSL_ATTRIBUTE_PACKED;
 static_assert(sizeof(UnmapBlockDescriptor) == 16);
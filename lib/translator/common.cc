@@ -14,19 +14,13 @@
 
 #include "common.h"
 
-#ifdef __KERNEL__
-#include <linux/byteorder/generic.h>
-#else
-#include <netinet/in.h>
-#endif
-#include <byteswap.h>
-
 #include <stdarg.h>
 #include <stdio.h>
 
 namespace translator {
 
 static void (*debug_callback)(const char*);
+static LogLevel log_level = LogLevel::kDebug;
 static uint64_t (*alloc_pages_callback)(uint32_t, uint16_t);
 static void (*dealloc_pages_callback)(uint64_t, uint16_t);
 
@@ -44,6 +38,12 @@ void SetDebugCallback(void (*callback)(const char*)) {
   debug_callback = callback;
 }
 
+bool IsLogEnabled(LogLevel level) {
+  return debug_callback != nullptr && level >= log_level;
+}
+
+void SetLogLevel(LogLevel level) { log_level = level; }
+
 // A return value of 0 is equivalent to nullptr.
 uint64_t AllocPages(uint32_t page_size, uint16_t count) {
   if (alloc_pages_callback == nullptr) return 0;
@@ -61,72 +61,48 @@ void SetAllocPageCallbacks(uint64_t (*alloc_callback)(uint32_t, uint16_t),
   dealloc_pages_callback = dealloc_callback;
 }
 
-bool IsLittleEndian() {
-  static uint32_t test_val = 42;
-  // Check first byte to determine endianness
-  if (*reinterpret_cast<const char*>(&test_val) == test_val)  // little endian
-    return true;
-  return false;  // big endian
-}
-
-uint64_t htonll(uint64_t value) {
-  if (IsLittleEndian()) {  // little endian
-    const uint32_t high_bits = htonl(static_cast<uint32_t>(value >> 32));
-    const uint32_t low_bits =
-        htonl(static_cast<uint32_t>(value & 0xFFFFFFFFLL));
-
-    return (static_cast<uint64_t>(low_bits) << 32) | high_bits;
-  } else {  // big endian
-    return value;
-  }
-}
-
-uint16_t htols(uint16_t value) {
-  if (IsLittleEndian()) {
-    return value;
-  } else {
-    return bswap_16(value);
-  }
-}
-
-uint32_t htoll(uint32_t value) {
-  if (IsLittleEndian()) {
-    return value;
-  } else {
-    return bswap_32(value);
-  }
-}
-
-uint64_t htolll(uint64_t value) {
-  if (IsLittleEndian()) {
-    return value;
-  } else {
-    return bswap_64(value);
-  }
-}
-
 StatusCode Allocation::SetPages(uint32_t page_size, uint16_t data_page_count,
                                 uint16_t mdata_page_count) {
   if ((data_page_count != 0 && this->data_addr != 0) ||
       (mdata_page_count != 0 && this->mdata_addr != 0)) {
-    DebugLog("Trying to override data that has not been flushed");
+    TRANSLATOR_LOG(kWarning,
+                   "Trying to override data that has not been flushed");
     return StatusCode::kFailure;
   }
 
   this->data_page_count = data_page_count;
-  this->data_addr = AllocPages(page_size, data_page_count);
+  this->data_addr = 0;
+  if (data_page_count != 0 && data_page_count <= this->scratch_page_count) {
+    // AllocPages hands out zeroed pages, so scratch pages must match
+    memset(reinterpret_cast<void*>(this->scratch_addr), 0,
+           data_page_count * page_size);
+    this->data_addr = this->scratch_addr;
+  } else if (data_page_count != 0) {
+    this->data_addr = AllocPages(page_size, data_page_count);
+  }
   this->mdata_page_count = mdata_page_count;
-  this->mdata_addr = AllocPages(page_size, mdata_page_count);
+  this->mdata_addr = 0;
+  if (mdata_page_count != 0)
+    this->mdata_addr = AllocPages(page_size, mdata_page_count);
 
   if ((data_page_count != 0 && this->data_addr == 0) ||
       (mdata_page_count != 0 && this->mdata_addr == 0)) {
-    DebugLog("Error when requesting memory");
+    TRANSLATOR_LOG(kError, "Error when requesting memory");
     return StatusCode::kFailure;
   }
 
   return StatusCode::kSuccess;
 }
 
+void Allocation::FreePages() {
+  if (this->data_addr != 0 && this->data_addr != this->scratch_addr)
+    DeallocPages(this->data_addr, this->data_page_count);
+  this->data_addr = 0;
+  if (this->mdata_addr != 0)
+    DeallocPages(this->mdata_addr, this->mdata_page_count);
+  this->mdata_addr = 0;
+}
+
 const char* ScsiOpcodeToString(scsi::OpCode opcode) {
   switch (opcode) {
     case scsi::OpCode::kTestUnitReady:
@@ -159,6 +135,8 @@ const char* ScsiOpcodeToString(scsi::OpCode opcode) {
       return "kVerify10";
     case scsi::OpCode::kSync10:
       return "kSync10";
+    case scsi::OpCode::kWriteSame10:
+      return "kWriteSame10";
     case scsi::OpCode::kUnmap:
       return "kUnmap";
     case scsi::OpCode::kReadToc:
@@ -182,6 +160,8 @@ const char* ScsiOpcodeToString(scsi::OpCode opcode) {
       return "kVerify16";
     case scsi::OpCode::kSync16:
       return "kSync16";
+    case scsi::OpCode::kWriteSame16:
+      return "kWriteSame16";
     case scsi::OpCode::kServiceActionIn:
       return "kServiceActionIn";
     case scsi::OpCode::kReportLuns:
@@ -199,6 +179,71 @@ const char* ScsiOpcodeToString(scsi::OpCode opcode) {
   }
 }
 
+StatusCode NvmeCmdChain::Resize(uint32_t size, uint32_t page_size) {
+  if (size > capacity_) {
+    Release();
+    // Spilled storage holds the wrappers followed by the allocations
+    uint64_t bytes = static_cast<uint64_t>(size) *
+                     (sizeof(NvmeCmdWrapper) + sizeof(Allocation));
+    uint64_t page_count = (bytes + page_size - 1) / page_size;
+    if (page_count > UINT16_MAX) {
+      TRANSLATOR_LOG(kError, "Too many NVMe commands requested: %u", size);
+      return StatusCode::kFailure;
+    }
+    uint64_t addr = AllocPages(page_size, page_count);
+    if (addr == 0) {
+      TRANSLATOR_LOG(kError,
+                     "Error when requesting memory for %u NVMe commands", size);
+      return StatusCode::kFailure;
+    }
+    memset(reinterpret_cast<void*>(addr), 0, page_count * page_size);
+    spill_addr_ = addr;
+    spill_page_count_ = page_count;
+    capacity_ = size;
+  }
+  size_ = size;
+
+  Span<Allocation> allocs = allocations();
+  for (uint32_t i = 0; i < size_; ++i) {
+    bool has_scratch = i < scratch_page_count_;
+    allocs[i].scratch_addr = has_scratch ? scratch_addr_ + i * page_size : 0;
+    allocs[i].scratch_page_count = has_scratch ? 1 : 0;
+  }
+  return StatusCode::kSuccess;
+}
+
+void NvmeCmdChain::SetScratchPages(uint64_t addr, uint16_t page_count) {
+  scratch_addr_ = addr;
+  scratch_page_count_ = addr != 0 ? page_count : 0;
+}
+
+Span<NvmeCmdWrapper> NvmeCmdChain::wrappers() {
+  if (spill_addr_ == 0) return Span<NvmeCmdWrapper>(inline_wrappers_, size_);
+  return Span(reinterpret_cast<NvmeCmdWrapper*>(spill_addr_), size_);
+}
+
+Span<Allocation> NvmeCmdChain::allocations() {
+  if (spill_addr_ == 0) return Span<Allocation>(inline_allocations_, size_);
+  NvmeCmdWrapper* wrappers = reinterpret_cast<NvmeCmdWrapper*>(spill_addr_);
+  return Span(reinterpret_cast<Allocation*>(wrappers + capacity_), size_);
+}
+
+void NvmeCmdChain::Release() {
+  if (spill_addr_ != 0) DeallocPages(spill_addr_, spill_page_count_);
+  size_ = 0;
+  capacity_ = kMaxCommandRatio;
+  spill_addr_ = 0;
+  spill_page_count_ = 0;
+}
+
+uint64_t DataSegmentsLength(Span<const DataSegment> data_segments) {
+  uint64_t len = 0;
+  for (size_t i = 0; i < data_segments.size(); ++i) {
+    len += data_segments[i].len;
+  }
+  return len;
+}
+
 bool FillSenseBuffer(Span<uint8_t> sense_buffer,
                      const ScsiStatus& scsi_status) {
   // Descriptor sense logic (d_sense set to 1)
@@ -210,7 +255,7 @@ bool FillSenseBuffer(Span<uint8_t> sense_buffer,
   dfsd.additional_sense_code_qualifier = scsi_status.ascq;
   dfsd.additional_sense_length = 0;
   if (!WriteValue(dfsd, sense_buffer)) {
-    DebugLog("Failed to write to sense buffer");
+    TRANSLATOR_LOG(kError, "Failed to write to sense buffer");
     return false;
   }
   return true;
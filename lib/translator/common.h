@@ -21,6 +21,7 @@
 
 #include "third_party/spdk/nvme.h"
 
+#include "lib/endian.h"
 #include "lib/scsi.h"
 
 namespace translator {
@@ -32,6 +33,12 @@ static const char* kNvmeVendorIdentification = "NVMe    ";
 // The maximum amplification ratio of any supported SCSI:NVMe translation
 constexpr int kMaxCommandRatio = 3;
 
+// Unmap block descriptors that fit in the largest Unmap parameter list. Lists
+// longer than a Dataset Management command takes are split over several
+constexpr uint32_t kMaxUnmapBlockDescriptors =
+    (UINT16_MAX - sizeof(scsi::UnmapParamList)) /
+    sizeof(scsi::UnmapBlockDescriptor);
+
 // Reports the status of a translation for internal use
 enum class StatusCode {
   kSuccess,
@@ -46,21 +53,70 @@ struct Allocation {
   uint16_t data_page_count;   // Number of data pages
   uint64_t mdata_addr;        // Start of metadata buffer
   uint16_t mdata_page_count;  // Number of metadata pages
+  // Preallocated pages owned by the library user. Data buffers that fit are
+  // placed here instead of calling AllocPages
+  uint64_t scratch_addr;
+  uint16_t scratch_page_count;
 
-  // Sets [m]data_page_count, calls AllocPages([m]data_page_count),
-  // and returns StatusCode based on whether AllocPages was successful
+  // Sets [m]data_page_count, takes the data pages from the scratch pages or
+  // AllocPages and the metadata pages from AllocPages, and returns
+  // StatusCode based on whether the pages were available
   StatusCode SetPages(uint32_t page_size, uint16_t data_page_count,
                       uint16_t mdata_page_count);
+
+  // Returns the pages taken by SetPages. Scratch pages are kept
+  void FreePages();
+};
+
+// A physically contiguous piece of a SCSI data buffer. Read and Write
+// commands transfer data directly to and from these segments, so the library
+// user never has to copy between a scatter-gather list and a linear buffer.
+struct DataSegment {
+  uint64_t addr;  // Start of the segment
+  uint32_t len;   // Length of the segment in bytes
 };
 
 struct NvmeCmdWrapper {
   nvme::GenericQueueEntryCmd cmd;
   uint32_t buffer_len;
   bool is_admin;
+  // Offset of this command's data within the SCSI data buffer, for commands
+  // that transfer a part of it
+  uint32_t data_offset;
 };
 
+// Severity of a log message. Messages below kMinLogLevel are compiled out,
+// messages below the level given to SetLogLevel() are skipped at runtime
+enum class LogLevel : uint8_t { kDebug, kInfo, kWarning, kError };
+
+#ifndef TRANSLATOR_MIN_LOG_LEVEL
+#define TRANSLATOR_MIN_LOG_LEVEL 0
+#endif
+
+constexpr LogLevel kMinLogLevel =
+    static_cast<LogLevel>(TRANSLATOR_MIN_LOG_LEVEL);
+
+// Formats a message and passes it to the debug callback. Prefer
+// TRANSLATOR_LOG, which skips the formatting and the evaluation of the
+// arguments when the message would be dropped
 void DebugLog(const char* format, ...);
 
+// Returns true if a message of level reaches the debug callback
+bool IsLogEnabled(LogLevel level);
+
+void SetLogLevel(LogLevel level);
+
+// Logs a message at LogLevel::level, e.g.
+// TRANSLATOR_LOG(kWarning, "Bad OpCode: %#x", opc);
+#define TRANSLATOR_LOG(level, ...)                                        \
+  do {                                                                    \
+    if constexpr (::translator::LogLevel::level >=                        \
+                  ::translator::kMinLogLevel) {                           \
+      if (::translator::IsLogEnabled(::translator::LogLevel::level))      \
+        ::translator::DebugLog(__VA_ARGS__);                              \
+    }                                                                     \
+  } while (0)
+
 // Max consecutive pages required by NVMe PRP list is 512
 uint64_t AllocPages(uint32_t page_size, uint16_t count);
 
@@ -73,13 +129,13 @@ void SetAllocPageCallbacks(uint64_t (*alloc_callback)(uint32_t, uint16_t),
 
 // Returns true if system is little endian.
 // Returns false if system is big endian.
-bool IsLittleEndian();
+constexpr bool IsLittleEndian() { return endian::kHostIsLittleEndian; }
 
 // Host to Network endianness transformation for uint64_t
 // Network endianness is always big endian
 // Converts value to big endian if Host is little endian
 // No op if Host is big endian
-uint64_t htonll(uint64_t value);
+constexpr uint64_t htonll(uint64_t value) { return endian::HostToBig(value); }
 
 // Network to Host endianness transformation for uint64_t
 // Network endianness is always big endian
@@ -90,9 +146,15 @@ uint64_t htonll(uint64_t value);
 // Host to little endian transformation for uint16_t, uint32_t, uint64_t
 // Converts value to little endian if Host is big endian
 // No op if Host is little endian
-uint16_t htols(uint16_t value);
-uint32_t htoll(uint32_t value);
-uint64_t htolll(uint64_t value);
+constexpr uint16_t htols(uint16_t value) {
+  return endian::HostToLittle(value);
+}
+constexpr uint32_t htoll(uint32_t value) {
+  return endian::HostToLittle(value);
+}
+constexpr uint64_t htolll(uint64_t value) {
+  return endian::HostToLittle(value);
+}
 
 // Little endian to Host transformation for uint16_t, uint32_t, uint64_t
 // Converts value to Host endian if Host is big endian
@@ -111,12 +173,13 @@ class Span {
   Span(T* ptr, size_t len) : ptr_(ptr), len_(len) {}
   template <size_t N>
   Span(T (&a)[N]) : Span(a, N) {}
-  template <typename Y, typename = std::enable_if<std::is_same<
-                            typename std::decay<T*>::type, Y*>::value>>
+  // Only allows conversions that add const, e.g. Span<T> to Span<const T>
+  template <typename Y, typename = std::enable_if_t<
+                            std::is_convertible<Y (*)[], T (*)[]>::value>>
   Span(const Span<Y>& ref) : Span(ref.data(), ref.size()) {}
   T* data() const { return ptr_; }
   size_t size() const { return len_; }
-  bool empty() { return len_ == 0; }
+  bool empty() const { return len_ == 0; }
   T& operator[](size_t i) const { return *(ptr_ + i); }
   Span subspan(size_t pos, size_t len = npos) {
     if (pos >= len_) return Span<T>(nullptr, 0);
@@ -147,6 +210,54 @@ bool WriteValue(const T& data, Span<uint8_t> out,
   return true;
 }
 
+// Returns the total number of bytes described by data_segments
+uint64_t DataSegmentsLength(Span<const DataSegment> data_segments);
+
+// Storage for the NVMe commands a SCSI command translates to, and their
+// allocations. kMaxCommandRatio commands are held inline; longer chains,
+// such as split Read and Write commands, spill into pages from AllocPages.
+class NvmeCmdChain {
+ public:
+  NvmeCmdChain()
+      : size_(0),
+        capacity_(kMaxCommandRatio),
+        spill_addr_(0),
+        spill_page_count_(0),
+        scratch_addr_(0),
+        scratch_page_count_(0),
+        inline_wrappers_(),
+        inline_allocations_() {}
+
+  // Sets the number of commands in the chain. Storage spilled for more than
+  // kMaxCommandRatio commands starts out zeroed. The first commands'
+  // allocations are given one scratch page each
+  StatusCode Resize(uint32_t size, uint32_t page_size);
+
+  // Lends page_count pages at addr, which must stay valid while the chain is
+  // in use, to the allocations of later Resize calls
+  void SetScratchPages(uint64_t addr, uint16_t page_count);
+
+  uint32_t size() const { return size_; }
+  NvmeCmdWrapper& wrapper(uint32_t i) { return wrappers()[i]; }
+  Allocation& allocation(uint32_t i) { return allocations()[i]; }
+  Span<NvmeCmdWrapper> wrappers();
+  Span<Allocation> allocations();
+
+  // Frees spilled storage and empties the chain. Does not free the pages held
+  // by the commands' allocations
+  void Release();
+
+ private:
+  uint32_t size_;
+  uint32_t capacity_;
+  uint64_t spill_addr_;
+  uint16_t spill_page_count_;
+  uint64_t scratch_addr_;
+  uint16_t scratch_page_count_;
+  NvmeCmdWrapper inline_wrappers_[kMaxCommandRatio];
+  Allocation inline_allocations_[kMaxCommandRatio];
+};
+
 // Scsi status bundle
 struct ScsiStatus {
   scsi::Status status;
@@ -166,12 +277,12 @@ bool FillSenseBuffer(Span<uint8_t> sense_buffer, const ScsiStatus& scsi_status);
 template <typename T>
 T* SafePointerCastWrite(Span<uint8_t> buf) {
   if (buf.size() < sizeof(T)) {
-    DebugLog("Pointer cast called on span of invalid size");
+    TRANSLATOR_LOG(kError, "Pointer cast called on span of invalid size");
     return nullptr;
   }
   if (reinterpret_cast<uintptr_t>(buf.data()) % std::alignment_of<T>::value !=
       0) {
-    DebugLog("Pointer cast called on unaligned memory");
+    TRANSLATOR_LOG(kError, "Pointer cast called on unaligned memory");
     return nullptr;
   }
   return new (buf.data()) T;
@@ -183,12 +294,12 @@ T* SafePointerCastWrite(Span<uint8_t> buf) {
 template <typename T>
 const T* SafePointerCastRead(Span<const uint8_t> buf) {
   if (buf.size() < sizeof(T)) {
-    DebugLog("Pointer cast called on span of invalid size");
+    TRANSLATOR_LOG(kError, "Pointer cast called on span of invalid size");
     return nullptr;
   }
   if (reinterpret_cast<uintptr_t>(buf.data()) % std::alignment_of<T>::value !=
       0) {
-    DebugLog("Pointer cast called on unaligned memory");
+    TRANSLATOR_LOG(kError, "Pointer cast called on unaligned memory");
     return nullptr;
   }
   return reinterpret_cast<const T*>(buf.data());
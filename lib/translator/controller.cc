@@ -0,0 +1,245 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "controller.h"
+
+namespace translator {
+
+namespace {
+
+// NVMe Base Specification Figure 247, SGLS bits 1:0
+constexpr uint32_t kSglSupported = 0b01;
+constexpr uint32_t kSglSupportedDwordAligned = 0b10;
+
+// NVMe Base Specification Figure 247, VWC bits 2:1
+constexpr uint32_t kFlushBroadcastSupported = 0b11;
+
+// Larger MDTS values exceed any transfer a SCSI command can request
+constexpr uint32_t kMaxMdts = 32;
+
+// Supported logical block sizes are 512 bytes to 2 GiB
+constexpr uint8_t kMinLbaShift = 9;
+constexpr uint8_t kMaxLbaShift = 31;
+
+// Layout of CachedNamespace::format
+constexpr uint64_t kFormatValid = uint64_t{1} << 63;
+constexpr uint32_t kFormatMetadataSizeShift = 8;
+constexpr uint32_t kFormatPiTypeShift = 24;
+constexpr uint32_t kFormatPiFirstShift = 27;
+// The deallocate granularity and alignment are kept 0's based, as reported
+constexpr uint32_t kFormatDeallocGranularityShift = 28;
+constexpr uint32_t kFormatDeallocAlignmentShift = 44;
+constexpr uint32_t kFormatDeallocShift = 60;
+
+// Layout of CachedNamespace::layout
+constexpr uint64_t kLayoutPhysicalBlockShiftMask = 0b1111;
+constexpr uint64_t kLayoutReadsZeroes = 1 << 4;
+
+// READ CAPACITY (16) reports the physical block exponent in 4 bits
+constexpr uint8_t kMaxPhysicalBlockShift = 15;
+
+// NVM Command Set Specification Figure 97, DLFEAT bits 2:0
+constexpr uint8_t kDeallocReadsZeroes = 0b001;
+
+uint64_t PackDealloc(const NamespaceGeometry& geometry) {
+  if (geometry.dealloc_granularity == 0 || geometry.dealloc_alignment == 0 ||
+      geometry.dealloc_granularity > UINT16_MAX + 1 ||
+      geometry.dealloc_alignment > UINT16_MAX + 1)
+    return 0;
+  return uint64_t{1} << kFormatDeallocShift |
+         static_cast<uint64_t>(geometry.dealloc_granularity - 1)
+             << kFormatDeallocGranularityShift |
+         static_cast<uint64_t>(geometry.dealloc_alignment - 1)
+             << kFormatDeallocAlignmentShift;
+}
+
+uint64_t PackFormat(const NamespaceGeometry& geometry) {
+  return kFormatValid | geometry.lba_shift |
+         static_cast<uint64_t>(geometry.metadata_size)
+             << kFormatMetadataSizeShift |
+         static_cast<uint64_t>(geometry.pi_type & 0b111) << kFormatPiTypeShift |
+         static_cast<uint64_t>(geometry.pi_first) << kFormatPiFirstShift |
+         PackDealloc(geometry);
+}
+
+void UnpackFormat(uint64_t format, NamespaceGeometry& geometry) {
+  geometry.lba_shift = static_cast<uint8_t>(format);
+  geometry.metadata_size =
+      static_cast<uint16_t>(format >> kFormatMetadataSizeShift);
+  geometry.pi_type = (format >> kFormatPiTypeShift) & 0b111;
+  geometry.pi_first = (format >> kFormatPiFirstShift) & 0b1;
+  geometry.dealloc_granularity = 0;
+  geometry.dealloc_alignment = 0;
+  if ((format >> kFormatDeallocShift) & 0b1) {
+    geometry.dealloc_granularity =
+        static_cast<uint16_t>(format >> kFormatDeallocGranularityShift) + 1;
+    geometry.dealloc_alignment =
+        static_cast<uint16_t>(format >> kFormatDeallocAlignmentShift) + 1;
+  }
+}
+
+uint64_t PackLayout(const NamespaceGeometry& geometry) {
+  return (geometry.physical_block_shift & kLayoutPhysicalBlockShiftMask) |
+         (geometry.dealloc_reads_zeroes ? kLayoutReadsZeroes : 0);
+}
+
+void UnpackLayout(uint64_t layout, NamespaceGeometry& geometry) {
+  geometry.physical_block_shift = layout & kLayoutPhysicalBlockShiftMask;
+  geometry.dealloc_reads_zeroes = (layout & kLayoutReadsZeroes) != 0;
+}
+
+// Returns log2 of the preferred write granularity of identify_ns, or 0 if it
+// is not reported or not a power of two
+uint8_t ReadPhysicalBlockShift(const nvme::IdentifyNamespace& identify_ns) {
+  if (!identify_ns.nsfeat.opt_perf) return 0;
+  // NPWG is 0's based
+  uint32_t granularity = uint32_t{ltohs(identify_ns.npwg)} + 1;
+  if (granularity & (granularity - 1)) return 0;
+  uint8_t shift = 0;
+  while ((granularity >>= 1) != 0) ++shift;
+  return shift > kMaxPhysicalBlockShift ? kMaxPhysicalBlockShift : shift;
+}
+
+}  // namespace
+
+StatusCode ReadNamespaceGeometry(const nvme::IdentifyNamespace& identify_ns,
+                                 NamespaceGeometry& geometry) {
+  uint8_t lbads = identify_ns.lbaf[identify_ns.flbas.format].lbads;
+  if (lbads < kMinLbaShift) {
+    TRANSLATOR_LOG(kWarning, "lbads value smaller than 9 is not supported");
+    return StatusCode::kFailure;
+  } else if (lbads > kMaxLbaShift) {
+    TRANSLATOR_LOG(kWarning, "lbads exceeds the supported logical block size");
+    return StatusCode::kFailure;
+  }
+
+  geometry.block_count = ltohll(identify_ns.nsze);
+  geometry.lba_shift = lbads;
+  geometry.metadata_size = identify_ns.lbaf[identify_ns.flbas.format].ms;
+  geometry.pi_type = identify_ns.dps.pit;
+  geometry.pi_first = identify_ns.dps.md_start;
+  // NPDG and NPDA are 0's based
+  geometry.dealloc_granularity =
+      identify_ns.nsfeat.opt_perf ? ltohs(identify_ns.npdg) + 1 : 0;
+  geometry.dealloc_alignment =
+      identify_ns.nsfeat.opt_perf ? ltohs(identify_ns.npda) + 1 : 0;
+  geometry.physical_block_shift = ReadPhysicalBlockShift(identify_ns);
+  geometry.dealloc_reads_zeroes =
+      identify_ns.dlfeat.bits.read_value == kDeallocReadsZeroes;
+  return StatusCode::kSuccess;
+}
+
+void Controller::SetIdentifyControllerData(
+    const nvme::IdentifyControllerData& data) {
+  __atomic_store_n(&sgl_support_, static_cast<uint32_t>(data.sgls.supported),
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&mdts_, static_cast<uint32_t>(data.mdts), __ATOMIC_RELAXED);
+  __atomic_store_n(&write_zeroes_,
+                   static_cast<uint32_t>(data.oncs.write_zeroes),
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&deallocate_, static_cast<uint32_t>(data.oncs.dsm),
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&vwc_present_, static_cast<uint32_t>(data.vwc.present),
+                   __ATOMIC_RELAXED);
+  __atomic_store_n(&broadcast_,
+                   static_cast<uint32_t>(data.vwc.flush_broadcast),
+                   __ATOMIC_RELAXED);
+}
+
+uint32_t Controller::page_size() const { return page_size_; }
+
+bool Controller::SglSupported() const {
+  uint32_t sgl_support = __atomic_load_n(&sgl_support_, __ATOMIC_RELAXED);
+  return sgl_support == kSglSupported ||
+         sgl_support == kSglSupportedDwordAligned;
+}
+
+bool Controller::SglRequiresDwordAlignment() const {
+  return __atomic_load_n(&sgl_support_, __ATOMIC_RELAXED) ==
+         kSglSupportedDwordAligned;
+}
+
+uint64_t Controller::MaxTransferBytes() const {
+  uint32_t mdts = __atomic_load_n(&mdts_, __ATOMIC_RELAXED);
+  if (mdts == 0) return 0;
+  if (mdts > kMaxMdts) mdts = kMaxMdts;
+  // MDTS is in units of the minimum memory page size, which page_size_ is
+  return (uint64_t{1} << mdts) * page_size_;
+}
+
+bool Controller::WriteZeroesSupported() const {
+  return __atomic_load_n(&write_zeroes_, __ATOMIC_RELAXED) != 0;
+}
+
+bool Controller::DeallocateSupported() const {
+  return __atomic_load_n(&deallocate_, __ATOMIC_RELAXED) != 0;
+}
+
+bool Controller::VolatileWriteCacheEnabled() const {
+  return __atomic_load_n(&vwc_present_, __ATOMIC_RELAXED) != 0 &&
+         __atomic_load_n(&vwc_enabled_, __ATOMIC_RELAXED) != 0;
+}
+
+void Controller::SetVolatileWriteCacheEnabled(bool enabled) {
+  __atomic_store_n(&vwc_enabled_, static_cast<uint32_t>(enabled),
+                   __ATOMIC_RELAXED);
+}
+
+bool Controller::FlushBroadcastSupported() const {
+  return __atomic_load_n(&broadcast_, __ATOMIC_RELAXED) ==
+         kFlushBroadcastSupported;
+}
+
+void Controller::SetAlignUnmapRanges(bool enable) {
+  __atomic_store_n(&align_unmap_, static_cast<uint32_t>(enable),
+                   __ATOMIC_RELAXED);
+}
+
+bool Controller::AlignUnmapRanges() const {
+  return __atomic_load_n(&align_unmap_, __ATOMIC_RELAXED) != 0;
+}
+
+void Controller::SetNamespaceGeometry(uint32_t nsid,
+                                      const NamespaceGeometry& geometry) {
+  if (nsid == 0 || nsid > kMaxCachedNamespaces) return;
+  CachedNamespace& cached = namespaces_[nsid - 1];
+  // Readers that see the old format after the new block count or layout
+  // discard what they read, see GetNamespaceGeometry()
+  __atomic_store_n(&cached.format, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&cached.block_count, geometry.block_count,
+                   __ATOMIC_RELEASE);
+  __atomic_store_n(&cached.layout, PackLayout(geometry), __ATOMIC_RELEASE);
+  __atomic_store_n(&cached.format, PackFormat(geometry), __ATOMIC_RELEASE);
+}
+
+bool Controller::GetNamespaceGeometry(uint32_t nsid,
+                                      NamespaceGeometry& geometry) const {
+  if (nsid == 0 || nsid > kMaxCachedNamespaces) return false;
+  const CachedNamespace& cached = namespaces_[nsid - 1];
+  uint64_t format = __atomic_load_n(&cached.format, __ATOMIC_ACQUIRE);
+  if (!(format & kFormatValid)) return false;
+  uint64_t block_count = __atomic_load_n(&cached.block_count, __ATOMIC_ACQUIRE);
+  uint64_t layout = __atomic_load_n(&cached.layout, __ATOMIC_ACQUIRE);
+  // Treat a concurrent update as a miss rather than mixing two geometries
+  if (__atomic_load_n(&cached.format, __ATOMIC_ACQUIRE) != format)
+    return false;
+
+  geometry.block_count = block_count;
+  UnpackFormat(format, geometry);
+  UnpackLayout(layout, geometry);
+  return true;
+}
+
+}  // namespace translator
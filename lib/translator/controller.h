@@ -0,0 +1,145 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef LIB_TRANSLATOR_CONTROLLER_H
+#define LIB_TRANSLATOR_CONTROLLER_H
+
+#include "common.h"
+#include "third_party/spdk/nvme.h"
+
+namespace translator {
+
+constexpr uint32_t kDefaultPageSize = 4096;
+// Logical block size assumed for namespaces whose geometry is unknown
+constexpr uint8_t kDefaultLbaShift = 12;
+// Namespaces 1 to kMaxCachedNamespaces have their geometry cached
+constexpr uint32_t kMaxCachedNamespaces = 16;
+
+// Format and size of a namespace, from its Identify Namespace data
+struct NamespaceGeometry {
+  uint64_t block_count;    // Namespace size in logical blocks
+  uint8_t lba_shift;       // Logical block data size is 1 << lba_shift bytes
+  uint16_t metadata_size;  // Metadata bytes per logical block
+  uint8_t pi_type;         // End-to-end protection type, 0 if disabled
+  bool pi_first;           // Protection information starts the metadata
+  // Preferred deallocate granularity and alignment in logical blocks, or 0
+  // if the namespace does not report them
+  uint32_t dealloc_granularity;
+  uint32_t dealloc_alignment;
+  // Logical blocks per physical block as a power of two, from the preferred
+  // write granularity, or 0 if the namespace does not report one
+  uint8_t physical_block_shift;
+  bool dealloc_reads_zeroes;  // Deallocated blocks read back as zeroes
+};
+
+// Reads the geometry of the formatted LBA format of identify_ns. Returns
+// kFailure if its logical block size is below 512 bytes or above 2 GiB
+StatusCode ReadNamespaceGeometry(const nvme::IdentifyNamespace& identify_ns,
+                                 NamespaceGeometry& geometry);
+
+// Capabilities of the NVMe controller that change how commands are built,
+// and the geometry of its namespaces.
+// Defaults to what every controller supports until Identify Controller data
+// is supplied. Accessors may be used while another thread updates the
+// capabilities; each identified value is read and written atomically.
+class Controller {
+ public:
+  constexpr Controller()
+      : page_size_(kDefaultPageSize),
+        sgl_support_(0),
+        mdts_(0),
+        write_zeroes_(0),
+        deallocate_(0),
+        vwc_present_(1),
+        vwc_enabled_(1),
+        broadcast_(0),
+        align_unmap_(0),
+        namespaces_() {}
+
+  // Updates capabilities from an Identify Controller data structure
+  void SetIdentifyControllerData(const nvme::IdentifyControllerData& data);
+
+  // Memory page size used for PRP entries
+  uint32_t page_size() const;
+
+  // True if NVM command set commands accept SGLs for data transfer
+  bool SglSupported() const;
+
+  // True if SGL data block addresses and lengths must be dword aligned
+  bool SglRequiresDwordAlignment() const;
+
+  // Largest data transfer of a single command in bytes, or 0 if the
+  // controller reports no limit
+  uint64_t MaxTransferBytes() const;
+
+  // True if the controller supports the Write Zeroes command
+  bool WriteZeroesSupported() const;
+
+  // True if the controller supports deallocating blocks with Dataset
+  // Management
+  bool DeallocateSupported() const;
+
+  // True unless the controller reported no volatile write cache, or the
+  // latest Get Features of it found it disabled. Writes then reach
+  // non-volatile media without Flush or FUA
+  bool VolatileWriteCacheEnabled() const;
+
+  // Records the Volatile Write Cache Enable bit from the current value of
+  // the Volatile Write Cache feature
+  void SetVolatileWriteCacheEnabled(bool enabled);
+
+  // True if Flush accepts the broadcast NSID FFFFFFFFh to flush every
+  // namespace
+  bool FlushBroadcastSupported() const;
+
+  // Trims Unmap ranges to the preferred deallocate granularity and alignment
+  // of the namespace. Blocks trimmed off keep their data, so only enable this
+  // where hosts do not rely on unmapped blocks reading as zeroes
+  void SetAlignUnmapRanges(bool enable);
+  bool AlignUnmapRanges() const;
+
+  // Caches the geometry of namespace nsid. Namespaces above
+  // kMaxCachedNamespaces are not cached
+  void SetNamespaceGeometry(uint32_t nsid, const NamespaceGeometry& geometry);
+
+  // Copies the cached geometry of namespace nsid to geometry. Returns false
+  // if none is cached
+  bool GetNamespaceGeometry(uint32_t nsid, NamespaceGeometry& geometry) const;
+
+ private:
+  // A namespace's geometry packed for atomic access. format holds the LBA
+  // format and deallocation fields and is 0 while nothing is cached. layout
+  // holds the physical block and read-after-deallocate fields
+  struct CachedNamespace {
+    uint64_t block_count = 0;
+    uint64_t format = 0;
+    uint64_t layout = 0;
+  };
+
+  uint32_t page_size_;
+  uint32_t sgl_support_;   // Identify Controller SGLS bits 1:0
+  uint32_t mdts_;          // Identify Controller MDTS, a power of two in pages
+  uint32_t write_zeroes_;  // Identify Controller ONCS Write Zeroes bit
+  uint32_t deallocate_;    // Identify Controller ONCS Dataset Management bit
+  uint32_t vwc_present_;   // Identify Controller VWC Present bit
+  uint32_t vwc_enabled_;   // Set by SetVolatileWriteCacheEnabled()
+  uint32_t broadcast_;     // Identify Controller VWC Flush broadcast bits
+  uint32_t align_unmap_;   // Set by SetAlignUnmapRanges()
+  CachedNamespace namespaces_[kMaxCachedNamespaces];
+};
+
+}  // namespace translator
+
+#endif
@@ -0,0 +1,187 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "data_pointer.h"
+
+#include "prp.h"
+
+namespace translator {
+
+namespace {  // anonymous namespace for helper functions
+
+// PSDT value selecting SGLs for the data pointer and a contiguous buffer for
+// the metadata pointer. NVMe Base Specification Figure 105
+constexpr uint8_t kPsdtSgl = 0b01;
+
+nvme::SglDescriptor BuildDescriptor(nvme::SglDescriptorType type,
+                                    uint64_t addr, uint32_t len) {
+  nvme::SglDescriptor desc = {};
+  desc.address = htolll(addr);
+  desc.unkeyed.length = htoll(len);
+  desc.unkeyed.subtype =
+      static_cast<uint8_t>(nvme::SglDescriptorSubtype::kAddress);
+  desc.unkeyed.type = static_cast<uint8_t>(type);
+  return desc;
+}
+
+// Describes the list page at addr holding the next remaining descriptors
+nvme::SglDescriptor BuildSegmentDescriptor(uint64_t addr, uint32_t remaining,
+                                           uint32_t per_page) {
+  if (remaining <= per_page) {
+    return BuildDescriptor(nvme::SglDescriptorType::kLastSegment, addr,
+                           remaining * sizeof(nvme::SglDescriptor));
+  }
+  return BuildDescriptor(nvme::SglDescriptorType::kSegment, addr,
+                         per_page * sizeof(nvme::SglDescriptor));
+}
+
+// Calls on_block with each Data Block of the transfer
+template <typename F>
+StatusCode ForEachDataBlock(Span<const DataSegment> data_segments,
+                            uint32_t offset, uint32_t transfer_len,
+                            bool dword_aligned, F on_block) {
+  uint64_t skip = offset;
+  uint64_t remaining = transfer_len;
+  for (size_t i = 0; i < data_segments.size() && remaining > 0; ++i) {
+    if (skip >= data_segments[i].len) {
+      skip -= data_segments[i].len;
+      continue;
+    }
+    uint64_t addr = data_segments[i].addr + skip;
+    uint32_t len = data_segments[i].len - skip;
+    if (len > remaining) len = remaining;
+    skip = 0;
+    remaining -= len;
+
+    if (dword_aligned && (addr % 4 != 0 || len % 4 != 0)) {
+      TRANSLATOR_LOG(kWarning, "Data segment %u is not dword aligned", i);
+      return StatusCode::kFailure;
+    }
+    on_block(addr, len);
+  }
+
+  if (remaining > 0) {
+    TRANSLATOR_LOG(kWarning,
+                   "Data segments are shorter than the transfer length %u",
+                   transfer_len);
+    return StatusCode::kFailure;
+  }
+  return StatusCode::kSuccess;
+}
+
+// Number of list pages needed for count descriptors when the last descriptor
+// of every page but the last one points to the next list page
+uint32_t SglListPageCount(uint32_t count, uint32_t per_page) {
+  if (count <= per_page) return 1;
+  uint32_t overflow = count - per_page;
+  return 1 + (overflow + per_page - 2) / (per_page - 1);
+}
+
+}  // namespace
+
+StatusCode BuildSgl(Span<const DataSegment> data_segments, uint32_t offset,
+                    uint32_t transfer_len, uint32_t page_size,
+                    bool dword_aligned, Allocation& allocation,
+                    nvme::GenericQueueEntryCmd& cmd) {
+  uint32_t count = 0;
+  uint64_t first_addr = 0;
+  uint32_t first_len = 0;
+  StatusCode status = ForEachDataBlock(
+      data_segments, offset, transfer_len, dword_aligned,
+      [&](uint64_t addr, uint32_t len) {
+        if (count++ == 0) {
+          first_addr = addr;
+          first_len = len;
+        }
+      });
+  if (status != StatusCode::kSuccess) return status;
+
+  cmd.psdt = kPsdtSgl;
+  if (count <= 1) {
+    cmd.dptr.sgl_descriptor = BuildDescriptor(
+        nvme::SglDescriptorType::kDataBlock, first_addr, first_len);
+    return StatusCode::kSuccess;
+  }
+
+  uint32_t per_page = page_size / sizeof(nvme::SglDescriptor);
+  uint32_t page_count = SglListPageCount(count, per_page);
+  if (page_count > UINT16_MAX) {
+    TRANSLATOR_LOG(kWarning, "Transfer needs too many SGL segment pages");
+    return StatusCode::kFailure;
+  }
+  status = allocation.SetPages(page_size, page_count, 0);
+  if (status != StatusCode::kSuccess) return status;
+
+  nvme::SglDescriptor* list =
+      reinterpret_cast<nvme::SglDescriptor*>(allocation.data_addr);
+  cmd.dptr.sgl_descriptor =
+      BuildSegmentDescriptor(allocation.data_addr, count, per_page);
+
+  uint32_t index = 0;
+  uint32_t slot = 0;
+  ForEachDataBlock(
+      data_segments, offset, transfer_len, dword_aligned,
+      [&](uint64_t addr, uint32_t len) {
+        // Chain to the next list page if this one is full and more than one
+        // descriptor is left
+        if (slot == per_page - 1 && count - index > 1) {
+          uint64_t next_page = reinterpret_cast<uint64_t>(list) + page_size;
+          list[slot] = BuildSegmentDescriptor(next_page, count - index,
+                                              per_page);
+          list = reinterpret_cast<nvme::SglDescriptor*>(next_page);
+          slot = 0;
+        }
+        list[slot++] =
+            BuildDescriptor(nvme::SglDescriptorType::kDataBlock, addr, len);
+        ++index;
+      });
+
+  return StatusCode::kSuccess;
+}
+
+StatusCode BuildDataPointer(const Controller& controller,
+                            Span<const DataSegment> data_segments,
+                            uint32_t offset, uint32_t transfer_len,
+                            Allocation& allocation,
+                            nvme::GenericQueueEntryCmd& cmd) {
+  uint32_t page_size = controller.page_size();
+
+  // Find the segment the transfer starts in
+  size_t first = 0;
+  uint64_t skip = offset;
+  while (first < data_segments.size() && skip >= data_segments[first].len) {
+    skip -= data_segments[first].len;
+    ++first;
+  }
+
+  // PRP1 and PRP2 describe up to two pages without any list memory
+  bool fits_two_prps =
+      first == data_segments.size() ||
+      (data_segments[first].len - skip >= transfer_len &&
+       (data_segments[first].addr + skip) % page_size + transfer_len <=
+           2 * page_size);
+
+  if (!fits_two_prps && controller.SglSupported()) {
+    StatusCode status =
+        BuildSgl(data_segments, offset, transfer_len, page_size,
+                 controller.SglRequiresDwordAlignment(), allocation, cmd);
+    if (status == StatusCode::kSuccess) return status;
+    TRANSLATOR_LOG(kDebug, "Falling back to PRPs");
+  }
+  return BuildPrps(data_segments, offset, transfer_len, page_size, allocation,
+                   cmd);
+}
+
+}  // namespace translator
@@ -0,0 +1,50 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef LIB_TRANSLATOR_DATA_POINTER_H
+#define LIB_TRANSLATOR_DATA_POINTER_H
+
+#include "common.h"
+#include "controller.h"
+
+namespace translator {
+
+// Points cmd at the transfer_len bytes of data_segments that start offset
+// bytes in, using an SGL.
+// NVMe Base Specification Section 4.4
+// A single segment is described by one Data Block descriptor in the command.
+// Fragmented buffers get a list of Data Block descriptors in pages from
+// allocation, with a Segment or Last Segment descriptor in the command and at
+// the end of each full list page pointing to the next page.
+// Returns kFailure if the segments are too short, or if dword_aligned is set
+// and a descriptor address or length is not a multiple of four
+StatusCode BuildSgl(Span<const DataSegment> data_segments, uint32_t offset,
+                    uint32_t transfer_len, uint32_t page_size,
+                    bool dword_aligned, Allocation& allocation,
+                    nvme::GenericQueueEntryCmd& cmd);
+
+// Fills the data pointer of an NVM command set IO command.
+// Uses PRP1 and PRP2 when the transfer touches at most two memory pages, and
+// an SGL for larger or fragmented transfers if the controller supports SGLs.
+// Falls back to a PRP list otherwise
+StatusCode BuildDataPointer(const Controller& controller,
+                            Span<const DataSegment> data_segments,
+                            uint32_t offset, uint32_t transfer_len,
+                            Allocation& allocation,
+                            nvme::GenericQueueEntryCmd& cmd);
+
+}  // namespace translator
+
+#endif
@@ -66,7 +66,9 @@ StatusCode GetSptValueFromDPC(
       spt = 0b111;
       break;
     default:
-      DebugLog("DPC value not recoginized while translating ExtendedInquiry\n");
+      TRANSLATOR_LOG(
+          kWarning,
+          "DPC value not recoginized while translating ExtendedInquiry\n");
       return StatusCode::kFailure;
   }
   return StatusCode::kSuccess;
@@ -96,7 +98,8 @@ StatusCode BuildIdentificationDescriptor(
     identifier_length = kIdentifierLengthNguid;
     if (!WriteValue(identify_namespace_data.nguid,
                     buffer.subspan(sizeof(scsi::IdentificationDescriptor)))) {
-      DebugLog("Failed to write IdentificationDescriptor to the buffer\n");
+      TRANSLATOR_LOG(
+          kError, "Failed to write IdentificationDescriptor to the buffer\n");
       return StatusCode::kFailure;
     }
   } else if (eui64_nz) {
@@ -105,13 +108,16 @@ StatusCode BuildIdentificationDescriptor(
     identifier_length = kIdentifierLengthEui64;
     if (!WriteValue(identify_namespace_data.eui64,
                     buffer.subspan(sizeof(scsi::IdentificationDescriptor)))) {
-      DebugLog("Failed to write IdentificationDescriptor to the buffer\n");
+      TRANSLATOR_LOG(
+          kError, "Failed to write IdentificationDescriptor to the buffer\n");
       return StatusCode::kFailure;
     }
 
   } else {
     // function not supported as both NGUID and EUI64 fields are zero
-    DebugLog("Both NGUID and EUI-64 fields are zero in IdentityNamespaceData");
+    TRANSLATOR_LOG(
+        kWarning,
+        "Both NGUID and EUI-64 fields are zero in IdentityNamespaceData");
     return StatusCode::kFailure;
   }
 
@@ -137,7 +143,8 @@ StatusCode BuildIdentificationDescriptor(
 
       .identifier_length = identifier_length};
   if (!WriteValue(identification_descriptor, buffer)) {
-    DebugLog("Failed to write IdentificationDescriptor to the buffer\n");
+    TRANSLATOR_LOG(kError,
+                   "Failed to write IdentificationDescriptor to the buffer\n");
     return StatusCode::kFailure;
   };
   return StatusCode::kSuccess;
@@ -179,7 +186,7 @@ StatusCode TranslateStandardInquiry(
   }
   // SCSI specs only require first 36 bytes to be written to the buffer
   if (!WriteValue(result, buffer, 36)) {
-    DebugLog("Error writing 36 bytes of Inquiry Data to buffer");
+    TRANSLATOR_LOG(kError, "Error writing 36 bytes of Inquiry Data to buffer");
     return StatusCode::kFailure;
   }
   return StatusCode::kSuccess;
@@ -201,7 +208,8 @@ StatusCode TranslateSupportedVpdPages(Span<uint8_t> buffer) {
 
   if (!WriteValue(result, buffer) ||
       !WriteValue(supported_page_list, buffer.subspan(sizeof(result)))) {
-    DebugLog("Error writing Supported VPD pages or Page List to buffer");
+    TRANSLATOR_LOG(kError,
+                   "Error writing Supported VPD pages or Page List to buffer");
     return StatusCode::kFailure;
   }
   return StatusCode::kSuccess;
@@ -281,7 +289,8 @@ StatusCode TranslateUnitSerialNumberVpd(
 
   if (!WriteValue(result, buffer) ||
       !WriteValue(product_serial_number, buffer.subspan(sizeof(result)))) {
-    DebugLog(
+    TRANSLATOR_LOG(
+        kError,
         "Error writing Unit Serial Number or Product Serial Number to buffer");
     return StatusCode::kFailure;
   }
@@ -324,7 +333,8 @@ StatusCode TranslateDeviceIdentificationVpd(
       .page_length = page_length,
   };
   if (!WriteValue(result, buffer)) {
-    DebugLog("Error! Cannot write DeviceIdentificationVPD to buffer\n");
+    TRANSLATOR_LOG(kError,
+                   "Error! Cannot write DeviceIdentificationVPD to buffer\n");
     return StatusCode::kFailure;
   }
   return status;
@@ -394,7 +404,7 @@ StatusCode TranslateExtendedInquiryDataVpd(
       // to ll some other value.
   };
   if (!WriteValue(extended_inquiry_data, buffer)) {
-    DebugLog("Couldn't write ExtendedInquiry to buffer\n");
+    TRANSLATOR_LOG(kError, "Couldn't write ExtendedInquiry to buffer\n");
     return StatusCode::kFailure;
   }
   return status;
@@ -415,7 +425,8 @@ StatusCode TranslateBlockDeviceCharacteristicsVpd(Span<uint8_t> buffer) {
       .nominal_form_factor = scsi::NominalFormFactor::kNotReported};
 
   if (!WriteValue(block_device_characteristics_vpd, buffer)) {
-    DebugLog("Couldn't write BlockDeviceCharacteristicsVpd to buffer\n");
+    TRANSLATOR_LOG(kError,
+                   "Couldn't write BlockDeviceCharacteristicsVpd to buffer\n");
     return StatusCode::kFailure;
   }
   return StatusCode::kSuccess;
@@ -430,7 +441,7 @@ StatusCode TranslateBlockLimitsVpd(
   if (identify_ctrl.mdts > 16) {
     // Max transfer length should be 2^16 according to section 3.13 of
     // https://www.nvmexpress.org/wp-content/uploads/NVM-Express-SCSI-Translation-Reference-1_1-Gold.pdf
-    DebugLog("max transfer length is > 2^16");
+    TRANSLATOR_LOG(kInfo, "max transfer length is > 2^16");
     max_transfer_length = 1 << 16;
   } else {
     max_transfer_length = identify_ctrl.mdts ? 1 << identify_ctrl.mdts : 0;
@@ -448,6 +459,10 @@ StatusCode TranslateBlockLimitsVpd(
       .page_code = scsi::PageCode::kBlockLimitsVpd,
       .page_length = 0x003c,
 
+      // Write Same of zero blocks is rejected rather than writing to the end
+      // of the medium
+      .wsnz = 1,
+
       // Shall be set to 00h if Fused Operation is not supported;
       // May be set to a non-zero value that is less than or equal
       // to the value in MAXIMUM TRANSFER LENGTH field if
@@ -472,15 +487,15 @@ StatusCode TranslateBlockLimitsVpd(
 
       // Shall be set to 0000_0000h if Dataset Management
       // command – Deallocate (AD) attribute is not supported.
-      // Shall be set to 0000_0100h if Dataset Management
-      // command – Deallocate (AD) attribute is supported.
-
-      // TODO: add named var for 0x0100
+      // The translation reference sets it to 0000_0100h, the ranges of one
+      // Dataset Management command, if Deallocate is supported. Longer lists
+      // are split over several commands, so every descriptor an Unmap
+      // parameter list holds is accepted
       .max_unmap_block_descriptor_count =
-          htonl(identify_ctrl.oncs.dsm ? 0x0100 : 0)};
+          htonl(identify_ctrl.oncs.dsm ? kMaxUnmapBlockDescriptors : 0)};
 
   if (!WriteValue(result, buffer)) {
-    DebugLog("Error writing Block Limits VPD to the buffer");
+    TRANSLATOR_LOG(kError, "Error writing Block Limits VPD to the buffer");
     return StatusCode::kFailure;
   }
   return StatusCode::kSuccess;
@@ -517,6 +532,12 @@ StatusCode TranslateLogicalBlockProvisioningVpd(
       // if there are any errors.
       .lbprz = ad,
 
+      // LBPWS and LBPWS10
+      // Write Same with the UNMAP bit set deallocates zeroed blocks if Write
+      // Zeroes is supported
+      .lbpws10 = static_cast<bool>(identify_ctrl.oncs.write_zeroes),
+      .lbpws = static_cast<bool>(identify_ctrl.oncs.write_zeroes),
+
       // ANC_SUP
       // Shall be set to 0, to indicate that setting the ANCHOR bit in UNMAP is
       // not supported if the namespace is not resource or thin provisioned.
@@ -556,7 +577,8 @@ StatusCode TranslateLogicalBlockProvisioningVpd(
   }
 
   if (!WriteValue(result, buffer)) {
-    DebugLog("Error writing Logical Block Provisioning VPD to buffer");
+    TRANSLATOR_LOG(kError,
+                   "Error writing Logical Block Provisioning VPD to buffer");
     return StatusCode::kFailure;
   }
   return StatusCode::kSuccess;
@@ -571,7 +593,7 @@ StatusCode InquiryToNvme(Span<const uint8_t> raw_scsi,
                          Span<Allocation> allocations, uint32_t& alloc_len) {
   scsi::InquiryCommand cmd = {};
   if (!ReadValue(raw_scsi, cmd)) {
-    DebugLog("Malformed Inquiry Command");
+    TRANSLATOR_LOG(kWarning, "Malformed Inquiry Command");
     return StatusCode::kInvalidInput;
   };
 
@@ -617,7 +639,7 @@ StatusCode InquiryToScsi(Span<const uint8_t> raw_scsi, Span<uint8_t> buffer,
   scsi::InquiryCommand inquiry_cmd = {};
 
   if (!ReadValue(raw_scsi, inquiry_cmd)) {
-    DebugLog("Malformed Inquiry Command");
+    TRANSLATOR_LOG(kWarning, "Malformed Inquiry Command");
     return StatusCode::kInvalidInput;
   };
 
@@ -630,14 +652,14 @@ StatusCode InquiryToScsi(Span<const uint8_t> raw_scsi, Span<uint8_t> buffer,
   const nvme::IdentifyNamespace* identify_ns_data =
       SafePointerCastRead<nvme::IdentifyNamespace>(ns_span);
   if (identify_ns_data == nullptr) {
-    DebugLog("Identify namespace structure failed to cast");
+    TRANSLATOR_LOG(kError, "Identify namespace structure failed to cast");
     return StatusCode::kFailure;
   }
 
   const nvme::IdentifyControllerData* identify_ctrl_data =
       SafePointerCastRead<nvme::IdentifyControllerData>(ctrl_span);
   if (identify_ctrl_data == nullptr) {
-    DebugLog("Identify controller structure failed to cast");
+    TRANSLATOR_LOG(kError, "Identify controller structure failed to cast");
     return StatusCode::kFailure;
   }
 
@@ -676,7 +698,8 @@ StatusCode InquiryToScsi(Span<const uint8_t> raw_scsi, Span<uint8_t> buffer,
       default:
         // Command may be terminated with CHECK CONDITION status, ILLEGAL
         // REQUEST dense key, and ILLEGAL FIELD IN CDB additional sense code
-        DebugLog("Inquiry Command parameters do not map to any action.");
+        TRANSLATOR_LOG(kWarning,
+                       "Inquiry Command parameters do not map to any action.");
         return StatusCode::kInvalidInput;
     }
   } else {
@@ -0,0 +1,89 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "io_command.h"
+
+#include "data_pointer.h"
+
+namespace translator {
+
+uint32_t BuildIoCdw12(uint32_t block_count, uint8_t prinfo, bool fua) {
+  // cdw12 nlb bits 15:00 (zero based field), prinfo bits 29:26, fua bit 30
+  return (static_cast<uint32_t>(fua) << 30) |
+         (static_cast<uint32_t>(prinfo) << 26) | (block_count - 1);
+}
+
+StatusCode BuildIoCommands(const IoCommand& io, const Controller& controller,
+                           Span<const DataSegment> data_segments,
+                           NvmeCmdChain& chain) {
+  uint64_t transfer_len = static_cast<uint64_t>(io.block_count) << io.lba_shift;
+  if (transfer_len > UINT32_MAX) {
+    TRANSLATOR_LOG(kWarning, "Transfer length of %u blocks exceeds 4 GiB",
+                   io.block_count);
+    return StatusCode::kInvalidInput;
+  }
+
+  uint32_t max_blocks = kMaxBlocksPerCommand;
+  uint64_t max_bytes = controller.MaxTransferBytes();
+  if (max_bytes != 0 && (max_bytes >> io.lba_shift) < max_blocks)
+    max_blocks = max_bytes >> io.lba_shift;
+  if (max_blocks == 0) {
+    TRANSLATOR_LOG(kWarning,
+                   "Logical block size %u exceeds the maximum transfer size",
+                   1u << io.lba_shift);
+    return StatusCode::kFailure;
+  }
+
+  uint32_t count = (io.block_count + max_blocks - 1) / max_blocks;
+  StatusCode status = chain.Resize(count, controller.page_size());
+  if (status != StatusCode::kSuccess) return status;
+
+  uint32_t block_offset = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    uint32_t blocks = io.block_count - block_offset < max_blocks
+                          ? io.block_count - block_offset
+                          : max_blocks;
+    uint32_t data_offset = block_offset << io.lba_shift;
+    uint64_t len = static_cast<uint64_t>(blocks) << io.lba_shift;
+
+    uint64_t lba = io.lba + block_offset;
+    NvmeCmdWrapper& nvme_wrapper = chain.wrapper(i);
+    nvme_wrapper.cmd = nvme::GenericQueueEntryCmd{
+        .opc = static_cast<uint8_t>(io.opc), .nsid = io.nsid};
+    // cdw10 and cdw11 hold the starting lba
+    nvme_wrapper.cmd.cdw[0] = htoll(static_cast<uint32_t>(lba));
+    nvme_wrapper.cmd.cdw[1] = htoll(static_cast<uint32_t>(lba >> 32));
+    nvme_wrapper.cmd.cdw[2] = htoll(BuildIoCdw12(blocks, io.prinfo, io.fua));
+    nvme_wrapper.buffer_len = len;
+    nvme_wrapper.is_admin = false;
+    nvme_wrapper.data_offset = data_offset;
+
+    // Keep the scratch page Resize() lent the command for its PRP or SGL
+    // list
+    Allocation& allocation = chain.allocation(i);
+    allocation.data_addr = 0;
+    allocation.data_page_count = 0;
+    allocation.mdata_addr = 0;
+    allocation.mdata_page_count = 0;
+    status = BuildDataPointer(controller, data_segments, data_offset, len,
+                              allocation, nvme_wrapper.cmd);
+    if (status != StatusCode::kSuccess) return status;
+
+    block_offset += blocks;
+  }
+  return StatusCode::kSuccess;
+}
+
+}  // namespace translator
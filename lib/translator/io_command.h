@@ -0,0 +1,146 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef LIB_TRANSLATOR_IO_COMMAND_H
+#define LIB_TRANSLATOR_IO_COMMAND_H
+
+#include "common.h"
+#include "controller.h"
+
+namespace translator {
+
+// NLB is a 16 bit zero based field
+constexpr uint32_t kMaxBlocksPerCommand = 0x10000;
+
+// An NVM command set Read or Write of any length, decoded from a SCSI command
+struct IoCommand {
+  nvme::NvmOpcode opc;
+  uint32_t nsid;
+  uint64_t lba;
+  uint32_t block_count;  // Not zero based
+  uint8_t lba_shift;  // Logical block size is 1 << lba_shift bytes
+  uint8_t prinfo;
+  bool fua;
+};
+
+// Byte layouts of the Read and Write CDBs, which share one layout per CDB
+// size. Offsets count from the byte after the opcode and multi-byte fields
+// are big endian
+struct IoCdb6 {
+  static constexpr uint8_t kSize = sizeof(scsi::Read6Command);
+  static constexpr uint8_t kLbaOffset = 0;
+  static constexpr uint8_t kLbaWidth = 3;
+  static constexpr uint8_t kLbaBits = 21;
+  static constexpr uint8_t kLengthOffset = 3;
+  static constexpr uint8_t kLengthWidth = 1;
+  // Read(6) and Write(6) have no protection or FUA fields, and a transfer
+  // length of 0 means 256 blocks
+  static constexpr bool kLegacy = true;
+};
+
+struct IoCdb10 {
+  static constexpr uint8_t kSize = sizeof(scsi::Read10Command);
+  static constexpr uint8_t kLbaOffset = 1;
+  static constexpr uint8_t kLbaWidth = 4;
+  static constexpr uint8_t kLbaBits = 32;
+  static constexpr uint8_t kLengthOffset = 6;
+  static constexpr uint8_t kLengthWidth = 2;
+  static constexpr bool kLegacy = false;
+};
+
+struct IoCdb12 {
+  static constexpr uint8_t kSize = sizeof(scsi::Read12Command);
+  static constexpr uint8_t kLbaOffset = 1;
+  static constexpr uint8_t kLbaWidth = 4;
+  static constexpr uint8_t kLbaBits = 32;
+  static constexpr uint8_t kLengthOffset = 5;
+  static constexpr uint8_t kLengthWidth = 4;
+  static constexpr bool kLegacy = false;
+};
+
+struct IoCdb16 {
+  static constexpr uint8_t kSize = sizeof(scsi::Read16Command);
+  static constexpr uint8_t kLbaOffset = 1;
+  static constexpr uint8_t kLbaWidth = 8;
+  static constexpr uint8_t kLbaBits = 64;
+  static constexpr uint8_t kLengthOffset = 9;
+  static constexpr uint8_t kLengthWidth = 4;
+  static constexpr bool kLegacy = false;
+};
+
+static_assert(sizeof(scsi::Write6Command) == IoCdb6::kSize);
+static_assert(sizeof(scsi::Write10Command) == IoCdb10::kSize);
+static_assert(sizeof(scsi::Write12Command) == IoCdb12::kSize);
+static_assert(sizeof(scsi::Write16Command) == IoCdb16::kSize);
+
+// Fields of a Read or Write CDB
+struct IoCdbFields {
+  uint64_t lba;
+  uint32_t transfer_length;
+  uint8_t protect;  // RDPROTECT or WRPROTECT, 0 for legacy CDBs
+  bool fua;
+};
+
+// Reads the kWidth byte big endian value at bytes
+template <uint8_t kWidth>
+inline uint64_t LoadBigEndian(const uint8_t* bytes) {
+  uint64_t value = 0;
+  for (uint8_t i = 0; i < kWidth; ++i) value = (value << 8) | bytes[i];
+  return value;
+}
+
+// Decodes scsi_cmd, a Read or Write CDB without its opcode, straight from its
+// bytes. Returns false if scsi_cmd is shorter than Layout::kSize
+template <typename Layout>
+bool DecodeIoCdb(Span<const uint8_t> scsi_cmd, IoCdbFields& fields) {
+  static_assert(Layout::kLbaOffset + Layout::kLbaWidth <= Layout::kSize);
+  static_assert(Layout::kLengthOffset + Layout::kLengthWidth <= Layout::kSize);
+  static_assert(Layout::kLengthWidth <= sizeof(fields.transfer_length));
+  if (scsi_cmd.size() < Layout::kSize) return false;
+
+  const uint8_t* cdb = scsi_cmd.data();
+  fields.lba = LoadBigEndian<Layout::kLbaWidth>(cdb + Layout::kLbaOffset);
+  if constexpr (Layout::kLbaBits < 64)
+    fields.lba &= (uint64_t{1} << Layout::kLbaBits) - 1;
+  fields.transfer_length =
+      LoadBigEndian<Layout::kLengthWidth>(cdb + Layout::kLengthOffset);
+  if constexpr (Layout::kLegacy) {
+    fields.protect = 0;
+    fields.fua = false;
+  } else {
+    // Protection is bits 7:5 and FUA bit 3 of the first byte
+    fields.protect = cdb[0] >> 5;
+    fields.fua = (cdb[0] >> 3) & 1;
+  }
+  return true;
+}
+
+// Builds cdw12 of an NVM command set Read, Write or Write Zeroes command
+// for block_count blocks, which must not exceed kMaxBlocksPerCommand
+uint32_t BuildIoCdw12(uint32_t block_count, uint8_t prinfo, bool fua);
+
+// Builds the NVMe commands for io into chain, splitting it into commands that
+// transfer at most the controller's maximum data transfer size and the 65536
+// blocks an NVMe command can address. Each command points at its part of
+// data_segments, which must hold every block io transfers.
+// Returns kInvalidInput if io transfers more than 4 GiB, and kFailure if a
+// single block exceeds the maximum transfer size or memory is unavailable
+StatusCode BuildIoCommands(const IoCommand& io, const Controller& controller,
+                           Span<const DataSegment> data_segments,
+                           NvmeCmdChain& chain);
+
+}  // namespace translator
+
+#endif
@@ -18,35 +18,83 @@
 
 namespace translator {
 
+namespace {
+
+// Each bit of a CDB usage map is set if the device server honors the bit at
+// that position of the CDB. The first byte is the opcode
+constexpr uint8_t kWriteSame10Usage[] = {
+    static_cast<uint8_t>(scsi::OpCode::kWriteSame10),
+    0xe8,  // WRPROTECT and UNMAP
+    0xff, 0xff, 0xff, 0xff,  // LOGICAL BLOCK ADDRESS
+    0x00,
+    0xff, 0xff,  // NUMBER OF LOGICAL BLOCKS
+    0x00};
+static_assert(sizeof(kWriteSame10Usage) ==
+              sizeof(scsi::WriteSame10Command) + 1);
+
+constexpr uint8_t kWriteSame16Usage[] = {
+    static_cast<uint8_t>(scsi::OpCode::kWriteSame16),
+    0xe9,  // WRPROTECT, UNMAP and NDOB
+    0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,  // LOGICAL BLOCK ADDRESS
+    0xff, 0xff, 0xff, 0xff,  // NUMBER OF LOGICAL BLOCKS
+    0x00,
+    0x00};
+static_assert(sizeof(kWriteSame16Usage) ==
+              sizeof(scsi::WriteSame16Command) + 1);
+
+// Returns the CDB usage map of opcode, or an empty span if it is not
+// reported
+Span<const uint8_t> CdbUsage(uint8_t opcode) {
+  switch (static_cast<scsi::OpCode>(opcode)) {
+    case scsi::OpCode::kWriteSame10:
+      return Span<const uint8_t>(kWriteSame10Usage, sizeof(kWriteSame10Usage));
+    case scsi::OpCode::kWriteSame16:
+      return Span<const uint8_t>(kWriteSame16Usage, sizeof(kWriteSame16Usage));
+    default:
+      return Span<const uint8_t>();
+  }
+}
+
+}  // namespace
+
 StatusCode ValidateReportSupportedOpCodes(Span<const uint8_t> scsi_cmd,
                                           uint32_t& alloc_len) {
   scsi::ReportOpCodesCommand report_cmd = {};
   if (!ReadValue(scsi_cmd, report_cmd)) {
-    DebugLog("Malformed Report Supported OpCodes command");
+    TRANSLATOR_LOG(kWarning, "Malformed Report Supported OpCodes command");
     return StatusCode::kInvalidInput;
   }
 
-  if (report_cmd.requested_op_code !=
-          static_cast<uint8_t>(scsi::OpCode::kWriteSame16) ||
-      report_cmd.reporting_options != 0b001) {
+  Span<const uint8_t> usage = CdbUsage(report_cmd.requested_op_code);
+  if (usage.empty() || report_cmd.reporting_options != 0b001) {
     // Project specifications only require supporting ReportSupportedOpCodes for
-    // WriteSame16
-    DebugLog("Only supporting ReportSupportedOpCodes for WriteSame16");
+    // Write Same
+    TRANSLATOR_LOG(kWarning,
+                   "Only supporting ReportSupportedOpCodes for WriteSame10 "
+                   "and WriteSame16");
     return StatusCode::kInvalidInput;
   }
 
-  alloc_len = sizeof(scsi::OneCommandParamData);
+  alloc_len = sizeof(scsi::OneCommandParamData) + usage.size();
 
   return StatusCode::kSuccess;
 }
 
-void WriteReportSupportedOpCodesResult(Span<uint8_t> buffer) {
+void WriteReportSupportedOpCodesResult(Span<const uint8_t> scsi_cmd,
+                                       Span<uint8_t> buffer) {
+  scsi::ReportOpCodesCommand report_cmd = {};
+  ReadValue(scsi_cmd, report_cmd);
+  Span<const uint8_t> usage = CdbUsage(report_cmd.requested_op_code);
   scsi::OneCommandParamData data = {
-      // device does not support the requested command
-      // all data after byte 1 is undefined
-      .support = 0b001};
+      // device supports the requested command in conformance with the
+      // standard, and the CDB usage data follows
+      .support = 0b011,
+      .cdb_size = endian::HostToBig(static_cast<uint16_t>(usage.size()))};
 
-  WriteValue(data, buffer);
+  if (!WriteValue(data, buffer) ||
+      buffer.size() < sizeof(data) + usage.size())
+    return;
+  memcpy(buffer.data() + sizeof(data), usage.data(), usage.size());
 }
 
 }  // namespace translator
@@ -19,17 +19,20 @@
 
 namespace translator {
 
-// Translation library only supports ReportSupportedOpCodes for WriteSame16
-// We always report that we do not support WriteSame16
+// Translation library only supports ReportSupportedOpCodes for WriteSame10
+// and WriteSame16, which it reports as supported along with the CDB fields
+// it honors
 // This command does not require call to NVMe so it doesn't require translation
 
 // Validates command to ensure it is a well-formatted ReportSupportedOpCodes cmd
-// and that the requested OpCode is scsi::OpCode::WriteSame16
+// and that the requested OpCode is scsi::OpCode::WriteSame10 or WriteSame16
 StatusCode ValidateReportSupportedOpCodes(Span<const uint8_t> scsi_cmd,
                                           uint32_t& alloc_len);
 
-// Writes to the buffer that we do not support the command
-void WriteReportSupportedOpCodesResult(Span<uint8_t> buffer);
+// Writes the support and CDB usage data of the requested command to the
+// buffer. scsi_cmd must have passed ValidateReportSupportedOpCodes()
+void WriteReportSupportedOpCodesResult(Span<const uint8_t> scsi_cmd,
+                                       Span<uint8_t> buffer);
 
 }  // namespace translator
 
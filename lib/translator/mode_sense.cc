@@ -113,7 +113,7 @@ StatusCode GenerateCacheGetFeaturesCmd(NvmeCmdWrapper& nvme_wrapper,
       tmp_get_features.sel = nvme::FeatureSelect::kDefault;
       break;
     default:
-      DebugLog("Unsupported page control recieved");
+      TRANSLATOR_LOG(kWarning, "Unsupported page control recieved");
       return StatusCode::kFailure;
   }
   tmp_get_features.fid = nvme::FeatureType::kVolatileWriteCache;
@@ -169,7 +169,8 @@ StatusCode ModeSenseToNvme(CommonCmdAttributes cmd_attributes,
     StatusCode status = GenerateBlockDescriptorIdentifyCmd(
         nvme_wrappers[cmd_count++], allocation, page_size, nsid);
     if (status != StatusCode::kSuccess) {
-      DebugLog("Error generating Block Descriptor Identify Command");
+      TRANSLATOR_LOG(kError,
+                     "Error generating Block Descriptor Identify Command");
       return status;
     }
   }
@@ -181,7 +182,7 @@ StatusCode ModeSenseToNvme(CommonCmdAttributes cmd_attributes,
         cmd_attributes.page_code == scsi::ModePageCode::kPowerConditionMode) {
       return StatusCode::kSuccess;
     }
-    DebugLog("Unsuppported mode sense page code recieved");
+    TRANSLATOR_LOG(kWarning, "Unsuppported mode sense page code recieved");
     return StatusCode::kFailure;
   }
 
@@ -203,7 +204,7 @@ bool WriteMode6Header(CommonCmdAttributes cmd_attributes,
   else
     header.bdl = 0;
   if (!WriteValue(header, buffer)) {
-    DebugLog("Insufficient size for mode 6 parameter header");
+    TRANSLATOR_LOG(kWarning, "Insufficient size for mode 6 parameter header");
     return false;
   }
   return true;
@@ -225,7 +226,7 @@ bool WriteMode10Header(CommonCmdAttributes cmd_attributes,
     header.bdl = 0;
   }
   if (!WriteValue(header, buffer)) {
-    DebugLog("Insufficient size for mode 10 parameter header");
+    TRANSLATOR_LOG(kWarning, "Insufficient size for mode 10 parameter header");
     return false;
   }
   return true;
@@ -311,7 +312,8 @@ StatusCode ModeSenseToScsi(CommonCmdAttributes cmd_attributes, bool is_mode_10,
     uint32_t write_len = 0;
     if (!WriteBlockDescriptor(identify, buffer, cmd_attributes.llbaa,
                               write_len)) {
-      DebugLog("Truncating mode sense response at block descriptor");
+      TRANSLATOR_LOG(kInfo,
+                     "Truncating mode sense response at block descriptor");
       return StatusCode::kSuccess;
     }
     buffer = buffer.subspan(write_len);
@@ -319,7 +321,7 @@ StatusCode ModeSenseToScsi(CommonCmdAttributes cmd_attributes, bool is_mode_10,
 
   // Append page data
   if (!WritePageData(cmd_attributes.page_code, get_features_result, buffer)) {
-    DebugLog("Failed to write variable length mode-page data");
+    TRANSLATOR_LOG(kError, "Failed to write variable length mode-page data");
   }
   return StatusCode::kSuccess;
 }
@@ -336,7 +338,7 @@ StatusCode ModeSense6ToNvme(Span<const uint8_t> scsi_cmd,
   // cast scsi_cmd to Mode Sense 6 command
   scsi::ModeSense6Command ms6_cmd;
   if (!ReadValue(scsi_cmd, ms6_cmd)) {
-    DebugLog("Mode Sense 6 Command Malformed");
+    TRANSLATOR_LOG(kWarning, "Mode Sense 6 Command Malformed");
     return StatusCode::kFailure;
   }
 
@@ -360,7 +362,7 @@ StatusCode ModeSense10ToNvme(Span<const uint8_t> scsi_cmd,
   // cast scsi_cmd to Mode Sense 10 command
   scsi::ModeSense10Command ms10_cmd;
   if (!ReadValue(scsi_cmd, ms10_cmd)) {
-    DebugLog("Mode Sense 10 Command Malformed");
+    TRANSLATOR_LOG(kWarning, "Mode Sense 10 Command Malformed");
     return StatusCode::kFailure;
   }
 
@@ -382,7 +384,7 @@ StatusCode ModeSense6ToScsi(Span<const uint8_t> scsi_cmd,
   // cast scsi_cmd to Mode Sense 6 command
   scsi::ModeSense6Command ms6_cmd;
   if (!ReadValue(scsi_cmd, ms6_cmd)) {
-    DebugLog("Mode Sense 6 Command Malformed");
+    TRANSLATOR_LOG(kWarning, "Mode Sense 6 Command Malformed");
     return StatusCode::kFailure;
   }
 
@@ -403,7 +405,7 @@ StatusCode ModeSense10ToScsi(Span<const uint8_t> scsi_cmd,
   // cast scsi_cmd to Mode Sense 10 command
   scsi::ModeSense10Command ms10_cmd;
   if (!ReadValue(scsi_cmd, ms10_cmd)) {
-    DebugLog("Mode Sense 10 Command Malformed");
+    TRANSLATOR_LOG(kWarning, "Mode Sense 10 Command Malformed");
     return StatusCode::kFailure;
   }
 
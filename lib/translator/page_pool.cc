@@ -0,0 +1,205 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "page_pool.h"
+
+namespace translator {
+
+namespace {
+
+constexpr uint32_t kNoClass = kPagePoolClassCount;
+
+// Smallest class holding count pages: 1, 2, 4 or 8
+uint32_t SizeClass(uint16_t count) {
+  if (count == 0 || count > kPagePoolMaxCachedPages) return kNoClass;
+  uint32_t size_class = 0;
+  while ((1u << size_class) < count) ++size_class;
+  return size_class;
+}
+
+uint16_t ClassPages(uint32_t size_class) { return 1u << size_class; }
+
+bool TryLock(uint32_t& busy) {
+  return __atomic_exchange_n(&busy, 1, __ATOMIC_ACQUIRE) == 0;
+}
+
+void Unlock(uint32_t& busy) { __atomic_store_n(&busy, 0, __ATOMIC_RELEASE); }
+
+void Count(uint64_t& counter) {
+  __atomic_fetch_add(&counter, 1, __ATOMIC_RELAXED);
+}
+
+uint64_t Load(const uint64_t& counter) {
+  return __atomic_load_n(&counter, __ATOMIC_RELAXED);
+}
+
+}  // namespace
+
+StatusCode PagePool::Init(uint32_t page_size, uint32_t cpu_count,
+                          uint32_t (*current_cpu)(),
+                          uint64_t (*backing_alloc)(uint32_t, uint16_t),
+                          void (*backing_dealloc)(uint64_t, uint16_t)) {
+  if (page_size == 0 || cpu_count == 0 || current_cpu == nullptr ||
+      backing_alloc == nullptr || backing_dealloc == nullptr) {
+    TRANSLATOR_LOG(kError, "Page pool needs a page size, CPUs and callbacks");
+    return StatusCode::kFailure;
+  }
+
+  uint64_t bytes = static_cast<uint64_t>(cpu_count) * sizeof(CpuCache);
+  uint64_t page_count = (bytes + page_size - 1) / page_size;
+  if (page_count > UINT16_MAX) {
+    TRANSLATOR_LOG(kError, "Too many CPUs for the page pool: %u", cpu_count);
+    return StatusCode::kFailure;
+  }
+  uint64_t addr = backing_alloc(page_size, page_count);
+  if (addr == 0) {
+    TRANSLATOR_LOG(kError, "Error when requesting memory for the page pool");
+    return StatusCode::kFailure;
+  }
+  memset(reinterpret_cast<void*>(addr), 0, page_count * page_size);
+
+  page_size_ = page_size;
+  cpu_count_ = cpu_count;
+  current_cpu_ = current_cpu;
+  backing_alloc_ = backing_alloc;
+  backing_dealloc_ = backing_dealloc;
+  cpus_ = reinterpret_cast<CpuCache*>(addr);
+  cpu_page_count_ = page_count;
+  memset(depots_, 0, sizeof(depots_));
+  return StatusCode::kSuccess;
+}
+
+void PagePool::Destroy() {
+  if (cpus_ == nullptr) return;
+  for (uint32_t size_class = 0; size_class < kPagePoolClassCount;
+       ++size_class) {
+    uint16_t class_pages = ClassPages(size_class);
+    for (uint32_t cpu = 0; cpu < cpu_count_; ++cpu) {
+      Magazine& magazine = cpus_[cpu].magazines[size_class];
+      for (uint32_t i = 0; i < magazine.count; ++i)
+        backing_dealloc_(magazine.pages[i], class_pages);
+      magazine.count = 0;
+    }
+    Depot& depot = depots_[size_class];
+    for (uint32_t i = 0; i < depot.count; ++i)
+      backing_dealloc_(depot.pages[i], class_pages);
+    depot.count = 0;
+  }
+  backing_dealloc_(reinterpret_cast<uint64_t>(cpus_), cpu_page_count_);
+  cpus_ = nullptr;
+  cpu_page_count_ = 0;
+  cpu_count_ = 0;
+}
+
+uint64_t PagePool::Alloc(uint32_t page_size, uint16_t count) {
+  if (count == 0) return 0;
+  if (page_size != page_size_) {
+    TRANSLATOR_LOG(kWarning, "Page pool serves %u byte pages, not %u",
+                   page_size_, page_size);
+    return 0;
+  }
+  uint32_t size_class = SizeClass(count);
+  CpuCache* cpu = GetCpu();
+  if (cpu == nullptr || size_class == kNoClass)
+    return backing_alloc_(page_size, count);
+
+  if (TryLock(cpu->busy)) {
+    Magazine& magazine = cpu->magazines[size_class];
+    if (magazine.count == 0) Refill(size_class, magazine, cpu->stats);
+    if (magazine.count != 0) {
+      uint64_t addr = magazine.pages[--magazine.count];
+      Count(cpu->stats.hits);
+      Unlock(cpu->busy);
+      return addr;
+    }
+    Unlock(cpu->busy);
+  }
+  Count(cpu->stats.misses);
+  return backing_alloc_(page_size, ClassPages(size_class));
+}
+
+void PagePool::Dealloc(uint64_t addr, uint16_t count) {
+  if (addr == 0) return;
+  uint32_t size_class = SizeClass(count);
+  CpuCache* cpu = GetCpu();
+  if (cpu == nullptr || size_class == kNoClass) {
+    backing_dealloc_(addr, count);
+    return;
+  }
+
+  uint16_t class_pages = ClassPages(size_class);
+  if (!TryLock(cpu->busy)) {
+    backing_dealloc_(addr, class_pages);
+    return;
+  }
+  // Cached pages are handed out as they are
+  memset(reinterpret_cast<void*>(addr), 0,
+         static_cast<uint64_t>(class_pages) * page_size_);
+  Magazine& magazine = cpu->magazines[size_class];
+  if (magazine.count == kMagazineSize) Flush(size_class, magazine, cpu->stats);
+  magazine.pages[magazine.count++] = addr;
+  Unlock(cpu->busy);
+}
+
+PagePoolStats PagePool::GetStats() const {
+  PagePoolStats stats = {};
+  if (cpus_ == nullptr) return stats;
+  for (uint32_t cpu = 0; cpu < cpu_count_; ++cpu) {
+    const PagePoolStats& cpu_stats = cpus_[cpu].stats;
+    stats.hits += Load(cpu_stats.hits);
+    stats.misses += Load(cpu_stats.misses);
+    stats.refills += Load(cpu_stats.refills);
+    stats.flushes += Load(cpu_stats.flushes);
+  }
+  return stats;
+}
+
+PagePool::CpuCache* PagePool::GetCpu() {
+  if (cpus_ == nullptr) return nullptr;
+  uint32_t cpu = current_cpu_();
+  if (cpu >= cpu_count_) return nullptr;
+  return &cpus_[cpu];
+}
+
+void PagePool::Refill(uint32_t size_class, Magazine& magazine,
+                      PagePoolStats& stats) {
+  Depot& depot = depots_[size_class];
+  if (!TryLock(depot.busy)) return;
+  uint32_t moved = 0;
+  while (moved < kMagazineBatch && depot.count != 0) {
+    magazine.pages[magazine.count++] = depot.pages[--depot.count];
+    ++moved;
+  }
+  Unlock(depot.busy);
+  if (moved != 0) Count(stats.refills);
+}
+
+void PagePool::Flush(uint32_t size_class, Magazine& magazine,
+                     PagePoolStats& stats) {
+  Depot& depot = depots_[size_class];
+  uint32_t moved = 0;
+  if (TryLock(depot.busy)) {
+    while (moved < kMagazineBatch && depot.count != kDepotSize) {
+      depot.pages[depot.count++] = magazine.pages[--magazine.count];
+      ++moved;
+    }
+    Unlock(depot.busy);
+    if (moved != 0) Count(stats.flushes);
+  }
+  // Whatever the depot could not take goes back to the backing allocator
+  for (; moved < kMagazineBatch; ++moved)
+    backing_dealloc_(magazine.pages[--magazine.count], ClassPages(size_class));
+}
+
+}  // namespace translator
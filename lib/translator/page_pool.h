@@ -0,0 +1,118 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef LIB_TRANSLATOR_PAGE_POOL_H
+#define LIB_TRANSLATOR_PAGE_POOL_H
+
+#include "common.h"
+
+namespace translator {
+
+// Allocations of 1, 2, 4 and 8 pages are cached. Identify, log and DSM
+// buffers take one page, PRP and SGL lists of the largest transfers up to 8
+constexpr uint32_t kPagePoolClassCount = 4;
+constexpr uint16_t kPagePoolMaxCachedPages = 8;
+// Page runs each CPU keeps per size class
+constexpr uint32_t kMagazineSize = 16;
+// Page runs moved between a magazine and the depot at once
+constexpr uint32_t kMagazineBatch = kMagazineSize / 2;
+// Page runs the shared depot keeps per size class
+constexpr uint32_t kDepotSize = 128;
+
+struct PagePoolStats {
+  uint64_t hits;     // Allocations served from a CPU's magazine
+  uint64_t misses;   // Allocations passed on to the backing allocator
+  uint64_t refills;  // Batches a magazine took from the depot
+  uint64_t flushes;  // Batches a magazine returned to the depot
+};
+
+// Caches zeroed pages in front of a backing page allocator, to be installed
+// with SetAllocPageCallbacks(). Each CPU has a magazine per size class, and
+// the magazines exchange batches of pages with a shared depot. Pages are
+// zeroed when they are freed, so cached allocations need no clearing.
+//
+// Alloc() and Dealloc() never wait: if a magazine or the depot is in use,
+// such as by code the calling context interrupted, the call goes to the
+// backing allocator instead. Runs of more pages are never cached.
+class PagePool {
+ public:
+  PagePool()
+      : page_size_(0),
+        cpu_count_(0),
+        current_cpu_(nullptr),
+        backing_alloc_(nullptr),
+        backing_dealloc_(nullptr),
+        cpus_(nullptr),
+        cpu_page_count_(0),
+        depots_() {}
+
+  // Caches pages of page_size for cpu_count CPUs. current_cpu returns the
+  // calling CPU, in [0, cpu_count). The per-CPU state is allocated with
+  // backing_alloc. Returns kFailure if that fails
+  StatusCode Init(uint32_t page_size, uint32_t cpu_count,
+                  uint32_t (*current_cpu)(),
+                  uint64_t (*backing_alloc)(uint32_t, uint16_t),
+                  void (*backing_dealloc)(uint64_t, uint16_t));
+
+  // Returns every cached page and the per-CPU state to the backing
+  // allocator. No allocation may be in use from other threads
+  void Destroy();
+
+  // Same contract as AllocPages() and DeallocPages(), for pages of the size
+  // given to Init(). Dealloc() must be given the count the pages were
+  // allocated with. Neither may be called before Init()
+  uint64_t Alloc(uint32_t page_size, uint16_t count);
+  void Dealloc(uint64_t addr, uint16_t count);
+
+  // Sums the counters of every CPU. Counters may be updated concurrently
+  PagePoolStats GetStats() const;
+
+ private:
+  struct Magazine {
+    uint32_t count;
+    uint64_t pages[kMagazineSize];
+  };
+
+  struct CpuCache {
+    uint32_t busy;
+    Magazine magazines[kPagePoolClassCount];
+    PagePoolStats stats;
+  };
+
+  struct Depot {
+    uint32_t busy;
+    uint32_t count;
+    uint64_t pages[kDepotSize];
+  };
+
+  CpuCache* GetCpu();
+  // Moves up to kMagazineBatch runs from the depot into magazine
+  void Refill(uint32_t size_class, Magazine& magazine, PagePoolStats& stats);
+  // Moves kMagazineBatch runs from magazine to the depot, or to the backing
+  // allocator if the depot is full or busy
+  void Flush(uint32_t size_class, Magazine& magazine, PagePoolStats& stats);
+
+  uint32_t page_size_;
+  uint32_t cpu_count_;
+  uint32_t (*current_cpu_)();
+  uint64_t (*backing_alloc_)(uint32_t, uint16_t);
+  void (*backing_dealloc_)(uint64_t, uint16_t);
+  CpuCache* cpus_;
+  uint16_t cpu_page_count_;
+  Depot depots_[kPagePoolClassCount];
+};
+
+}  // namespace translator
+
+#endif
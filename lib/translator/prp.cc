@@ -0,0 +1,131 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "prp.h"
+
+namespace translator {
+
+namespace {  // anonymous namespace for helper functions
+
+// Calls on_entry with the address of each PRP entry of the transfer: the
+// start of the transfer, then the start of every further memory page
+template <typename F>
+StatusCode ForEachPrpEntry(Span<const DataSegment> data_segments,
+                           uint32_t offset, uint32_t transfer_len,
+                           uint32_t page_size, F on_entry) {
+  uint64_t skip = offset;
+  uint64_t remaining = transfer_len;
+  bool first = true;
+  for (size_t i = 0; i < data_segments.size() && remaining > 0; ++i) {
+    if (skip >= data_segments[i].len) {
+      skip -= data_segments[i].len;
+      continue;
+    }
+    uint64_t addr = data_segments[i].addr + skip;
+    uint64_t len = data_segments[i].len - skip;
+    if (len > remaining) len = remaining;
+    skip = 0;
+    remaining -= len;
+
+    // PRP entries after the first have no page offset, and the first one
+    // must be dword aligned
+    if ((first && addr % 4 != 0) || (!first && addr % page_size != 0) ||
+        (remaining > 0 && (addr + len) % page_size != 0)) {
+      TRANSLATOR_LOG(kWarning, "Data segment %u cannot be described by PRPs",
+                     i);
+      return StatusCode::kFailure;
+    }
+    first = false;
+
+    uint64_t end = addr + len;
+    while (addr < end) {
+      on_entry(addr);
+      addr = (addr / page_size + 1) * page_size;
+    }
+  }
+
+  if (remaining > 0) {
+    TRANSLATOR_LOG(kWarning,
+                   "Data segments are shorter than the transfer length %u",
+                   transfer_len);
+    return StatusCode::kFailure;
+  }
+  return StatusCode::kSuccess;
+}
+
+// Number of list pages needed for list_entries entries when the last entry of
+// every page but the last one points to the next list page
+uint32_t PrpListPageCount(uint32_t list_entries, uint32_t page_size) {
+  uint32_t entries_per_page = page_size / sizeof(uint64_t);
+  if (list_entries <= entries_per_page) return 1;
+  uint32_t overflow = list_entries - entries_per_page;
+  return 1 + (overflow + entries_per_page - 2) / (entries_per_page - 1);
+}
+
+}  // namespace
+
+StatusCode BuildPrps(Span<const DataSegment> data_segments, uint32_t offset,
+                     uint32_t transfer_len, uint32_t page_size,
+                     Allocation& allocation, nvme::GenericQueueEntryCmd& cmd) {
+  cmd.psdt = 0;  // PRPs are used for data transfer
+  cmd.dptr.prp.prp1 = 0;
+  cmd.dptr.prp.prp2 = 0;
+
+  uint32_t entry_count = 0;
+  StatusCode status =
+      ForEachPrpEntry(data_segments, offset, transfer_len, page_size,
+                      [&entry_count](uint64_t addr) { ++entry_count; });
+  if (status != StatusCode::kSuccess || entry_count == 0) return status;
+
+  uint32_t entries_per_page = page_size / sizeof(uint64_t);
+  uint64_t* list = nullptr;
+  if (entry_count > 2) {
+    uint32_t page_count = PrpListPageCount(entry_count - 1, page_size);
+    if (page_count > UINT16_MAX) {
+      TRANSLATOR_LOG(kWarning, "Transfer needs too many PRP list pages");
+      return StatusCode::kFailure;
+    }
+    status = allocation.SetPages(page_size, page_count, 0);
+    if (status != StatusCode::kSuccess) return status;
+    list = reinterpret_cast<uint64_t*>(allocation.data_addr);
+    cmd.dptr.prp.prp2 = htolll(allocation.data_addr);
+  }
+
+  uint32_t index = 0;
+  uint32_t slot = 0;
+  ForEachPrpEntry(
+      data_segments, offset, transfer_len, page_size, [&](uint64_t addr) {
+        if (index == 0) {
+          cmd.dptr.prp.prp1 = htolll(addr);
+        } else if (list == nullptr) {
+          cmd.dptr.prp.prp2 = htolll(addr);
+        } else {
+          // Chain to the next list page if this one is full and more than
+          // one entry is left
+          if (slot == entries_per_page - 1 && entry_count - index > 1) {
+            uint64_t next_page = reinterpret_cast<uint64_t>(list) + page_size;
+            list[slot] = htolll(next_page);
+            list = reinterpret_cast<uint64_t*>(next_page);
+            slot = 0;
+          }
+          list[slot++] = htolll(addr);
+        }
+        ++index;
+      });
+
+  return StatusCode::kSuccess;
+}
+
+}  // namespace translator
@@ -0,0 +1,38 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef LIB_TRANSLATOR_PRP_H
+#define LIB_TRANSLATOR_PRP_H
+
+#include "common.h"
+
+namespace translator {
+
+// Points cmd at the transfer_len bytes of data_segments that start offset
+// bytes in, using Physical Region Page entries.
+// NVMe Base Specification Section 4.3
+// Transfers touching one or two memory pages only use PRP1 and PRP2. Larger
+// transfers get PRP list pages from allocation, chained through the last
+// entry of each full list page, and PRP2 points to the first list page.
+// Returns kFailure if the segments are too short or cannot be described by
+// PRPs, i.e. a segment other than the first does not start on a page
+// boundary or a segment other than the last does not end on one
+StatusCode BuildPrps(Span<const DataSegment> data_segments, uint32_t offset,
+                     uint32_t transfer_len, uint32_t page_size,
+                     Allocation& allocation, nvme::GenericQueueEntryCmd& cmd);
+
+}  // namespace translator
+
+#endif
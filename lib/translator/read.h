@@ -16,43 +16,39 @@
 #define LIB_TRANSLATOR_READ_H
 
 #include "common.h"
+#include "controller.h"
 
 namespace translator {
 
 // SCSI has 4 Read commands: Read(6), Read(10), Read(12), Read(16)
-// Each translation function takes in a raw SCSI command in bytes,
-// casts it to scsi::Read[6,10,12,16]Command,
-// ensures SCSI command is layed out in Big Endian using hton[sl](),
-// and builds an NVMe Read command
-// It also sets the NVMe prp pointer to the SCSI data in buffer so the
-// NVMe driver can write directly to the data in buffer
+// Each translation function decodes the raw SCSI command in bytes with the
+// IoCdb layout of its size and builds NVMe Read commands into chain
+// Reads longer than the controller's maximum data transfer size are split
+// into several NVMe commands, each pointed at its part of the SCSI data in
+// segments so the NVMe driver can write directly to the SCSI data in buffer
 
 // Read(6) is obsolete, but may still be implemented on some devices.
-// As such, it will call the LegacyRead() translation function
-
-// Read(10), Read(12), and Read(16) have essentially the same fields but with
-// different memory layouts. They all call the Read() translation function,
-// which calls LegacyRead() and handles some additional fields
-
-StatusCode Read6ToNvme(Span<const uint8_t> scsi_cmd,
-                       NvmeCmdWrapper& nvme_wrapper, Allocation& allocation,
-                       uint32_t nsid, uint32_t lba_size,
-                       Span<const uint8_t> buffer_in, uint32_t& alloc_len);
-
-StatusCode Read10ToNvme(Span<const uint8_t> scsi_cmd,
-                        NvmeCmdWrapper& nvme_wrapper, Allocation& allocation,
-                        uint32_t nsid, uint32_t lba_size,
-                        Span<const uint8_t> buffer_in, uint32_t& alloc_len);
-
-StatusCode Read12ToNvme(Span<const uint8_t> scsi_cmd,
-                        NvmeCmdWrapper& nvme_wrapper, Allocation& allocation,
-                        uint32_t nsid, uint32_t lba_size,
-                        Span<const uint8_t> buffer_in, uint32_t& alloc_len);
-
-StatusCode Read16ToNvme(Span<const uint8_t> scsi_cmd,
-                        NvmeCmdWrapper& nvme_wrapper, Allocation& allocation,
-                        uint32_t nsid, uint32_t lba_size,
-                        Span<const uint8_t> buffer_in, uint32_t& alloc_len);
+// It has no protection information or FUA fields
+
+StatusCode Read6ToNvme(Span<const uint8_t> scsi_cmd, NvmeCmdChain& chain,
+                       uint32_t nsid, uint8_t lba_shift,
+                       const Controller& controller,
+                       Span<const DataSegment> data_in, uint32_t& alloc_len);
+
+StatusCode Read10ToNvme(Span<const uint8_t> scsi_cmd, NvmeCmdChain& chain,
+                        uint32_t nsid, uint8_t lba_shift,
+                        const Controller& controller,
+                        Span<const DataSegment> data_in, uint32_t& alloc_len);
+
+StatusCode Read12ToNvme(Span<const uint8_t> scsi_cmd, NvmeCmdChain& chain,
+                        uint32_t nsid, uint8_t lba_shift,
+                        const Controller& controller,
+                        Span<const DataSegment> data_in, uint32_t& alloc_len);
+
+StatusCode Read16ToNvme(Span<const uint8_t> scsi_cmd, NvmeCmdChain& chain,
+                        uint32_t nsid, uint8_t lba_shift,
+                        const Controller& controller,
+                        Span<const DataSegment> data_in, uint32_t& alloc_len);
 
 }  // namespace translator
 
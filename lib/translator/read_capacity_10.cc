@@ -22,18 +22,19 @@
 
 namespace translator {
 
-StatusCode ReadCapacity10ToNvme(Span<const uint8_t> raw_scsi,
-                                NvmeCmdWrapper& wrapper, uint32_t page_size,
-                                uint32_t nsid, Allocation& allocation,
-                                uint32_t& alloc_len) {
+StatusCode ValidateReadCapacity10(Span<const uint8_t> raw_scsi,
+                                  uint32_t& alloc_len) {
   scsi::ReadCapacity10Command cmd = {};
   if (!ReadValue(raw_scsi, cmd)) {
-    DebugLog("Malformed ReadCapacity10 Command - Error in reading to buffer");
+    TRANSLATOR_LOG(
+        kError,
+        "Malformed ReadCapacity10 Command - Error in reading to buffer");
     return StatusCode::kInvalidInput;
   };
 
   if (cmd.control_byte.naca == 1) {
-    DebugLog("Malformed ReadCapacity10 Command - Invalid NACA bit");
+    TRANSLATOR_LOG(kWarning,
+                   "Malformed ReadCapacity10 Command - Invalid NACA bit");
     return StatusCode::kInvalidInput;
   }
 
@@ -41,6 +42,17 @@ StatusCode ReadCapacity10ToNvme(Span<const uint8_t> raw_scsi,
   // server transfer 8 bytes of parameter data describing the capacity
   // and medium format of the direct-access block device to the data-in buffer.
   alloc_len = 8;
+  return StatusCode::kSuccess;
+}
+
+StatusCode ReadCapacity10ToNvme(Span<const uint8_t> raw_scsi,
+                                NvmeCmdWrapper& wrapper, uint32_t page_size,
+                                uint32_t nsid, Allocation& allocation,
+                                uint32_t& alloc_len) {
+  StatusCode status = ValidateReadCapacity10(raw_scsi, alloc_len);
+  if (status != StatusCode::kSuccess) {
+    return status;
+  }
 
   uint16_t num_pages = 1;
   // Allocate prp & assign to command
@@ -69,31 +81,32 @@ StatusCode ReadCapacity10ToScsi(
   const nvme::IdentifyNamespace* identify_ns =
       SafePointerCastRead<nvme::IdentifyNamespace>(ns_span);
   if (identify_ns == nullptr) {
-    DebugLog("Identify namespace structure failed to cast");
+    TRANSLATOR_LOG(kError, "Identify namespace structure failed to cast");
     return StatusCode::kFailure;
   }
 
+  NamespaceGeometry geometry;
+  StatusCode status = ReadNamespaceGeometry(*identify_ns, geometry);
+  if (status != StatusCode::kSuccess) {
+    return status;
+  }
+  return ReadCapacity10ToScsi(buffer, geometry);
+}
+
+StatusCode ReadCapacity10ToScsi(Span<uint8_t> buffer,
+                                const NamespaceGeometry& geometry) {
+  // The last LBA, or 0xffffffff to direct hosts to READ CAPACITY (16) if
+  // it does not fit
+  uint64_t last_lba = geometry.block_count == 0 ? 0 : geometry.block_count - 1;
   scsi::ReadCapacity10Data result = {
       .returned_logical_block_address =
-          htonl(ltohll(identify_ns->nsze) > 0xffffffff
-                    ? 0xffffffff
-                    : static_cast<uint32_t>(ltohll(identify_ns->nsze))),
+          last_lba > 0xffffffff ? 0xffffffff
+                                : static_cast<uint32_t>(last_lba),
+      .block_length = uint32_t{1} << geometry.lba_shift,
   };
 
-  uint8_t lbads = identify_ns->lbaf[identify_ns->flbas.format].lbads;
-  if (lbads < 9) {
-    DebugLog("lbads value smaller than 9 is not supported");
-    return StatusCode::kFailure;
-  } else if (lbads > 31) {
-    DebugLog(
-        "lbads exceeds type limit of "
-        "scsi::ReadCapacity10Data.block_length");
-    return StatusCode::kFailure;
-  }
-  result.block_length = htonl(static_cast<uint32_t>(1 << lbads));
-
   if (!WriteValue(result, buffer)) {
-    DebugLog("Error writing Read Capacity 10 Data to buffer");
+    TRANSLATOR_LOG(kError, "Error writing Read Capacity 10 Data to buffer");
     return StatusCode::kFailure;
   }
   return StatusCode::kSuccess;
@@ -16,9 +16,15 @@
 #define LIB_TRANSLATOR_READ_CAPACITY_10_H
 
 #include "common.h"
+#include "controller.h"
 
 namespace translator {
 
+// Checks the command and sets alloc_len, for when the namespace geometry is
+// already known and no Identify Namespace needs to be sent
+StatusCode ValidateReadCapacity10(Span<const uint8_t> raw_scsi,
+                                  uint32_t& alloc_len);
+
 StatusCode ReadCapacity10ToNvme(Span<const uint8_t> raw_scsi,
                                 NvmeCmdWrapper& wrapper, uint32_t page_size,
                                 uint32_t nsid, Allocation& allocation,
@@ -27,5 +33,9 @@ StatusCode ReadCapacity10ToNvme(Span<const uint8_t> raw_scsi,
 StatusCode ReadCapacity10ToScsi(
     Span<uint8_t> buffer, const nvme::GenericQueueEntryCmd& gen_identify_ns);
 
+// Same as above from a cached namespace geometry
+StatusCode ReadCapacity10ToScsi(Span<uint8_t> buffer,
+                                const NamespaceGeometry& geometry);
+
 };  // namespace translator
 #endif
@@ -0,0 +1,131 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "read_capacity_16.h"
+
+namespace translator {
+
+namespace {
+
+// RC BASIS: the returned LBA is that of the last logical block
+constexpr uint8_t kRcBasisLastLogicalBlock = 0b01;
+
+}  // namespace
+
+StatusCode ValidateReadCapacity16(Span<const uint8_t> raw_scsi,
+                                  uint32_t& alloc_len) {
+  scsi::ReadCapacity16Command cmd = {};
+  if (!ReadValue(raw_scsi, cmd)) {
+    TRANSLATOR_LOG(
+        kError,
+        "Malformed ReadCapacity16 Command - Error in reading to buffer");
+    return StatusCode::kInvalidInput;
+  }
+
+  // READ CAPACITY (16) is the only supported Service Action In command
+  if (cmd.service_action !=
+      static_cast<uint8_t>(scsi::ServiceActionIn16::kReadCapacity16)) {
+    TRANSLATOR_LOG(kDebug, "Unsupported Service Action In service action %#x",
+                   cmd.service_action);
+    return StatusCode::kInvalidInput;
+  }
+
+  if (cmd.control_byte.naca == 1) {
+    TRANSLATOR_LOG(kWarning,
+                   "Malformed ReadCapacity16 Command - Invalid NACA bit");
+    return StatusCode::kInvalidInput;
+  }
+
+  uint32_t alloc_length = cmd.alloc_length.value();
+  alloc_len = alloc_length < sizeof(scsi::ReadCapacity16Data)
+                  ? alloc_length
+                  : sizeof(scsi::ReadCapacity16Data);
+  return StatusCode::kSuccess;
+}
+
+StatusCode ReadCapacity16ToNvme(Span<const uint8_t> raw_scsi,
+                                NvmeCmdWrapper& wrapper, uint32_t page_size,
+                                uint32_t nsid, Allocation& allocation,
+                                uint32_t& alloc_len) {
+  StatusCode status = ValidateReadCapacity16(raw_scsi, alloc_len);
+  if (status != StatusCode::kSuccess) {
+    return status;
+  }
+
+  // The namespace geometry comes from Identify Namespace
+  auto page_status = allocation.SetPages(page_size, 1, 0);
+  if (page_status != StatusCode::kSuccess) {
+    return page_status;
+  }
+
+  wrapper.cmd = nvme::GenericQueueEntryCmd{
+      .opc = static_cast<uint8_t>(nvme::AdminOpcode::kIdentify), .nsid = nsid};
+  wrapper.cmd.dptr.prp.prp1 = allocation.data_addr;
+  wrapper.cmd.cdw[0] = 0x0;  // CNS 00h: Identify Namespace
+  wrapper.buffer_len = page_size;
+  wrapper.is_admin = true;
+  return StatusCode::kSuccess;
+}
+
+StatusCode ReadCapacity16ToScsi(
+    Span<uint8_t> buffer, const nvme::GenericQueueEntryCmd& gen_identify_ns,
+    const Controller& controller) {
+  uint8_t* ns_dptr = reinterpret_cast<uint8_t*>(gen_identify_ns.dptr.prp.prp1);
+  Span<uint8_t> ns_span(ns_dptr, sizeof(nvme::IdentifyNamespace));
+
+  const nvme::IdentifyNamespace* identify_ns =
+      SafePointerCastRead<nvme::IdentifyNamespace>(ns_span);
+  if (identify_ns == nullptr) {
+    TRANSLATOR_LOG(kError, "Identify namespace structure failed to cast");
+    return StatusCode::kFailure;
+  }
+
+  NamespaceGeometry geometry;
+  StatusCode status = ReadNamespaceGeometry(*identify_ns, geometry);
+  if (status != StatusCode::kSuccess) {
+    return status;
+  }
+  return ReadCapacity16ToScsi(buffer, geometry, controller);
+}
+
+StatusCode ReadCapacity16ToScsi(Span<uint8_t> buffer,
+                                const NamespaceGeometry& geometry,
+                                const Controller& controller) {
+  bool lbpme = controller.DeallocateSupported();
+  scsi::ReadCapacity16Data result = {
+      .returned_logical_block_address =
+          geometry.block_count == 0 ? 0 : geometry.block_count - 1,
+      .block_length = uint32_t{1} << geometry.lba_shift,
+      .prot_en = geometry.pi_type != 0,
+      .p_type = static_cast<uint8_t>(
+          geometry.pi_type == 0 ? 0 : geometry.pi_type - 1),
+      .rc_basis = kRcBasisLastLogicalBlock,
+      .logical_blocks_per_physical_block_exponent =
+          geometry.physical_block_shift,
+      // NVMe namespaces are aligned to their preferred write granularity
+      // from LBA 0
+      .lowest_aligned_logical_block_address_msb = 0,
+      .lbprz = lbpme && geometry.dealloc_reads_zeroes,
+      .lbpme = lbpme,
+      .lowest_aligned_logical_block_address_lsb = 0,
+  };
+
+  // Hosts may ask for fewer bytes than the parameter data holds
+  uint32_t len =
+      buffer.size() < sizeof(result) ? buffer.size() : sizeof(result);
+  if (len != 0) memcpy(buffer.data(), &result, len);
+  return StatusCode::kSuccess;
+}
+
+};  // namespace translator
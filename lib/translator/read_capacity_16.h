@@ -0,0 +1,46 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef LIB_TRANSLATOR_READ_CAPACITY_16_H
+#define LIB_TRANSLATOR_READ_CAPACITY_16_H
+
+#include "common.h"
+#include "controller.h"
+
+namespace translator {
+
+// Checks that raw_scsi is a READ CAPACITY (16) Service Action In command and
+// sets alloc_len, for when the namespace geometry is already known and no
+// Identify Namespace needs to be sent
+StatusCode ValidateReadCapacity16(Span<const uint8_t> raw_scsi,
+                                  uint32_t& alloc_len);
+
+StatusCode ReadCapacity16ToNvme(Span<const uint8_t> raw_scsi,
+                                NvmeCmdWrapper& wrapper, uint32_t page_size,
+                                uint32_t nsid, Allocation& allocation,
+                                uint32_t& alloc_len);
+
+// Writes the parameter data, truncated to buffer. Logical block
+// provisioning is reported enabled if controller supports deallocation
+StatusCode ReadCapacity16ToScsi(
+    Span<uint8_t> buffer, const nvme::GenericQueueEntryCmd& gen_identify_ns,
+    const Controller& controller);
+
+// Same as above from a cached namespace geometry
+StatusCode ReadCapacity16ToScsi(Span<uint8_t> buffer,
+                                const NamespaceGeometry& geometry,
+                                const Controller& controller);
+
+};  // namespace translator
+#endif
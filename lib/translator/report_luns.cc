@@ -46,13 +46,14 @@ StatusCode ReportLunsToNvme(Span<const uint8_t> scsi_cmd,
   // Cast scsi_cmd to ReportLunsCommand
   scsi::ReportLunsCommand rl_cmd;
   if (!ReadValue(scsi_cmd, rl_cmd)) {
-    DebugLog("Malformed ReportLuns command");
+    TRANSLATOR_LOG(kWarning, "Malformed ReportLuns command");
     return StatusCode::kInvalidInput;
   }
   if (rl_cmd.select_report != scsi::SelectReport::kRestrictedMethods &&
       rl_cmd.select_report != scsi::SelectReport::kWellKnown &&
       rl_cmd.select_report != scsi::SelectReport::kAllLogical) {
-    DebugLog("Invalid report luns select report %u", rl_cmd.select_report);
+    TRANSLATOR_LOG(kWarning, "Invalid report luns select report %u",
+                   rl_cmd.select_report);
     return StatusCode::kInvalidInput;
   }
 
@@ -80,7 +81,7 @@ StatusCode ReportLunsToNvme(Span<const uint8_t> scsi_cmd,
 StatusCode ReportLunsToScsi(const nvme::GenericQueueEntryCmd& identify_cmd,
                             Span<uint8_t> buffer) {
   if (buffer.size() < sizeof(scsi::ReportLunsParamData)) {
-    DebugLog("Insufficient buffer size");
+    TRANSLATOR_LOG(kWarning, "Insufficient buffer size");
     return StatusCode::kFailure;
   }
 
@@ -90,7 +91,7 @@ StatusCode ReportLunsToScsi(const nvme::GenericQueueEntryCmd& identify_cmd,
   const nvme::IdentifyNamespaceList* ns_list;
   ns_list = SafePointerCastRead<nvme::IdentifyNamespaceList>(ns_span);
   if (ns_list == nullptr) {
-    DebugLog("Namespace pointer was null");
+    TRANSLATOR_LOG(kError, "Namespace pointer was null");
     return StatusCode::kFailure;
   }
   uint32_t lun_count = GetNsListLength(*ns_list);
@@ -109,7 +110,8 @@ StatusCode ReportLunsToScsi(const nvme::GenericQueueEntryCmd& identify_cmd,
 
   // Write response to buffer
   if (!WriteValue(rlpd, buffer)) {
-    DebugLog("Buffer not large enough for report luns response header");
+    TRANSLATOR_LOG(kInfo,
+                   "Buffer not large enough for report luns response header");
     return StatusCode::kSuccess;
   }
   uint32_t lun_offset = sizeof(scsi::ReportLunsParamData);
@@ -118,7 +120,8 @@ StatusCode ReportLunsToScsi(const nvme::GenericQueueEntryCmd& identify_cmd,
         ltohl(ns_list->ids[i]) - 1));  // LUN must start @ 0 via SAM spec
     if (!WriteValue(
             lun, buffer.subspan(lun_offset + i * sizeof(scsi::LunAddress)))) {
-      DebugLog("Truncating report luns response at position %u", i);
+      TRANSLATOR_LOG(kInfo, "Truncating report luns response at position %u",
+                     i);
       return StatusCode::kSuccess;
     }
   }
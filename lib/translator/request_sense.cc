@@ -29,7 +29,8 @@ StatusCode TranslateDescriptorSenseData(Span<uint8_t> buffer) {
           scsi::AdditionalSenseCode::kNoAdditionalSenseInfo,
   };
   if (!WriteValue(result, buffer)) {
-    DebugLog("Error writing Descriptor Format Sense Data to buffer");
+    TRANSLATOR_LOG(kError,
+                   "Error writing Descriptor Format Sense Data to buffer");
     return StatusCode::kFailure;
   }
   return StatusCode::kSuccess;
@@ -58,7 +59,7 @@ StatusCode TranslateFixedSenseData(Span<uint8_t> buffer) {
           scsi::AdditionalSenseCode::kNoAdditionalSenseInfo,
   };
   if (!WriteValue(result, buffer)) {
-    DebugLog("Error writing Fixed Format Sense Data to buffer");
+    TRANSLATOR_LOG(kError, "Error writing Fixed Format Sense Data to buffer");
     return StatusCode::kFailure;
   }
   return StatusCode::kSuccess;
@@ -70,12 +71,12 @@ StatusCode RequestSenseToNvme(Span<const uint8_t> scsi_cmd,
                               uint32_t& allocation_length) {
   scsi::RequestSenseCommand request_sense_cmd{};
   if (!ReadValue(scsi_cmd, request_sense_cmd)) {
-    DebugLog("Malformed RequestSense Command");
+    TRANSLATOR_LOG(kWarning, "Malformed RequestSense Command");
     return StatusCode::kInvalidInput;
   }
 
   if (request_sense_cmd.control_byte.naca == 1) {
-    DebugLog("Malformed RequestSense Command");
+    TRANSLATOR_LOG(kWarning, "Malformed RequestSense Command");
     return StatusCode::kInvalidInput;
   }
   allocation_length = request_sense_cmd.allocation_length;
@@ -86,7 +87,7 @@ StatusCode RequestSenseToScsi(Span<const uint8_t> scsi_cmd,
                               Span<uint8_t> buffer) {
   scsi::RequestSenseCommand request_sense_cmd{};
   if (!ReadValue(scsi_cmd, request_sense_cmd)) {
-    DebugLog("Malformed RequestSense Command");
+    TRANSLATOR_LOG(kWarning, "Malformed RequestSense Command");
     return StatusCode::kInvalidInput;
   }
 
@@ -102,8 +102,9 @@ ScsiStatus StatusToScsi(nvme::GenericCommandStatusCode status_code) {
           kLogicalUnitNotReadyCauseNotReportable;
       break;
     default:
-      DebugLog("No SCSI translation for NVMe status with code %#x",
-               static_cast<uint8_t>(status_code));
+      TRANSLATOR_LOG(kWarning,
+                     "No SCSI translation for NVMe status with code %#x",
+                     static_cast<uint8_t>(status_code));
   }
   return result;
 }
@@ -131,8 +132,9 @@ ScsiStatus StatusToScsi(nvme::CommandSpecificStatusCode status_code) {
       result.ascq = scsi::AdditionalSenseCodeQualifier::kInvalidFieldInCdb;
       break;
     default:
-      DebugLog("No SCSI translation for NVMe status with code %#x",
-               static_cast<uint8_t>(status_code));
+      TRANSLATOR_LOG(kWarning,
+                     "No SCSI translation for NVMe status with code %#x",
+                     static_cast<uint8_t>(status_code));
   }
   return result;
 }
@@ -194,8 +196,9 @@ ScsiStatus StatusToScsi(nvme::MediaErrorStatusCode status_code) {
           scsi::AdditionalSenseCodeQualifier::kAccessDeniedInvalidLuIdentifier;
       break;
     default:
-      DebugLog("No SCSI translation for NVMe status with code %#x",
-               static_cast<uint8_t>(status_code));
+      TRANSLATOR_LOG(kWarning,
+                     "No SCSI translation for NVMe status with code %#x",
+                     static_cast<uint8_t>(status_code));
   }
   return result;
 }
@@ -215,10 +218,10 @@ ScsiStatus StatusToScsi(nvme::StatusCodeType type, uint8_t status_code) {
     case nvme::StatusCodeType::kPath:
     case nvme::StatusCodeType::kVendorSpecific:
     default:
-      DebugLog(
-          "No SCSI translation for nvme status code type %#x"
-          "and status code %#x",
-          static_cast<uint8_t>(type), status_code);
+      TRANSLATOR_LOG(kWarning,
+                     "No SCSI translation for nvme status code type %#x"
+                     "and status code %#x",
+                     static_cast<uint8_t>(type), status_code);
       return kDefaultScsiStatus;
   }
 }
@@ -26,4 +26,8 @@ void SynchronizeCache10ToNvme(NvmeCmdWrapper& nvme_wrapper, uint32_t nsid) {
   nvme_wrapper.is_admin = false;
 }
 
+void SynchronizeCache16ToNvme(NvmeCmdWrapper& nvme_wrapper, uint32_t nsid) {
+  SynchronizeCache10ToNvme(nvme_wrapper, nsid);
+}
+
 };  // namespace translator
@@ -13,7 +13,7 @@
 // limitations under the License.
 
 #ifndef LIB_TRANSLATOR_SYNCHRONIZE_CACHE_H
-#define LIB_TRANSLATOR_SYNCRHONIZE_CACHE_H
+#define LIB_TRANSLATOR_SYNCHRONIZE_CACHE_H
 
 #include "common.h"
 
@@ -23,5 +23,9 @@ namespace translator {
 // NVMe Flush does not have command specific response data to translate
 void SynchronizeCache10ToNvme(NvmeCmdWrapper& nvme_wrapper, uint32_t nsid);
 
+// Flush writes back the whole namespace, so the range of SYNCHRONIZE
+// CACHE (16) is ignored just as that of SYNCHRONIZE CACHE (10)
+void SynchronizeCache16ToNvme(NvmeCmdWrapper& nvme_wrapper, uint32_t nsid);
+
 };  // namespace translator
 #endif
@@ -0,0 +1,221 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "trace.h"
+
+#include <stdio.h>
+
+namespace translator {
+
+namespace {
+
+TraceBuffer* trace_buffer;
+
+bool IsFormatFlag(char c) {
+  return c == '-' || c == '+' || c == ' ' || c == '#' || c == '.' ||
+         (c >= '0' && c <= '9');
+}
+
+bool IsLengthModifier(char c) {
+  return c == 'h' || c == 'l' || c == 'L' || c == 'q' || c == 'j' ||
+         c == 'z' || c == 't';
+}
+
+}  // namespace
+
+StatusCode TraceBuffer::Init(uint32_t page_size, uint32_t cpu_count,
+                             uint32_t ring_size, uint32_t (*current_cpu)(),
+                             uint64_t (*backing_alloc)(uint32_t, uint16_t),
+                             void (*backing_dealloc)(uint64_t, uint16_t)) {
+  if (page_size == 0 || cpu_count == 0 || current_cpu == nullptr ||
+      backing_alloc == nullptr || backing_dealloc == nullptr) {
+    TRANSLATOR_LOG(kError,
+                   "Trace buffer needs a page size, CPUs and callbacks");
+    return StatusCode::kFailure;
+  }
+  if (ring_size == 0 || (ring_size & (ring_size - 1)) != 0) {
+    TRANSLATOR_LOG(kError, "Trace ring size %u is not a power of two",
+                   ring_size);
+    return StatusCode::kFailure;
+  }
+
+  uint64_t ring_bytes = static_cast<uint64_t>(cpu_count) * sizeof(Ring);
+  uint64_t bytes = ring_bytes + static_cast<uint64_t>(cpu_count) * ring_size *
+                                    sizeof(TraceRecord);
+  uint64_t page_count = (bytes + page_size - 1) / page_size;
+  if (page_count > UINT16_MAX) {
+    TRANSLATOR_LOG(kError, "Trace buffer of %u records per CPU is too large",
+                   ring_size);
+    return StatusCode::kFailure;
+  }
+  uint64_t addr = backing_alloc(page_size, page_count);
+  if (addr == 0) {
+    TRANSLATOR_LOG(kError, "Error when requesting memory for the trace buffer");
+    return StatusCode::kFailure;
+  }
+  memset(reinterpret_cast<void*>(addr), 0, page_count * page_size);
+
+  rings_ = reinterpret_cast<Ring*>(addr);
+  TraceRecord* records = reinterpret_cast<TraceRecord*>(addr + ring_bytes);
+  for (uint32_t cpu = 0; cpu < cpu_count; ++cpu)
+    rings_[cpu].records = records + static_cast<uint64_t>(cpu) * ring_size;
+  cpu_count_ = cpu_count;
+  ring_size_ = ring_size;
+  current_cpu_ = current_cpu;
+  backing_dealloc_ = backing_dealloc;
+  page_count_ = page_count;
+  return StatusCode::kSuccess;
+}
+
+void TraceBuffer::Destroy() {
+  if (rings_ == nullptr) return;
+  backing_dealloc_(reinterpret_cast<uint64_t>(rings_), page_count_);
+  rings_ = nullptr;
+  page_count_ = 0;
+  cpu_count_ = 0;
+}
+
+void TraceBuffer::Write(const TraceSite& site, const uint64_t* args,
+                        uint32_t arg_count) {
+  if (rings_ == nullptr) return;
+  uint32_t cpu = current_cpu_();
+  if (cpu >= cpu_count_) return;
+
+  // Claiming a position makes the ring safe for writers that interrupt each
+  // other on a CPU
+  Ring& ring = rings_[cpu];
+  uint64_t position = __atomic_fetch_add(&ring.head, 1, __ATOMIC_RELAXED);
+  TraceRecord& record = ring.records[position & (ring_size_ - 1)];
+  // Readers drop records whose sequence is 0 or changes while they copy
+  __atomic_store_n(&record.sequence, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&record.site, &site, __ATOMIC_RELAXED);
+  for (uint32_t i = 0; i < kTraceMaxArgs; ++i)
+    __atomic_store_n(&record.args[i], i < arg_count ? args[i] : 0,
+                     __ATOMIC_RELAXED);
+  __atomic_store_n(&record.sequence, position + 1, __ATOMIC_RELEASE);
+}
+
+uint32_t TraceBuffer::Read(uint32_t cpu, uint64_t& cursor,
+                           Span<TraceRecord> records, uint64_t& lost) const {
+  if (rings_ == nullptr || cpu >= cpu_count_) return 0;
+  const Ring& ring = rings_[cpu];
+  uint64_t head = __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE);
+  if (cursor > head) cursor = head;
+  if (head - cursor > ring_size_) {
+    lost += head - ring_size_ - cursor;
+    cursor = head - ring_size_;
+  }
+
+  uint32_t count = 0;
+  while (cursor < head && count < records.size()) {
+    const TraceRecord& slot = ring.records[cursor & (ring_size_ - 1)];
+    uint64_t sequence = __atomic_load_n(&slot.sequence, __ATOMIC_ACQUIRE);
+    if (sequence != cursor + 1) {
+      // Either a later lap overwrote the record or its writer has not
+      // finished yet, in which case the rest of the ring is left for the
+      // next Read()
+      uint64_t now = __atomic_load_n(&ring.head, __ATOMIC_RELAXED);
+      if (sequence <= cursor && now - cursor <= ring_size_) break;
+      ++lost;
+      ++cursor;
+      continue;
+    }
+
+    TraceRecord& copy = records[count];
+    copy.sequence = sequence;
+    copy.site = __atomic_load_n(&slot.site, __ATOMIC_RELAXED);
+    for (uint32_t i = 0; i < kTraceMaxArgs; ++i)
+      copy.args[i] = __atomic_load_n(&slot.args[i], __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&slot.sequence, __ATOMIC_RELAXED) == sequence)
+      ++count;
+    else
+      ++lost;
+    ++cursor;
+  }
+  return count;
+}
+
+void SetTraceBuffer(TraceBuffer* buffer) {
+  __atomic_store_n(&trace_buffer, buffer, __ATOMIC_RELEASE);
+}
+
+void WriteTrace(const TraceSite& site, const uint64_t* args,
+                uint32_t arg_count) {
+  TraceBuffer* buffer = __atomic_load_n(&trace_buffer, __ATOMIC_ACQUIRE);
+  if (buffer != nullptr) buffer->Write(site, args, arg_count);
+}
+
+uint32_t DecodeTraceRecord(const TraceRecord& record, Span<char> out) {
+  if (out.empty()) return 0;
+  uint32_t len = 0;
+  uint32_t limit = out.size() - 1;
+  if (record.site == nullptr) {
+    out[0] = '\0';
+    return 0;
+  }
+
+  const char* format = record.site->format;
+  uint32_t arg = 0;
+  while (*format != '\0' && len < limit) {
+    if (*format != '%' || format[1] == '%') {
+      out[len++] = *format;
+      format += *format == '%' ? 2 : 1;
+      continue;
+    }
+
+    // Rebuild the conversion with a long long argument
+    char spec[16] = "%";
+    uint32_t spec_len = 1;
+    ++format;
+    while (IsFormatFlag(*format) && spec_len < sizeof(spec) - 4)
+      spec[spec_len++] = *format++;
+    while (IsLengthModifier(*format)) ++format;
+    char conversion = *format;
+    if (conversion == '\0') break;
+    ++format;
+    spec[spec_len++] = 'l';
+    spec[spec_len++] = 'l';
+    spec[spec_len++] = conversion;
+    spec[spec_len] = '\0';
+
+    uint64_t value = arg < kTraceMaxArgs ? record.args[arg++] : 0;
+    int written;
+    switch (conversion) {
+      case 'd':
+      case 'i':
+        written = snprintf(out.data() + len, limit - len + 1, spec,
+                           static_cast<long long>(value));
+        break;
+      case 'u':
+      case 'x':
+      case 'X':
+      case 'o':
+        written = snprintf(out.data() + len, limit - len + 1, spec,
+                           static_cast<unsigned long long>(value));
+        break;
+      default:
+        // Strings, pointers and floating point values are not traced
+        written = snprintf(out.data() + len, limit - len + 1, "?");
+        break;
+    }
+    if (written < 0) break;
+    len += static_cast<uint32_t>(written) < limit - len ? written : limit - len;
+  }
+  out[len] = '\0';
+  return len;
+}
+
+}  // namespace translator
@@ -0,0 +1,127 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef LIB_TRANSLATOR_TRACE_H
+#define LIB_TRANSLATOR_TRACE_H
+
+#include "common.h"
+
+namespace translator {
+
+constexpr uint32_t kTraceMaxArgs = 4;
+
+// A place in the code that records traces. Sites are constants, so a record
+// refers to its site by address and the format string is only read when the
+// record is decoded
+struct TraceSite {
+  const char* format;  // printf format of the integer arguments
+  const char* file;
+  uint32_t line;
+};
+
+// A trace as stored in the ring buffer
+struct TraceRecord {
+  // One more than the record's position in its ring, or 0 while the record is
+  // being written
+  uint64_t sequence;
+  const TraceSite* site;
+  uint64_t args[kTraceMaxArgs];
+};
+
+// Per-CPU ring buffers of binary trace records. Writers never wait and never
+// format: a record is the site and its raw integer arguments, and the oldest
+// records are overwritten once a ring is full. Read() copies records out
+// while writers keep running, and DecodeTraceRecord() formats them afterwards.
+class TraceBuffer {
+ public:
+  TraceBuffer()
+      : cpu_count_(0),
+        ring_size_(0),
+        current_cpu_(nullptr),
+        backing_dealloc_(nullptr),
+        rings_(nullptr),
+        page_count_(0) {}
+
+  // Keeps ring_size records for each of cpu_count CPUs. ring_size must be a
+  // power of two. current_cpu returns the calling CPU, in [0, cpu_count). The
+  // rings are allocated with backing_alloc in pages of page_size. Returns
+  // kFailure if that fails
+  StatusCode Init(uint32_t page_size, uint32_t cpu_count, uint32_t ring_size,
+                  uint32_t (*current_cpu)(),
+                  uint64_t (*backing_alloc)(uint32_t, uint16_t),
+                  void (*backing_dealloc)(uint64_t, uint16_t));
+
+  // Frees the rings. The buffer must not be installed with SetTraceBuffer()
+  void Destroy();
+
+  // Appends a record to the calling CPU's ring
+  void Write(const TraceSite& site, const uint64_t* args, uint32_t arg_count);
+
+  // Copies the records of cpu's ring from position cursor on into records,
+  // oldest first, and advances cursor past them. Records overwritten before
+  // they were copied are skipped and counted in lost. Returns the number of
+  // records copied
+  uint32_t Read(uint32_t cpu, uint64_t& cursor, Span<TraceRecord> records,
+                uint64_t& lost) const;
+
+  uint32_t cpu_count() const { return cpu_count_; }
+
+ private:
+  // Rings written by different CPUs do not share cache lines
+  struct alignas(64) Ring {
+    uint64_t head;  // Position of the next record to write
+    TraceRecord* records;
+  };
+
+  uint32_t cpu_count_;
+  uint32_t ring_size_;
+  uint32_t (*current_cpu_)();
+  void (*backing_dealloc_)(uint64_t, uint16_t);
+  Ring* rings_;
+  uint16_t page_count_;
+};
+
+// Installs the buffer TRANSLATOR_TRACE writes to, or nullptr to stop tracing
+void SetTraceBuffer(TraceBuffer* buffer);
+
+// Writes a record to the installed buffer, if any
+void WriteTrace(const TraceSite& site, const uint64_t* args,
+                uint32_t arg_count);
+
+template <typename... Args>
+void Trace(const TraceSite& site, Args... args) {
+  static_assert(sizeof...(Args) <= kTraceMaxArgs, "Too many trace arguments");
+  static_assert(((std::is_integral_v<Args> || std::is_enum_v<Args>)&&...),
+                "Trace arguments must be integers");
+  uint64_t values[kTraceMaxArgs] = {static_cast<uint64_t>(args)...};
+  WriteTrace(site, values, sizeof...(Args));
+}
+
+// Formats record with the format string of its site into out, truncating if
+// out is too short. Every conversion is given a 64 bit argument, so length
+// modifiers in the format are ignored. Returns the length of the text
+uint32_t DecodeTraceRecord(const TraceRecord& record, Span<char> out);
+
+// Records a trace of up to kTraceMaxArgs integers, e.g.
+// TRANSLATOR_TRACE("Begin opcode %#x status %u", opc, status);
+#define TRANSLATOR_TRACE(format, ...)                                       \
+  do {                                                                      \
+    static constexpr ::translator::TraceSite kTraceSite = {format, __FILE__, \
+                                                           __LINE__};       \
+    ::translator::Trace(kTraceSite, ##__VA_ARGS__);                         \
+  } while (0)
+
+}  // namespace translator
+
+#endif
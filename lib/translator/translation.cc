@@ -19,153 +19,506 @@
 #include "mode_sense.h"
 #include "read.h"
 #include "read_capacity_10.h"
+#include "read_capacity_16.h"
 #include "report_luns.h"
 #include "request_sense.h"
 #include "status.h"
 #include "synchronize_cache.h"
+#include "trace.h"
 #include "unmap.h"
 #include "verify.h"
 #include "write.h"
 
-constexpr uint32_t kPageSize = 4096;
-constexpr uint32_t kLbaSize = 4096;
-
 namespace translator {
 
+namespace {
+
+// Capabilities assumed for translations created without a controller
+constexpr Controller kDefaultController;
+
+// Learns the controller capabilities from the Identify Controller data
+// fetched for Inquiry
+void UpdateController(Controller* controller,
+                      const nvme::GenericQueueEntryCmd& identify_ctrl) {
+  if (controller == nullptr) return;
+  uint8_t* ctrl_dptr = reinterpret_cast<uint8_t*>(identify_ctrl.dptr.prp.prp1);
+  const nvme::IdentifyControllerData* identify_ctrl_data =
+      SafePointerCastRead<nvme::IdentifyControllerData>(
+          Span<uint8_t>(ctrl_dptr, sizeof(nvme::IdentifyControllerData)));
+  if (identify_ctrl_data != nullptr)
+    controller->SetIdentifyControllerData(*identify_ctrl_data);
+}
+
+// Caches the namespace geometry from the Identify Namespace data fetched for
+// Inquiry or Read Capacity
+void UpdateNamespace(Controller* controller,
+                     const nvme::GenericQueueEntryCmd& identify_ns) {
+  if (controller == nullptr) return;
+  uint8_t* ns_dptr = reinterpret_cast<uint8_t*>(identify_ns.dptr.prp.prp1);
+  const nvme::IdentifyNamespace* identify_ns_data =
+      SafePointerCastRead<nvme::IdentifyNamespace>(
+          Span<uint8_t>(ns_dptr, sizeof(nvme::IdentifyNamespace)));
+  NamespaceGeometry geometry;
+  if (identify_ns_data != nullptr &&
+      ReadNamespaceGeometry(*identify_ns_data, geometry) ==
+          StatusCode::kSuccess)
+    controller->SetNamespaceGeometry(identify_ns.nsid, geometry);
+}
+
+// Learns whether the volatile write cache is enabled from the current value
+// of the Volatile Write Cache feature, fetched for a Mode Sense caching page
+void UpdateVolatileWriteCache(Controller* controller, NvmeCmdChain& chain,
+                              Span<const nvme::GenericQueueEntryCpl> cpl_data) {
+  if (controller == nullptr) return;
+  for (uint32_t i = 0; i < cpl_data.size(); ++i) {
+    nvme::GetFeaturesCmd get_features;
+    static_assert(sizeof(get_features) == sizeof(chain.wrapper(i).cmd));
+    memcpy(&get_features, &chain.wrapper(i).cmd, sizeof(get_features));
+    if (chain.wrapper(i).is_admin &&
+        get_features.opc ==
+            static_cast<uint8_t>(nvme::AdminOpcode::kGetFeatures) &&
+        get_features.fid == nvme::FeatureType::kVolatileWriteCache &&
+        get_features.sel == nvme::FeatureSelect::kCurrent)
+      controller->SetVolatileWriteCacheEnabled(cpl_data[i].cdw0 & 0b1);
+  }
+}
+
+// NVMe command count of opcodes whose begin handler sets the count
+constexpr uint8_t kVariableCmdCount = 0xff;
+
+// Arguments of the begin handler of an opcode. scsi_cmd excludes the opcode
+struct BeginArgs {
+  Span<const uint8_t> scsi_cmd;
+  Span<const uint8_t> buffer;
+  Span<const DataSegment> data_segments;
+  uint32_t nsid;
+  const Controller& controller;
+  bool geometry_cached;
+  uint8_t lba_shift;
+  // Cached geometry of the namespace, or defaults if none is cached
+  const NamespaceGeometry& geometry;
+  NvmeCmdChain& chain;
+  uint32_t& nvme_cmd_count;  // Set only for kVariableCmdCount opcodes
+  uint32_t& alloc_len;
+};
+
+// Arguments of the complete handler of an opcode. scsi_cmd excludes the
+// opcode. Handlers run only after every NVMe command completed successfully
+struct CompleteArgs {
+  Span<const uint8_t> scsi_cmd;
+  Span<const nvme::GenericQueueEntryCpl> cpl_data;
+  Span<uint8_t> buffer_in;
+  NvmeCmdChain& chain;
+  Controller* controller;
+  const NamespaceGeometry& geometry;
+};
+
+using BeginHandler = StatusCode (*)(const BeginArgs& args);
+using CompleteHandler = StatusCode (*)(const CompleteArgs& args);
+
+struct OpcodeHandlers {
+  uint8_t cdb_len;  // Shorter commands are rejected before begin runs
+  // The data buffer may be given as data segments (Read and Write)
+  bool direct;
+  uint8_t nvme_cmd_count;
+  BeginHandler begin;
+  // nullptr for commands without response data to translate
+  CompleteHandler complete;
+};
+
+struct OpcodeRegistration {
+  scsi::OpCode opc;
+  OpcodeHandlers handlers;
+};
+
+StatusCode BeginInquiry(const BeginArgs& args) {
+  Span<NvmeCmdWrapper> wrappers = args.chain.wrappers();
+  return InquiryToNvme(args.scsi_cmd, wrappers[0], wrappers[1],
+                       args.controller.page_size(), args.nsid,
+                       args.chain.allocations(), args.alloc_len);
+}
+
+StatusCode CompleteInquiry(const CompleteArgs& args) {
+  StatusCode status =
+      InquiryToScsi(args.scsi_cmd, args.buffer_in, args.chain.wrapper(0).cmd,
+                    args.chain.wrapper(1).cmd);
+  UpdateController(args.controller, args.chain.wrapper(1).cmd);
+  UpdateNamespace(args.controller, args.chain.wrapper(0).cmd);
+  return status;
+}
+
+StatusCode BeginUnmap(const BeginArgs& args) {
+  DeallocAlignment alignment = {};
+  if (args.controller.AlignUnmapRanges()) {
+    alignment = {.granularity = args.geometry.dealloc_granularity,
+                 .alignment = args.geometry.dealloc_alignment};
+  }
+  return UnmapToNvme(args.scsi_cmd, args.buffer, args.chain,
+                     args.controller.page_size(), args.nsid, alignment,
+                     args.nvme_cmd_count);
+}
+
+StatusCode BeginModeSense6(const BeginArgs& args) {
+  return ModeSense6ToNvme(args.scsi_cmd, args.chain.wrappers(),
+                          args.chain.allocations()[0],
+                          args.controller.page_size(), args.nsid,
+                          args.nvme_cmd_count, args.alloc_len);
+}
+
+StatusCode CompleteModeSense6(const CompleteArgs& args) {
+  // TODO: Update this when the cpl_data interface is finalized
+  UpdateVolatileWriteCache(args.controller, args.chain, args.cpl_data);
+  return ModeSense6ToScsi(args.scsi_cmd, args.chain.wrapper(0).cmd,
+                          args.cpl_data[0].cdw0, args.buffer_in);
+}
+
+StatusCode BeginModeSense10(const BeginArgs& args) {
+  return ModeSense10ToNvme(args.scsi_cmd, args.chain.wrappers(),
+                           args.chain.allocations()[0],
+                           args.controller.page_size(), args.nsid,
+                           args.nvme_cmd_count, args.alloc_len);
+}
+
+StatusCode CompleteModeSense10(const CompleteArgs& args) {
+  // TODO: Update this when the cpl_data interface is finalized
+  UpdateVolatileWriteCache(args.controller, args.chain, args.cpl_data);
+  return ModeSense10ToScsi(args.scsi_cmd, args.chain.wrapper(0).cmd,
+                           args.cpl_data[0].cdw0, args.buffer_in);
+}
+
+// ReportSupportedOpCodes is the only supported MaintenanceIn command
+StatusCode BeginMaintenanceIn(const BeginArgs& args) {
+  return ValidateReportSupportedOpCodes(args.scsi_cmd, args.alloc_len);
+}
+
+StatusCode CompleteMaintenanceIn(const CompleteArgs& args) {
+  WriteReportSupportedOpCodesResult(args.scsi_cmd, args.buffer_in);
+  return StatusCode::kSuccess;
+}
+
+StatusCode BeginReportLuns(const BeginArgs& args) {
+  return ReportLunsToNvme(args.scsi_cmd, args.chain.wrappers()[0],
+                          args.controller.page_size(),
+                          args.chain.allocations()[0], args.alloc_len);
+}
+
+StatusCode CompleteReportLuns(const CompleteArgs& args) {
+  return ReportLunsToScsi(args.chain.wrapper(0).cmd, args.buffer_in);
+}
+
+StatusCode BeginReadCapacity10(const BeginArgs& args) {
+  if (args.geometry_cached) {
+    // Answered from the cached geometry without an Identify Namespace
+    args.nvme_cmd_count = 0;
+    return ValidateReadCapacity10(args.scsi_cmd, args.alloc_len);
+  }
+  args.nvme_cmd_count = 1;
+  return ReadCapacity10ToNvme(args.scsi_cmd, args.chain.wrappers()[0],
+                              args.controller.page_size(), args.nsid,
+                              args.chain.allocations()[0], args.alloc_len);
+}
+
+StatusCode CompleteReadCapacity10(const CompleteArgs& args) {
+  if (args.cpl_data.empty())
+    return ReadCapacity10ToScsi(args.buffer_in, args.geometry);
+  StatusCode status =
+      ReadCapacity10ToScsi(args.buffer_in, args.chain.wrapper(0).cmd);
+  UpdateNamespace(args.controller, args.chain.wrapper(0).cmd);
+  return status;
+}
+
+// READ CAPACITY (16) is the only supported Service Action In command
+StatusCode BeginServiceActionIn(const BeginArgs& args) {
+  if (args.geometry_cached) {
+    args.nvme_cmd_count = 0;
+    return ValidateReadCapacity16(args.scsi_cmd, args.alloc_len);
+  }
+  args.nvme_cmd_count = 1;
+  return ReadCapacity16ToNvme(args.scsi_cmd, args.chain.wrappers()[0],
+                              args.controller.page_size(), args.nsid,
+                              args.chain.allocations()[0], args.alloc_len);
+}
+
+StatusCode CompleteServiceActionIn(const CompleteArgs& args) {
+  const Controller& controller =
+      args.controller != nullptr ? *args.controller : kDefaultController;
+  if (args.cpl_data.empty())
+    return ReadCapacity16ToScsi(args.buffer_in, args.geometry, controller);
+  StatusCode status = ReadCapacity16ToScsi(
+      args.buffer_in, args.chain.wrapper(0).cmd, controller);
+  UpdateNamespace(args.controller, args.chain.wrapper(0).cmd);
+  return status;
+}
+
+StatusCode BeginRequestSense(const BeginArgs& args) {
+  return RequestSenseToNvme(args.scsi_cmd, args.alloc_len);
+}
+
+StatusCode CompleteRequestSense(const CompleteArgs& args) {
+  return RequestSenseToScsi(args.scsi_cmd, args.buffer_in);
+}
+
+// Synchronize Cache completes without a Flush when the controller has no
+// enabled volatile write cache to write back
+template <void (*ToNvme)(NvmeCmdWrapper&, uint32_t)>
+StatusCode BeginSync(const BeginArgs& args) {
+  if (!args.controller.VolatileWriteCacheEnabled()) {
+    args.nvme_cmd_count = 0;
+    return StatusCode::kSuccess;
+  }
+  ToNvme(args.chain.wrappers()[0], args.nsid);
+  args.nvme_cmd_count = 1;
+  return StatusCode::kSuccess;
+}
+
+StatusCode BeginVerify10(const BeginArgs& args) {
+  return VerifyToNvme(args.scsi_cmd, args.chain.wrappers()[0]);
+}
+
+// Always return NVMe device is ready
+// The implementation of actually querying readiness of NVMe device does
+// not fit with our Library and engine design and is of little use
+StatusCode BeginTestUnitReady(const BeginArgs& args) {
+  return StatusCode::kSuccess;
+}
+
+// Read data is transferred directly to the SCSI data in buffer
+template <StatusCode (*ToNvme)(Span<const uint8_t>, NvmeCmdChain&, uint32_t,
+                               uint8_t, const Controller&,
+                               Span<const DataSegment>, uint32_t&)>
+StatusCode BeginRead(const BeginArgs& args) {
+  StatusCode status =
+      ToNvme(args.scsi_cmd, args.chain, args.nsid, args.lba_shift,
+             args.controller, args.data_segments, args.alloc_len);
+  args.nvme_cmd_count = args.chain.size();
+  return status;
+}
+
+template <StatusCode (*ToNvme)(Span<const uint8_t>, NvmeCmdChain&, uint32_t,
+                               uint8_t, const Controller&,
+                               Span<const DataSegment>)>
+StatusCode BeginWrite(const BeginArgs& args) {
+  StatusCode status = ToNvme(args.scsi_cmd, args.chain, args.nsid,
+                             args.lba_shift, args.controller,
+                             args.data_segments);
+  args.nvme_cmd_count = args.chain.size();
+  return status;
+}
+
+// Write Same reads its block from the linear data out buffer
+template <StatusCode (*ToNvme)(Span<const uint8_t>, NvmeCmdChain&, uint32_t,
+                               uint8_t, const Controller&,
+                               Span<const uint8_t>)>
+StatusCode BeginWriteSame(const BeginArgs& args) {
+  StatusCode status = ToNvme(args.scsi_cmd, args.chain, args.nsid,
+                             args.lba_shift, args.controller, args.buffer);
+  args.nvme_cmd_count = args.chain.size();
+  return status;
+}
+
+// Every supported opcode, with the length of its CDB including the opcode.
+// Adding an opcode here is all Begin() and Complete() need to translate it
+constexpr OpcodeRegistration kOpcodeRegistrations[] = {
+    {scsi::OpCode::kTestUnitReady,
+     {sizeof(scsi::TestUnitReadyCommand) + 1, false, 0, BeginTestUnitReady,
+      nullptr}},
+    {scsi::OpCode::kRequestSense,
+     {sizeof(scsi::RequestSenseCommand) + 1, false, 0, BeginRequestSense,
+      CompleteRequestSense}},
+    {scsi::OpCode::kRead6,
+     {sizeof(scsi::Read6Command) + 1, true, kVariableCmdCount,
+      BeginRead<Read6ToNvme>, nullptr}},
+    {scsi::OpCode::kWrite6,
+     {sizeof(scsi::Write6Command) + 1, true, kVariableCmdCount,
+      BeginWrite<Write6ToNvme>, nullptr}},
+    {scsi::OpCode::kInquiry,
+     {sizeof(scsi::InquiryCommand) + 1, false, 2, BeginInquiry,
+      CompleteInquiry}},
+    {scsi::OpCode::kModeSense6,
+     {sizeof(scsi::ModeSense6Command) + 1, false, kVariableCmdCount,
+      BeginModeSense6, CompleteModeSense6}},
+    {scsi::OpCode::kReadCapacity10,
+     {sizeof(scsi::ReadCapacity10Command) + 1, false, kVariableCmdCount,
+      BeginReadCapacity10, CompleteReadCapacity10}},
+    {scsi::OpCode::kRead10,
+     {sizeof(scsi::Read10Command) + 1, true, kVariableCmdCount,
+      BeginRead<Read10ToNvme>, nullptr}},
+    {scsi::OpCode::kWrite10,
+     {sizeof(scsi::Write10Command) + 1, true, kVariableCmdCount,
+      BeginWrite<Write10ToNvme>, nullptr}},
+    {scsi::OpCode::kVerify10,
+     {sizeof(scsi::Verify10Command) + 1, false, 1, BeginVerify10, nullptr}},
+    {scsi::OpCode::kSync10,
+     {sizeof(scsi::SynchronizeCache10Command) + 1, false, kVariableCmdCount,
+      BeginSync<SynchronizeCache10ToNvme>, nullptr}},
+    {scsi::OpCode::kWriteSame10,
+     {sizeof(scsi::WriteSame10Command) + 1, false, kVariableCmdCount,
+      BeginWriteSame<WriteSame10ToNvme>, nullptr}},
+    {scsi::OpCode::kUnmap,
+     {sizeof(scsi::UnmapCommand) + 1, false, kVariableCmdCount, BeginUnmap,
+      nullptr}},
+    {scsi::OpCode::kModeSense10,
+     {sizeof(scsi::ModeSense10Command) + 1, false, kVariableCmdCount,
+      BeginModeSense10, CompleteModeSense10}},
+    {scsi::OpCode::kRead16,
+     {sizeof(scsi::Read16Command) + 1, true, kVariableCmdCount,
+      BeginRead<Read16ToNvme>, nullptr}},
+    {scsi::OpCode::kWrite16,
+     {sizeof(scsi::Write16Command) + 1, true, kVariableCmdCount,
+      BeginWrite<Write16ToNvme>, nullptr}},
+    {scsi::OpCode::kSync16,
+     {sizeof(scsi::SynchronizeCache16Command) + 1, false, kVariableCmdCount,
+      BeginSync<SynchronizeCache16ToNvme>, nullptr}},
+    {scsi::OpCode::kWriteSame16,
+     {sizeof(scsi::WriteSame16Command) + 1, false, kVariableCmdCount,
+      BeginWriteSame<WriteSame16ToNvme>, nullptr}},
+    {scsi::OpCode::kServiceActionIn,
+     {sizeof(scsi::ReadCapacity16Command) + 1, false, kVariableCmdCount,
+      BeginServiceActionIn, CompleteServiceActionIn}},
+    {scsi::OpCode::kReportLuns,
+     {sizeof(scsi::ReportLunsCommand) + 1, false, 1, BeginReportLuns,
+      CompleteReportLuns}},
+    {scsi::OpCode::kMaintenanceIn,
+     {sizeof(scsi::ReportOpCodesCommand) + 1, false, 0, BeginMaintenanceIn,
+      CompleteMaintenanceIn}},
+    {scsi::OpCode::kRead12,
+     {sizeof(scsi::Read12Command) + 1, true, kVariableCmdCount,
+      BeginRead<Read12ToNvme>, nullptr}},
+    {scsi::OpCode::kWrite12,
+     {sizeof(scsi::Write12Command) + 1, true, kVariableCmdCount,
+      BeginWrite<Write12ToNvme>, nullptr}},
+};
+
+// Handlers of every opcode, and a bitmap of the registered ones
+struct OpcodeTable {
+  OpcodeHandlers handlers[256];
+  uint64_t supported[4];
+
+  constexpr bool IsSupported(uint8_t opc) const {
+    return (supported[opc >> 6] >> (opc & 63)) & 1;
+  }
+};
+
+constexpr OpcodeTable MakeOpcodeTable() {
+  OpcodeTable table = {};
+  for (const OpcodeRegistration& registration : kOpcodeRegistrations) {
+    uint8_t opc = static_cast<uint8_t>(registration.opc);
+    table.handlers[opc] = registration.handlers;
+    table.supported[opc >> 6] |= uint64_t{1} << (opc & 63);
+  }
+  return table;
+}
+
+constexpr OpcodeTable kOpcodeTable = MakeOpcodeTable();
+
+constexpr bool HasUniqueOpcodes() {
+  uint32_t count = 0;
+  for (uint32_t opc = 0; opc < 256; ++opc)
+    count += kOpcodeTable.IsSupported(opc);
+  return count == sizeof(kOpcodeRegistrations) / sizeof(OpcodeRegistration);
+}
+
+static_assert(HasUniqueOpcodes(), "An opcode is registered more than once");
+
+}  // namespace
+
+bool IsDirectDataTransfer(Span<const uint8_t> scsi_cmd) {
+  if (scsi_cmd.empty()) return false;
+  return kOpcodeTable.IsSupported(scsi_cmd[0]) &&
+         kOpcodeTable.handlers[scsi_cmd[0]].direct;
+}
+
 BeginResponse Translation::Begin(Span<const uint8_t> scsi_cmd,
                                  Span<const uint8_t> buffer,
                                  scsi::LunAddress lun) {
+  // A linear buffer is a scatter-gather list with one segment
+  DataSegment segment = {.addr = reinterpret_cast<uint64_t>(buffer.data()),
+                         .len = static_cast<uint32_t>(buffer.size())};
+  return BeginTranslation(scsi_cmd, buffer, Span(&segment, 1), lun);
+}
+
+BeginResponse Translation::Begin(Span<const uint8_t> scsi_cmd,
+                                 Span<const DataSegment> data_segments,
+                                 scsi::LunAddress lun) {
+  if (!IsDirectDataTransfer(scsi_cmd)) {
+    TRANSLATOR_LOG(kError,
+                   "Invalid use of API: command requires a linear buffer");
+    BeginResponse response = {};
+    response.status = ApiStatus::kFailure;
+    return response;
+  }
+  return BeginTranslation(scsi_cmd, {}, data_segments, lun);
+}
+
+BeginResponse Translation::BeginTranslation(
+    Span<const uint8_t> scsi_cmd, Span<const uint8_t> buffer,
+    Span<const DataSegment> data_segments, scsi::LunAddress lun) {
   BeginResponse response = {};
   response.status = ApiStatus::kSuccess;
   if (pipeline_status_ != StatusCode::kUninitialized) {
-    DebugLog("Invalid use of API: Begin called before complete or abort");
+    TRANSLATOR_LOG(kError,
+                   "Invalid use of API: Begin called before complete or abort");
     response.status = ApiStatus::kFailure;
     return response;
   }
 
   // Verify buffer is large enough to contain opcode (one byte)
   if (scsi_cmd.empty()) {
-    DebugLog("Empty SCSI Command Buffer");
+    TRANSLATOR_LOG(kWarning, "Empty SCSI Command Buffer");
     pipeline_status_ = StatusCode::kFailure;
     return response;
   }
 
-  pipeline_status_ = StatusCode::kSuccess;
   scsi_cmd_ = scsi_cmd;
-  DebugLog("Translating command %s with opcode %#x",
-           ScsiOpcodeToString((scsi::OpCode)(scsi_cmd[0])), scsi_cmd[0]);
-  uint32_t nsid = static_cast<uint32_t>(lun) + 1;
-  Span<const uint8_t> scsi_cmd_no_op = scsi_cmd.subspan(1);
-  scsi::OpCode opc = static_cast<scsi::OpCode>(scsi_cmd[0]);
-  switch (opc) {
-    case scsi::OpCode::kInquiry:
-      pipeline_status_ =
-          InquiryToNvme(scsi_cmd_no_op, nvme_wrappers_[0], nvme_wrappers_[1],
-                        kPageSize, nsid, allocations_, response.alloc_len);
-      nvme_cmd_count_ = 2;
-      break;
-    case scsi::OpCode::kUnmap:
-      pipeline_status_ = UnmapToNvme(scsi_cmd_no_op, buffer, nvme_wrappers_[0],
-                                     kPageSize, nsid, allocations_[0]);
-      nvme_cmd_count_ = 1;
-    case scsi::OpCode::kModeSense6:
-      pipeline_status_ = ModeSense6ToNvme(scsi_cmd_no_op, nvme_wrappers_,
-                                          allocations_[0], kPageSize, nsid,
-                                          nvme_cmd_count_, response.alloc_len);
-      break;
-    case scsi::OpCode::kModeSense10:
-      pipeline_status_ = ModeSense10ToNvme(scsi_cmd_no_op, nvme_wrappers_,
-                                           allocations_[0], kPageSize, nsid,
-                                           nvme_cmd_count_, response.alloc_len);
-    case scsi::OpCode::kMaintenanceIn:
-      // ReportSupportedOpCodes is the only supported MaintenanceIn command
-      pipeline_status_ =
-          ValidateReportSupportedOpCodes(scsi_cmd_no_op, response.alloc_len);
-      nvme_cmd_count_ = 0;
-    case scsi::OpCode::kReportLuns:
-      pipeline_status_ =
-          ReportLunsToNvme(scsi_cmd_no_op, nvme_wrappers_[0], kPageSize,
-                           allocations_[0], response.alloc_len);
-      nvme_cmd_count_ = 1;
-      break;
-    case scsi::OpCode::kReadCapacity10:
-      pipeline_status_ =
-          ReadCapacity10ToNvme(scsi_cmd_no_op, nvme_wrappers_[0], kPageSize,
-                               nsid, allocations_[0], response.alloc_len);
-      nvme_cmd_count_ = 1;
-      break;
-    case scsi::OpCode::kRequestSense:
-      pipeline_status_ = RequestSenseToNvme(scsi_cmd_no_op, response.alloc_len);
-      break;
-    case scsi::OpCode::kRead6:
-      pipeline_status_ =
-          Read6ToNvme(scsi_cmd_no_op, nvme_wrappers_[0], allocations_[0], nsid,
-                      kLbaSize, buffer, response.alloc_len);
-      nvme_cmd_count_ = 1;
-      break;
-    case scsi::OpCode::kRead10:
-      pipeline_status_ =
-          Read10ToNvme(scsi_cmd_no_op, nvme_wrappers_[0], allocations_[0], nsid,
-                       kLbaSize, buffer, response.alloc_len);
-      nvme_cmd_count_ = 1;
-      break;
-    case scsi::OpCode::kRead12:
-      pipeline_status_ =
-          Read12ToNvme(scsi_cmd_no_op, nvme_wrappers_[0], allocations_[0], nsid,
-                       kLbaSize, buffer, response.alloc_len);
-      nvme_cmd_count_ = 1;
-      break;
-    case scsi::OpCode::kRead16:
-      pipeline_status_ =
-          Read16ToNvme(scsi_cmd_no_op, nvme_wrappers_[0], allocations_[0], nsid,
-                       kLbaSize, buffer, response.alloc_len);
-      nvme_cmd_count_ = 1;
-      break;
-    case scsi::OpCode::kSync10:
-      SynchronizeCache10ToNvme(nvme_wrappers_[0], nsid);
-      pipeline_status_ = StatusCode::kSuccess;
-      nvme_cmd_count_ = 1;
-      break;
-    case scsi::OpCode::kVerify10:
-      pipeline_status_ = VerifyToNvme(scsi_cmd_no_op, nvme_wrappers_[0]);
-      nvme_cmd_count_ = 1;
-      break;
-    case scsi::OpCode::kTestUnitReady:
-      // Always return NVMe device is ready
-      // The implementation of actually querying readiness of NVMe device does
-      // not fit with our Library and engine design and is of little use
-      pipeline_status_ = StatusCode::kSuccess;
-      break;
-    case scsi::OpCode::kWrite6:
-      pipeline_status_ = Write6ToNvme(scsi_cmd_no_op, nvme_wrappers_[0],
-                                      allocations_[0], nsid, kLbaSize, buffer);
-      nvme_cmd_count_ = 1;
-      break;
-    case scsi::OpCode::kWrite10:
-      pipeline_status_ = Write10ToNvme(scsi_cmd_no_op, nvme_wrappers_[0],
-                                       allocations_[0], nsid, kLbaSize, buffer);
-      nvme_cmd_count_ = 1;
-      break;
-    case scsi::OpCode::kWrite12:
-      pipeline_status_ = Write12ToNvme(scsi_cmd_no_op, nvme_wrappers_[0],
-                                       allocations_[0], nsid, kLbaSize, buffer);
-      nvme_cmd_count_ = 1;
-      break;
-    case scsi::OpCode::kWrite16:
-      pipeline_status_ = Write16ToNvme(scsi_cmd_no_op, nvme_wrappers_[0],
-                                       allocations_[0], nsid, kLbaSize, buffer);
-      nvme_cmd_count_ = 1;
-      break;
-    default:
-      DebugLog("Bad OpCode: %#x", static_cast<uint8_t>(opc));
-      pipeline_status_ = StatusCode::kFailure;
-      break;
+  uint8_t opc = scsi_cmd[0];
+  TRANSLATOR_LOG(kDebug, "Translating command %s with opcode %#x",
+                 ScsiOpcodeToString(static_cast<scsi::OpCode>(opc)), opc);
+  if (!kOpcodeTable.IsSupported(opc)) {
+    TRANSLATOR_LOG(kWarning, "Bad OpCode: %#x", opc);
+    pipeline_status_ = StatusCode::kFailure;
+    return response;
+  }
+  const OpcodeHandlers& handlers = kOpcodeTable.handlers[opc];
+  if (scsi_cmd.size() < handlers.cdb_len) {
+    TRANSLATOR_LOG(kWarning,
+                   "SCSI command of %zu bytes is shorter than its %u byte CDB",
+                   scsi_cmd.size(), handlers.cdb_len);
+    pipeline_status_ = StatusCode::kFailure;
+    return response;
   }
 
+  uint32_t nsid = static_cast<uint32_t>(lun) + 1;
+  const Controller& controller =
+      controller_ != nullptr ? *controller_ : kDefaultController;
+  // Namespaces are addressed with the default block size until Inquiry or
+  // Read Capacity has cached their geometry
+  geometry_ = {.lba_shift = kDefaultLbaShift};
+  bool geometry_cached = controller.GetNamespaceGeometry(nsid, geometry_);
+  // Read and Write resize the chain to as many commands as they split into
+  chain_.Resize(kMaxCommandRatio, controller.page_size());
+  // Variable count translators such as Mode Sense count up from zero
+  nvme_cmd_count_ = handlers.nvme_cmd_count == kVariableCmdCount
+                        ? 0
+                        : handlers.nvme_cmd_count;
+  BeginArgs args = {.scsi_cmd = scsi_cmd.subspan(1),
+                    .buffer = buffer,
+                    .data_segments = data_segments,
+                    .nsid = nsid,
+                    .controller = controller,
+                    .geometry_cached = geometry_cached,
+                    .lba_shift = geometry_.lba_shift,
+                    .geometry = geometry_,
+                    .chain = chain_,
+                    .nvme_cmd_count = nvme_cmd_count_,
+                    .alloc_len = response.alloc_len};
+  pipeline_status_ = handlers.begin(args);
+
   if (pipeline_status_ != StatusCode::kSuccess) {
     FlushMemory();
     nvme_cmd_count_ = 0;
   }
+  TRANSLATOR_TRACE("Begin opcode %#x status %u nvme commands %u", opc,
+                   pipeline_status_, nvme_cmd_count_);
   return response;
 }
 
@@ -174,16 +527,16 @@ CompleteResponse Translation::Complete(
     Span<uint8_t> sense_buffer) {
   CompleteResponse resp = {};
   if (pipeline_status_ == StatusCode::kUninitialized) {
-    DebugLog("Invalid use of API: Complete called before Begin");
+    TRANSLATOR_LOG(kError, "Invalid use of API: Complete called before Begin");
     resp.status = ApiStatus::kFailure;
     return resp;
   }
 
   if (cpl_data.size() != nvme_cmd_count_) {
-    DebugLog(
-        "Invalid use of API, completion count %u does not equal command count "
-        "%u",
-        cpl_data.size(), nvme_cmd_count_);
+    TRANSLATOR_LOG(kError,
+                   "Invalid use of API, completion count %u does not equal "
+                   "command count %u",
+                   cpl_data.size(), nvme_cmd_count_);
     AbortPipeline();
     resp.status = ApiStatus::kFailure;
     return resp;
@@ -208,6 +561,8 @@ CompleteResponse Translation::Complete(
     const nvme::CplStatus& cpl_status = cpl_entry.cpl_status;
     ScsiStatus scsi_status = StatusToScsi(cpl_status.sct, cpl_status.sc);
     if (scsi_status.status != scsi::Status::kGood) {
+      TRANSLATOR_TRACE("Complete opcode %#x nvme command %u sct %#x sc %#x",
+                       scsi_cmd_[0], i, cpl_status.sct, cpl_status.sc);
       FillSenseBuffer(sense_buffer, scsi_status);
       AbortPipeline();
       resp.status = ApiStatus::kSuccess;
@@ -216,79 +571,34 @@ CompleteResponse Translation::Complete(
     }
   }
 
-  // Switch cases should not return
   resp.status = ApiStatus::kSuccess;
-  Span<const uint8_t> scsi_cmd_no_op = scsi_cmd_.subspan(1);
-  scsi::OpCode opc = static_cast<scsi::OpCode>(scsi_cmd_[0]);
-  switch (opc) {
-    case scsi::OpCode::kVerify10:
-      // VerifyToScsi() is not needed
-      break;
-    case scsi::OpCode::kInquiry:
-      pipeline_status_ =
-          InquiryToScsi(scsi_cmd_no_op, buffer_in, nvme_wrappers_[0].cmd,
-                        nvme_wrappers_[1].cmd);
-      break;
-    case scsi::OpCode::kModeSense6:
-      // TODO: Update this when the cpl_data interface is finalized
-      ModeSense6ToScsi(scsi_cmd_no_op, nvme_wrappers_[0].cmd, cpl_data[0].cdw0,
-                       buffer_in);
-      break;
-    case scsi::OpCode::kModeSense10:
-      // TODO: Update this when the cpl_data interface is finalized
-      ModeSense10ToScsi(scsi_cmd_no_op, nvme_wrappers_[0].cmd, cpl_data[0].cdw0,
-                        buffer_in);
-      break;
-    case scsi::OpCode::kMaintenanceIn:
-      // ReportSupportedOpCodes is the only supported MaintenanceIn command
-      WriteReportSupportedOpCodesResult(buffer_in);
-      break;
-    case scsi::OpCode::kReportLuns:
-      pipeline_status_ = ReportLunsToScsi(nvme_wrappers_[0].cmd, buffer_in);
-      break;
-    case scsi::OpCode::kUnmap:
-      pipeline_status_ = StatusCode::kSuccess;
-      break;
-    case scsi::OpCode::kReadCapacity10:
-      pipeline_status_ = ReadCapacity10ToScsi(buffer_in, nvme_wrappers_[0].cmd);
-      break;
-    case scsi::OpCode::kRequestSense:
-      pipeline_status_ = RequestSenseToScsi(scsi_cmd_no_op, buffer_in);
-      break;
-    case scsi::OpCode::kRead6:
-    case scsi::OpCode::kRead10:
-    case scsi::OpCode::kRead12:
-    case scsi::OpCode::kRead16:
-      // Data has been written directly to the buffer
-      pipeline_status_ = StatusCode::kSuccess;
-      break;
-    case scsi::OpCode::kSync10:
-      // No command specific response data to translate
-      pipeline_status_ = StatusCode::kSuccess;
-      break;
-    case scsi::OpCode::kTestUnitReady:
-    case scsi::OpCode::kWrite6:
-    case scsi::OpCode::kWrite10:
-    case scsi::OpCode::kWrite12:
-    case scsi::OpCode::kWrite16:
-      pipeline_status_ = StatusCode::kSuccess;
-      break;
-    default:
-      DebugLog(
-          "Invalid opcode case reached: %u. Please contact SCSI2NVMe devs.",
-          scsi_cmd_[0]);
-      break;
+  // Begin() only succeeds for registered opcodes
+  const OpcodeHandlers& handlers = kOpcodeTable.handlers[scsi_cmd_[0]];
+  if (handlers.complete != nullptr) {
+    CompleteArgs args = {.scsi_cmd = scsi_cmd_.subspan(1),
+                         .cpl_data = cpl_data,
+                         .buffer_in = buffer_in,
+                         .chain = chain_,
+                         .controller = controller_,
+                         .geometry = geometry_};
+    pipeline_status_ = handlers.complete(args);
   }
   if (pipeline_status_ != StatusCode::kSuccess) {
     // TODO fill buffer with SCSI CHECK CONDITION response
-    DebugLog("Failed to translate back to SCSI");
+    TRANSLATOR_LOG(kError, "Failed to translate back to SCSI");
   }
+  TRANSLATOR_TRACE("Complete opcode %#x status %u", scsi_cmd_[0],
+                   pipeline_status_);
   AbortPipeline();
   return resp;
 }
 
+void Translation::SetScratchPages(uint64_t addr, uint16_t page_count) {
+  chain_.SetScratchPages(addr, page_count);
+}
+
 Span<const NvmeCmdWrapper> Translation::GetNvmeWrappers() {
-  return Span<NvmeCmdWrapper>(nvme_wrappers_, nvme_cmd_count_);
+  return chain_.wrappers().subspan(0, nvme_cmd_count_);
 }
 
 void Translation::AbortPipeline() {
@@ -298,17 +608,80 @@ void Translation::AbortPipeline() {
 }
 
 void Translation::FlushMemory() {
-  for (uint32_t i = 0; i < nvme_cmd_count_; ++i) {
-    if (allocations_[i].data_addr != 0) {
-      DeallocPages(allocations_[i].data_addr, allocations_[i].data_page_count);
-      allocations_[i].data_addr = 0;
+  Span<Allocation> allocations = chain_.allocations();
+  for (uint32_t i = 0; i < allocations.size(); ++i) {
+    allocations[i].FreePages();
+  }
+  chain_.Release();
+}
+
+BatchBeginResponse BeginBatch(Span<const BatchEntry> entries,
+                              Span<BatchContext> contexts,
+                              Span<NvmeCmdWrapper> nvme_cmds) {
+  BatchBeginResponse resp = {.status = ApiStatus::kFailure};
+  if (contexts.size() < entries.size()) {
+    TRANSLATOR_LOG(kWarning, "Batch of %zu commands has %zu contexts",
+                   entries.size(), contexts.size());
+    return resp;
+  }
+
+  resp.status = ApiStatus::kSuccess;
+  uint32_t offset = 0;
+  uint32_t i = 0;
+  for (; i < entries.size(); ++i) {
+    const BatchEntry& entry = entries[i];
+    BatchContext& context = contexts[i];
+    if (entry.data_segments.size() != 0) {
+      context.response = context.translation.Begin(
+          entry.scsi_cmd, entry.data_segments, entry.lun);
+    } else {
+      context.response =
+          context.translation.Begin(entry.scsi_cmd, entry.buffer, entry.lun);
+    }
+
+    Span<const NvmeCmdWrapper> wrappers =
+        context.translation.GetNvmeWrappers();
+    if (wrappers.size() > nvme_cmds.size() - offset) {
+      context.translation.AbortPipeline();
+      break;
+    }
+    for (uint32_t j = 0; j < wrappers.size(); ++j) {
+      nvme_cmds[offset + j] = wrappers[j];
     }
-    if (allocations_[i].mdata_addr != 0) {
-      DeallocPages(allocations_[i].mdata_addr,
-                   allocations_[i].mdata_page_count);
-      allocations_[i].mdata_addr = 0;
+    context.nvme_offset = offset;
+    context.nvme_count = wrappers.size();
+    offset += wrappers.size();
+  }
+  resp.entry_count = i;
+  resp.nvme_cmd_count = offset;
+  return resp;
+}
+
+ApiStatus CompleteBatch(Span<const BatchEntry> entries,
+                        Span<BatchContext> contexts,
+                        Span<const nvme::GenericQueueEntryCpl> cpl_data,
+                        Span<CompleteResponse> responses) {
+  if (contexts.size() < entries.size() || responses.size() < entries.size()) {
+    TRANSLATOR_LOG(kWarning,
+                   "Batch of %zu commands has %zu contexts and %zu responses",
+                   entries.size(), contexts.size(), responses.size());
+    return ApiStatus::kFailure;
+  }
+
+  for (uint32_t i = 0; i < entries.size(); ++i) {
+    BatchContext& context = contexts[i];
+    if (static_cast<uint64_t>(context.nvme_offset) + context.nvme_count >
+        cpl_data.size()) {
+      TRANSLATOR_LOG(kWarning, "Missing NVMe completions for batch command %u",
+                     i);
+      return ApiStatus::kFailure;
     }
+    Span<const nvme::GenericQueueEntryCpl> cpls(
+        cpl_data.data() + context.nvme_offset, context.nvme_count);
+    responses[i] = context.translation.Complete(cpls, entries[i].buffer,
+                                                entries[i].sense_buffer);
   }
+  return ApiStatus::kSuccess;
 }
 
 };  // namespace translator
@@ -16,6 +16,7 @@
 #define LIB_TRANSLATOR_TRANSLATION_H
 
 #include "common.h"
+#include "controller.h"
 #include "third_party/spdk/nvme.h"
 
 namespace translator {
@@ -33,12 +34,33 @@ struct CompleteResponse {
   scsi::Status scsi_status;  // Return value of library consumer functions
 };
 
+// Returns true if scsi_cmd transfers data directly between the NVMe device and
+// the SCSI data buffer (Read and Write). Only these commands can be started
+// with a scatter-gather list instead of a linear buffer.
+bool IsDirectDataTransfer(Span<const uint8_t> scsi_cmd);
+
 class Translation {
  public:
   Translation()
       : pipeline_status_(StatusCode::kUninitialized),
+        controller_(nullptr),
         nvme_cmd_count_(0),
-        allocations_() {}
+        geometry_() {}
+
+  // Builds commands for the capabilities of controller, which must outlive
+  // the translation. Identify data returned for Inquiry and Read Capacity
+  // updates controller and its namespace geometry cache
+  explicit Translation(Controller& controller)
+      : pipeline_status_(StatusCode::kUninitialized),
+        controller_(&controller),
+        nvme_cmd_count_(0),
+        geometry_() {}
+
+  // Lends page_count pages at addr to the translation. Identify, log and
+  // PRP or SGL list buffers are placed there, one per NVMe command, before
+  // falling back to AllocPages. The pages must stay valid while the
+  // translation is in use
+  void SetScratchPages(uint64_t addr, uint16_t page_count);
 
   // Translates from SCSI to NVMe. Translated commands available through
   // GetNvmeCmdWrappers()
@@ -47,7 +69,17 @@ class Translation {
   BeginResponse Begin(Span<const uint8_t> scsi_cmd, Span<const uint8_t> buffer,
                       scsi::LunAddress lun);
 
+  // Same as above for commands where IsDirectDataTransfer() is true, with the
+  // SCSI data buffer given as data_segments so NVMe transfers need no copy.
+  // data_segments must stay valid until Complete() or AbortPipeline()
+  BeginResponse Begin(Span<const uint8_t> scsi_cmd,
+                      Span<const DataSegment> data_segments,
+                      scsi::LunAddress lun);
+
   // Translates from NVMe to SCSI. Writes SCSI response data to buffer.
+  // cpl_data holds a completion for each command from GetNvmeWrappers(). A
+  // SCSI command split into several NVMe commands completes with the status
+  // of the first one that failed
   CompleteResponse Complete(Span<const nvme::GenericQueueEntryCpl> cpl_data,
                             Span<uint8_t> buffer_in,
                             Span<uint8_t> sense_buffer);
@@ -58,17 +90,71 @@ class Translation {
   void AbortPipeline();
 
  private:
+  BeginResponse BeginTranslation(Span<const uint8_t> scsi_cmd,
+                                 Span<const uint8_t> buffer,
+                                 Span<const DataSegment> data_segments,
+                                 scsi::LunAddress lun);
+
   // Releases memory vended to the translation object
   void FlushMemory();
 
  private:
   StatusCode pipeline_status_;
+  Controller* controller_;
   Span<const uint8_t> scsi_cmd_;
   uint32_t nvme_cmd_count_;
-  NvmeCmdWrapper nvme_wrappers_[kMaxCommandRatio];
-  Allocation allocations_[kMaxCommandRatio];
+  NvmeCmdChain chain_;
+  // Geometry of the addressed namespace when the translation began
+  NamespaceGeometry geometry_;
 };
 
+// One SCSI command of a batch. The same entries are given to BeginBatch()
+// and CompleteBatch()
+struct BatchEntry {
+  Span<const uint8_t> scsi_cmd;
+  // Data buffer of commands started with a linear buffer, and the response
+  // buffer of Complete()
+  Span<uint8_t> buffer;
+  // Data buffer of commands where IsDirectDataTransfer() is true. The command
+  // is started with buffer if empty
+  Span<const DataSegment> data_segments;
+  scsi::LunAddress lun;
+  Span<uint8_t> sense_buffer;
+};
+
+// Per-command state of a batch, kept from BeginBatch() to CompleteBatch()
+struct BatchContext {
+  Translation translation;
+  BeginResponse response;  // Result of the command's Begin()
+  // The command's NVMe commands within the batch's NVMe command array
+  uint32_t nvme_offset;
+  uint32_t nvme_count;
+};
+
+struct BatchBeginResponse {
+  ApiStatus status;
+  uint32_t entry_count;     // Leading entries that were begun
+  uint32_t nvme_cmd_count;  // NVMe commands written to nvme_cmds
+};
+
+// Begins entries[i] with contexts[i].translation, which may be built for a
+// Controller, and writes the NVMe commands of all entries back to back to
+// nvme_cmds. A command whose Begin() fails is recorded in its context and
+// contributes no NVMe commands. Stops before the first entry whose NVMe
+// commands do not fit; the caller begins the remaining entries in another
+// batch. contexts must hold at least as many elements as entries
+BatchBeginResponse BeginBatch(Span<const BatchEntry> entries,
+                              Span<BatchContext> contexts,
+                              Span<NvmeCmdWrapper> nvme_cmds);
+
+// Completes the entries begun by BeginBatch(). cpl_data holds a completion
+// for each command BeginBatch() wrote to nvme_cmds, in the same order.
+// Writes the response of entries[i] to responses[i]
+ApiStatus CompleteBatch(Span<const BatchEntry> entries,
+                        Span<BatchContext> contexts,
+                        Span<const nvme::GenericQueueEntryCpl> cpl_data,
+                        Span<CompleteResponse> responses);
+
 }  // namespace translator
 
 #endif
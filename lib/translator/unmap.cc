@@ -14,107 +14,257 @@
 
 #include "unmap.h"
 
-#ifdef __KERNEL__
-#include <linux/byteorder/generic.h>
+// The kernel may not use vector registers outside kernel_fpu_begin()
+#if defined(__SSSE3__) && !defined(__KERNEL__)
+#include <tmmintrin.h>
+#define UNMAP_SHUFFLE_DESCRIPTORS 1
+#endif
+
+namespace translator {
+
+namespace {
+
+// NVMe Base Specification Figure 364: Number of Ranges is 8 bits, 0's based
+constexpr uint32_t kMaxDsmRanges = 256;
+
+// Blocks a single Dataset Management range can cover
+constexpr uint64_t kMaxRangeBlocks = UINT32_MAX;
+
+static_assert(sizeof(scsi::UnmapBlockDescriptor) ==
+              sizeof(nvme::DatasetManagmentRange));
+
+#ifdef UNMAP_SHUFFLE_DESCRIPTORS
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__);
+
+// Converts count Unmap block descriptors at src to Dataset Management ranges
+// at dst, one 16 byte shuffle each: the big endian LBA and block count are
+// byte reversed into place and the reserved bytes become zeroed context
+// attributes
+void ConvertDescriptors(const uint8_t* src, uint8_t* dst, uint32_t count) {
+  const __m128i kShuffle =
+      _mm_setr_epi8(-1, -1, -1, -1, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+  for (uint32_t i = 0; i < count; ++i) {
+    __m128i descriptor =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(src) + i);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst) + i,
+                     _mm_shuffle_epi8(descriptor, kShuffle));
+  }
+}
 #else
-#include <netinet/in.h>
+// Converts count Unmap block descriptors at src to Dataset Management ranges
+// at dst
+void ConvertDescriptors(const uint8_t* src, uint8_t* dst, uint32_t count) {
+  for (uint32_t i = 0; i < count; ++i) {
+    scsi::UnmapBlockDescriptor descriptor;
+    memcpy(&descriptor, src + i * sizeof(descriptor), sizeof(descriptor));
+    nvme::DatasetManagmentRange range = {};
+    range.lba = descriptor.logical_block_addr.value();
+    range.lb_count = descriptor.logical_block_count.value();
+    memcpy(dst + i * sizeof(range), &range, sizeof(range));
+  }
+}
 #endif
 
-#include <byteswap.h>
+// Returns false if a range runs past the last LBA. Sets sorted to whether the
+// ranges are in LBA order
+bool CheckRanges(const nvme::DatasetManagmentRange* ranges, uint32_t count,
+                 bool& sorted) {
+  sorted = true;
+  uint64_t prev_lba = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    uint64_t lba = ranges[i].lba.value();
+    if (lba + ranges[i].lb_count.value() < lba) {
+      TRANSLATOR_LOG(kWarning,
+                     "Unmap block descriptor %u exceeds the LBA range", i);
+      return false;
+    }
+    if (lba < prev_lba) sorted = false;
+    prev_lba = lba;
+  }
+  return true;
+}
+
+// Moves ranges[root] down the max-heap of the first count ranges
+void SiftDown(nvme::DatasetManagmentRange* ranges, uint32_t root,
+              uint32_t count) {
+  nvme::DatasetManagmentRange range = ranges[root];
+  uint64_t lba = range.lba.value();
+  for (uint32_t child; (child = 2 * root + 1) < count; root = child) {
+    if (child + 1 < count &&
+        ranges[child + 1].lba.value() > ranges[child].lba.value())
+      ++child;
+    if (ranges[child].lba.value() <= lba) break;
+    ranges[root] = ranges[child];
+  }
+  ranges[root] = range;
+}
 
-namespace translator {
+// Sorts ranges by starting LBA in place, in O(n log n) without recursion
+void SortRanges(nvme::DatasetManagmentRange* ranges, uint32_t count) {
+  for (uint32_t i = count / 2; i > 0; --i) SiftDown(ranges, i - 1, count);
+  for (uint32_t end = count; end > 1; --end) {
+    nvme::DatasetManagmentRange largest = ranges[0];
+    ranges[0] = ranges[end - 1];
+    ranges[end - 1] = largest;
+    SiftDown(ranges, 0, end - 1);
+  }
+}
+
+// Shrinks the blocks [lba, end) to whole units of alignment.granularity
+// blocks that start at multiples of alignment.alignment
+void TrimRange(DeallocAlignment alignment, uint64_t& lba, uint64_t& end) {
+  uint64_t unit_start = alignment.alignment > 1 ? alignment.alignment : 1;
+  uint64_t skip = (unit_start - lba % unit_start) % unit_start;
+  if (skip >= end - lba) {
+    end = lba;
+    return;
+  }
+  lba += skip;
+  end = lba + (end - lba) / alignment.granularity * alignment.granularity;
+}
+
+// Merges overlapping and adjacent ranges of a sorted list in place, drops
+// empty ones, trims them if alignment asks for it and splits ranges longer
+// than a range can describe. Returns the number of ranges left.
+// Ranges of at most kMaxRangeBlocks merge into at most as many ranges as
+// they came from, so the list never grows
+uint32_t MergeRanges(nvme::DatasetManagmentRange* ranges, uint32_t count,
+                     DeallocAlignment alignment) {
+  uint32_t merged_count = 0;
+  uint32_t i = 0;
+  while (i < count) {
+    uint64_t lba = ranges[i].lba.value();
+    uint64_t end = lba + ranges[i].lb_count.value();
+    for (++i; i < count && ranges[i].lba.value() <= end; ++i) {
+      uint64_t next_end = ranges[i].lba.value() + ranges[i].lb_count.value();
+      if (next_end > end) end = next_end;
+    }
+    if (alignment.granularity != 0) TrimRange(alignment, lba, end);
+    while (lba < end) {
+      uint64_t lb_count = end - lba;
+      if (lb_count > kMaxRangeBlocks) lb_count = kMaxRangeBlocks;
+      nvme::DatasetManagmentRange& merged = ranges[merged_count++];
+      merged = {};
+      merged.lba = lba;
+      merged.lb_count = static_cast<uint32_t>(lb_count);
+      lba += lb_count;
+    }
+  }
+  return merged_count;
+}
+
+}  // namespace
 
 // Section 5.6
 // https://www.nvmexpress.org/wp-content/uploads/NVM-Express-SCSI-Translation-Reference-1_1-Gold.pdf
 StatusCode UnmapToNvme(Span<const uint8_t> scsi_cmd,
-                       Span<const uint8_t> buffer_out,
-                       NvmeCmdWrapper& nvme_wrapper, uint32_t page_size,
-                       uint32_t nsid, Allocation& allocation) {
+                       Span<const uint8_t> buffer_out, NvmeCmdChain& chain,
+                       uint32_t page_size, uint32_t nsid,
+                       DeallocAlignment alignment, uint32_t& nvme_cmd_count) {
+  nvme_cmd_count = 0;
   scsi::UnmapCommand unmap_cmd;
   if (!ReadValue(scsi_cmd, unmap_cmd)) {
-    DebugLog("Malformed unmap command");
+    TRANSLATOR_LOG(kWarning, "Malformed unmap command");
     return StatusCode::kFailure;
   }
-  if (ntohs(unmap_cmd.param_list_length) < sizeof(scsi::UnmapParamList)) {
-    DebugLog("Insufficient unmap parameter list length");
+  if (unmap_cmd.param_list_length.value() < sizeof(scsi::UnmapParamList)) {
+    TRANSLATOR_LOG(kWarning, "Insufficient unmap parameter list length");
     return StatusCode::kFailure;
   }
   if (unmap_cmd.anchor == 1) {
-    DebugLog("Unsupported unmap anchor request");
+    TRANSLATOR_LOG(kWarning, "Unsupported unmap anchor request");
     return StatusCode::kNoTranslation;
   }
 
   // Copy unmap parameter list into memory
   scsi::UnmapParamList param_list;
   if (!ReadValue(buffer_out, param_list)) {
-    DebugLog("Malformed unmap parameter list");
+    TRANSLATOR_LOG(kWarning, "Malformed unmap parameter list");
     return StatusCode::kFailure;
   }
   buffer_out = buffer_out.subspan(sizeof(scsi::UnmapParamList));
 
   // Ensure that block descriptor data length & span length align
-  uint16_t bd_data_length = ntohs(param_list.block_desc_data_length);
+  uint16_t bd_data_length = param_list.block_desc_data_length.value();
   if (buffer_out.size() < bd_data_length) {
-    DebugLog("Block descriptor list length reported longer than buffer");
+    TRANSLATOR_LOG(kWarning,
+                   "Block descriptor list length reported longer than buffer");
     return StatusCode::kFailure;
   }
   uint32_t data_length_remainder =
       bd_data_length % sizeof(scsi::UnmapBlockDescriptor);
   if (data_length_remainder != 0) {
-    DebugLog("Non-divisible unmap block descriptor data length %u",
-             bd_data_length);
+    TRANSLATOR_LOG(kWarning,
+                   "Non-divisible unmap block descriptor data length %u",
+                   bd_data_length);
     return StatusCode::kInvalidInput;
   }
+  // SBC-4 5.32.2: a list without block descriptors is not an error
   uint32_t block_descriptor_count =
       bd_data_length / sizeof(scsi::UnmapBlockDescriptor);
-  if (block_descriptor_count == 0 || block_descriptor_count > 256) {
-    DebugLog("Unsupported unmap block descriptor count %u",
-             block_descriptor_count);
-    return StatusCode::kNoTranslation;
-  }
+  if (block_descriptor_count == 0) return StatusCode::kSuccess;
 
-  // Copy block descriptors into structures
-  scsi::UnmapBlockDescriptor block_descriptors[block_descriptor_count];
-  for (uint32_t i = 0; i < block_descriptor_count; ++i) {
-    if (!ReadValue(buffer_out, block_descriptors[i])) {
-      DebugLog("Failed to read unmap block descriptor");
-      return StatusCode::kFailure;
-    }
-    buffer_out = buffer_out.subspan(sizeof(block_descriptors[i]));
-  }
-
-  uint16_t num_pages = 1;
-  // Copy block descriptor data into allocated nvme data buffer
+  // Every command's ranges start a page of their own within one allocation,
+  // sized for the commands the descriptors need before they are merged
+  uint32_t max_cmd_count =
+      (block_descriptor_count + kMaxDsmRanges - 1) / kMaxDsmRanges;
+  uint32_t dsm_bytes = kMaxDsmRanges * sizeof(nvme::DatasetManagmentRange);
+  uint32_t cmd_stride = (dsm_bytes + page_size - 1) / page_size * page_size;
+  uint16_t num_pages = max_cmd_count * cmd_stride / page_size;
+  if (chain.Resize(max_cmd_count, page_size) != StatusCode::kSuccess)
+    return StatusCode::kFailure;
+  Allocation& allocation = chain.allocation(0);
   if (allocation.SetPages(page_size, num_pages, 0) == StatusCode::kFailure)
     return StatusCode::kFailure;
+
+  // Convert the descriptors into one array of ranges, then spread the merged
+  // ranges over the command pages
   uint8_t* dmr_ptr = reinterpret_cast<uint8_t*>(allocation.data_addr);
-  Span<uint8_t> dmr_span(
-      dmr_ptr, sizeof(nvme::DatasetManagmentRange) * block_descriptor_count);
-  for (uint32_t i = 0; i < block_descriptor_count; ++i) {
-    nvme::DatasetManagmentRange* dme =
-        SafePointerCastWrite<nvme::DatasetManagmentRange>(dmr_span);
-    if (dme == nullptr) {
-      DebugLog("Failed to cast dataset managment pointer");
-      return StatusCode::kFailure;
-    }
-    dme->lba = bswap_64(block_descriptors[i].logical_block_addr);
-    dme->lb_count = bswap_32(block_descriptors[i].logical_block_count);
-    dmr_span = dmr_span.subspan(sizeof(nvme::DatasetManagmentRange));
+  ConvertDescriptors(buffer_out.data(), dmr_ptr, block_descriptor_count);
+  nvme::DatasetManagmentRange* ranges =
+      reinterpret_cast<nvme::DatasetManagmentRange*>(dmr_ptr);
+  bool sorted;
+  if (!CheckRanges(ranges, block_descriptor_count, sorted))
+    return StatusCode::kInvalidInput;
+  if (!sorted) SortRanges(ranges, block_descriptor_count);
+  uint32_t range_count = MergeRanges(ranges, block_descriptor_count, alignment);
+  // Nothing left to deallocate completes the command without the device
+  if (range_count == 0) return StatusCode::kSuccess;
+
+  uint32_t cmd_count = (range_count + kMaxDsmRanges - 1) / kMaxDsmRanges;
+  // Move the ranges of later commands, last first, to their pages. Each
+  // command's ranges lie at or after where they start in the array, since
+  // cmd_stride is at least the bytes of kMaxDsmRanges ranges
+  for (uint32_t i = cmd_count - 1; i > 0 && cmd_stride != dsm_bytes; --i) {
+    uint32_t first = i * kMaxDsmRanges;
+    uint32_t count = range_count - first < kMaxDsmRanges
+                         ? range_count - first
+                         : kMaxDsmRanges;
+    memmove(dmr_ptr + i * cmd_stride, &ranges[first],
+            count * sizeof(nvme::DatasetManagmentRange));
   }
+  chain.Resize(cmd_count, page_size);
 
-  // Create NVMe command
-  uint8_t bd_count_byte = static_cast<uint8_t>(block_descriptor_count - 1);
-  nvme::DatasetManagementCmd dataset_cmd = {
-      .opc = static_cast<uint8_t>(nvme::NvmOpcode::kDatasetManagement),
-      .nsid = nsid,
-      .nr = bd_count_byte,  // (1's based -> 0's based)
-      .ad = 1};
-  dataset_cmd.dptr.prp.prp1 = allocation.data_addr,
-  memcpy(&nvme_wrapper.cmd, &dataset_cmd, sizeof(nvme_wrapper.cmd));
-
-  nvme_wrapper.buffer_len = page_size * num_pages;
-  nvme_wrapper.is_admin = true;
-  static_assert(sizeof(nvme_wrapper.cmd) == sizeof(dataset_cmd));
+  // Create NVMe commands
+  for (uint32_t i = 0; i < cmd_count; ++i) {
+    uint32_t first = i * kMaxDsmRanges;
+    uint32_t count = range_count - first < kMaxDsmRanges
+                         ? range_count - first
+                         : kMaxDsmRanges;
+    nvme::DatasetManagementCmd dataset_cmd = {
+        .opc = static_cast<uint8_t>(nvme::NvmOpcode::kDatasetManagement),
+        .nsid = nsid,
+        .nr = static_cast<uint8_t>(count - 1),  // (1's based -> 0's based)
+        .ad = 1};
+    dataset_cmd.dptr.prp.prp1 = allocation.data_addr + i * cmd_stride;
+    NvmeCmdWrapper& nvme_wrapper = chain.wrapper(i);
+    memcpy(&nvme_wrapper.cmd, &dataset_cmd, sizeof(nvme_wrapper.cmd));
+    static_assert(sizeof(nvme_wrapper.cmd) == sizeof(dataset_cmd));
+    nvme_wrapper.buffer_len = count * sizeof(nvme::DatasetManagmentRange);
+    nvme_wrapper.data_offset = 0;
+    nvme_wrapper.is_admin = false;
+  }
+  nvme_cmd_count = cmd_count;
 
   return StatusCode::kSuccess;
 }
@@ -21,12 +21,24 @@
 
 namespace translator {
 
-// Translates Unmap to the NVMe Dataset Management command
+// Deallocate ranges are trimmed to whole units of granularity logical blocks
+// starting at multiples of alignment. A granularity of 0 disables trimming
+struct DeallocAlignment {
+  uint32_t granularity;
+  uint32_t alignment;
+};
+
+// Translates Unmap to NVMe Dataset Management commands
 // Buffer_out is a SCSI data buffer containing variable-length cmd data.
+// The block descriptors are converted straight into the range buffer, sorted
+// by LBA, merged where they overlap or touch, stripped of empty ranges and
+// trimmed as alignment asks. The ranges are then split over as many commands
+// as needed, 256 per command, resizing chain to nvme_cmd_count commands.
+// nvme_cmd_count is 0 if no blocks are left to deallocate.
 StatusCode UnmapToNvme(Span<const uint8_t> scsi_cmd,
-                       Span<const uint8_t> buffer_out,
-                       NvmeCmdWrapper& nvme_wrapper, uint32_t page_size,
-                       uint32_t nsid, Allocation& allocation);
+                       Span<const uint8_t> buffer_out, NvmeCmdChain& chain,
+                       uint32_t page_size, uint32_t nsid,
+                       DeallocAlignment alignment, uint32_t& nvme_cmd_count);
 
 }  // namespace translator
 #endif
@@ -62,18 +62,19 @@ StatusCode VerifyToNvme(translator::Span<const uint8_t> scsi_cmd,
                         NvmeCmdWrapper& nvme_wrapper) {
   scsi::Verify10Command verify_cmd{};
   if (!ReadValue(scsi_cmd, verify_cmd)) {
-    DebugLog("Malformed Verify Command - ReadValue Failure");
+    TRANSLATOR_LOG(kWarning, "Malformed Verify Command - ReadValue Failure");
     return StatusCode::kInvalidInput;
   }
 
   // verification length of 0 is a no-op
-  if (verify_cmd.verification_length == 0) {
-    DebugLog("Verify Command is a No-Op");
+  if (verify_cmd.verification_length.value() == 0) {
+    TRANSLATOR_LOG(kInfo, "Verify Command is a No-Op");
     return StatusCode::kNoTranslation;
   }
 
   if (verify_cmd.control_byte.naca == 1) {
-    DebugLog("Malformed Verify Command - Control Byte NACA is 0b1");
+    TRANSLATOR_LOG(kWarning,
+                   "Malformed Verify Command - Control Byte NACA is 0b1");
     return StatusCode::kInvalidInput;
   }
 
@@ -104,7 +105,7 @@ StatusCode VerifyToNvme(translator::Span<const uint8_t> scsi_cmd,
           // to be verified as part of the operation. Command Dword 10 contains
           // bits 31:00; Command
           // Dword 11 contains bits 63: 32.
-          bswap_32(verify_cmd.logical_block_address),  // cdw 10
+          htoll(verify_cmd.logical_block_address.value()),  // cdw 10
           0,
 
           // Support requires translation to Number of Logical Blocks (NLB)
@@ -115,7 +116,7 @@ StatusCode VerifyToNvme(translator::Span<const uint8_t> scsi_cmd,
 
           // bits 15:00 is NLB
           // bits 29:26 is PRINFO
-          htoll((ntohs(verify_cmd.verification_length) - 1) |
+          htoll((verify_cmd.verification_length.value() - 1) |
                 ((pr_info) << 26)),  // cdw 12
       }};
 
@@ -1,11 +1,6 @@
 #include "write.h"
 
-#ifdef __KERNEL__
-#include <linux/byteorder/generic.h>
-#else
-#include <netinet/in.h>
-#endif
-#include <byteswap.h>
+#include "io_command.h"
 
 namespace translator {
 
@@ -44,7 +39,7 @@ StatusCode BuildPRInfo(uint8_t wrprotect, uint8_t& pr_info) {
       // All other codes shall result in command termination with CHECK
       // CONDITION status, ILLEGAL REQUEST sense key, and ILLEGAL FIELD IN CDB
       // additional sense code.
-      DebugLog("Invalid WriteProtect Code for PRInfo");
+      TRANSLATOR_LOG(kWarning, "Invalid WriteProtect Code for PRInfo");
       return StatusCode::kFailure;
   }
 
@@ -52,163 +47,297 @@ StatusCode BuildPRInfo(uint8_t wrprotect, uint8_t& pr_info) {
   return StatusCode::kSuccess;
 }
 
-// Converts transfer_length in units of logical blocks to units of pages
-
-// This function populates the nvme::GenericQueueEntryCmd object with fields
-// that are common to all Write Commands (6, 10, 12, 16) Refer to Section 5.7
+// Decodes a Write CDB of the given layout and builds its NVMe Write commands.
+// Refer to Section 5.7
 // (https://nvmexpress.org/wp-content/uploads/NVM_Express_-_SCSI_Translation_Reference-1_5_20150624_Gold.pdf)
-StatusCode LegacyWrite(NvmeCmdWrapper& nvme_wrapper, Allocation& allocation,
-                       uint32_t nsid, Span<const uint8_t> buffer_out) {
-  nvme_wrapper.cmd = {.opc = static_cast<uint8_t>(nvme::NvmOpcode::kWrite),
-                      .psdt = 0,  // prps are used
-                      .nsid = nsid};
+// Writes longer than the controller's maximum data transfer size are split
+// into several NVMe commands
+template <typename Layout>
+StatusCode WriteToNvme(Span<const uint8_t> scsi_cmd, NvmeCmdChain& chain,
+                       uint32_t nsid, uint8_t lba_shift,
+                       const Controller& controller,
+                       Span<const DataSegment> data_out) {
+  IoCdbFields cdb;
+  if (!DecodeIoCdb<Layout>(scsi_cmd, cdb)) {
+    TRANSLATOR_LOG(kWarning, "Malformed Write%u Command", Layout::kSize + 1);
+    return StatusCode::kInvalidInput;
+  }
 
-  nvme_wrapper.cmd.dptr.prp.prp1 =
-      reinterpret_cast<uint64_t>(buffer_out.data());
+  uint8_t pr_info = 0;
+  if constexpr (Layout::kLegacy) {
+    // A TRANSFER LENGTH field set to zero specifies that 256 logical blocks
+    // shall be written. Any other value specifies the number of logical
+    // blocks that shall be written (Section 3.59) of
+    // https://www.seagate.com/files/staticfiles/support/docs/manual/Interface%20manuals/100293068j.pdf
+    if (cdb.transfer_length == 0) cdb.transfer_length = 256;
+  } else {
+    if (cdb.transfer_length == 0) {
+      TRANSLATOR_LOG(
+          kWarning,
+          "NVMe write command does not support transfering zero blocks");
+      return StatusCode::kNoTranslation;
+    }
+    StatusCode status_code = BuildPRInfo(cdb.protect, pr_info);
+    if (status_code != StatusCode::kSuccess) return status_code;
+  }
 
-  nvme_wrapper.buffer_len = buffer_out.size();
-  nvme_wrapper.is_admin = false;
+  uint64_t transfer_len = static_cast<uint64_t>(cdb.transfer_length)
+                          << lba_shift;
+  if (DataSegmentsLength(data_out) < transfer_len) {
+    TRANSLATOR_LOG(kError, "Not enough data in Write buffer");
+    return StatusCode::kFailure;
+  }
 
-  return StatusCode::kSuccess;
+  IoCommand io = {.opc = nvme::NvmOpcode::kWrite,
+                  .nsid = nsid,
+                  .lba = cdb.lba,
+                  .block_count = cdb.transfer_length,
+                  .lba_shift = lba_shift,
+                  .prinfo = pr_info,
+                  // Without a volatile write cache every write is durable
+                  .fua = cdb.fua && controller.VolatileWriteCacheEnabled()};
+  return BuildIoCommands(io, controller, data_out, chain);
 }
 
-// Builds NVMe cdw 12 for Write10, Write12, Write16 translations
-uint32_t BuildCdw12(uint16_t transfer_length, uint8_t prinfo, bool fua) {
-  // cdw12 nlb bits 15:00 (zero based field), prinfo bits 29:26, fua bit 30
-  return (static_cast<uint32_t>(fua) << 30) |
-         (static_cast<uint32_t>(prinfo) << 26) | (transfer_length - 1);
+// Pattern writes repeat the block over a buffer of at most this size, or of
+// one block if blocks are larger
+constexpr uint32_t kMaxPatternBytes = 128 * 1024;
+
+// Deallocate bit of Write Zeroes cdw12 (NVM Command Set Specification)
+constexpr uint32_t kDeallocate = 1 << 25;
+
+// Fields of a Write Same CDB
+struct WriteSameFields {
+  uint64_t lba;
+  uint32_t block_count;
+  uint8_t wr_protect;
+  bool unmap;
+  bool ndob;  // No data-out buffer, the block is all zeroes
+};
+
+bool IsZeroBlock(const uint8_t* block, uint32_t len) {
+  for (uint32_t i = 0; i < len; ++i) {
+    if (block[i] != 0) return false;
+  }
+  return true;
 }
 
-StatusCode Write(bool fua, uint8_t wrprotect, uint32_t transfer_length,
-                 NvmeCmdWrapper& nvme_wrapper, Allocation& allocation,
-                 uint32_t nsid, uint32_t lba_size,
-                 Span<const uint8_t> buffer_out) {
-  if (transfer_length == 0) {
-    DebugLog("NVMe write command does not support transfering zero blocks");
-    return StatusCode::kNoTranslation;
+// Builds Write Zeroes commands of at most kMaxBlocksPerCommand blocks each.
+// They transfer no data, so the maximum data transfer size does not apply
+StatusCode BuildWriteZeroes(const WriteSameFields& cdb, uint8_t pr_info,
+                            uint32_t nsid, const Controller& controller,
+                            NvmeCmdChain& chain) {
+  uint32_t count = (cdb.block_count - 1) / kMaxBlocksPerCommand + 1;
+  StatusCode status = chain.Resize(count, controller.page_size());
+  if (status != StatusCode::kSuccess) return status;
+
+  uint32_t deallocate = cdb.unmap ? kDeallocate : 0;
+  uint32_t block_offset = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    uint32_t blocks = cdb.block_count - block_offset < kMaxBlocksPerCommand
+                          ? cdb.block_count - block_offset
+                          : kMaxBlocksPerCommand;
+    uint64_t lba = cdb.lba + block_offset;
+    NvmeCmdWrapper& nvme_wrapper = chain.wrapper(i);
+    nvme_wrapper.cmd = nvme::GenericQueueEntryCmd{
+        .opc = static_cast<uint8_t>(nvme::NvmOpcode::kWriteZeroes),
+        .nsid = nsid};
+    nvme_wrapper.cmd.cdw[0] = htoll(static_cast<uint32_t>(lba));
+    nvme_wrapper.cmd.cdw[1] = htoll(static_cast<uint32_t>(lba >> 32));
+    nvme_wrapper.cmd.cdw[2] =
+        htoll(BuildIoCdw12(blocks, pr_info, false) | deallocate);
+    nvme_wrapper.buffer_len = 0;
+    nvme_wrapper.is_admin = false;
+    nvme_wrapper.data_offset = 0;
+    block_offset += blocks;
   }
+  return StatusCode::kSuccess;
+}
 
-  transfer_length &= 0xffff;  // truncate to 16 bits
-
-  StatusCode status_code =
-      LegacyWrite(nvme_wrapper, allocation, nsid, buffer_out);
-
-  if (status_code != StatusCode::kSuccess) {
-    return status_code;
+// Builds Write commands that all transfer from one buffer holding the block
+// repeated, or zeroes if block is empty. Each writes as many blocks as the
+// buffer holds, so the data crosses memory once per buffer rather than once
+// per block
+StatusCode BuildPatternWrites(const WriteSameFields& cdb, uint8_t pr_info,
+                              uint32_t nsid, uint8_t lba_shift,
+                              const Controller& controller,
+                              Span<const uint8_t> block, NvmeCmdChain& chain) {
+  uint32_t block_size = 1u << lba_shift;
+  uint64_t pattern_bytes =
+      block_size > kMaxPatternBytes ? block_size : kMaxPatternBytes;
+  uint64_t max_bytes = controller.MaxTransferBytes();
+  if (max_bytes != 0 && max_bytes < pattern_bytes) pattern_bytes = max_bytes;
+  uint32_t pattern_blocks = pattern_bytes >> lba_shift;
+  if (pattern_blocks > kMaxBlocksPerCommand)
+    pattern_blocks = kMaxBlocksPerCommand;
+  if (pattern_blocks > cdb.block_count) pattern_blocks = cdb.block_count;
+  uint32_t page_size = controller.page_size();
+  uint64_t buffer_len = static_cast<uint64_t>(pattern_blocks) << lba_shift;
+  uint64_t page_count = (buffer_len + page_size - 1) / page_size;
+  if (pattern_blocks == 0 || page_count > UINT16_MAX) {
+    TRANSLATOR_LOG(kWarning,
+                   "Logical block size %u exceeds the maximum transfer size",
+                   block_size);
+    return StatusCode::kFailure;
   }
 
-  uint8_t pr_info;
-  status_code = BuildPRInfo(wrprotect, pr_info);
-
-  if (status_code != StatusCode::kSuccess) {
-    return status_code;
+  uint32_t count = (cdb.block_count - 1) / pattern_blocks + 1;
+  StatusCode status = chain.Resize(count, page_size);
+  if (status != StatusCode::kSuccess) return status;
+
+  // Every command reads the pattern from the first allocation. Its pages
+  // start out zeroed, which is the pattern if there is no block
+  Allocation& allocation = chain.allocation(0);
+  status = allocation.SetPages(page_size, page_count, 0);
+  if (status != StatusCode::kSuccess) return status;
+  uint8_t* pattern = reinterpret_cast<uint8_t*>(allocation.data_addr);
+  if (!block.empty()) {
+    memcpy(pattern, block.data(), block_size);
+    // Each copy doubles the repeated part of the buffer
+    for (uint64_t filled = block_size; filled < buffer_len;) {
+      uint64_t len =
+          buffer_len - filled < filled ? buffer_len - filled : filled;
+      memcpy(pattern + filled, pattern, len);
+      filled += len;
+    }
   }
-  nvme_wrapper.cmd.cdw[2] = htoll(BuildCdw12(transfer_length, pr_info, fua));
 
-  return status_code;
+  uint32_t block_offset = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    uint32_t blocks = cdb.block_count - block_offset < pattern_blocks
+                          ? cdb.block_count - block_offset
+                          : pattern_blocks;
+    uint64_t lba = cdb.lba + block_offset;
+    NvmeCmdWrapper& nvme_wrapper = chain.wrapper(i);
+    nvme_wrapper.cmd = nvme::GenericQueueEntryCmd{
+        .opc = static_cast<uint8_t>(nvme::NvmOpcode::kWrite), .nsid = nsid};
+    nvme_wrapper.cmd.cdw[0] = htoll(static_cast<uint32_t>(lba));
+    nvme_wrapper.cmd.cdw[1] = htoll(static_cast<uint32_t>(lba >> 32));
+    nvme_wrapper.cmd.cdw[2] = htoll(BuildIoCdw12(blocks, pr_info, false));
+    nvme_wrapper.cmd.dptr.prp.prp1 = allocation.data_addr;
+    nvme_wrapper.buffer_len = blocks << lba_shift;
+    nvme_wrapper.is_admin = false;
+    nvme_wrapper.data_offset = 0;
+    block_offset += blocks;
+  }
+  return StatusCode::kSuccess;
 }
 
-}  // namespace
-
-StatusCode Write6ToNvme(Span<const uint8_t> scsi_cmd,
-                        NvmeCmdWrapper& nvme_wrapper, Allocation& allocation,
-                        uint32_t nsid, uint32_t lba_size,
-                        Span<const uint8_t> buffer_out) {
-  scsi::Write6Command write_cmd = {};
-  if (!ReadValue(scsi_cmd, write_cmd)) {
-    DebugLog("Malformed Write6 Command");
+// Translates a decoded Write Same CDB. SBC-4 lets UNMAP unmap blocks only if
+// they then read as the pattern, and forbids it without UNMAP. Deallocated
+// blocks read as zeroes, so only Write Zeroes with UNMAP set deallocates
+StatusCode WriteSameToNvme(const WriteSameFields& cdb, NvmeCmdChain& chain,
+                           uint32_t nsid, uint8_t lba_shift,
+                           const Controller& controller,
+                           Span<const uint8_t> data_out) {
+  if (cdb.block_count == 0) {
+    // Block Limits VPD reports WSNZ, so the whole medium is never written
+    TRANSLATOR_LOG(kWarning, "Write Same of zero blocks is not supported");
     return StatusCode::kInvalidInput;
   }
-
-  // A TRANSFER LENGTH field set to zero specifies that 256 logical blocks shall
-  // be written. Any other value specifies the number of logical blocks that
-  // shall be written (Section 3.59) of
-  // https://www.seagate.com/files/staticfiles/support/docs/manual/Interface%20manuals/100293068j.pdf
-  uint16_t updated_transfer_length =
-      (write_cmd.transfer_length == 0) ? 256 : write_cmd.transfer_length;
-
-  StatusCode status_code =
-      LegacyWrite(nvme_wrapper, allocation, nsid, buffer_out);
-
-  if (status_code != StatusCode::kSuccess) {
-    return status_code;
+  uint8_t pr_info = 0;
+  StatusCode status = BuildPRInfo(cdb.wr_protect, pr_info);
+  if (status != StatusCode::kSuccess) return status;
+
+  uint32_t block_size = 1u << lba_shift;
+  Span<const uint8_t> block;
+  if (!cdb.ndob) {
+    if (data_out.size() < block_size) {
+      TRANSLATOR_LOG(kWarning,
+                     "Write Same data of %zu bytes is shorter than a block",
+                     data_out.size());
+      return StatusCode::kInvalidInput;
+    }
+    if (!IsZeroBlock(data_out.data(), block_size))
+      block = Span<const uint8_t>(data_out.data(), block_size);
   }
 
-  // cdw10 Starting lba bits 31:00
-  uint32_t host_endian_lba = (write_cmd.logical_block_address_1 << 16) +
-                             ntohs(write_cmd.logical_block_address_2);
-
-  nvme_wrapper.cmd.cdw[0] = htoll(host_endian_lba);
-  nvme_wrapper.cmd.cdw[2] =
-      htoll(static_cast<uint32_t>(updated_transfer_length - 1));
-  return status_code;
+  if (block.empty() && controller.WriteZeroesSupported())
+    return BuildWriteZeroes(cdb, pr_info, nsid, controller, chain);
+  return BuildPatternWrites(cdb, pr_info, nsid, lba_shift, controller, block,
+                            chain);
 }
 
-StatusCode Write10ToNvme(Span<const uint8_t> scsi_cmd,
-                         NvmeCmdWrapper& nvme_wrapper, Allocation& allocation,
-                         uint32_t nsid, uint32_t lba_size,
-                         Span<const uint8_t> buffer_out) {
-  scsi::Write10Command write_cmd = {};
-  if (!ReadValue(scsi_cmd, write_cmd)) {
-    DebugLog("Malformed Write10 Command");
-    return StatusCode::kInvalidInput;
-  }
+}  // namespace
 
-  StatusCode status_code = Write(write_cmd.fua, write_cmd.wr_protect,
-                                 ntohs(write_cmd.transfer_length), nvme_wrapper,
-                                 allocation, nsid, lba_size, buffer_out);
+StatusCode Write6ToNvme(Span<const uint8_t> scsi_cmd, NvmeCmdChain& chain,
+                        uint32_t nsid, uint8_t lba_shift,
+                        const Controller& controller,
+                        Span<const DataSegment> data_out) {
+  return WriteToNvme<IoCdb6>(scsi_cmd, chain, nsid, lba_shift, controller,
+                             data_out);
+}
 
-  if (status_code != StatusCode::kSuccess) {
-    return status_code;
-  }
+StatusCode Write10ToNvme(Span<const uint8_t> scsi_cmd, NvmeCmdChain& chain,
+                         uint32_t nsid, uint8_t lba_shift,
+                         const Controller& controller,
+                         Span<const DataSegment> data_out) {
+  return WriteToNvme<IoCdb10>(scsi_cmd, chain, nsid, lba_shift, controller,
+                              data_out);
+}
 
-  nvme_wrapper.cmd.cdw[0] = bswap_32(write_cmd.logical_block_address);
-  return status_code;
+StatusCode Write12ToNvme(Span<const uint8_t> scsi_cmd, NvmeCmdChain& chain,
+                         uint32_t nsid, uint8_t lba_shift,
+                         const Controller& controller,
+                         Span<const DataSegment> data_out) {
+  return WriteToNvme<IoCdb12>(scsi_cmd, chain, nsid, lba_shift, controller,
+                              data_out);
 }
-StatusCode Write12ToNvme(Span<const uint8_t> scsi_cmd,
-                         NvmeCmdWrapper& nvme_wrapper, Allocation& allocation,
-                         uint32_t nsid, uint32_t lba_size,
-                         Span<const uint8_t> buffer_out) {
-  scsi::Write12Command write_cmd = {};
-  if (!ReadValue(scsi_cmd, write_cmd)) {
-    DebugLog("Malformed Write12 Command");
-    return StatusCode::kInvalidInput;
-  }
 
-  StatusCode status_code = Write(write_cmd.fua, write_cmd.wr_protect,
-                                 ntohl(write_cmd.transfer_length), nvme_wrapper,
-                                 allocation, nsid, lba_size, buffer_out);
+StatusCode Write16ToNvme(Span<const uint8_t> scsi_cmd, NvmeCmdChain& chain,
+                         uint32_t nsid, uint8_t lba_shift,
+                         const Controller& controller,
+                         Span<const DataSegment> data_out) {
+  return WriteToNvme<IoCdb16>(scsi_cmd, chain, nsid, lba_shift, controller,
+                              data_out);
+}
 
-  if (status_code != StatusCode::kSuccess) {
-    return status_code;
+StatusCode WriteSame10ToNvme(Span<const uint8_t> scsi_cmd, NvmeCmdChain& chain,
+                             uint32_t nsid, uint8_t lba_shift,
+                             const Controller& controller,
+                             Span<const uint8_t> data_out) {
+  scsi::WriteSame10Command cmd = {};
+  if (!ReadValue(scsi_cmd, cmd)) {
+    TRANSLATOR_LOG(kWarning, "Malformed Write Same10 Command");
+    return StatusCode::kInvalidInput;
   }
-
-  nvme_wrapper.cmd.cdw[0] = bswap_32(write_cmd.logical_block_address);
-  return status_code;
+  if (cmd.anchor || cmd.lbdata || cmd.pbdata) {
+    TRANSLATOR_LOG(kWarning, "Write Same10 ANCHOR, LBDATA and PBDATA are not "
+                             "supported");
+    return StatusCode::kInvalidInput;
+  }
+  WriteSameFields fields = {
+      .lba = cmd.logical_block_address.value(),
+      .block_count = cmd.number_of_logical_blocks.value(),
+      .wr_protect = cmd.wr_protect,
+      .unmap = cmd.unmap,
+      .ndob = false};
+  return WriteSameToNvme(fields, chain, nsid, lba_shift, controller,
+                         data_out);
 }
 
-StatusCode Write16ToNvme(Span<const uint8_t> scsi_cmd,
-                         NvmeCmdWrapper& nvme_wrapper, Allocation& allocation,
-                         uint32_t nsid, uint32_t lba_size,
-                         Span<const uint8_t> buffer_out) {
-  scsi::Write16Command write_cmd = {};
-  if (!ReadValue(scsi_cmd, write_cmd)) {
-    DebugLog("Malformed Write16 Command");
+StatusCode WriteSame16ToNvme(Span<const uint8_t> scsi_cmd, NvmeCmdChain& chain,
+                             uint32_t nsid, uint8_t lba_shift,
+                             const Controller& controller,
+                             Span<const uint8_t> data_out) {
+  scsi::WriteSame16Command cmd = {};
+  if (!ReadValue(scsi_cmd, cmd)) {
+    TRANSLATOR_LOG(kWarning, "Malformed Write Same16 Command");
     return StatusCode::kInvalidInput;
   }
-
-  StatusCode status_code = Write(write_cmd.fua, write_cmd.wr_protect,
-                                 ntohl(write_cmd.transfer_length), nvme_wrapper,
-                                 allocation, nsid, lba_size, buffer_out);
-
-  if (status_code != StatusCode::kSuccess) {
-    return status_code;
+  if (cmd.anchor || cmd.lbdata || cmd.pbdata) {
+    TRANSLATOR_LOG(kWarning, "Write Same16 ANCHOR, LBDATA and PBDATA are not "
+                             "supported");
+    return StatusCode::kInvalidInput;
   }
-
-  uint64_t host_endian_lba = ntohll(write_cmd.logical_block_address);
-  nvme_wrapper.cmd.cdw[0] = htoll(static_cast<uint32_t>(host_endian_lba));
-  nvme_wrapper.cmd.cdw[1] = htoll(static_cast<uint32_t>(host_endian_lba >> 32));
-
-  return status_code;
+  WriteSameFields fields = {
+      .lba = cmd.logical_block_address.value(),
+      .block_count = cmd.number_of_logical_blocks.value(),
+      .wr_protect = cmd.wr_protect,
+      .unmap = cmd.unmap,
+      .ndob = cmd.ndob};
+  return WriteSameToNvme(fields, chain, nsid, lba_shift, controller,
+                         data_out);
 }
+
 }  // namespace translator
@@ -18,28 +18,43 @@
 #include "third_party/spdk/nvme.h"
 
 #include "common.h"
+#include "controller.h"
 
 namespace translator {
 
-StatusCode Write6ToNvme(Span<const uint8_t> scsi_cmd,
-                        NvmeCmdWrapper& nvme_wrapper, Allocation& allocation,
-                        uint32_t nsid, uint32_t lba_size,
-                        Span<const uint8_t> buffer_out);
-
-StatusCode Write10ToNvme(Span<const uint8_t> scsi_cmd,
-                         NvmeCmdWrapper& nvme_wrapper, Allocation& allocation,
-                         uint32_t nsid, uint32_t lba_size,
-                         Span<const uint8_t> buffer_out);
-
-StatusCode Write12ToNvme(Span<const uint8_t> scsi_cmd,
-                         NvmeCmdWrapper& nvme_wrapper, Allocation& allocation,
-                         uint32_t nsid, uint32_t lba_size,
-                         Span<const uint8_t> buffer_out);
-
-StatusCode Write16ToNvme(Span<const uint8_t> scsi_cmd,
-                         NvmeCmdWrapper& nvme_wrapper, Allocation& allocation,
-                         uint32_t nsid, uint32_t lba_size,
-                         Span<const uint8_t> buffer_out);
+StatusCode Write6ToNvme(Span<const uint8_t> scsi_cmd, NvmeCmdChain& chain,
+                        uint32_t nsid, uint8_t lba_shift,
+                        const Controller& controller,
+                        Span<const DataSegment> data_out);
+
+StatusCode Write10ToNvme(Span<const uint8_t> scsi_cmd, NvmeCmdChain& chain,
+                         uint32_t nsid, uint8_t lba_shift,
+                         const Controller& controller,
+                         Span<const DataSegment> data_out);
+
+StatusCode Write12ToNvme(Span<const uint8_t> scsi_cmd, NvmeCmdChain& chain,
+                         uint32_t nsid, uint8_t lba_shift,
+                         const Controller& controller,
+                         Span<const DataSegment> data_out);
+
+StatusCode Write16ToNvme(Span<const uint8_t> scsi_cmd, NvmeCmdChain& chain,
+                         uint32_t nsid, uint8_t lba_shift,
+                         const Controller& controller,
+                         Span<const DataSegment> data_out);
+
+// Write Same writes one block of data_out, or zeroes if NDOB is set, to
+// every block of the range. Zeroes become Write Zeroes commands, which also
+// deallocate the blocks if UNMAP is set, when the controller supports them.
+// Other patterns are written from one buffer holding the block repeated.
+StatusCode WriteSame10ToNvme(Span<const uint8_t> scsi_cmd, NvmeCmdChain& chain,
+                             uint32_t nsid, uint8_t lba_shift,
+                             const Controller& controller,
+                             Span<const uint8_t> data_out);
+
+StatusCode WriteSame16ToNvme(Span<const uint8_t> scsi_cmd, NvmeCmdChain& chain,
+                             uint32_t nsid, uint8_t lba_shift,
+                             const Controller& controller,
+                             Span<const uint8_t> data_out);
 
 }  // namespace translator
 
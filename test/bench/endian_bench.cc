@@ -0,0 +1,87 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <byteswap.h>
+#include <netinet/in.h>
+
+#include <cstring>
+
+#include "benchmark/benchmark.h"
+#include "lib/scsi.h"
+
+// Compares decoding a Read16 CDB through the typed endian fields against the
+// previous pattern of raw integer fields swapped with the libc helpers
+namespace {
+
+// Layout of Read16 before its fields were typed
+struct LegacyRead16Command {
+  uint8_t flags;
+  uint64_t logical_block_address;
+  uint32_t transfer_length;
+  uint8_t group_number;
+  uint8_t control_byte;
+} __attribute__((packed));
+
+static_assert(sizeof(LegacyRead16Command) == sizeof(scsi::Read16Command));
+
+uint64_t LegacyNtohll(uint64_t value) {
+  return ntohl(1) == 1 ? value : bswap_64(value);
+}
+
+constexpr int kCdbCount = 1024;
+
+void FillCdbs(uint8_t (*cdbs)[sizeof(scsi::Read16Command)]) {
+  for (int i = 0; i < kCdbCount; ++i) {
+    scsi::Read16Command cmd = {.logical_block_address = 0x1000u * i,
+                               .transfer_length = 8u + i};
+    memcpy(cdbs[i], &cmd, sizeof(cmd));
+  }
+}
+
+void BM_TypedFields(benchmark::State& state) {
+  static uint8_t cdbs[kCdbCount][sizeof(scsi::Read16Command)];
+  FillCdbs(cdbs);
+  for (auto _ : state) {
+    uint64_t sum = 0;
+    for (int i = 0; i < kCdbCount; ++i) {
+      scsi::Read16Command cmd;
+      memcpy(&cmd, cdbs[i], sizeof(cmd));
+      sum += cmd.logical_block_address.value() + cmd.transfer_length.value();
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * kCdbCount);
+}
+BENCHMARK(BM_TypedFields);
+
+void BM_LegacyHelpers(benchmark::State& state) {
+  static uint8_t cdbs[kCdbCount][sizeof(scsi::Read16Command)];
+  FillCdbs(cdbs);
+  for (auto _ : state) {
+    uint64_t sum = 0;
+    for (int i = 0; i < kCdbCount; ++i) {
+      LegacyRead16Command cmd;
+      memcpy(&cmd, cdbs[i], sizeof(cmd));
+      sum += LegacyNtohll(cmd.logical_block_address) +
+             ntohl(cmd.transfer_length);
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetItemsProcessed(state.iterations() * kCdbCount);
+}
+BENCHMARK(BM_LegacyHelpers);
+
+}  // namespace
+
+BENCHMARK_MAIN();
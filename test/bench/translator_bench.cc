@@ -0,0 +1,368 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <netinet/in.h>
+#include <stdlib.h>
+
+#include "benchmark/benchmark.h"
+#include "lib/translator/common.h"
+#include "lib/translator/inquiry.h"
+#include "lib/translator/report_luns.h"
+#include "lib/translator/status.h"
+#include "lib/translator/translation.h"
+#include "lib/translator/unmap.h"
+
+// Measures the per-command cost of the translation library. Every benchmark
+// reports allocs/op, the AllocPages() calls the library makes per iteration
+namespace {
+
+constexpr uint32_t kPageSize = 4096;
+constexpr uint32_t kDataSize = 64 * 1024;
+constexpr uint32_t kMaxDescriptors = 256;
+
+uint64_t alloc_count;
+
+uint64_t CountingAlloc(uint32_t page_size, uint16_t count) {
+  ++alloc_count;
+  void* addr = aligned_alloc(page_size, page_size * count);
+  memset(addr, 0, page_size * count);
+  return reinterpret_cast<uint64_t>(addr);
+}
+
+void CountingDealloc(uint64_t addr, uint16_t count) {
+  free(reinterpret_cast<void*>(addr));
+}
+
+// Installs the counting allocator for the lifetime of a benchmark and
+// reports the allocations per iteration when it ends
+class AllocCounter {
+ public:
+  explicit AllocCounter(benchmark::State& state) : state_(state) {
+    translator::SetAllocPageCallbacks(CountingAlloc, CountingDealloc);
+  }
+
+  // Starts counting once the benchmark's setup is done
+  void Start() { alloc_count = 0; }
+
+  ~AllocCounter() {
+    state_.counters["allocs/op"] =
+        benchmark::Counter(alloc_count, benchmark::Counter::kAvgIterations);
+    translator::SetAllocPageCallbacks(nullptr, nullptr);
+  }
+
+ private:
+  benchmark::State& state_;
+};
+
+alignas(kPageSize) uint8_t data_buffer[kDataSize];
+uint8_t sense_buffer[sizeof(scsi::DescriptorFormatSenseData)];
+
+void FillIdentifyNamespace(nvme::IdentifyNamespace& identify_ns) {
+  identify_ns = {.nsze = 1 << 20};
+  identify_ns.lbaf[0].lbads = 9;
+  identify_ns.nguid[0] = 0x0123456789abcdef;
+  identify_ns.eui64 = 0xfedcba9876543210;
+  identify_ns.dpc.pit1 = 1;
+}
+
+void FillIdentifyController(nvme::IdentifyControllerData& identify_ctrl) {
+  identify_ctrl = {};
+  memcpy(identify_ctrl.sn, "SERIAL01", 8);
+  memcpy(identify_ctrl.mn, "BENCH CONTROLLER", 16);
+  memcpy(identify_ctrl.fr, "1.0     ", 8);
+}
+
+void FillNamespaceList(nvme::IdentifyNamespaceList& list, uint32_t count) {
+  list = {};
+  for (uint32_t i = 0; i < count; ++i) list.ids[i] = i + 1;
+}
+
+// Answers the Identify commands of a translation the way a device would
+void RunDevice(translator::Span<const translator::NvmeCmdWrapper> wrappers) {
+  for (uint32_t i = 0; i < wrappers.size(); ++i) {
+    const translator::NvmeCmdWrapper& wrapper = wrappers[i];
+    if (!wrapper.is_admin ||
+        wrapper.cmd.opc != static_cast<uint8_t>(nvme::AdminOpcode::kIdentify))
+      continue;
+    void* data = reinterpret_cast<void*>(wrapper.cmd.dptr.prp.prp1);
+    switch (translator::ltohl(wrapper.cmd.cdw[0]) & 0xff) {
+      case 0x0:
+        FillIdentifyNamespace(*static_cast<nvme::IdentifyNamespace*>(data));
+        break;
+      case 0x1:
+        FillIdentifyController(
+            *static_cast<nvme::IdentifyControllerData*>(data));
+        break;
+      case 0x2:
+        FillNamespaceList(*static_cast<nvme::IdentifyNamespaceList*>(data), 1);
+        break;
+    }
+  }
+}
+
+struct Cdb {
+  const char* name;
+  uint8_t bytes[32];
+  uint8_t len;
+};
+
+template <typename T>
+Cdb MakeCdb(const char* name, scsi::OpCode opc, const T& cmd) {
+  static_assert(sizeof(T) < sizeof(Cdb::bytes));
+  Cdb cdb = {.name = name, .len = sizeof(T) + 1};
+  cdb.bytes[0] = static_cast<uint8_t>(opc);
+  memcpy(cdb.bytes + 1, &cmd, sizeof(T));
+  return cdb;
+}
+
+// A command for every opcode the library translates. IO commands move 8
+// logical blocks
+const Cdb kCdbs[] = {
+    MakeCdb("TestUnitReady", scsi::OpCode::kTestUnitReady,
+            scsi::TestUnitReadyCommand{}),
+    MakeCdb("RequestSense", scsi::OpCode::kRequestSense,
+            scsi::RequestSenseCommand{.allocation_length = 252}),
+    MakeCdb("Read6", scsi::OpCode::kRead6,
+            scsi::Read6Command{.transfer_length = 8}),
+    MakeCdb("Read10", scsi::OpCode::kRead10,
+            scsi::Read10Command{.transfer_length = 8}),
+    MakeCdb("Read12", scsi::OpCode::kRead12,
+            scsi::Read12Command{.transfer_length = 8}),
+    MakeCdb("Read16", scsi::OpCode::kRead16,
+            scsi::Read16Command{.transfer_length = 8}),
+    MakeCdb("Write6", scsi::OpCode::kWrite6,
+            scsi::Write6Command{.transfer_length = 8}),
+    MakeCdb("Write10", scsi::OpCode::kWrite10,
+            scsi::Write10Command{.transfer_length = 8}),
+    MakeCdb("Write12", scsi::OpCode::kWrite12,
+            scsi::Write12Command{.transfer_length = 8}),
+    MakeCdb("Write16", scsi::OpCode::kWrite16,
+            scsi::Write16Command{.transfer_length = 8}),
+    MakeCdb("Verify10", scsi::OpCode::kVerify10,
+            scsi::Verify10Command{.verification_length = 8}),
+    MakeCdb("SynchronizeCache10", scsi::OpCode::kSync10,
+            scsi::SynchronizeCache10Command{}),
+    MakeCdb("Inquiry", scsi::OpCode::kInquiry,
+            scsi::InquiryCommand{.allocation_length = htons(96)}),
+    MakeCdb("ModeSense6", scsi::OpCode::kModeSense6,
+            scsi::ModeSense6Command{.page_code = scsi::ModePageCode::kCacheMode,
+                                    .alloc_length = 255}),
+    MakeCdb(
+        "ModeSense10", scsi::OpCode::kModeSense10,
+        scsi::ModeSense10Command{.page_code = scsi::ModePageCode::kCacheMode,
+                                 .alloc_length = htons(255)}),
+    MakeCdb("ReadCapacity10", scsi::OpCode::kReadCapacity10,
+            scsi::ReadCapacity10Command{}),
+    MakeCdb("ReportLuns", scsi::OpCode::kReportLuns,
+            scsi::ReportLunsCommand{.alloc_length = htonl(1024)}),
+    MakeCdb("ReportSupportedOpCodes", scsi::OpCode::kMaintenanceIn,
+            scsi::ReportOpCodesCommand{
+                .reporting_options = 0b001,
+                .requested_op_code =
+                    static_cast<uint8_t>(scsi::OpCode::kWriteSame16)}),
+    MakeCdb("Unmap", scsi::OpCode::kUnmap,
+            scsi::UnmapCommand{.param_list_length =
+                                   sizeof(scsi::UnmapParamList) +
+                                   sizeof(scsi::UnmapBlockDescriptor)}),
+};
+constexpr int kCdbCount = sizeof(kCdbs) / sizeof(kCdbs[0]);
+
+// Writes an Unmap parameter list of count descriptors to buffer and returns
+// its length
+uint32_t WriteUnmapParamList(uint8_t* buffer, uint32_t count) {
+  uint16_t desc_length = count * sizeof(scsi::UnmapBlockDescriptor);
+  scsi::UnmapParamList param_list = {
+      .data_length = static_cast<uint16_t>(sizeof(scsi::UnmapParamList) - 2 +
+                                           desc_length),
+      .block_desc_data_length = desc_length};
+  memcpy(buffer, &param_list, sizeof(param_list));
+  scsi::UnmapBlockDescriptor* descriptors =
+      reinterpret_cast<scsi::UnmapBlockDescriptor*>(buffer +
+                                                    sizeof(param_list));
+  for (uint32_t i = 0; i < count; ++i) {
+    descriptors[i] = {.logical_block_addr = i * 64ull,
+                      .logical_block_count = 8};
+  }
+  return sizeof(param_list) + desc_length;
+}
+
+// Runs one SCSI command through Begin(), the device and Complete(). Returns
+// false if the library failed it
+bool RunCommand(translator::Controller& controller, const Cdb& cdb) {
+  translator::Translation translation(controller);
+  translator::Span<const uint8_t> scsi_cmd(cdb.bytes, cdb.len);
+  translator::BeginResponse begin_resp =
+      translation.Begin(scsi_cmd, data_buffer, 0);
+  translator::Span<const translator::NvmeCmdWrapper> wrappers =
+      translation.GetNvmeWrappers();
+  RunDevice(wrappers);
+  nvme::GenericQueueEntryCpl cpl_data[translator::kMaxCommandRatio] = {};
+  translator::CompleteResponse cpl_resp = translation.Complete(
+      translator::Span(cpl_data, wrappers.size()),
+      translator::Span(data_buffer, begin_resp.alloc_len), sense_buffer);
+  return begin_resp.status == translator::ApiStatus::kSuccess &&
+         cpl_resp.status == translator::ApiStatus::kSuccess &&
+         cpl_resp.scsi_status == scsi::Status::kGood;
+}
+
+void BM_BeginComplete(benchmark::State& state) {
+  const Cdb& cdb = kCdbs[state.range(0)];
+  state.SetLabel(cdb.name);
+  AllocCounter alloc_counter(state);
+  WriteUnmapParamList(data_buffer, 1);
+  translator::Controller controller;
+  if (!RunCommand(controller, cdb)) {
+    state.SkipWithError("Translation failed");
+    return;
+  }
+  alloc_counter.Start();
+  for (auto _ : state) {
+    RunCommand(controller, cdb);
+  }
+}
+BENCHMARK(BM_BeginComplete)->DenseRange(0, kCdbCount - 1);
+
+void BM_StatusToScsi(benchmark::State& state) {
+  AllocCounter alloc_counter(state);
+  alloc_counter.Start();
+  for (auto _ : state) {
+    for (uint8_t sc = 0; sc < 0x20; ++sc) {
+      benchmark::DoNotOptimize(
+          translator::StatusToScsi(nvme::StatusCodeType::kGeneric, sc));
+      benchmark::DoNotOptimize(
+          translator::StatusToScsi(nvme::StatusCodeType::kMediaError, sc));
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * 0x40);
+}
+BENCHMARK(BM_StatusToScsi);
+
+void BM_FillSenseBuffer(benchmark::State& state) {
+  AllocCounter alloc_counter(state);
+  translator::ScsiStatus scsi_status = {
+      .status = scsi::Status::kCheckCondition,
+      .sense_key = scsi::SenseKey::kIllegalRequest,
+      .asc = scsi::AdditionalSenseCode::kInvalidFieldInCdb,
+      .ascq = scsi::AdditionalSenseCodeQualifier::kNoAdditionalSenseInfo};
+  alloc_counter.Start();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        translator::FillSenseBuffer(sense_buffer, scsi_status));
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_FillSenseBuffer);
+
+void BM_UnmapToNvme(benchmark::State& state) {
+  AllocCounter alloc_counter(state);
+  uint32_t count = state.range(0);
+  uint32_t length = WriteUnmapParamList(data_buffer, count);
+  scsi::UnmapCommand cmd = {.param_list_length = static_cast<uint16_t>(length)};
+  translator::Span<const uint8_t> scsi_cmd(reinterpret_cast<uint8_t*>(&cmd),
+                                           sizeof(cmd));
+  translator::Span<const uint8_t> buffer_out(data_buffer, length);
+  translator::NvmeCmdChain chain;
+  alloc_counter.Start();
+  for (auto _ : state) {
+    uint32_t nvme_cmd_count;
+    translator::StatusCode status = translator::UnmapToNvme(
+        scsi_cmd, buffer_out, chain, kPageSize, 1, {}, nvme_cmd_count);
+    if (status != translator::StatusCode::kSuccess) {
+      state.SkipWithError("Unmap translation failed");
+      break;
+    }
+    for (uint32_t i = 0; i < chain.size(); ++i)
+      chain.allocation(i).FreePages();
+  }
+  chain.Release();
+  state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_UnmapToNvme)
+    ->Arg(1)
+    ->Arg(64)
+    ->Arg(kMaxDescriptors)
+    ->Arg(translator::kMaxUnmapBlockDescriptors);
+
+void BM_ReportLunsToScsi(benchmark::State& state) {
+  AllocCounter alloc_counter(state);
+  alignas(kPageSize) static nvme::IdentifyNamespaceList list;
+  FillNamespaceList(list, state.range(0));
+  nvme::GenericQueueEntryCmd identify_cmd = {};
+  identify_cmd.dptr.prp.prp1 = reinterpret_cast<uint64_t>(&list);
+  translator::Span<uint8_t> buffer(data_buffer, kDataSize);
+  alloc_counter.Start();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        translator::ReportLunsToScsi(identify_cmd, buffer));
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_ReportLunsToScsi)->Arg(1)->Arg(nvme::kIdentifyNsListMaxLength);
+
+struct InquiryPage {
+  const char* name;
+  bool evpd;
+  scsi::PageCode page_code;
+};
+
+const InquiryPage kInquiryPages[] = {
+    {"Standard", false, scsi::PageCode::kSupportedVpd},
+    {"SupportedVpd", true, scsi::PageCode::kSupportedVpd},
+    {"UnitSerialNumber", true, scsi::PageCode::kUnitSerialNumber},
+    {"DeviceIdentification", true, scsi::PageCode::kDeviceIdentification},
+    {"Extended", true, scsi::PageCode::kExtended},
+    {"BlockLimits", true, scsi::PageCode::kBlockLimitsVpd},
+    {"BlockDeviceCharacteristics", true,
+     scsi::PageCode::kBlockDeviceCharacteristicsVpd},
+    {"LogicalBlockProvisioning", true,
+     scsi::PageCode::kLogicalBlockProvisioningVpd},
+};
+constexpr int kInquiryPageCount =
+    sizeof(kInquiryPages) / sizeof(kInquiryPages[0]);
+
+void BM_InquiryToScsi(benchmark::State& state) {
+  const InquiryPage& page = kInquiryPages[state.range(0)];
+  state.SetLabel(page.name);
+  AllocCounter alloc_counter(state);
+  alignas(kPageSize) static nvme::IdentifyNamespace identify_ns;
+  alignas(kPageSize) static nvme::IdentifyControllerData identify_ctrl;
+  FillIdentifyNamespace(identify_ns);
+  FillIdentifyController(identify_ctrl);
+  nvme::GenericQueueEntryCmd identify_ns_cmd = {};
+  identify_ns_cmd.dptr.prp.prp1 = reinterpret_cast<uint64_t>(&identify_ns);
+  nvme::GenericQueueEntryCmd identify_ctrl_cmd = {};
+  identify_ctrl_cmd.dptr.prp.prp1 = reinterpret_cast<uint64_t>(&identify_ctrl);
+
+  scsi::InquiryCommand cmd = {.evpd = page.evpd,
+                              .page_code = page.page_code,
+                              .allocation_length = htons(255)};
+  translator::Span<const uint8_t> scsi_cmd(reinterpret_cast<uint8_t*>(&cmd),
+                                           sizeof(cmd));
+  translator::Span<uint8_t> buffer(data_buffer, 255);
+  alloc_counter.Start();
+  for (auto _ : state) {
+    translator::StatusCode status = translator::InquiryToScsi(
+        scsi_cmd, buffer, identify_ns_cmd, identify_ctrl_cmd);
+    if (status != translator::StatusCode::kSuccess) {
+      state.SkipWithError("Inquiry translation failed");
+      break;
+    }
+    benchmark::ClobberMemory();
+  }
+}
+BENCHMARK(BM_InquiryToScsi)->DenseRange(0, kInquiryPageCount - 1);
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,171 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "third_party/e2e/discard_queue.h"
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+using Range = std::pair<uint64_t, uint32_t>;
+
+// A deallocating Dataset Management command and its ranges
+struct Dsm {
+  Dsm(const std::vector<Range>& ranges, uint32_t nsid = 1) {
+    for (uint32_t i = 0; i < ranges.size(); ++i) {
+      this->ranges[i].lba = ranges[i].first;
+      this->ranges[i].lb_count = ranges[i].second;
+    }
+    nvme::DatasetManagementCmd cmd = {
+        .opc = static_cast<uint8_t>(nvme::NvmOpcode::kDatasetManagement),
+        .nsid = nsid,
+        .nr = static_cast<uint8_t>(ranges.size() - 1),
+        .ad = 1};
+    cmd.dptr.prp.prp1 = reinterpret_cast<uint64_t>(this->ranges);
+    memcpy(&wrapper.cmd, &cmd, sizeof(cmd));
+  }
+
+  translator::Span<const translator::NvmeCmdWrapper> wrappers() const {
+    return translator::Span<const translator::NvmeCmdWrapper>(&wrapper, 1);
+  }
+
+  nvme::DatasetManagmentRange ranges[256] = {};
+  translator::NvmeCmdWrapper wrapper = {};
+};
+
+std::vector<Range> Ranges(
+    translator::Span<const nvme::DatasetManagmentRange> batch) {
+  std::vector<Range> ranges;
+  for (uint32_t i = 0; i < batch.size(); ++i)
+    ranges.push_back({batch[i].lba.value(), batch[i].lb_count.value()});
+  return ranges;
+}
+
+class DiscardQueueTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    DiscardQueueConfig config = {
+        .max_ranges = 8, .max_foreground = 1, .batch_interval_ns = 1000};
+    ASSERT_TRUE(queue_.Init(config));
+  }
+
+  void TearDown() override { queue_.Destroy(); }
+
+  DiscardQueue queue_;
+  uint32_t nsid_ = 0;
+};
+
+TEST_F(DiscardQueueTest, ShouldMergeRangesIntoOneBatch) {
+  EXPECT_FALSE(queue_.Pending());
+  ASSERT_TRUE(queue_.Add(Dsm({{10, 5}, {30, 2}}, 3).wrappers()));
+  ASSERT_TRUE(queue_.Add(Dsm({{15, 5}, {0, 3}, {12, 1}}, 3).wrappers()));
+  EXPECT_TRUE(queue_.Pending());
+
+  translator::Span<const nvme::DatasetManagmentRange> batch =
+      queue_.NextBatch(0, nsid_);
+  EXPECT_EQ(3, nsid_);
+  std::vector<Range> expected = {{0, 3}, {10, 10}, {30, 2}};
+  EXPECT_EQ(expected, Ranges(batch));
+  // One batch is in flight at a time
+  EXPECT_TRUE(queue_.NextBatch(0, nsid_).empty());
+  EXPECT_TRUE(queue_.Pending());
+  queue_.BatchDone();
+  EXPECT_FALSE(queue_.Pending());
+  EXPECT_TRUE(queue_.NextBatch(0, nsid_).empty());
+}
+
+TEST_F(DiscardQueueTest, ShouldYieldToForegroundCommands) {
+  ASSERT_TRUE(queue_.Add(Dsm({{0, 8}}).wrappers()));
+  queue_.ForegroundStarted();
+  queue_.ForegroundStarted();
+  EXPECT_TRUE(queue_.NextBatch(5000, nsid_).empty());
+  queue_.ForegroundDone();
+  EXPECT_EQ(1, queue_.NextBatch(5000, nsid_).size());
+  queue_.BatchDone();
+
+  // The next batch waits for the interval while the device is busy
+  ASSERT_TRUE(queue_.Add(Dsm({{100, 8}}).wrappers()));
+  EXPECT_TRUE(queue_.NextBatch(5500, nsid_).empty());
+  EXPECT_EQ(1, queue_.NextBatch(6000, nsid_).size());
+  queue_.BatchDone();
+
+  // An idle device takes batches right away
+  ASSERT_TRUE(queue_.Add(Dsm({{200, 8}}).wrappers()));
+  queue_.ForegroundDone();
+  EXPECT_EQ(1, queue_.NextBatch(6001, nsid_).size());
+  queue_.BatchDone();
+}
+
+TEST_F(DiscardQueueTest, ShouldDetectConflictsAndHurry) {
+  ASSERT_TRUE(queue_.Add(Dsm({{100, 10}, {200, 1}}).wrappers()));
+  queue_.ForegroundStarted();
+  queue_.ForegroundStarted();
+  EXPECT_FALSE(queue_.Conflicts(90, 10));
+  EXPECT_FALSE(queue_.Conflicts(110, 90));
+  EXPECT_TRUE(queue_.NextBatch(0, nsid_).empty());
+
+  EXPECT_TRUE(queue_.Conflicts(109, 1));
+  // The batch is sent despite the foreground commands, and keeps conflicting
+  // until the device completes it
+  EXPECT_EQ(2, queue_.NextBatch(0, nsid_).size());
+  EXPECT_TRUE(queue_.Conflicts(0, 101));
+  EXPECT_TRUE(queue_.Conflicts(200, 1));
+  EXPECT_FALSE(queue_.Conflicts(201, 1));
+  queue_.BatchDone();
+  EXPECT_FALSE(queue_.Conflicts(0, 1000));
+  queue_.ForegroundDone();
+  queue_.ForegroundDone();
+}
+
+TEST_F(DiscardQueueTest, ShouldResendBatchesThatFailedToSubmit) {
+  ASSERT_TRUE(queue_.Add(Dsm({{0, 8}}).wrappers()));
+  EXPECT_EQ(1, queue_.NextBatch(0, nsid_).size());
+  queue_.BatchSubmitFailed();
+  // Ranges queued meanwhile wait for the next batch
+  ASSERT_TRUE(queue_.Add(Dsm({{100, 8}}).wrappers()));
+  std::vector<Range> expected = {{0, 8}};
+  EXPECT_EQ(expected, Ranges(queue_.NextBatch(0, nsid_)));
+  queue_.BatchDone();
+  expected = {{100, 8}};
+  EXPECT_EQ(expected, Ranges(queue_.NextBatch(0, nsid_)));
+  queue_.BatchDone();
+}
+
+TEST_F(DiscardQueueTest, ShouldRefuseRangesItCannotQueue) {
+  ASSERT_TRUE(queue_.Add(Dsm({{0, 1}, {2, 1}, {4, 1}, {6, 1}}).wrappers()));
+  // Nine ranges could need nine intervals
+  std::vector<Range> ranges;
+  for (uint32_t i = 0; i < 5; ++i) ranges.push_back({i * 2, 1});
+  EXPECT_FALSE(queue_.Add(Dsm(ranges).wrappers()));
+  // Ranges of another namespace wait for the device
+  EXPECT_FALSE(queue_.Add(Dsm({{0, 1}}, 2).wrappers()));
+
+  Dsm hint({{0, 1}});
+  hint.wrapper.cmd.cdw[1] = 0;
+  EXPECT_FALSE(queue_.Add(hint.wrappers()));
+  Dsm admin({{0, 1}});
+  admin.wrapper.is_admin = true;
+  EXPECT_FALSE(queue_.Add(admin.wrappers()));
+
+  std::vector<Range> expected = {{0, 1}, {2, 1}, {4, 1}, {6, 1}};
+  EXPECT_EQ(expected, Ranges(queue_.NextBatch(0, nsid_)));
+  queue_.BatchDone();
+}
+
+}  // namespace
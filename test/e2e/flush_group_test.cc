@@ -0,0 +1,129 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "third_party/e2e/flush_group.h"
+
+#include <cstdint>
+#include <set>
+
+#include "gtest/gtest.h"
+#include "lib/translator/common.h"
+
+namespace {
+
+// A Synchronize Cache command's Flush request and its waiter
+struct Sync {
+  Sync() { waiter = {.next = nullptr, .request = &request}; }
+
+  NvmeAsyncRequest request = {};
+  FlushWaiter waiter;
+};
+
+std::set<NvmeAsyncRequest*> Requests(FlushWaiter* waiter) {
+  std::set<NvmeAsyncRequest*> requests;
+  for (; waiter != nullptr; waiter = waiter->next)
+    requests.insert(waiter->request);
+  return requests;
+}
+
+class FlushGroupTest : public ::testing::Test {
+ protected:
+  void SetUp() override { ASSERT_TRUE(group_.Init()); }
+
+  void TearDown() override { group_.Destroy(); }
+
+  FlushGroup group_;
+};
+
+TEST_F(FlushGroupTest, ShouldShareTheFlushAfterTheOneInFlight) {
+  Sync first, second, third;
+  EXPECT_FALSE(group_.Pending());
+  ASSERT_TRUE(group_.Join(1, &first.waiter));
+  EXPECT_TRUE(group_.Queued());
+
+  NvmeAsyncRequest* flush = group_.NextFlush();
+  ASSERT_NE(nullptr, flush);
+  EXPECT_EQ(static_cast<uint8_t>(nvme::NvmOpcode::kFlush), flush->cmd.opcode);
+  EXPECT_EQ(1, flush->cmd.nsid);
+  EXPECT_FALSE(group_.Queued());
+  EXPECT_TRUE(group_.Pending());
+
+  // The Flush in flight may predate their writes
+  ASSERT_TRUE(group_.Join(1, &second.waiter));
+  ASSERT_TRUE(group_.Join(1, &third.waiter));
+  EXPECT_EQ(nullptr, group_.NextFlush());
+  EXPECT_EQ(std::set<NvmeAsyncRequest*>{&first.request},
+            Requests(group_.Done(flush)));
+
+  flush = group_.NextFlush();
+  ASSERT_NE(nullptr, flush);
+  EXPECT_EQ(nullptr, group_.NextFlush());
+  std::set<NvmeAsyncRequest*> expected = {&second.request, &third.request};
+  EXPECT_EQ(expected, Requests(group_.Done(flush)));
+  EXPECT_FALSE(group_.Pending());
+}
+
+TEST_F(FlushGroupTest, ShouldFlushNamespacesIndependently) {
+  Sync ns1, ns2, broadcast;
+  ASSERT_TRUE(group_.Join(1, &ns1.waiter));
+  ASSERT_TRUE(group_.Join(2, &ns2.waiter));
+  ASSERT_TRUE(group_.Join(kBroadcastNsid, &broadcast.waiter));
+
+  std::set<uint32_t> nsids;
+  NvmeAsyncRequest* flushes[3];
+  for (NvmeAsyncRequest*& flush : flushes) {
+    flush = group_.NextFlush();
+    ASSERT_NE(nullptr, flush);
+    nsids.insert(flush->cmd.nsid);
+  }
+  EXPECT_EQ(nullptr, group_.NextFlush());
+  std::set<uint32_t> expected = {1, 2, kBroadcastNsid};
+  EXPECT_EQ(expected, nsids);
+  for (NvmeAsyncRequest* flush : flushes) {
+    FlushWaiter* covered = group_.Done(flush);
+    ASSERT_NE(nullptr, covered);
+    EXPECT_EQ(nullptr, covered->next);
+  }
+  EXPECT_FALSE(group_.Pending());
+}
+
+TEST_F(FlushGroupTest, ShouldResendFlushesThatFailedToSubmit) {
+  Sync first, second;
+  ASSERT_TRUE(group_.Join(3, &first.waiter));
+  NvmeAsyncRequest* flush = group_.NextFlush();
+  ASSERT_NE(nullptr, flush);
+  group_.SubmitFailed(flush);
+  EXPECT_TRUE(group_.Queued());
+
+  // Waiters queued meanwhile share the resent Flush
+  ASSERT_TRUE(group_.Join(3, &second.waiter));
+  flush = group_.NextFlush();
+  ASSERT_NE(nullptr, flush);
+  std::set<NvmeAsyncRequest*> expected = {&first.request, &second.request};
+  EXPECT_EQ(expected, Requests(group_.Done(flush)));
+  EXPECT_FALSE(group_.Pending());
+}
+
+TEST_F(FlushGroupTest, ShouldRefuseNamespacesWithoutAGroup) {
+  Sync sync;
+  EXPECT_FALSE(group_.Join(0, &sync.waiter));
+  EXPECT_FALSE(group_.Join(FlushGroup::kMaxFlushGroupNsid + 1, &sync.waiter));
+  EXPECT_FALSE(group_.Pending());
+
+  group_.Destroy();
+  EXPECT_FALSE(group_.enabled());
+  EXPECT_FALSE(group_.Join(1, &sync.waiter));
+}
+
+}  // namespace
@@ -0,0 +1,488 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "third_party/e2e/nvme_emulator.h"
+
+#include <errno.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "lib/translator/common.h"
+#include "third_party/e2e/engine.h"
+#include "third_party/e2e/nvme_driver.h"
+
+namespace {
+
+constexpr uint32_t kPageSize = 4096;
+constexpr uint32_t kBlockSize = 512;
+
+class NvmeEmulatorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    NvmeEmulatorConfig config = kDefaultNvmeEmulatorConfig;
+    config.block_count = 1024;
+    ASSERT_EQ(0, nvme_emulator_init(config));
+  }
+
+  void TearDown() override { nvme_emulator_exit(); }
+
+  static void Done(NvmeAsyncRequest* request) {
+    ++*static_cast<std::atomic<int>*>(request->priv);
+  }
+
+  // Submits request and waits for its completion. Returns the status code
+  // without the phase tag
+  uint16_t Run(NvmeAsyncRequest& request, void* buffer, uint32_t len,
+               bool is_admin = false) {
+    std::atomic<int> done_count(0);
+    request.done = Done;
+    request.priv = &done_count;
+    int ret = is_admin ? submit_admin_command(&request, buffer, len, 0)
+                       : submit_io_command(&request, buffer, len, 0,
+                                           NVME_ANY_HW_QUEUE);
+    EXPECT_EQ(0, ret);
+    while (done_count == 0) std::this_thread::yield();
+    return request.cpl.status >> 1;
+  }
+
+  static NvmeAsyncRequest IoRequest(nvme::NvmOpcode opc, uint64_t slba,
+                                    uint16_t block_count) {
+    NvmeAsyncRequest request = {};
+    request.cmd.opcode = static_cast<uint8_t>(opc);
+    request.cmd.nsid = 1;
+    request.cmd.cdw3[0] = slba;
+    request.cmd.cdw3[1] = slba >> 32;
+    request.cmd.cdw3[2] = block_count - 1;
+    return request;
+  }
+};
+
+TEST_F(NvmeEmulatorTest, ShouldIdentifyControllerAndNamespace) {
+  alignas(kPageSize) static uint8_t buffer[kPageSize];
+  NvmeAsyncRequest request = {};
+  request.cmd.opcode = static_cast<uint8_t>(nvme::AdminOpcode::kIdentify);
+  request.cmd.cdw3[0] = 0x1;
+  ASSERT_EQ(0, Run(request, buffer, sizeof(buffer), true));
+  nvme::IdentifyControllerData identify_ctrl;
+  memcpy(&identify_ctrl, buffer, sizeof(identify_ctrl));
+  EXPECT_EQ(1, identify_ctrl.nn);
+  EXPECT_EQ(1, identify_ctrl.vwc.present);
+  EXPECT_EQ(0b11, identify_ctrl.vwc.flush_broadcast);
+  EXPECT_EQ(1, identify_ctrl.oncs.dsm);
+
+  request.cmd.nsid = 1;
+  request.cmd.cdw3[0] = 0x0;
+  ASSERT_EQ(0, Run(request, buffer, sizeof(buffer), true));
+  nvme::IdentifyNamespace identify_ns;
+  memcpy(&identify_ns, buffer, sizeof(identify_ns));
+  EXPECT_EQ(1024, identify_ns.nsze);
+  EXPECT_EQ(9, identify_ns.lbaf[0].lbads);
+
+  request.cmd.nsid = 2;
+  EXPECT_NE(0, Run(request, buffer, sizeof(buffer), true));
+}
+
+TEST_F(NvmeEmulatorTest, ShouldReadWhatWasWritten) {
+  uint8_t out[2 * kBlockSize];
+  for (uint32_t i = 0; i < sizeof(out); ++i) out[i] = i * 7;
+  NvmeAsyncRequest write = IoRequest(nvme::NvmOpcode::kWrite, 10, 2);
+  ASSERT_EQ(0, Run(write, out, sizeof(out)));
+
+  uint8_t in[2 * kBlockSize] = {};
+  NvmeAsyncRequest read = IoRequest(nvme::NvmOpcode::kRead, 10, 2);
+  ASSERT_EQ(0, Run(read, in, sizeof(in)));
+  EXPECT_EQ(0, memcmp(in, out, sizeof(in)));
+
+  NvmeAsyncRequest compare = IoRequest(nvme::NvmOpcode::kCompare, 10, 2);
+  EXPECT_EQ(0, Run(compare, out, sizeof(out)));
+  out[kBlockSize] ^= 1;
+  EXPECT_NE(0, Run(compare, out, sizeof(out)));
+}
+
+TEST_F(NvmeEmulatorTest, ShouldReadAndWriteDataSegments) {
+  uint8_t first[100];
+  uint8_t second[kBlockSize];
+  NvmeDataSegment segments[] = {
+      {.addr = reinterpret_cast<uint64_t>(first), .len = sizeof(first)},
+      {.addr = reinterpret_cast<uint64_t>(second), .len = sizeof(second)}};
+  for (uint32_t i = 0; i < sizeof(second); ++i) second[i] = i;
+  std::atomic<int> done_count(0);
+  NvmeAsyncRequest write = IoRequest(nvme::NvmOpcode::kWrite, 0, 1);
+  write.done = Done;
+  write.priv = &done_count;
+  // The block starts at second
+  ASSERT_EQ(0, submit_io_command_segments(&write, segments, 2, sizeof(first),
+                                          kBlockSize, 0, NVME_ANY_HW_QUEUE));
+  EXPECT_EQ(1, done_count);
+  EXPECT_EQ(0, write.cpl.status);
+
+  uint8_t in[kBlockSize] = {};
+  NvmeAsyncRequest read = IoRequest(nvme::NvmOpcode::kRead, 0, 1);
+  ASSERT_EQ(0, Run(read, in, sizeof(in)));
+  EXPECT_EQ(0, memcmp(in, second, sizeof(in)));
+}
+
+TEST_F(NvmeEmulatorTest, ShouldZeroDeallocatedBlocks) {
+  uint8_t out[4 * kBlockSize];
+  memset(out, 0xab, sizeof(out));
+  NvmeAsyncRequest write = IoRequest(nvme::NvmOpcode::kWrite, 0, 4);
+  ASSERT_EQ(0, Run(write, out, sizeof(out)));
+
+  nvme::DatasetManagmentRange range = {};
+  range.lba = 1;
+  range.lb_count = 1;
+  NvmeAsyncRequest dsm = {};
+  dsm.cmd.opcode = static_cast<uint8_t>(nvme::NvmOpcode::kDatasetManagement);
+  dsm.cmd.nsid = 1;
+  dsm.cmd.cdw3[1] = 1 << 2;  // Deallocate
+  ASSERT_EQ(0, Run(dsm, &range, sizeof(range)));
+  NvmeAsyncRequest write_zeroes =
+      IoRequest(nvme::NvmOpcode::kWriteZeroes, 3, 1);
+  ASSERT_EQ(0, Run(write_zeroes, nullptr, 0));
+
+  uint8_t in[4 * kBlockSize];
+  NvmeAsyncRequest read = IoRequest(nvme::NvmOpcode::kRead, 0, 4);
+  ASSERT_EQ(0, Run(read, in, sizeof(in)));
+  uint8_t zeroes[kBlockSize] = {};
+  EXPECT_EQ(0, memcmp(in, out, kBlockSize));
+  EXPECT_EQ(0, memcmp(in + kBlockSize, zeroes, kBlockSize));
+  EXPECT_EQ(0, memcmp(in + 2 * kBlockSize, out, kBlockSize));
+  EXPECT_EQ(0, memcmp(in + 3 * kBlockSize, zeroes, kBlockSize));
+}
+
+TEST_F(NvmeEmulatorTest, ShouldRejectBlocksOutsideTheNamespace) {
+  uint8_t in[2 * kBlockSize];
+  NvmeAsyncRequest read = IoRequest(nvme::NvmOpcode::kRead, 1023, 2);
+  EXPECT_EQ(
+      static_cast<uint16_t>(nvme::GenericCommandStatusCode::kLbaOutOfRange),
+      Run(read, in, sizeof(in)));
+}
+
+TEST(NvmeEmulator, ShouldDelayCompletionsAndLimitQueueDepth) {
+  NvmeEmulatorConfig config = kDefaultNvmeEmulatorConfig;
+  config.block_count = 8;
+  config.latency_ns = 1000000;
+  config.io_queue_depth = 1;
+  ASSERT_EQ(0, nvme_emulator_init(config));
+
+  std::atomic<int> done_count(0);
+  NvmeAsyncRequest flush = {};
+  flush.cmd.opcode = static_cast<uint8_t>(nvme::NvmOpcode::kFlush);
+  flush.cmd.nsid = 1;
+  flush.done = [](NvmeAsyncRequest* request) {
+    ++*static_cast<std::atomic<int>*>(request->priv);
+  };
+  flush.priv = &done_count;
+  auto start = std::chrono::steady_clock::now();
+  ASSERT_EQ(0, submit_io_command(&flush, nullptr, 0, 0, 0));
+  NvmeAsyncRequest second = flush;
+  EXPECT_EQ(-EAGAIN, submit_io_command(&second, nullptr, 0, 0, 0));
+  while (done_count == 0) std::this_thread::yield();
+  EXPECT_GE(std::chrono::steady_clock::now() - start,
+            std::chrono::nanoseconds(config.latency_ns));
+  EXPECT_EQ(0, submit_io_command(&second, nullptr, 0, 0, 0));
+  nvme_emulator_exit();
+  EXPECT_EQ(2, done_count);
+}
+
+// Runs SCSI commands through the engine against the emulator
+TEST_F(NvmeEmulatorTest, ShouldRunScsiCommandsThroughTheEngine) {
+  SetEngineCallbacks();
+  alignas(kPageSize) static uint8_t scratch_page[kPageSize];
+  static uint64_t context[1024];
+  ASSERT_LE(ScsiToNvmeContextSize(), sizeof(context));
+  uint8_t sense[96];
+  static std::atomic<int> status;
+  ScsiToNvmeDone done = [](void* priv, ScsiToNvmeResponse resp) {
+    status = resp.return_code;
+  };
+
+  // Read Capacity caches the block size for Read and Write
+  uint8_t read_capacity[sizeof(scsi::ReadCapacity10Command) + 1] = {
+      static_cast<uint8_t>(scsi::OpCode::kReadCapacity10)};
+  scsi::ReadCapacity10Data capacity = {};
+  status = -1;
+  ASSERT_EQ(0, ScsiToNvme(context, scratch_page, read_capacity,
+                          sizeof(read_capacity), 0, sense, sizeof(sense),
+                          reinterpret_cast<uint8_t*>(&capacity), nullptr, 0,
+                          sizeof(capacity), true, NVME_ANY_HW_QUEUE, done,
+                          nullptr));
+  EXPECT_EQ(0, status);
+  EXPECT_EQ(kBlockSize, capacity.block_length.value());
+
+  uint8_t out[kBlockSize];
+  for (uint32_t i = 0; i < sizeof(out); ++i) out[i] = i;
+  scsi::Write10Command write = {};
+  write.logical_block_address = 5;
+  write.transfer_length = 1;
+  uint8_t write_cdb[sizeof(write) + 1] = {
+      static_cast<uint8_t>(scsi::OpCode::kWrite10)};
+  memcpy(write_cdb + 1, &write, sizeof(write));
+  status = -1;
+  ASSERT_EQ(0, ScsiToNvme(context, scratch_page, write_cdb, sizeof(write_cdb),
+                          0, sense, sizeof(sense), out, nullptr, 0,
+                          sizeof(out), false, NVME_ANY_HW_QUEUE, done,
+                          nullptr));
+  EXPECT_EQ(0, status);
+
+  uint8_t in[kBlockSize] = {};
+  NvmeDataSegment segment = {.addr = reinterpret_cast<uint64_t>(in),
+                             .len = sizeof(in)};
+  scsi::Read10Command read = {};
+  read.logical_block_address = 5;
+  read.transfer_length = 1;
+  uint8_t read_cdb[sizeof(read) + 1] = {
+      static_cast<uint8_t>(scsi::OpCode::kRead10)};
+  memcpy(read_cdb + 1, &read, sizeof(read));
+  ASSERT_TRUE(ScsiToNvmeIsDirect(read_cdb, sizeof(read_cdb)));
+  status = -1;
+  ASSERT_EQ(0, ScsiToNvme(context, scratch_page, read_cdb, sizeof(read_cdb),
+                          0, sense, sizeof(sense), nullptr, &segment, 1,
+                          sizeof(in), true, NVME_ANY_HW_QUEUE, done, nullptr));
+  EXPECT_EQ(0, status);
+  EXPECT_EQ(0, memcmp(in, out, sizeof(in)));
+  ReleaseEngine();
+}
+
+TEST_F(NvmeEmulatorTest, ShouldWriteSameThroughTheEngine) {
+  SetEngineCallbacks();
+  alignas(kPageSize) static uint8_t scratch_page[kPageSize];
+  static uint64_t context[1024];
+  uint8_t sense[96];
+  static std::atomic<int> status;
+  ScsiToNvmeDone done = [](void* priv, ScsiToNvmeResponse resp) {
+    status = resp.return_code;
+  };
+  auto run = [&](uint8_t* cdb, uint32_t cdb_len, uint8_t* data,
+                 uint32_t data_len, bool is_data_in) {
+    status = -1;
+    EXPECT_EQ(0, ScsiToNvme(context, scratch_page, cdb, cdb_len, 0, sense,
+                            sizeof(sense), data, nullptr, 0, data_len,
+                            is_data_in, NVME_ANY_HW_QUEUE, done, nullptr));
+    while (status == -1) std::this_thread::yield();
+    return status.load();
+  };
+
+  // Inquiry identifies the controller's Write Zeroes support, and Read
+  // Capacity caches the block size
+  uint8_t inquiry_cdb[6] = {static_cast<uint8_t>(scsi::OpCode::kInquiry), 0,
+                            0, 0, 36};
+  uint8_t inquiry[36];
+  ASSERT_EQ(0, run(inquiry_cdb, sizeof(inquiry_cdb), inquiry,
+                   sizeof(inquiry), true));
+  uint8_t read_capacity_cdb[10] = {
+      static_cast<uint8_t>(scsi::OpCode::kReadCapacity10)};
+  scsi::ReadCapacity10Data capacity = {};
+  ASSERT_EQ(0, run(read_capacity_cdb, sizeof(read_capacity_cdb),
+                   reinterpret_cast<uint8_t*>(&capacity), sizeof(capacity),
+                   true));
+
+  // Blocks 10 to 309 get the pattern, over several NVMe Writes
+  uint8_t pattern[kBlockSize];
+  for (uint32_t i = 0; i < sizeof(pattern); ++i) pattern[i] = i * 3 + 1;
+  uint8_t write_same_10[10] = {
+      static_cast<uint8_t>(scsi::OpCode::kWriteSame10)};
+  write_same_10[5] = 10;
+  write_same_10[7] = 300 >> 8;
+  write_same_10[8] = 300 & 0xff;
+  ASSERT_EQ(0, run(write_same_10, sizeof(write_same_10), pattern,
+                   sizeof(pattern), false));
+
+  // Blocks 12 and 13 are unmapped without a data out buffer
+  uint8_t write_same_16[16] = {
+      static_cast<uint8_t>(scsi::OpCode::kWriteSame16), 0b1001};
+  write_same_16[9] = 12;
+  write_same_16[13] = 2;
+  ASSERT_EQ(0, run(write_same_16, sizeof(write_same_16), nullptr, 0, false));
+
+  static uint8_t in[300 * kBlockSize];
+  memset(in, 0xff, sizeof(in));
+  NvmeDataSegment segment = {.addr = reinterpret_cast<uint64_t>(in),
+                             .len = sizeof(in)};
+  uint8_t read_cdb[10] = {static_cast<uint8_t>(scsi::OpCode::kRead10)};
+  read_cdb[5] = 10;
+  read_cdb[7] = 300 >> 8;
+  read_cdb[8] = 300 & 0xff;
+  status = -1;
+  ASSERT_EQ(0, ScsiToNvme(context, scratch_page, read_cdb, sizeof(read_cdb),
+                          0, sense, sizeof(sense), nullptr, &segment, 1,
+                          sizeof(in), true, NVME_ANY_HW_QUEUE, done, nullptr));
+  while (status == -1) std::this_thread::yield();
+  ASSERT_EQ(0, status);
+  uint8_t zeroes[kBlockSize] = {};
+  for (uint32_t i = 0; i < 300; ++i) {
+    const uint8_t* expected = i == 2 || i == 3 ? zeroes : pattern;
+    EXPECT_EQ(0, memcmp(expected, in + i * kBlockSize, kBlockSize)) << i;
+  }
+  ReleaseEngine();
+}
+
+TEST_F(NvmeEmulatorTest, ShouldReadCapacity16ThroughTheEngine) {
+  SetEngineCallbacks();
+  alignas(kPageSize) static uint8_t scratch_page[kPageSize];
+  static uint64_t context[1024];
+  uint8_t sense[96];
+  static std::atomic<int> status;
+  ScsiToNvmeDone done = [](void* priv, ScsiToNvmeResponse resp) {
+    status = resp.return_code;
+  };
+  auto run = [&](uint8_t* cdb, uint32_t cdb_len, uint8_t* data,
+                 uint32_t data_len) {
+    status = -1;
+    EXPECT_EQ(0, ScsiToNvme(context, scratch_page, cdb, cdb_len, 0, sense,
+                            sizeof(sense), data, nullptr, 0, data_len, true,
+                            NVME_ANY_HW_QUEUE, done, nullptr));
+    while (status == -1) std::this_thread::yield();
+    return status.load();
+  };
+
+  // Inquiry identifies the controller's Dataset Management support
+  uint8_t inquiry_cdb[6] = {static_cast<uint8_t>(scsi::OpCode::kInquiry), 0,
+                            0, 0, 36};
+  uint8_t inquiry[36];
+  ASSERT_EQ(0, run(inquiry_cdb, sizeof(inquiry_cdb), inquiry,
+                   sizeof(inquiry)));
+
+  uint8_t read_capacity_cdb[16] = {
+      static_cast<uint8_t>(scsi::OpCode::kServiceActionIn),
+      static_cast<uint8_t>(scsi::ServiceActionIn16::kReadCapacity16)};
+  read_capacity_cdb[13] = sizeof(scsi::ReadCapacity16Data);
+  scsi::ReadCapacity16Data capacity = {};
+  ASSERT_EQ(0, run(read_capacity_cdb, sizeof(read_capacity_cdb),
+                   reinterpret_cast<uint8_t*>(&capacity), sizeof(capacity)));
+  EXPECT_EQ(1023, capacity.returned_logical_block_address.value());
+  EXPECT_EQ(kBlockSize, capacity.block_length.value());
+  EXPECT_TRUE(capacity.lbpme);
+  EXPECT_TRUE(capacity.lbprz);
+  ReleaseEngine();
+}
+
+// Unmap completes before the device deallocates its blocks, and commands
+// that touch them wait until it has
+TEST(NvmeEmulator, ShouldDeallocateUnmappedBlocksInTheBackground) {
+  NvmeEmulatorConfig config = kDefaultNvmeEmulatorConfig;
+  config.block_count = 1024;
+  config.latency_ns = 1000000;
+  ASSERT_EQ(0, nvme_emulator_init(config));
+  SetEngineCallbacks();
+  ScsiToNvmeDiscardConfig discard_config = {.early_ack = true,
+                                            .max_ranges = 16,
+                                            .max_foreground = 0,
+                                            .batch_interval_ns = 0};
+  ASSERT_EQ(0, SetScsiToNvmeDiscardConfig(&discard_config));
+  alignas(kPageSize) static uint8_t scratch_page[kPageSize];
+  static uint64_t context[1024];
+  uint8_t sense[96];
+  static std::atomic<int> status;
+  ScsiToNvmeDone done = [](void* priv, ScsiToNvmeResponse resp) {
+    status = resp.return_code;
+  };
+  auto wait = [] {
+    while (status == -1) std::this_thread::yield();
+    return status.load();
+  };
+
+  uint8_t out[kBlockSize];
+  memset(out, 0xab, sizeof(out));
+  uint8_t write_cdb[10] = {static_cast<uint8_t>(scsi::OpCode::kWrite10)};
+  write_cdb[5] = 5;
+  write_cdb[8] = 1;
+  status = -1;
+  ASSERT_EQ(0, ScsiToNvme(context, scratch_page, write_cdb, sizeof(write_cdb),
+                          0, sense, sizeof(sense), out, nullptr, 0,
+                          sizeof(out), false, NVME_ANY_HW_QUEUE, done,
+                          nullptr));
+  ASSERT_EQ(0, wait());
+
+  uint8_t unmap_cdb[10] = {static_cast<uint8_t>(scsi::OpCode::kUnmap)};
+  unmap_cdb[8] = 24;
+  uint8_t params[24] = {0, 22, 0, 16};
+  params[15] = 5;  // LBA
+  params[19] = 1;  // Block count
+  status = -1;
+  ASSERT_EQ(0, ScsiToNvme(context, scratch_page, unmap_cdb, sizeof(unmap_cdb),
+                          0, sense, sizeof(sense), params, nullptr, 0,
+                          sizeof(params), false, NVME_ANY_HW_QUEUE, done,
+                          nullptr));
+  // Completed without waiting for the device's latency
+  EXPECT_EQ(0, status);
+  EXPECT_TRUE(ScsiToNvmeDiscardsPending());
+
+  uint8_t in[kBlockSize];
+  memset(in, 0xff, sizeof(in));
+  uint8_t read_cdb[10] = {static_cast<uint8_t>(scsi::OpCode::kRead10)};
+  read_cdb[5] = 5;
+  read_cdb[8] = 1;
+  auto read = [&] {
+    return ScsiToNvme(context, scratch_page, read_cdb, sizeof(read_cdb), 0,
+                      sense, sizeof(sense), in, nullptr, 0, sizeof(in), true,
+                      NVME_ANY_HW_QUEUE, done, nullptr);
+  };
+  status = -1;
+  EXPECT_EQ(-EBUSY, read());
+  while (ScsiToNvmeDiscardsPending()) std::this_thread::yield();
+  ASSERT_EQ(0, read());
+  ASSERT_EQ(0, wait());
+  uint8_t zeroes[kBlockSize] = {};
+  EXPECT_EQ(0, memcmp(in, zeroes, sizeof(in)));
+
+  ReleaseEngine();
+  nvme_emulator_exit();
+}
+
+// Synchronize Cache commands that arrive while a Flush is in flight share
+// the next one
+TEST(NvmeEmulator, ShouldGroupConcurrentFlushes) {
+  NvmeEmulatorConfig config = kDefaultNvmeEmulatorConfig;
+  config.block_count = 1024;
+  config.latency_ns = 1000000;
+  ASSERT_EQ(0, nvme_emulator_init(config));
+  SetEngineCallbacks();
+  ScsiToNvmeFlushConfig flush_config = {.group = true, .broadcast = false};
+  ASSERT_EQ(0, SetScsiToNvmeFlushConfig(&flush_config));
+  alignas(kPageSize) static uint8_t scratch_page[kPageSize];
+  constexpr int kSyncCount = 4;
+  static uint64_t contexts[kSyncCount][1024];
+  uint8_t sense[96];
+  static std::atomic<int> done_count;
+  static std::atomic<int> failed_count;
+  ScsiToNvmeDone done = [](void* priv, ScsiToNvmeResponse resp) {
+    if (resp.return_code != 0) ++failed_count;
+    ++done_count;
+  };
+  done_count = 0;
+  failed_count = 0;
+
+  uint8_t sync_cdb[10] = {static_cast<uint8_t>(scsi::OpCode::kSync10)};
+  for (int i = 0; i < kSyncCount; ++i) {
+    ASSERT_EQ(0, ScsiToNvme(contexts[i], scratch_page, sync_cdb,
+                            sizeof(sync_cdb), 0, sense, sizeof(sense),
+                            nullptr, nullptr, 0, 0, false, NVME_ANY_HW_QUEUE,
+                            done, nullptr));
+  }
+  while (done_count != kSyncCount) std::this_thread::yield();
+  EXPECT_EQ(0, failed_count);
+  // The first Flush was in flight when the others arrived, so they could
+  // not rely on it
+  EXPECT_EQ(2, nvme_emulator_flush_count());
+
+  ReleaseEngine();
+  nvme_emulator_exit();
+}
+
+}  // namespace
@@ -0,0 +1,208 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "third_party/e2e/trace_file.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "lib/translator/common.h"
+#include "third_party/e2e/engine.h"
+#include "third_party/e2e/nvme_driver.h"
+#include "third_party/e2e/nvme_emulator.h"
+
+namespace {
+
+constexpr uint32_t kPageSize = 4096;
+
+std::string TempPath(const char* name) {
+  return ::testing::TempDir() + "/" + name;
+}
+
+void WriteText(const std::string& path, const char* text) {
+  FILE* file = fopen(path.c_str(), "w");
+  ASSERT_NE(nullptr, file);
+  fputs(text, file);
+  fclose(file);
+}
+
+ScsiTraceRecord Record(uint64_t timestamp_ns, uint8_t opcode,
+                       uint32_t data_len, ScsiTraceDirection direction) {
+  ScsiTraceRecord record = {};
+  record.timestamp_ns = timestamp_ns;
+  record.data_len = data_len;
+  record.direction = direction;
+  record.cdb_len = 10;
+  record.cdb[0] = opcode;
+  return record;
+}
+
+TEST(TraceFile, ShouldReadWhatWasWritten) {
+  std::string path = TempPath("round_trip.trace");
+  ScsiTraceRecord read = Record(100, 0x28, 4096, SCSI_TRACE_DATA_IN);
+  read.lun = 3;
+  ScsiTraceRecord unmap = Record(250, 0x42, 24, SCSI_TRACE_DATA_OUT);
+  unmap.payload_len = 24;
+  uint8_t payload[24];
+  for (uint32_t i = 0; i < sizeof(payload); ++i) payload[i] = i + 1;
+
+  ScsiTraceWriter writer;
+  ASSERT_TRUE(writer.Open(path.c_str()));
+  ASSERT_TRUE(writer.Write(read, nullptr));
+  ASSERT_TRUE(writer.Write(unmap, payload));
+  ASSERT_TRUE(writer.Close());
+
+  std::vector<ScsiTraceCommand> commands;
+  ASSERT_TRUE(ReadScsiTrace(path.c_str(), commands));
+  ASSERT_EQ(2, commands.size());
+  EXPECT_EQ(0, memcmp(&read, &commands[0].record, sizeof(read)));
+  EXPECT_TRUE(commands[0].payload.empty());
+  EXPECT_EQ(0, memcmp(&unmap, &commands[1].record, sizeof(unmap)));
+  ASSERT_EQ(sizeof(payload), commands[1].payload.size());
+  EXPECT_EQ(0, memcmp(payload, commands[1].payload.data(), sizeof(payload)));
+}
+
+TEST(TraceFile, ShouldRejectTruncatedAndForeignFiles) {
+  std::string path = TempPath("truncated.trace");
+  ScsiTraceWriter writer;
+  ASSERT_TRUE(writer.Open(path.c_str()));
+  ASSERT_TRUE(writer.Write(Record(0, 0x00, 0, SCSI_TRACE_NO_DATA), nullptr));
+  ASSERT_TRUE(writer.Close());
+  ASSERT_EQ(0, truncate(path.c_str(), sizeof(ScsiTraceFileHeader) +
+                                          sizeof(ScsiTraceRecord) - 1));
+  std::vector<ScsiTraceCommand> commands;
+  EXPECT_FALSE(ReadScsiTrace(path.c_str(), commands));
+
+  WriteText(path, "0.1 0 in 8 12 00 00 00 08 00\n");
+  EXPECT_FALSE(ReadScsiTrace(path.c_str(), commands));
+}
+
+TEST(TraceFile, ShouldImportTextLogs) {
+  std::string path = TempPath("import.txt");
+  WriteText(path,
+            "# seconds lun direction data_len cdb\n"
+            "0.000125 2 in 4096 28 00 00 00 10 00 00 00 08 00\n"
+            "0.5 0 none 0 00 00 00 00 00 00\n"
+            "  8,0    3        1     0.750000000  4110  Q   R 255 (12 00 00 "
+            "00 ff 00) [sg_inq]\n"
+            "  8,0    3        2     0.750001000  4110  D   R 255 (12 00 00 "
+            "00 ff 00) [sg_inq]\n"
+            "  8,0    3        3     0.800000000  4110  D  WS 24 (42 00 00 "
+            "00 00 00 00 00 18 00) [sg_unmap]\n"
+            "CPU0 (8,0):\n");
+  std::vector<ScsiTraceCommand> commands;
+  ASSERT_TRUE(ImportTextTrace(path.c_str(), commands));
+  ASSERT_EQ(4, commands.size());
+
+  const ScsiTraceRecord& read = commands[0].record;
+  EXPECT_EQ(125000, read.timestamp_ns);
+  EXPECT_EQ(2, read.lun);
+  EXPECT_EQ(SCSI_TRACE_DATA_IN, read.direction);
+  EXPECT_EQ(4096, read.data_len);
+  EXPECT_EQ(10, read.cdb_len);
+  EXPECT_EQ(0x28, read.cdb[0]);
+  EXPECT_EQ(0x08, read.cdb[8]);
+
+  EXPECT_EQ(SCSI_TRACE_NO_DATA, commands[1].record.direction);
+  EXPECT_EQ(6, commands[1].record.cdb_len);
+
+  const ScsiTraceRecord& inquiry = commands[2].record;
+  EXPECT_EQ(750001000, inquiry.timestamp_ns);
+  EXPECT_EQ(SCSI_TRACE_DATA_IN, inquiry.direction);
+  EXPECT_EQ(255, inquiry.data_len);
+  EXPECT_EQ(6, inquiry.cdb_len);
+  EXPECT_EQ(0xff, inquiry.cdb[4]);
+
+  EXPECT_EQ(SCSI_TRACE_DATA_OUT, commands[3].record.direction);
+  EXPECT_EQ(0x42, commands[3].record.cdb[0]);
+}
+
+TEST(TraceFile, ShouldRejectMalformedCdb) {
+  std::string path = TempPath("malformed.txt");
+  WriteText(path, "0.1 0 in 8 12 00 zz 00 08 00\n");
+  std::vector<ScsiTraceCommand> commands;
+  EXPECT_FALSE(ImportTextTrace(path.c_str(), commands));
+}
+
+// Records the commands the engine hands to its trace hook
+void Collect(void* priv, const ScsiTraceRecord* record,
+             const unsigned char* payload) {
+  ScsiTraceCommand command = {*record};
+  command.payload.assign(payload, payload + record->payload_len);
+  static_cast<std::vector<ScsiTraceCommand>*>(priv)->push_back(command);
+}
+
+TEST(TraceFile, ShouldCaptureCommandsFromTheEngine) {
+  NvmeEmulatorConfig config = kDefaultNvmeEmulatorConfig;
+  config.block_count = 1024;
+  ASSERT_EQ(0, nvme_emulator_init(config));
+  SetEngineCallbacks();
+  std::vector<ScsiTraceCommand> commands;
+  SetScsiToNvmeTraceHook(Collect, &commands);
+
+  alignas(kPageSize) static uint8_t scratch_page[kPageSize];
+  static uint64_t context[1024];
+  ASSERT_LE(ScsiToNvmeContextSize(), sizeof(context));
+  uint8_t sense[96];
+  ScsiToNvmeDone done = [](void* priv, ScsiToNvmeResponse resp) {};
+
+  uint8_t tur[6] = {static_cast<uint8_t>(scsi::OpCode::kTestUnitReady)};
+  ASSERT_EQ(0, ScsiToNvme(context, scratch_page, tur, sizeof(tur), 4, sense,
+                          sizeof(sense), nullptr, nullptr, 0, 0, false,
+                          NVME_ANY_HW_QUEUE, done, nullptr));
+
+  // Write data is not captured, even from a bounce buffer
+  uint8_t write_cdb[10] = {static_cast<uint8_t>(scsi::OpCode::kWrite10)};
+  write_cdb[8] = 1;
+  uint8_t data[512] = {0xab};
+  ASSERT_EQ(0, ScsiToNvme(context, scratch_page, write_cdb, sizeof(write_cdb),
+                          0, sense, sizeof(sense), data, nullptr, 0,
+                          sizeof(data), false, NVME_ANY_HW_QUEUE, done,
+                          nullptr));
+
+  // Unmap parameter lists are
+  uint8_t unmap_cdb[10] = {static_cast<uint8_t>(scsi::OpCode::kUnmap)};
+  unmap_cdb[8] = 24;
+  uint8_t params[24] = {0, 22, 0, 16};
+  params[23] = 8;
+  ASSERT_EQ(0, ScsiToNvme(context, scratch_page, unmap_cdb, sizeof(unmap_cdb),
+                          0, sense, sizeof(sense), params, nullptr, 0,
+                          sizeof(params), false, NVME_ANY_HW_QUEUE, done,
+                          nullptr));
+
+  SetScsiToNvmeTraceHook(nullptr, nullptr);
+  ReleaseEngine();
+  nvme_emulator_exit();
+
+  ASSERT_EQ(3, commands.size());
+  EXPECT_EQ(4, commands[0].record.lun);
+  EXPECT_EQ(SCSI_TRACE_NO_DATA, commands[0].record.direction);
+  EXPECT_EQ(sizeof(tur), commands[0].record.cdb_len);
+  EXPECT_LE(commands[0].record.timestamp_ns, commands[1].record.timestamp_ns);
+
+  EXPECT_EQ(SCSI_TRACE_DATA_OUT, commands[1].record.direction);
+  EXPECT_EQ(sizeof(data), commands[1].record.data_len);
+  EXPECT_EQ(0, commands[1].record.payload_len);
+  EXPECT_EQ(0, memcmp(write_cdb, commands[1].record.cdb, sizeof(write_cdb)));
+
+  ASSERT_EQ(sizeof(params), commands[2].payload.size());
+  EXPECT_EQ(0, memcmp(params, commands[2].payload.data(), sizeof(params)));
+}
+
+}  // namespace
@@ -0,0 +1,63 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "lib/endian.h"
+
+#include <cstring>
+
+#include "gtest/gtest.h"
+
+namespace {
+
+// Tests the BigEndian and LittleEndian classes
+
+TEST(BigEndianClass, ShouldStoreMostSignificantByteFirst) {
+  endian::BigEndian<uint32_t> field = 0x01020304;
+  uint8_t bytes[sizeof(field)];
+  memcpy(bytes, &field, sizeof(field));
+
+  EXPECT_EQ(0x01, bytes[0]);
+  EXPECT_EQ(0x02, bytes[1]);
+  EXPECT_EQ(0x03, bytes[2]);
+  EXPECT_EQ(0x04, bytes[3]);
+  EXPECT_EQ(0x01020304, field.value());
+}
+
+TEST(BigEndianClass, ShouldLoadFromRawBytes) {
+  const uint8_t bytes[] = {0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08};
+  endian::BigEndian<uint64_t> field;
+  memcpy(&field, bytes, sizeof(field));
+
+  EXPECT_EQ(0x0102030405060708, field.value());
+}
+
+TEST(LittleEndianClass, ShouldStoreLeastSignificantByteFirst) {
+  endian::LittleEndian<uint16_t> field = 0x0102;
+  uint8_t bytes[sizeof(field)];
+  memcpy(bytes, &field, sizeof(field));
+
+  EXPECT_EQ(0x02, bytes[0]);
+  EXPECT_EQ(0x01, bytes[1]);
+  EXPECT_EQ(0x0102, field.value());
+}
+
+TEST(ByteSwap, ShouldBeEvaluatedAtCompileTime) {
+  static_assert(endian::ByteSwap<uint16_t>(0x0102) == 0x0201);
+  static_assert(endian::ByteSwap<uint64_t>(0x0102030405060708) ==
+                0x0807060504030201);
+  static_assert(endian::BigEndian<uint32_t>(0xdeadbeef).value() == 0xdeadbeef);
+  SUCCEED();
+}
+
+}  // namespace
@@ -0,0 +1,65 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "lib/histogram.h"
+
+#include "gtest/gtest.h"
+
+namespace {
+
+// Tests the LogLinear bucketing
+
+using Buckets = histogram::LogLinear<3, 36>;
+
+TEST(LogLinear, ShouldGiveSmallValuesABucketEach) {
+  for (uint64_t value = 0; value < Buckets::kSubBuckets; ++value) {
+    EXPECT_EQ(value, Buckets::Bucket(value));
+    EXPECT_EQ(value, Buckets::BucketLimit(value));
+  }
+}
+
+TEST(LogLinear, ShouldKeepValuesWithinTheirBucket) {
+  for (uint64_t value = 1; value < (1ull << 36); value = value * 3 + 1) {
+    uint32_t bucket = Buckets::Bucket(value);
+    EXPECT_LE(value, Buckets::BucketLimit(bucket));
+    EXPECT_GT(value, Buckets::BucketLimit(bucket - 1));
+    // Buckets are at most an eighth of their values wide
+    EXPECT_LE(Buckets::BucketLimit(bucket) - Buckets::BucketLimit(bucket - 1),
+              value / 8 + 1);
+  }
+}
+
+TEST(LogLinear, ShouldClampLargeValues) {
+  EXPECT_EQ(Buckets::kBucketCount - 1, Buckets::Bucket(1ull << 36));
+  EXPECT_EQ(Buckets::kBucketCount - 1, Buckets::Bucket(UINT64_MAX));
+  EXPECT_EQ((1ull << 36) - 1, Buckets::BucketLimit(Buckets::kBucketCount - 1));
+}
+
+TEST(LogLinear, ShouldFindPercentiles) {
+  uint32_t counts[Buckets::kBucketCount] = {};
+  // 90 fast values and 10 slow ones
+  counts[Buckets::Bucket(1000)] = 90;
+  counts[Buckets::Bucket(100000)] = 10;
+  auto count = [&counts](uint32_t bucket) { return counts[bucket]; };
+
+  uint64_t fast = Buckets::BucketLimit(Buckets::Bucket(1000));
+  uint64_t slow = Buckets::BucketLimit(Buckets::Bucket(100000));
+  EXPECT_EQ(fast, Buckets::Percentile(count, 100, 500));
+  EXPECT_EQ(fast, Buckets::Percentile(count, 100, 900));
+  EXPECT_EQ(slow, Buckets::Percentile(count, 100, 990));
+  EXPECT_EQ(slow, Buckets::Percentile(count, 100, 1000));
+  EXPECT_EQ(0, Buckets::Percentile(count, 0, 500));
+}
+
+}  // namespace
@@ -37,6 +37,29 @@ TEST(Common, ShouldCorrectlyCallback) {
   translator::SetDebugCallback(debug_callback);
 }
 
+int logged_messages;
+
+TEST(Common, ShouldSkipMessagesBelowLogLevel) {
+  auto callback = [](const char* buf) { ++logged_messages; };
+  int evaluations = 0;
+  auto argument = [&evaluations]() { return ++evaluations; };
+  translator::SetDebugCallback(callback);
+  translator::SetLogLevel(translator::LogLevel::kWarning);
+
+  logged_messages = 0;
+  TRANSLATOR_LOG(kInfo, "Skipped %d", argument());
+  EXPECT_EQ(0, logged_messages);
+  EXPECT_EQ(0, evaluations);
+  TRANSLATOR_LOG(kError, "Logged %d", argument());
+  EXPECT_EQ(1, logged_messages);
+  EXPECT_EQ(1, evaluations);
+
+  translator::SetLogLevel(translator::LogLevel::kDebug);
+  translator::SetDebugCallback(nullptr);
+  TRANSLATOR_LOG(kError, "No callback %d", argument());
+  EXPECT_EQ(1, evaluations);
+}
+
 TEST(Common, ShouldNotReadValueFromSpan) {
   scsi::Read6Command cmd;
   uint8_t buffer[sizeof(scsi::Read6Command) - 1];
@@ -168,6 +191,110 @@ TEST(Common, ShouldFailBuildAllocationWhenAllocPageFails) {
   EXPECT_EQ(translator::StatusCode::kFailure, status_code);
 }
 
+TEST(Common, ShouldPlaceAllocationInScratchPage) {
+  alignas(4096) static uint8_t scratch[4096];
+  memset(scratch, 0xff, sizeof(scratch));
+  auto alloc_callback = [](uint32_t page_size, uint16_t count) -> uint64_t {
+    ADD_FAILURE() << "Scratch page should be used";
+    return 0;
+  };
+  auto dealloc_callback = [](uint64_t addr, uint16_t count) {
+    ADD_FAILURE() << "Scratch page should not be freed";
+  };
+  translator::SetAllocPageCallbacks(alloc_callback, dealloc_callback);
+
+  translator::Allocation allocation = {
+      .scratch_addr = reinterpret_cast<uint64_t>(scratch),
+      .scratch_page_count = 1};
+  ASSERT_EQ(translator::StatusCode::kSuccess, allocation.SetPages(4096, 1, 0));
+  EXPECT_EQ(reinterpret_cast<uint64_t>(scratch), allocation.data_addr);
+  EXPECT_EQ(0, scratch[0]);
+  EXPECT_EQ(0, scratch[4095]);
+
+  allocation.FreePages();
+  EXPECT_EQ(0, allocation.data_addr);
+  translator::SetAllocPageCallbacks(nullptr, nullptr);
+}
+
+TEST(Common, ShouldAllocateWhenScratchPageTooSmall) {
+  alignas(4096) static uint8_t scratch[4096];
+  auto alloc_callback = [](uint32_t page_size, uint16_t count) -> uint64_t {
+    EXPECT_EQ(2, count);
+    return 1337;
+  };
+  static uint64_t freed_addr;
+  auto dealloc_callback = [](uint64_t addr, uint16_t count) {
+    freed_addr = addr;
+  };
+  translator::SetAllocPageCallbacks(alloc_callback, dealloc_callback);
+
+  translator::Allocation allocation = {
+      .scratch_addr = reinterpret_cast<uint64_t>(scratch),
+      .scratch_page_count = 1};
+  ASSERT_EQ(translator::StatusCode::kSuccess, allocation.SetPages(4096, 2, 0));
+  EXPECT_EQ(1337, allocation.data_addr);
+
+  allocation.FreePages();
+  EXPECT_EQ(1337, freed_addr);
+  translator::SetAllocPageCallbacks(nullptr, nullptr);
+}
+
+TEST(Common, ShouldLendScratchPagesToNvmeCmdChain) {
+  translator::NvmeCmdChain chain;
+  chain.SetScratchPages(0x10000, 2);
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            chain.Resize(translator::kMaxCommandRatio, 4096));
+  EXPECT_EQ(0x10000, chain.allocation(0).scratch_addr);
+  EXPECT_EQ(1, chain.allocation(0).scratch_page_count);
+  EXPECT_EQ(0x11000, chain.allocation(1).scratch_addr);
+  EXPECT_EQ(1, chain.allocation(1).scratch_page_count);
+  EXPECT_EQ(0, chain.allocation(2).scratch_addr);
+  EXPECT_EQ(0, chain.allocation(2).scratch_page_count);
+}
+
+TEST(Common, ShouldKeepShortNvmeCmdChainInline) {
+  auto alloc_callback = [](uint32_t page_size, uint16_t count) -> uint64_t {
+    ADD_FAILURE() << "Chain should not allocate";
+    return 0;
+  };
+  void (*dealloc_callback)(uint64_t, uint16_t) = nullptr;
+  translator::SetAllocPageCallbacks(alloc_callback, dealloc_callback);
+
+  translator::NvmeCmdChain chain;
+  EXPECT_EQ(translator::StatusCode::kSuccess,
+            chain.Resize(translator::kMaxCommandRatio, 4096));
+  EXPECT_EQ(translator::kMaxCommandRatio, chain.size());
+  EXPECT_EQ(&chain.wrapper(1), chain.wrappers().data() + 1);
+}
+
+TEST(Common, ShouldSpillLongNvmeCmdChain) {
+  alignas(4096) static uint8_t pages[2][4096];
+  auto alloc_callback = [](uint32_t page_size, uint16_t count) -> uint64_t {
+    EXPECT_EQ(2, count);
+    return reinterpret_cast<uint64_t>(pages);
+  };
+  static uint16_t freed_count;
+  auto dealloc_callback = [](uint64_t addr, uint16_t count) {
+    EXPECT_EQ(reinterpret_cast<uint64_t>(pages), addr);
+    freed_count = count;
+  };
+  translator::SetAllocPageCallbacks(alloc_callback, dealloc_callback);
+
+  // Enough commands and allocations to need a second page
+  uint32_t size = 4096 / sizeof(translator::NvmeCmdWrapper) + 1;
+  translator::NvmeCmdChain chain;
+  ASSERT_EQ(translator::StatusCode::kSuccess, chain.Resize(size, 4096));
+  EXPECT_EQ(size, chain.size());
+  EXPECT_EQ(reinterpret_cast<uint64_t>(pages),
+            reinterpret_cast<uint64_t>(chain.wrappers().data()));
+  EXPECT_EQ(reinterpret_cast<uint64_t>(chain.wrappers().data() + size),
+            reinterpret_cast<uint64_t>(chain.allocations().data()));
+
+  chain.Release();
+  EXPECT_EQ(2, freed_count);
+  EXPECT_EQ(0, chain.size());
+}
+
 TEST(Common, SafePointerCastWrite) {
   uint32_t expected_val = 0x13292022;
 
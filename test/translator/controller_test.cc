@@ -0,0 +1,245 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "lib/translator/controller.h"
+
+#include "gtest/gtest.h"
+
+// Tests controller capability tracking
+namespace {
+
+TEST(Controller, ShouldDefaultToPrpsOnly) {
+  translator::Controller controller;
+  EXPECT_EQ(translator::kDefaultPageSize, controller.page_size());
+  EXPECT_FALSE(controller.SglSupported());
+}
+
+TEST(Controller, ShouldReadSglSupport) {
+  translator::Controller controller;
+  nvme::IdentifyControllerData data = {};
+
+  data.sgls.supported = 0b01;
+  controller.SetIdentifyControllerData(data);
+  EXPECT_TRUE(controller.SglSupported());
+  EXPECT_FALSE(controller.SglRequiresDwordAlignment());
+
+  data.sgls.supported = 0b10;
+  controller.SetIdentifyControllerData(data);
+  EXPECT_TRUE(controller.SglSupported());
+  EXPECT_TRUE(controller.SglRequiresDwordAlignment());
+
+  // Reserved value
+  data.sgls.supported = 0b11;
+  controller.SetIdentifyControllerData(data);
+  EXPECT_FALSE(controller.SglSupported());
+}
+
+TEST(Controller, ShouldReadMaxTransferSize) {
+  translator::Controller controller;
+  nvme::IdentifyControllerData data = {};
+  EXPECT_EQ(0, controller.MaxTransferBytes());
+
+  data.mdts = 5;
+  controller.SetIdentifyControllerData(data);
+  EXPECT_EQ(32 * translator::kDefaultPageSize, controller.MaxTransferBytes());
+
+  data.mdts = 0;
+  controller.SetIdentifyControllerData(data);
+  EXPECT_EQ(0, controller.MaxTransferBytes());
+}
+
+TEST(Controller, ShouldReadWriteZeroesSupport) {
+  translator::Controller controller;
+  nvme::IdentifyControllerData data = {};
+  EXPECT_FALSE(controller.WriteZeroesSupported());
+
+  data.oncs.write_zeroes = 1;
+  controller.SetIdentifyControllerData(data);
+  EXPECT_TRUE(controller.WriteZeroesSupported());
+
+  data.oncs.write_zeroes = 0;
+  controller.SetIdentifyControllerData(data);
+  EXPECT_FALSE(controller.WriteZeroesSupported());
+}
+
+TEST(Controller, ShouldReadDeallocateSupport) {
+  translator::Controller controller;
+  nvme::IdentifyControllerData data = {};
+  EXPECT_FALSE(controller.DeallocateSupported());
+
+  data.oncs.dsm = 1;
+  controller.SetIdentifyControllerData(data);
+  EXPECT_TRUE(controller.DeallocateSupported());
+}
+
+TEST(Controller, ShouldTrackVolatileWriteCache) {
+  translator::Controller controller;
+  nvme::IdentifyControllerData data = {};
+  // Flushes are only skipped once the controller is known not to need them
+  EXPECT_TRUE(controller.VolatileWriteCacheEnabled());
+
+  controller.SetIdentifyControllerData(data);
+  EXPECT_FALSE(controller.VolatileWriteCacheEnabled());
+
+  data.vwc.present = 1;
+  controller.SetIdentifyControllerData(data);
+  EXPECT_TRUE(controller.VolatileWriteCacheEnabled());
+
+  controller.SetVolatileWriteCacheEnabled(false);
+  EXPECT_FALSE(controller.VolatileWriteCacheEnabled());
+  controller.SetVolatileWriteCacheEnabled(true);
+  EXPECT_TRUE(controller.VolatileWriteCacheEnabled());
+}
+
+TEST(Controller, ShouldReadFlushBroadcastSupport) {
+  translator::Controller controller;
+  nvme::IdentifyControllerData data = {};
+  EXPECT_FALSE(controller.FlushBroadcastSupported());
+
+  // 01b: support is not reported
+  data.vwc.flush_broadcast = 0b01;
+  controller.SetIdentifyControllerData(data);
+  EXPECT_FALSE(controller.FlushBroadcastSupported());
+
+  data.vwc.flush_broadcast = 0b11;
+  controller.SetIdentifyControllerData(data);
+  EXPECT_TRUE(controller.FlushBroadcastSupported());
+}
+
+TEST(Controller, ShouldReadNamespaceGeometry) {
+  nvme::IdentifyNamespace identify_ns = {};
+  identify_ns.nsze = 0x123456789;
+  identify_ns.flbas.format = 2;
+  identify_ns.lbaf[2] = {.ms = 8, .lbads = 9};
+  identify_ns.dps.pit = 1;
+  identify_ns.dps.md_start = 1;
+  identify_ns.npdg = 7;
+  identify_ns.npda = 15;
+  identify_ns.npwg = 7;
+  identify_ns.dlfeat.bits.read_value = 1;
+
+  translator::NamespaceGeometry geometry = {};
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            translator::ReadNamespaceGeometry(identify_ns, geometry));
+  EXPECT_EQ(0x123456789, geometry.block_count);
+  EXPECT_EQ(9, geometry.lba_shift);
+  EXPECT_EQ(8, geometry.metadata_size);
+  EXPECT_EQ(1, geometry.pi_type);
+  EXPECT_TRUE(geometry.pi_first);
+  // NPDG and NPDA are only valid with NSFEAT OPTPERF set
+  EXPECT_EQ(0, geometry.dealloc_granularity);
+  EXPECT_EQ(0, geometry.dealloc_alignment);
+  EXPECT_EQ(0, geometry.physical_block_shift);
+  EXPECT_TRUE(geometry.dealloc_reads_zeroes);
+
+  identify_ns.nsfeat.opt_perf = 1;
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            translator::ReadNamespaceGeometry(identify_ns, geometry));
+  EXPECT_EQ(8, geometry.dealloc_granularity);
+  EXPECT_EQ(16, geometry.dealloc_alignment);
+  EXPECT_EQ(3, geometry.physical_block_shift);
+}
+
+TEST(Controller, ShouldReadPhysicalBlockShiftFromWriteGranularity) {
+  nvme::IdentifyNamespace identify_ns = {};
+  identify_ns.lbaf[0].lbads = 9;
+  identify_ns.nsfeat.opt_perf = 1;
+  translator::NamespaceGeometry geometry = {};
+
+  // Granularities that are not a power of two have no exponent
+  identify_ns.npwg = 5;
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            translator::ReadNamespaceGeometry(identify_ns, geometry));
+  EXPECT_EQ(0, geometry.physical_block_shift);
+
+  identify_ns.npwg = 0xffff;
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            translator::ReadNamespaceGeometry(identify_ns, geometry));
+  EXPECT_EQ(15, geometry.physical_block_shift);
+
+  // Only 001b reads back zeroes
+  identify_ns.dlfeat.bits.read_value = 2;
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            translator::ReadNamespaceGeometry(identify_ns, geometry));
+  EXPECT_FALSE(geometry.dealloc_reads_zeroes);
+}
+
+TEST(Controller, ShouldRejectUnsupportedBlockSize) {
+  nvme::IdentifyNamespace identify_ns = {};
+  translator::NamespaceGeometry geometry = {};
+
+  identify_ns.lbaf[0].lbads = 8;
+  EXPECT_EQ(translator::StatusCode::kFailure,
+            translator::ReadNamespaceGeometry(identify_ns, geometry));
+
+  identify_ns.lbaf[0].lbads = 32;
+  EXPECT_EQ(translator::StatusCode::kFailure,
+            translator::ReadNamespaceGeometry(identify_ns, geometry));
+}
+
+TEST(Controller, ShouldCacheNamespaceGeometry) {
+  translator::Controller controller;
+  translator::NamespaceGeometry geometry = {};
+  EXPECT_FALSE(controller.GetNamespaceGeometry(1, geometry));
+
+  translator::NamespaceGeometry expected = {.block_count = 0xabcdef012345,
+                                            .lba_shift = 12,
+                                            .metadata_size = 64,
+                                            .pi_type = 3,
+                                            .pi_first = true,
+                                            .dealloc_granularity = 65536,
+                                            .dealloc_alignment = 8,
+                                            .physical_block_shift = 4,
+                                            .dealloc_reads_zeroes = true};
+  controller.SetNamespaceGeometry(1, expected);
+  ASSERT_TRUE(controller.GetNamespaceGeometry(1, geometry));
+  EXPECT_EQ(expected.block_count, geometry.block_count);
+  EXPECT_EQ(expected.lba_shift, geometry.lba_shift);
+  EXPECT_EQ(expected.metadata_size, geometry.metadata_size);
+  EXPECT_EQ(expected.pi_type, geometry.pi_type);
+  EXPECT_EQ(expected.pi_first, geometry.pi_first);
+  EXPECT_EQ(expected.dealloc_granularity, geometry.dealloc_granularity);
+  EXPECT_EQ(expected.dealloc_alignment, geometry.dealloc_alignment);
+  EXPECT_EQ(expected.physical_block_shift, geometry.physical_block_shift);
+  EXPECT_EQ(expected.dealloc_reads_zeroes, geometry.dealloc_reads_zeroes);
+
+  // Other namespaces stay uncached
+  EXPECT_FALSE(controller.GetNamespaceGeometry(2, geometry));
+}
+
+TEST(Controller, ShouldNotCacheNamespacesOutOfRange) {
+  translator::Controller controller;
+  translator::NamespaceGeometry geometry = {.lba_shift = 9};
+
+  controller.SetNamespaceGeometry(0, geometry);
+  controller.SetNamespaceGeometry(translator::kMaxCachedNamespaces + 1,
+                                  geometry);
+  EXPECT_FALSE(controller.GetNamespaceGeometry(0, geometry));
+  EXPECT_FALSE(controller.GetNamespaceGeometry(
+      translator::kMaxCachedNamespaces + 1, geometry));
+
+  controller.SetNamespaceGeometry(translator::kMaxCachedNamespaces, geometry);
+  EXPECT_TRUE(controller.GetNamespaceGeometry(
+      translator::kMaxCachedNamespaces, geometry));
+}
+
+TEST(Controller, ShouldAlignUnmapRangesOnlyWhenEnabled) {
+  translator::Controller controller;
+  EXPECT_FALSE(controller.AlignUnmapRanges());
+  controller.SetAlignUnmapRanges(true);
+  EXPECT_TRUE(controller.AlignUnmapRanges());
+}
+
+}  // namespace
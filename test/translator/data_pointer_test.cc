@@ -0,0 +1,190 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "lib/translator/data_pointer.h"
+
+#include "gtest/gtest.h"
+
+// Tests SGL construction and the choice between PRPs and SGLs
+namespace {
+
+constexpr uint32_t kPageSize = 4096;
+// Small pages make SGL segment chaining cheap to exercise
+constexpr uint32_t kSmallPageSize = 4 * sizeof(nvme::SglDescriptor);
+// Data addresses are never dereferenced, only list pages are
+constexpr uint64_t kDataAddr = 0x100000;
+constexpr uint8_t kPsdtSgl = 0b01;
+
+alignas(kPageSize) nvme::SglDescriptor
+    list_pages[2][kPageSize / sizeof(nvme::SglDescriptor)];
+
+class DataPointerTest : public ::testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    // Hands out consecutive list pages of the requested size
+    auto alloc_callback = [](uint32_t page_size, uint16_t count) -> uint64_t {
+      if (count == 0 || count * page_size > sizeof(list_pages)) return 0;
+      return reinterpret_cast<uint64_t>(list_pages);
+    };
+    auto dealloc_callback = [](uint64_t addr, uint16_t count) {};
+    translator::SetAllocPageCallbacks(alloc_callback, dealloc_callback);
+  }
+
+  void SetUp() override { memset(list_pages, 0, sizeof(list_pages)); }
+
+  void ExpectDescriptor(const nvme::SglDescriptor& desc,
+                        nvme::SglDescriptorType type, uint64_t addr,
+                        uint32_t len) {
+    EXPECT_EQ(static_cast<uint8_t>(type), desc.unkeyed.type);
+    EXPECT_EQ(static_cast<uint8_t>(nvme::SglDescriptorSubtype::kAddress),
+              desc.unkeyed.subtype);
+    EXPECT_EQ(addr, translator::ltohll(desc.address));
+    EXPECT_EQ(len, translator::ltohl(desc.unkeyed.length));
+  }
+
+  translator::Allocation allocation_ = {};
+  nvme::GenericQueueEntryCmd cmd_ = {};
+};
+
+TEST_F(DataPointerTest, ShouldUseDataBlockForSingleSegment) {
+  translator::DataSegment segments[] = {{.addr = kDataAddr, .len = 65536}};
+  EXPECT_EQ(translator::StatusCode::kSuccess,
+            translator::BuildSgl(segments, 0, 32768, kPageSize, false,
+                                 allocation_, cmd_));
+  EXPECT_EQ(kPsdtSgl, cmd_.psdt);
+  ExpectDescriptor(cmd_.dptr.sgl_descriptor,
+                   nvme::SglDescriptorType::kDataBlock, kDataAddr, 32768);
+  EXPECT_EQ(0, allocation_.data_addr);
+}
+
+TEST_F(DataPointerTest, ShouldStartDataBlockAtOffset) {
+  translator::DataSegment segments[] = {{.addr = kDataAddr, .len = 1000},
+                                        {.addr = kDataAddr + 8192, .len = 3000}};
+  EXPECT_EQ(translator::StatusCode::kSuccess,
+            translator::BuildSgl(segments, 1500, 2000, kPageSize, false,
+                                 allocation_, cmd_));
+  ExpectDescriptor(cmd_.dptr.sgl_descriptor,
+                   nvme::SglDescriptorType::kDataBlock, kDataAddr + 8692,
+                   2000);
+  EXPECT_EQ(0, allocation_.data_addr);
+}
+
+TEST_F(DataPointerTest, ShouldUseLastSegmentForFragmentedBuffer) {
+  translator::DataSegment segments[] = {
+      {.addr = kDataAddr + 100, .len = 1000},
+      {.addr = kDataAddr + 8192, .len = 3000},
+      {.addr = kDataAddr + 20000, .len = 5000}};
+  EXPECT_EQ(translator::StatusCode::kSuccess,
+            translator::BuildSgl(segments, 0, 6000, kPageSize, false,
+                                 allocation_, cmd_));
+  EXPECT_EQ(kPsdtSgl, cmd_.psdt);
+  ExpectDescriptor(cmd_.dptr.sgl_descriptor,
+                   nvme::SglDescriptorType::kLastSegment,
+                   reinterpret_cast<uint64_t>(list_pages),
+                   3 * sizeof(nvme::SglDescriptor));
+  ExpectDescriptor(list_pages[0][0], nvme::SglDescriptorType::kDataBlock,
+                   kDataAddr + 100, 1000);
+  ExpectDescriptor(list_pages[0][1], nvme::SglDescriptorType::kDataBlock,
+                   kDataAddr + 8192, 3000);
+  // The last descriptor is trimmed to the transfer length
+  ExpectDescriptor(list_pages[0][2], nvme::SglDescriptorType::kDataBlock,
+                   kDataAddr + 20000, 2000);
+}
+
+TEST_F(DataPointerTest, ShouldChainFullSegmentPages) {
+  constexpr uint32_t kCount = 7;
+  translator::DataSegment segments[kCount];
+  for (uint32_t i = 0; i < kCount; ++i) {
+    segments[i] = {.addr = kDataAddr + i * 0x1000, .len = 512};
+  }
+  EXPECT_EQ(translator::StatusCode::kSuccess,
+            translator::BuildSgl(segments, 0, kCount * 512, kSmallPageSize,
+                                 false, allocation_, cmd_));
+  EXPECT_EQ(2, allocation_.data_page_count);
+
+  const nvme::SglDescriptor* list =
+      reinterpret_cast<const nvme::SglDescriptor*>(list_pages);
+  uint64_t list_addr = reinterpret_cast<uint64_t>(list_pages);
+  ExpectDescriptor(cmd_.dptr.sgl_descriptor,
+                   nvme::SglDescriptorType::kSegment, list_addr,
+                   kSmallPageSize);
+  for (uint32_t i = 0; i < 3; ++i) {
+    ExpectDescriptor(list[i], nvme::SglDescriptorType::kDataBlock,
+                     kDataAddr + i * 0x1000, 512);
+  }
+  ExpectDescriptor(list[3], nvme::SglDescriptorType::kLastSegment,
+                   list_addr + kSmallPageSize, kSmallPageSize);
+  for (uint32_t i = 3; i < kCount; ++i) {
+    ExpectDescriptor(list[i + 1], nvme::SglDescriptorType::kDataBlock,
+                     kDataAddr + i * 0x1000, 512);
+  }
+}
+
+TEST_F(DataPointerTest, ShouldRejectUnalignedSegmentWhenRequired) {
+  translator::DataSegment segments[] = {{.addr = kDataAddr + 2, .len = 512}};
+  EXPECT_EQ(translator::StatusCode::kFailure,
+            translator::BuildSgl(segments, 0, 512, kPageSize, true, allocation_,
+                                 cmd_));
+  EXPECT_EQ(translator::StatusCode::kSuccess,
+            translator::BuildSgl(segments, 0, 512, kPageSize, false,
+                                 allocation_, cmd_));
+}
+
+TEST_F(DataPointerTest, ShouldPreferPrpsForSmallTransfers) {
+  translator::Controller controller;
+  nvme::IdentifyControllerData identify_ctrl = {};
+  identify_ctrl.sgls.supported = 0b01;
+  controller.SetIdentifyControllerData(identify_ctrl);
+
+  translator::DataSegment segments[] = {
+      {.addr = kDataAddr, .len = 2 * kPageSize}};
+  EXPECT_EQ(translator::StatusCode::kSuccess,
+            translator::BuildDataPointer(controller, segments, 0, 2 * kPageSize,
+                                         allocation_, cmd_));
+  EXPECT_EQ(0, cmd_.psdt);
+  EXPECT_EQ(kDataAddr, cmd_.dptr.prp.prp1);
+  EXPECT_EQ(kDataAddr + kPageSize, cmd_.dptr.prp.prp2);
+}
+
+TEST_F(DataPointerTest, ShouldUseSglsForLargeTransfersWhenSupported) {
+  translator::Controller controller;
+  nvme::IdentifyControllerData identify_ctrl = {};
+  identify_ctrl.sgls.supported = 0b01;
+  controller.SetIdentifyControllerData(identify_ctrl);
+
+  translator::DataSegment segments[] = {
+      {.addr = kDataAddr, .len = 32 * kPageSize}};
+  EXPECT_EQ(translator::StatusCode::kSuccess,
+            translator::BuildDataPointer(controller, segments, 0,
+                                         32 * kPageSize, allocation_, cmd_));
+  EXPECT_EQ(kPsdtSgl, cmd_.psdt);
+  ExpectDescriptor(cmd_.dptr.sgl_descriptor,
+                   nvme::SglDescriptorType::kDataBlock, kDataAddr,
+                   32 * kPageSize);
+}
+
+TEST_F(DataPointerTest, ShouldUsePrpListWithoutSglSupport) {
+  translator::Controller controller;
+  translator::DataSegment segments[] = {
+      {.addr = kDataAddr, .len = 4 * kPageSize}};
+  EXPECT_EQ(translator::StatusCode::kSuccess,
+            translator::BuildDataPointer(controller, segments, 0, 4 * kPageSize,
+                                         allocation_, cmd_));
+  EXPECT_EQ(0, cmd_.psdt);
+  EXPECT_EQ(kDataAddr, cmd_.dptr.prp.prp1);
+  EXPECT_EQ(reinterpret_cast<uint64_t>(list_pages), cmd_.dptr.prp.prp2);
+}
+
+}  // namespace
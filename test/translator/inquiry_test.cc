@@ -391,7 +391,8 @@ TEST_F(InquiryTest, BlockLimitsVpd) {
   EXPECT_EQ(result.max_transfer_length, max_transfer_length);
   EXPECT_EQ(result.max_unmap_lba_count, identify_ctrl_.oncs.dsm);
   EXPECT_EQ(result.max_unmap_block_descriptor_count,
-            identify_ctrl_.oncs.dsm ? 0x0100 : 0);
+            identify_ctrl_.oncs.dsm ? translator::kMaxUnmapBlockDescriptors
+                                    : 0);
 }
 
 TEST_F(InquiryTest, BlockLimitsVpdMdts) {
@@ -445,7 +446,8 @@ TEST_F(InquiryTest, BlockLimitsVpdFuse) {
   EXPECT_EQ(result.max_transfer_length, max_transfer_length);
   EXPECT_EQ(result.max_unmap_lba_count, identify_ctrl_.oncs.dsm);
   EXPECT_EQ(result.max_unmap_block_descriptor_count,
-            identify_ctrl_.oncs.dsm ? 0x0100 : 0);
+            identify_ctrl_.oncs.dsm ? translator::kMaxUnmapBlockDescriptors
+                                    : 0);
 }
 
 TEST_F(InquiryTest, BlockLimitsVpdDsm) {
@@ -472,7 +474,8 @@ TEST_F(InquiryTest, BlockLimitsVpdDsm) {
   EXPECT_EQ(result.max_transfer_length, htonl(max_transfer_length));
   EXPECT_EQ(result.max_unmap_lba_count,
             htonl(static_cast<uint32_t>(identify_ctrl_.oncs.dsm)));
-  EXPECT_EQ(result.max_unmap_block_descriptor_count, htonl(0x0100));
+  EXPECT_EQ(result.max_unmap_block_descriptor_count,
+            htonl(translator::kMaxUnmapBlockDescriptors));
 }
 
 TEST_F(InquiryTest, BlockLimitsVpdMdtsFuse) {
@@ -578,11 +581,13 @@ TEST_F(InquiryTest, BlockLimitsVpdMdtsOncs) {
 
   EXPECT_EQ(result.page_code, scsi::PageCode::kBlockLimitsVpd);
   EXPECT_EQ(result.page_length, 0x003c);
+  EXPECT_EQ(result.wsnz, 1);
   EXPECT_EQ(result.max_compare_write_length, 0);
   EXPECT_EQ(result.max_transfer_length, htonl(max_transfer_length));
   EXPECT_EQ(result.max_unmap_lba_count,
             htonl(static_cast<uint32_t>(identify_ctrl_.oncs.dsm)));
-  EXPECT_EQ(result.max_unmap_block_descriptor_count, htonl(0x0100));
+  EXPECT_EQ(result.max_unmap_block_descriptor_count,
+            htonl(translator::kMaxUnmapBlockDescriptors));
 }
 
 TEST_F(InquiryTest, BlockLimitsVpdFuseOncs) {
@@ -608,7 +613,8 @@ TEST_F(InquiryTest, BlockLimitsVpdFuseOncs) {
   EXPECT_EQ(result.max_compare_write_length, max_transfer_length);
   EXPECT_EQ(result.max_transfer_length, htonl(max_transfer_length));
   EXPECT_EQ(result.max_unmap_lba_count, htonl(identify_ctrl_.oncs.dsm));
-  EXPECT_EQ(result.max_unmap_block_descriptor_count, htonl(0x0100));
+  EXPECT_EQ(result.max_unmap_block_descriptor_count,
+            htonl(translator::kMaxUnmapBlockDescriptors));
 }
 
 TEST_F(InquiryTest, BlockLimitsVpdMdtsFuseOncs) {
@@ -634,7 +640,8 @@ TEST_F(InquiryTest, BlockLimitsVpdMdtsFuseOncs) {
   EXPECT_EQ(result.max_compare_write_length, max_transfer_length);
   EXPECT_EQ(result.max_transfer_length, htonl(max_transfer_length));
   EXPECT_EQ(result.max_unmap_lba_count, htonl(identify_ctrl_.oncs.dsm));
-  EXPECT_EQ(result.max_unmap_block_descriptor_count, htonl(0x0100));
+  EXPECT_EQ(result.max_unmap_block_descriptor_count,
+            htonl(translator::kMaxUnmapBlockDescriptors));
 }
 
 TEST_F(InquiryTest, LogicalBlockProvisioningVpd) {
@@ -723,6 +730,27 @@ TEST_F(InquiryTest, LogicalBlockProvisioningVpdAdThinprov) {
   EXPECT_EQ(result.lbpu, 1);
 }
 
+TEST_F(InquiryTest, LogicalBlockProvisioningVpdWriteZeroes) {
+  inquiry_cmd_.evpd = 1;
+  inquiry_cmd_.page_code = scsi::PageCode::kLogicalBlockProvisioningVpd;
+
+  translator::StatusCode status = translator::InquiryToScsi(
+      scsi_cmd_, buffer_, nvme_wrappers_[0].cmd, nvme_wrappers_[1].cmd);
+  EXPECT_EQ(status, translator::StatusCode::kSuccess);
+  scsi::LogicalBlockProvisioningVpd result{};
+  ASSERT_TRUE(translator::ReadValue(buffer_, result));
+  EXPECT_EQ(result.lbpws, 0);
+  EXPECT_EQ(result.lbpws10, 0);
+
+  identify_ctrl_.oncs.write_zeroes = 1;
+  status = translator::InquiryToScsi(scsi_cmd_, buffer_, nvme_wrappers_[0].cmd,
+                                     nvme_wrappers_[1].cmd);
+  EXPECT_EQ(status, translator::StatusCode::kSuccess);
+  ASSERT_TRUE(translator::ReadValue(buffer_, result));
+  EXPECT_EQ(result.lbpws, 1);
+  EXPECT_EQ(result.lbpws10, 1);
+}
+
 TEST_F(InquiryTest, TranslateDeviceIdentificationVPDBuildCorrectStructs) {
   inquiry_cmd_ = scsi::InquiryCommand{
       .evpd = 1, .page_code = scsi::PageCode::kUnitSerialNumber};
@@ -0,0 +1,147 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "lib/translator/io_command.h"
+
+#include "gtest/gtest.h"
+
+// Tests splitting of NVM command set Read and Write commands
+namespace {
+
+constexpr uint32_t kPageSize = 4096;
+constexpr uint8_t kLbaShift = 9;
+constexpr uint32_t kLbaSize = 1 << kLbaShift;
+constexpr uint32_t kNsid = 0x1a2b;
+
+alignas(kPageSize) uint8_t pages[3][kPageSize];
+
+translator::IoCommand BuildIo(uint64_t lba, uint32_t block_count) {
+  return translator::IoCommand{.opc = nvme::NvmOpcode::kRead,
+                               .nsid = kNsid,
+                               .lba = lba,
+                               .block_count = block_count,
+                               .lba_shift = kLbaShift,
+                               .prinfo = 0b0111,
+                               .fua = true};
+}
+
+// Limits commands to 2 pages, i.e. 16 blocks
+void SetMdtsTwoPages(translator::Controller& controller) {
+  nvme::IdentifyControllerData identify_ctrl = {};
+  identify_ctrl.mdts = 1;
+  controller.SetIdentifyControllerData(identify_ctrl);
+}
+
+TEST(IoCommand, ShouldBuildSingleCommandWithoutMdts) {
+  translator::Controller controller;
+  translator::DataSegment segments[] = {
+      {.addr = reinterpret_cast<uint64_t>(pages), .len = sizeof(pages)}};
+  translator::NvmeCmdChain chain;
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            translator::BuildIoCommands(BuildIo(0x123456789a, 8), controller,
+                                        segments, chain));
+  ASSERT_EQ(1, chain.size());
+
+  const nvme::GenericQueueEntryCmd& cmd = chain.wrapper(0).cmd;
+  EXPECT_EQ(static_cast<uint8_t>(nvme::NvmOpcode::kRead), cmd.opc);
+  EXPECT_EQ(kNsid, cmd.nsid);
+  EXPECT_EQ(0x3456789a, cmd.cdw[0]);
+  EXPECT_EQ(0x12, cmd.cdw[1]);
+  EXPECT_EQ(7 | 0b0111 << 26 | 1 << 30, cmd.cdw[2]);
+  EXPECT_EQ(8 * kLbaSize, chain.wrapper(0).buffer_len);
+  EXPECT_FALSE(chain.wrapper(0).is_admin);
+}
+
+TEST(IoCommand, ShouldSplitAtMdts) {
+  translator::Controller controller;
+  SetMdtsTwoPages(controller);
+  translator::DataSegment segments[] = {
+      {.addr = reinterpret_cast<uint64_t>(pages[0]), .len = kPageSize},
+      {.addr = reinterpret_cast<uint64_t>(pages[1]), .len = kPageSize},
+      {.addr = reinterpret_cast<uint64_t>(pages[2]), .len = kPageSize}};
+  translator::NvmeCmdChain chain;
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            translator::BuildIoCommands(BuildIo(100, 24), controller,
+                                        segments, chain));
+  ASSERT_EQ(2, chain.size());
+
+  const translator::NvmeCmdWrapper& first = chain.wrapper(0);
+  EXPECT_EQ(100, first.cmd.cdw[0]);
+  EXPECT_EQ(15, first.cmd.cdw[2] & 0xffff);
+  EXPECT_EQ(0, first.data_offset);
+  EXPECT_EQ(2 * kPageSize, first.buffer_len);
+  EXPECT_EQ(reinterpret_cast<uint64_t>(pages[0]), first.cmd.dptr.prp.prp1);
+  EXPECT_EQ(reinterpret_cast<uint64_t>(pages[1]), first.cmd.dptr.prp.prp2);
+
+  const translator::NvmeCmdWrapper& second = chain.wrapper(1);
+  EXPECT_EQ(116, second.cmd.cdw[0]);
+  EXPECT_EQ(7, second.cmd.cdw[2] & 0xffff);
+  EXPECT_EQ(2 * kPageSize, second.data_offset);
+  EXPECT_EQ(kPageSize, second.buffer_len);
+  EXPECT_EQ(reinterpret_cast<uint64_t>(pages[2]), second.cmd.dptr.prp.prp1);
+}
+
+TEST(IoCommand, ShouldRejectTransferOver4GiB) {
+  translator::Controller controller;
+  translator::NvmeCmdChain chain;
+  EXPECT_EQ(translator::StatusCode::kInvalidInput,
+            translator::BuildIoCommands(BuildIo(0, 0xffffffff), controller, {},
+                                        chain));
+}
+
+TEST(IoCommand, ShouldRejectBlockLargerThanMdts) {
+  translator::Controller controller;
+  SetMdtsTwoPages(controller);
+  translator::IoCommand io = BuildIo(0, 1);
+  io.lba_shift = 14;  // 4 pages
+  translator::NvmeCmdChain chain;
+  EXPECT_EQ(translator::StatusCode::kFailure,
+            translator::BuildIoCommands(io, controller, {}, chain));
+}
+
+TEST(IoCommand, ShouldDecodeLegacyCdb) {
+  // LBA 0x1f0203 with the 3 reserved bits set, transfer length 0
+  uint8_t cdb[translator::IoCdb6::kSize] = {0xff, 0x02, 0x03, 0x00, 0x00};
+  translator::IoCdbFields fields;
+  ASSERT_TRUE(translator::DecodeIoCdb<translator::IoCdb6>(cdb, fields));
+  EXPECT_EQ(0x1f0203, fields.lba);
+  EXPECT_EQ(0, fields.transfer_length);
+  EXPECT_EQ(0, fields.protect);
+  EXPECT_FALSE(fields.fua);
+}
+
+TEST(IoCommand, ShouldDecodeCdb16) {
+  scsi::Read16Command read_cmd = {
+      .fua = true,
+      .rd_protect = 0b101,
+      .logical_block_address = 0x0102030405060708,
+      .transfer_length = 0x0a0b0c0d};
+  uint8_t cdb[sizeof(read_cmd)];
+  ASSERT_TRUE(translator::WriteValue(read_cmd, cdb));
+  translator::IoCdbFields fields;
+  ASSERT_TRUE(translator::DecodeIoCdb<translator::IoCdb16>(cdb, fields));
+  EXPECT_EQ(0x0102030405060708, fields.lba);
+  EXPECT_EQ(0x0a0b0c0d, fields.transfer_length);
+  EXPECT_EQ(0b101, fields.protect);
+  EXPECT_TRUE(fields.fua);
+}
+
+TEST(IoCommand, ShouldRejectTruncatedCdb) {
+  uint8_t cdb[translator::IoCdb10::kSize - 1] = {};
+  translator::IoCdbFields fields;
+  EXPECT_FALSE(translator::DecodeIoCdb<translator::IoCdb10>(cdb, fields));
+}
+
+}  // namespace
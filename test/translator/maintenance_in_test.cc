@@ -56,15 +56,45 @@ TEST(ReportSupportedOpCodes, ValidationSuccess) {
       translator::ValidateReportSupportedOpCodes(scsi_cmd, alloc_len);
 
   EXPECT_EQ(translator::StatusCode::kSuccess, status_code);
-  EXPECT_EQ(sizeof(scsi::OneCommandParamData), alloc_len);
+  EXPECT_EQ(sizeof(scsi::OneCommandParamData) + 16, alloc_len);
 }
 
 TEST(ReportSupportedOpCodes, WriteResultSuccess) {
+  scsi::ReportOpCodesCommand cmd = {
+      .reporting_options = 0b001,
+      .requested_op_code = static_cast<uint8_t>(scsi::OpCode::kWriteSame16)};
+  uint8_t scsi_cmd[sizeof(scsi::ReportOpCodesCommand)];
+  translator::WriteValue(cmd, scsi_cmd);
   uint8_t buffer[256] = {};  // Sufficiently large buffer
 
-  translator::WriteReportSupportedOpCodesResult(buffer);
+  translator::WriteReportSupportedOpCodesResult(scsi_cmd, buffer);
+
+  // Supported, with 16 bytes of CDB usage data
+  EXPECT_EQ(0b011, buffer[1]);
+  EXPECT_EQ(0, buffer[2]);
+  EXPECT_EQ(16, buffer[3]);
+  EXPECT_EQ(static_cast<uint8_t>(scsi::OpCode::kWriteSame16), buffer[4]);
+  // WRPROTECT, UNMAP and NDOB
+  EXPECT_EQ(0xe9, buffer[5]);
+}
 
-  EXPECT_EQ(1, buffer[1]);
+TEST(ReportSupportedOpCodes, ShouldReportWriteSame10) {
+  uint32_t alloc_len = 0;
+  scsi::ReportOpCodesCommand cmd = {
+      .reporting_options = 0b001,
+      .requested_op_code = static_cast<uint8_t>(scsi::OpCode::kWriteSame10)};
+  uint8_t scsi_cmd[sizeof(scsi::ReportOpCodesCommand)];
+  translator::WriteValue(cmd, scsi_cmd);
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            translator::ValidateReportSupportedOpCodes(scsi_cmd, alloc_len));
+  EXPECT_EQ(sizeof(scsi::OneCommandParamData) + 10, alloc_len);
+
+  uint8_t buffer[256] = {};
+  translator::WriteReportSupportedOpCodesResult(scsi_cmd, buffer);
+  EXPECT_EQ(0b011, buffer[1]);
+  EXPECT_EQ(10, buffer[3]);
+  EXPECT_EQ(static_cast<uint8_t>(scsi::OpCode::kWriteSame10), buffer[4]);
+  EXPECT_EQ(0xe8, buffer[5]);
 }
 
 }  // namespace
@@ -0,0 +1,160 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "lib/translator/page_pool.h"
+
+#include <stdlib.h>
+
+#include "gtest/gtest.h"
+
+// Tests the per-CPU page cache
+namespace {
+
+constexpr uint32_t kPageSize = 4096;
+constexpr uint32_t kCpuCount = 2;
+
+uint32_t current_cpu;
+int backing_allocs;
+int backing_frees;
+
+uint32_t CurrentCpu() { return current_cpu; }
+
+uint64_t BackingAlloc(uint32_t page_size, uint16_t count) {
+  ++backing_allocs;
+  void* addr = aligned_alloc(page_size, page_size * count);
+  memset(addr, 0, page_size * count);
+  return reinterpret_cast<uint64_t>(addr);
+}
+
+void BackingDealloc(uint64_t addr, uint16_t count) {
+  ++backing_frees;
+  free(reinterpret_cast<void*>(addr));
+}
+
+class PagePoolTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    current_cpu = 0;
+    ASSERT_EQ(translator::StatusCode::kSuccess,
+              pool_.Init(kPageSize, kCpuCount, CurrentCpu, BackingAlloc,
+                         BackingDealloc));
+    backing_allocs = 0;
+    backing_frees = 0;
+  }
+
+  void TearDown() override { pool_.Destroy(); }
+
+  translator::PagePool pool_;
+};
+
+TEST(PagePool, ShouldRequireCallbacks) {
+  translator::PagePool pool;
+  EXPECT_EQ(translator::StatusCode::kFailure,
+            pool.Init(kPageSize, kCpuCount, nullptr, BackingAlloc,
+                      BackingDealloc));
+}
+
+TEST_F(PagePoolTest, ShouldReuseFreedPages) {
+  uint64_t addr = pool_.Alloc(kPageSize, 1);
+  ASSERT_NE(0, addr);
+  EXPECT_EQ(1, backing_allocs);
+
+  pool_.Dealloc(addr, 1);
+  EXPECT_EQ(0, backing_frees);
+  EXPECT_EQ(addr, pool_.Alloc(kPageSize, 1));
+  EXPECT_EQ(1, backing_allocs);
+
+  translator::PagePoolStats stats = pool_.GetStats();
+  EXPECT_EQ(1, stats.hits);
+  EXPECT_EQ(1, stats.misses);
+  pool_.Dealloc(addr, 1);
+}
+
+TEST_F(PagePoolTest, ShouldZeroPagesWhenFreed) {
+  uint64_t addr = pool_.Alloc(kPageSize, 2);
+  uint8_t* page = reinterpret_cast<uint8_t*>(addr);
+  memset(page, 0xff, 2 * kPageSize);
+  pool_.Dealloc(addr, 2);
+
+  ASSERT_EQ(addr, pool_.Alloc(kPageSize, 2));
+  for (uint32_t i = 0; i < 2 * kPageSize; ++i) ASSERT_EQ(0, page[i]);
+  pool_.Dealloc(addr, 2);
+}
+
+TEST_F(PagePoolTest, ShouldRoundUpToSizeClass) {
+  // 3 pages are served from the 4 page class
+  uint64_t addr = pool_.Alloc(kPageSize, 3);
+  pool_.Dealloc(addr, 3);
+  EXPECT_EQ(addr, pool_.Alloc(kPageSize, 4));
+  pool_.Dealloc(addr, 4);
+  EXPECT_NE(addr, pool_.Alloc(kPageSize, 2));
+}
+
+TEST_F(PagePoolTest, ShouldNotCacheLargeRuns) {
+  uint64_t addr = pool_.Alloc(kPageSize, 9);
+  pool_.Dealloc(addr, 9);
+  EXPECT_EQ(1, backing_allocs);
+  EXPECT_EQ(1, backing_frees);
+  EXPECT_EQ(0, pool_.GetStats().misses);
+}
+
+TEST_F(PagePoolTest, ShouldRejectOtherPageSizes) {
+  EXPECT_EQ(0, pool_.Alloc(2 * kPageSize, 1));
+  EXPECT_EQ(0, backing_allocs);
+}
+
+TEST_F(PagePoolTest, ShouldShareFreedPagesThroughDepot) {
+  // Freeing more than a magazine holds moves a batch to the depot
+  uint64_t pages[translator::kMagazineSize + 1];
+  for (uint64_t& addr : pages) addr = pool_.Alloc(kPageSize, 1);
+  for (uint64_t addr : pages) pool_.Dealloc(addr, 1);
+  EXPECT_EQ(1, pool_.GetStats().flushes);
+  EXPECT_EQ(0, backing_frees);
+
+  // Another CPU refills its empty magazine from the depot
+  current_cpu = 1;
+  int allocs = backing_allocs;
+  uint64_t addr = pool_.Alloc(kPageSize, 1);
+  EXPECT_EQ(allocs, backing_allocs);
+  translator::PagePoolStats stats = pool_.GetStats();
+  EXPECT_EQ(1, stats.refills);
+  EXPECT_EQ(1, stats.hits);
+  pool_.Dealloc(addr, 1);
+}
+
+TEST_F(PagePoolTest, ShouldBoundCachedPages) {
+  // Magazines and the depot are full, so later frees reach the backing
+  // allocator
+  constexpr uint32_t kCached = kCpuCount * translator::kMagazineSize +
+                               translator::kDepotSize;
+  constexpr uint32_t kAllocated = kCached + translator::kMagazineBatch;
+  static uint64_t pages[kAllocated];
+  for (uint64_t& addr : pages) addr = pool_.Alloc(kPageSize, 1);
+  for (uint32_t i = 0; i < kAllocated; ++i) {
+    current_cpu = i % kCpuCount;
+    pool_.Dealloc(pages[i], 1);
+  }
+  EXPECT_GE(backing_frees, kAllocated - kCached);
+  EXPECT_LT(backing_frees, kAllocated);
+}
+
+TEST_F(PagePoolTest, ShouldReturnPagesOnDestroy) {
+  pool_.Dealloc(pool_.Alloc(kPageSize, 1), 1);
+  pool_.Dealloc(pool_.Alloc(kPageSize, 8), 8);
+  pool_.Destroy();
+  // Both runs and the per-CPU state
+  EXPECT_EQ(3, backing_frees);
+}
+
+}  // namespace
@@ -0,0 +1,153 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "lib/translator/prp.h"
+
+#include "gtest/gtest.h"
+
+// Tests PRP construction
+namespace {
+
+constexpr uint32_t kPageSize = 4096;
+// Small pages make PRP list chaining cheap to exercise
+constexpr uint32_t kSmallPageSize = 64;
+constexpr uint32_t kSmallEntriesPerPage = kSmallPageSize / sizeof(uint64_t);
+// Data addresses are never dereferenced, only list pages are
+constexpr uint64_t kDataAddr = 0x100000;
+
+alignas(kPageSize) uint64_t list_pages[3][kPageSize / sizeof(uint64_t)];
+
+class PrpTest : public ::testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    // Hands out consecutive list pages of the requested size
+    auto alloc_callback = [](uint32_t page_size, uint16_t count) -> uint64_t {
+      if (count == 0 || count * page_size > sizeof(list_pages)) return 0;
+      return reinterpret_cast<uint64_t>(list_pages);
+    };
+    auto dealloc_callback = [](uint64_t addr, uint16_t count) {};
+    translator::SetAllocPageCallbacks(alloc_callback, dealloc_callback);
+  }
+
+  void SetUp() override { memset(list_pages, 0, sizeof(list_pages)); }
+
+  translator::Allocation allocation_ = {};
+  nvme::GenericQueueEntryCmd cmd_ = {};
+};
+
+TEST_F(PrpTest, ShouldUsePrp1ForSinglePage) {
+  translator::DataSegment segments[] = {{.addr = kDataAddr + 512, .len = 1024}};
+  EXPECT_EQ(translator::StatusCode::kSuccess,
+            translator::BuildPrps(segments, 0, 1024, kPageSize, allocation_,
+                                  cmd_));
+  EXPECT_EQ(0, cmd_.psdt);
+  EXPECT_EQ(kDataAddr + 512, cmd_.dptr.prp.prp1);
+  EXPECT_EQ(0, cmd_.dptr.prp.prp2);
+  EXPECT_EQ(0, allocation_.data_addr);
+}
+
+TEST_F(PrpTest, ShouldUsePrp2ForSecondPage) {
+  // Starts at an offset, so two pages are touched by less than a page of data
+  translator::DataSegment segments[] = {
+      {.addr = kDataAddr + kPageSize - 512, .len = 1024}};
+  EXPECT_EQ(translator::StatusCode::kSuccess,
+            translator::BuildPrps(segments, 0, 1024, kPageSize, allocation_,
+                                  cmd_));
+  EXPECT_EQ(kDataAddr + kPageSize - 512, cmd_.dptr.prp.prp1);
+  EXPECT_EQ(kDataAddr + kPageSize, cmd_.dptr.prp.prp2);
+  EXPECT_EQ(0, allocation_.data_addr);
+}
+
+TEST_F(PrpTest, ShouldBuildPrpListForLargeTransfer) {
+  translator::DataSegment segments[] = {
+      {.addr = kDataAddr, .len = 2 * kPageSize},
+      {.addr = kDataAddr + 8 * kPageSize, .len = 2 * kPageSize}};
+  EXPECT_EQ(translator::StatusCode::kSuccess,
+            translator::BuildPrps(segments, 0, 4 * kPageSize, kPageSize,
+                                  allocation_, cmd_));
+  EXPECT_EQ(kDataAddr, cmd_.dptr.prp.prp1);
+  EXPECT_EQ(reinterpret_cast<uint64_t>(list_pages), cmd_.dptr.prp.prp2);
+  EXPECT_EQ(1, allocation_.data_page_count);
+  EXPECT_EQ(kDataAddr + kPageSize, list_pages[0][0]);
+  EXPECT_EQ(kDataAddr + 8 * kPageSize, list_pages[0][1]);
+  EXPECT_EQ(kDataAddr + 9 * kPageSize, list_pages[0][2]);
+  EXPECT_EQ(0, list_pages[0][3]);
+}
+
+TEST_F(PrpTest, ShouldChainFullPrpListPages) {
+  constexpr uint32_t kPageCount = 20;
+  translator::DataSegment segments[] = {
+      {.addr = kDataAddr, .len = kPageCount * kSmallPageSize}};
+  EXPECT_EQ(translator::StatusCode::kSuccess,
+            translator::BuildPrps(segments, 0, kPageCount * kSmallPageSize,
+                                  kSmallPageSize, allocation_, cmd_));
+  EXPECT_EQ(3, allocation_.data_page_count);
+
+  // The last entry of each full list page points to the next list page
+  const uint64_t* list = reinterpret_cast<const uint64_t*>(list_pages);
+  uint64_t list_addr = reinterpret_cast<uint64_t>(list_pages);
+  EXPECT_EQ(list_addr, cmd_.dptr.prp.prp2);
+  EXPECT_EQ(list_addr + kSmallPageSize, list[kSmallEntriesPerPage - 1]);
+  EXPECT_EQ(list_addr + 2 * kSmallPageSize, list[2 * kSmallEntriesPerPage - 1]);
+
+  uint32_t page = 1;
+  for (uint32_t i = 0; i < 3 * kSmallEntriesPerPage && page < kPageCount;
+       ++i) {
+    if (i % kSmallEntriesPerPage == kSmallEntriesPerPage - 1) continue;
+    EXPECT_EQ(kDataAddr + page * kSmallPageSize, list[i]);
+    ++page;
+  }
+  EXPECT_EQ(kPageCount, page);
+}
+
+TEST_F(PrpTest, ShouldStartAtOffset) {
+  // The transfer starts in the second segment, one page in
+  translator::DataSegment segments[] = {
+      {.addr = kDataAddr, .len = kPageSize},
+      {.addr = kDataAddr + 8 * kPageSize, .len = 4 * kPageSize}};
+  EXPECT_EQ(translator::StatusCode::kSuccess,
+            translator::BuildPrps(segments, 2 * kPageSize, 2 * kPageSize,
+                                  kPageSize, allocation_, cmd_));
+  EXPECT_EQ(kDataAddr + 9 * kPageSize, cmd_.dptr.prp.prp1);
+  EXPECT_EQ(kDataAddr + 10 * kPageSize, cmd_.dptr.prp.prp2);
+  EXPECT_EQ(0, allocation_.data_addr);
+}
+
+TEST_F(PrpTest, ShouldRejectUnalignedMiddleSegment) {
+  translator::DataSegment segments[] = {
+      {.addr = kDataAddr, .len = kPageSize},
+      {.addr = kDataAddr + 2 * kPageSize + 8, .len = kPageSize}};
+  EXPECT_EQ(translator::StatusCode::kFailure,
+            translator::BuildPrps(segments, 0, 2 * kPageSize, kPageSize,
+                                  allocation_, cmd_));
+}
+
+TEST_F(PrpTest, ShouldRejectSegmentEndingInsidePage) {
+  translator::DataSegment segments[] = {
+      {.addr = kDataAddr, .len = 512},
+      {.addr = kDataAddr + kPageSize, .len = kPageSize}};
+  EXPECT_EQ(translator::StatusCode::kFailure,
+            translator::BuildPrps(segments, 0, 1024, kPageSize, allocation_,
+                                  cmd_));
+}
+
+TEST_F(PrpTest, ShouldRejectShortSegments) {
+  translator::DataSegment segments[] = {{.addr = kDataAddr, .len = 512}};
+  EXPECT_EQ(translator::StatusCode::kFailure,
+            translator::BuildPrps(segments, 0, 1024, kPageSize, allocation_,
+                                  cmd_));
+}
+
+}  // namespace
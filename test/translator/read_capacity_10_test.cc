@@ -14,8 +14,6 @@
 
 #include "lib/translator/read_capacity_10.h"
 
-#include <netinet/in.h>
-
 #include "gtest/gtest.h"
 
 namespace {
@@ -100,67 +98,74 @@ TEST_F(ReadCapacity10Test, Success) {
   identify_ns_.nsze = 0;
   identify_ns_.flbas.format = 0;
   identify_ns_.lbaf[identify_ns_.flbas.format].lbads = 10;
-  uint32_t scsi_block_length = htonl(1 << 10);
+  uint32_t block_length = 1 << 10;
   EXPECT_EQ(translator::StatusCode::kSuccess,
             translator::ReadCapacity10ToScsi(buffer_, nvme_wrapper_.cmd));
   scsi::ReadCapacity10Data result = {};
   ASSERT_TRUE(translator::ReadValue(buffer_, result));
-  EXPECT_EQ(result.returned_logical_block_address, 0);
-  EXPECT_EQ(result.block_length, scsi_block_length);
+  EXPECT_EQ(result.returned_logical_block_address.value(), 0);
+  EXPECT_EQ(result.block_length.value(), block_length);
 }
 
 TEST_F(ReadCapacity10Test, NszeNonzero) {
   identify_ns_.nsze = 1;
   identify_ns_.flbas.format = 0;
   identify_ns_.lbaf[identify_ns_.flbas.format].lbads = 10;
-  uint32_t scsi_block_length = htonl(1 << 10);
+  uint32_t block_length = 1 << 10;
   EXPECT_EQ(translator::StatusCode::kSuccess,
             translator::ReadCapacity10ToScsi(buffer_, nvme_wrapper_.cmd));
   scsi::ReadCapacity10Data result = {};
   ASSERT_TRUE(translator::ReadValue(buffer_, result));
-  EXPECT_EQ(
-      result.returned_logical_block_address,
-      htonl(static_cast<uint32_t>(translator::ltohll(identify_ns_.nsze))));
-  EXPECT_EQ(result.block_length, scsi_block_length);
+  // The returned LBA is that of the last logical block
+  EXPECT_EQ(result.returned_logical_block_address.value(),
+            static_cast<uint32_t>(translator::ltohll(identify_ns_.nsze)) - 1);
+  EXPECT_EQ(result.block_length.value(), block_length);
 }
 
 TEST_F(ReadCapacity10Test, NszeLarge) {
   identify_ns_.nsze = 0xffffffffffff;
   identify_ns_.flbas.format = 0;
   identify_ns_.lbaf[identify_ns_.flbas.format].lbads = 10;
-  uint32_t scsi_block_length = htonl(1 << 10);
+  uint32_t block_length = 1 << 10;
   EXPECT_EQ(translator::StatusCode::kSuccess,
             translator::ReadCapacity10ToScsi(buffer_, nvme_wrapper_.cmd));
   scsi::ReadCapacity10Data result = {};
   ASSERT_TRUE(translator::ReadValue(buffer_, result));
-  EXPECT_EQ(result.returned_logical_block_address, 0xffffffff);
-  EXPECT_EQ(result.block_length, scsi_block_length);
+  EXPECT_EQ(result.returned_logical_block_address.value(), 0xffffffff);
+  EXPECT_EQ(result.block_length.value(), block_length);
 }
 
 TEST_F(ReadCapacity10Test, NszeLimit) {
   identify_ns_.nsze = 0xffffffff;
   identify_ns_.flbas.format = 0;
   identify_ns_.lbaf[identify_ns_.flbas.format].lbads = 10;
-  uint32_t scsi_block_length = htonl(1 << 10);
+  uint32_t block_length = 1 << 10;
   EXPECT_EQ(translator::StatusCode::kSuccess,
             translator::ReadCapacity10ToScsi(buffer_, nvme_wrapper_.cmd));
   scsi::ReadCapacity10Data result = {};
   ASSERT_TRUE(translator::ReadValue(buffer_, result));
-  EXPECT_EQ(result.returned_logical_block_address, 0xffffffff);
-  EXPECT_EQ(result.block_length, scsi_block_length);
+  EXPECT_EQ(result.returned_logical_block_address.value(), 0xfffffffe);
+  EXPECT_EQ(result.block_length.value(), block_length);
+
+  identify_ns_.nsze = 0x100000000;
+  EXPECT_EQ(translator::StatusCode::kSuccess,
+            translator::ReadCapacity10ToScsi(buffer_, nvme_wrapper_.cmd));
+  ASSERT_TRUE(translator::ReadValue(buffer_, result));
+  EXPECT_EQ(result.returned_logical_block_address.value(), 0xffffffff);
+  EXPECT_EQ(result.block_length.value(), block_length);
 }
 
 TEST_F(ReadCapacity10Test, BlocklengthNonzeo) {
   identify_ns_.nsze = 0;
   identify_ns_.flbas.format = 0;
   identify_ns_.lbaf[identify_ns_.flbas.format].lbads = 10;
-  uint32_t scsi_block_length = htonl(1 << 10);
+  uint32_t block_length = 1 << 10;
   EXPECT_EQ(translator::StatusCode::kSuccess,
             translator::ReadCapacity10ToScsi(buffer_, nvme_wrapper_.cmd));
   scsi::ReadCapacity10Data result = {};
   ASSERT_TRUE(translator::ReadValue(buffer_, result));
-  EXPECT_EQ(result.returned_logical_block_address, 0);
-  EXPECT_EQ(result.block_length, scsi_block_length);
+  EXPECT_EQ(result.returned_logical_block_address.value(), 0);
+  EXPECT_EQ(result.block_length.value(), block_length);
 }
 
 TEST_F(ReadCapacity10Test, BlocklengthTooSmall) {
@@ -183,13 +188,13 @@ TEST_F(ReadCapacity10Test, BlocklengthLimit) {
   identify_ns_.nsze = 0;
   identify_ns_.flbas.format = 0;
   identify_ns_.lbaf[identify_ns_.flbas.format].lbads = 31;
-  uint32_t scsi_block_length = htonl(1 << 31);
+  uint32_t block_length = 1 << 31;
   EXPECT_EQ(translator::StatusCode::kSuccess,
             translator::ReadCapacity10ToScsi(buffer_, nvme_wrapper_.cmd));
   scsi::ReadCapacity10Data result = {};
   ASSERT_TRUE(translator::ReadValue(buffer_, result));
-  EXPECT_EQ(result.returned_logical_block_address, 0);
-  EXPECT_EQ(result.block_length, scsi_block_length);
+  EXPECT_EQ(result.returned_logical_block_address.value(), 0);
+  EXPECT_EQ(result.block_length.value(), block_length);
 }
 
 TEST_F(ReadCapacity10Test, FailsOnNullptr) {
@@ -198,4 +203,37 @@ TEST_F(ReadCapacity10Test, FailsOnNullptr) {
             translator::ReadCapacity10ToScsi(buffer_, nvme_wrapper_.cmd));
 }
 
+TEST_F(ReadCapacity10Test, ShouldValidateCommand) {
+  uint32_t alloc_len = 0;
+  EXPECT_EQ(translator::StatusCode::kSuccess,
+            translator::ValidateReadCapacity10(scsi_cmd_, alloc_len));
+  EXPECT_EQ(sizeof(scsi::ReadCapacity10Data), alloc_len);
+
+  read_capacity_10_cmd_.control_byte.naca = 1;
+  EXPECT_EQ(translator::StatusCode::kInvalidInput,
+            translator::ValidateReadCapacity10(scsi_cmd_, alloc_len));
+}
+
+TEST_F(ReadCapacity10Test, ShouldTranslateCachedGeometry) {
+  translator::NamespaceGeometry geometry = {.block_count = 0x1234,
+                                            .lba_shift = 9};
+  EXPECT_EQ(translator::StatusCode::kSuccess,
+            translator::ReadCapacity10ToScsi(buffer_, geometry));
+  scsi::ReadCapacity10Data result = {};
+  ASSERT_TRUE(translator::ReadValue(buffer_, result));
+  EXPECT_EQ(0x1233, result.returned_logical_block_address.value());
+  EXPECT_EQ(512, result.block_length.value());
+}
+
+TEST_F(ReadCapacity10Test, ShouldClampCachedBlockCount) {
+  translator::NamespaceGeometry geometry = {.block_count = 0x100000001,
+                                            .lba_shift = 12};
+  EXPECT_EQ(translator::StatusCode::kSuccess,
+            translator::ReadCapacity10ToScsi(buffer_, geometry));
+  scsi::ReadCapacity10Data result = {};
+  ASSERT_TRUE(translator::ReadValue(buffer_, result));
+  EXPECT_EQ(0xffffffff, result.returned_logical_block_address.value());
+  EXPECT_EQ(4096, result.block_length.value());
+}
+
 }  // namespace
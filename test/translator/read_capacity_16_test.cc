@@ -0,0 +1,201 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "lib/translator/read_capacity_16.h"
+
+#include "gtest/gtest.h"
+
+namespace {
+
+constexpr uint32_t kPageSize = 4096;
+
+class ReadCapacity16Test : public ::testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    auto alloc_callback = [](uint32_t page_size, uint16_t count) -> uint64_t {
+      return 1337;
+    };
+    void (*dealloc_callback)(uint64_t, uint16_t) = nullptr;
+    translator::SetAllocPageCallbacks(alloc_callback, dealloc_callback);
+  }
+
+  static void TearDownTestSuite() {
+    translator::SetAllocPageCallbacks(nullptr, nullptr);
+  }
+
+  void SetUp() override {
+    read_capacity_16_cmd_ = {
+        .service_action = static_cast<uint8_t>(
+            scsi::ServiceActionIn16::kReadCapacity16),
+        .alloc_length = sizeof(scsi::ReadCapacity16Data)};
+    scsi_cmd_ = translator::Span<const uint8_t>(
+        reinterpret_cast<const uint8_t*>(&read_capacity_16_cmd_),
+        sizeof(read_capacity_16_cmd_));
+    identify_ns_ = {};
+    identify_ns_.lbaf[0].lbads = 12;
+    identify_cmd_ = {};
+    identify_cmd_.dptr.prp.prp1 = reinterpret_cast<uint64_t>(&identify_ns_);
+    memset(buffer_, 0xff, sizeof(buffer_));
+  }
+
+  scsi::ReadCapacity16Data Result() {
+    scsi::ReadCapacity16Data result = {};
+    EXPECT_TRUE(translator::ReadValue(buffer_, result));
+    return result;
+  }
+
+  scsi::ReadCapacity16Command read_capacity_16_cmd_;
+  translator::Span<const uint8_t> scsi_cmd_;
+  nvme::IdentifyNamespace identify_ns_;
+  nvme::GenericQueueEntryCmd identify_cmd_;
+  translator::Controller controller_;
+  uint8_t buffer_[sizeof(scsi::ReadCapacity16Data)];
+};
+
+TEST_F(ReadCapacity16Test, ShouldBuildIdentifyNamespace) {
+  translator::NvmeCmdWrapper wrapper = {};
+  translator::Allocation allocation = {};
+  uint32_t alloc_len = 0;
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            translator::ReadCapacity16ToNvme(scsi_cmd_, wrapper, kPageSize, 3,
+                                             allocation, alloc_len));
+  EXPECT_EQ(sizeof(scsi::ReadCapacity16Data), alloc_len);
+  EXPECT_TRUE(wrapper.is_admin);
+  EXPECT_EQ(static_cast<uint8_t>(nvme::AdminOpcode::kIdentify),
+            wrapper.cmd.opc);
+  EXPECT_EQ(3, wrapper.cmd.nsid);
+  EXPECT_EQ(0, wrapper.cmd.cdw[0]);
+  EXPECT_EQ(1337, wrapper.cmd.dptr.prp.prp1);
+  EXPECT_EQ(kPageSize, wrapper.buffer_len);
+}
+
+TEST_F(ReadCapacity16Test, ShouldLimitAllocLenToTheParameterData) {
+  uint32_t alloc_len = 0;
+  read_capacity_16_cmd_.alloc_length = 12;
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            translator::ValidateReadCapacity16(scsi_cmd_, alloc_len));
+  EXPECT_EQ(12, alloc_len);
+
+  read_capacity_16_cmd_.alloc_length = 4096;
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            translator::ValidateReadCapacity16(scsi_cmd_, alloc_len));
+  EXPECT_EQ(sizeof(scsi::ReadCapacity16Data), alloc_len);
+}
+
+TEST_F(ReadCapacity16Test, ShouldRejectInvalidCommands) {
+  uint32_t alloc_len = 0;
+  uint8_t short_cmd[4] = {};
+  EXPECT_EQ(translator::StatusCode::kInvalidInput,
+            translator::ValidateReadCapacity16(short_cmd, alloc_len));
+
+  // Other Service Action In service actions are not supported
+  read_capacity_16_cmd_.service_action = 0x11;
+  EXPECT_EQ(translator::StatusCode::kInvalidInput,
+            translator::ValidateReadCapacity16(scsi_cmd_, alloc_len));
+
+  read_capacity_16_cmd_.service_action =
+      static_cast<uint8_t>(scsi::ServiceActionIn16::kReadCapacity16);
+  read_capacity_16_cmd_.control_byte.naca = 1;
+  EXPECT_EQ(translator::StatusCode::kInvalidInput,
+            translator::ValidateReadCapacity16(scsi_cmd_, alloc_len));
+}
+
+TEST_F(ReadCapacity16Test, ShouldReportTheLastLogicalBlock) {
+  identify_ns_.nsze = 0x123456789ab;
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            translator::ReadCapacity16ToScsi(buffer_, identify_cmd_,
+                                             controller_));
+  scsi::ReadCapacity16Data result = Result();
+  EXPECT_EQ(0x123456789aa, result.returned_logical_block_address.value());
+  EXPECT_EQ(4096, result.block_length.value());
+  EXPECT_FALSE(result.prot_en);
+  EXPECT_EQ(1, result.rc_basis);
+  EXPECT_EQ(0, result.logical_blocks_per_physical_block_exponent);
+  EXPECT_EQ(0, result.lowest_aligned_logical_block_address_msb);
+  EXPECT_EQ(0, result.lowest_aligned_logical_block_address_lsb);
+  EXPECT_FALSE(result.lbpme);
+  EXPECT_FALSE(result.lbprz);
+}
+
+TEST_F(ReadCapacity16Test, ShouldReportPhysicalBlockExponent) {
+  identify_ns_.nsze = 64;
+  identify_ns_.nsfeat.opt_perf = 1;
+  identify_ns_.npwg = 7;  // 0's based
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            translator::ReadCapacity16ToScsi(buffer_, identify_cmd_,
+                                             controller_));
+  EXPECT_EQ(3, Result().logical_blocks_per_physical_block_exponent);
+}
+
+TEST_F(ReadCapacity16Test, ShouldReportProtectionType) {
+  translator::NamespaceGeometry geometry = {
+      .block_count = 8, .lba_shift = 9, .metadata_size = 8, .pi_type = 2};
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            translator::ReadCapacity16ToScsi(buffer_, geometry, controller_));
+  scsi::ReadCapacity16Data result = Result();
+  EXPECT_TRUE(result.prot_en);
+  EXPECT_EQ(1, result.p_type);
+}
+
+TEST_F(ReadCapacity16Test, ShouldReportProvisioningFromDeallocateSupport) {
+  nvme::IdentifyControllerData identify_ctrl = {};
+  identify_ctrl.oncs.dsm = 1;
+  controller_.SetIdentifyControllerData(identify_ctrl);
+
+  translator::NamespaceGeometry geometry = {.block_count = 8,
+                                            .lba_shift = 9};
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            translator::ReadCapacity16ToScsi(buffer_, geometry, controller_));
+  EXPECT_TRUE(Result().lbpme);
+  EXPECT_FALSE(Result().lbprz);
+
+  geometry.dealloc_reads_zeroes = true;
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            translator::ReadCapacity16ToScsi(buffer_, geometry, controller_));
+  EXPECT_TRUE(Result().lbpme);
+  EXPECT_TRUE(Result().lbprz);
+
+  // Blocks that cannot be deallocated are not reported to read as zeroes
+  identify_ctrl.oncs.dsm = 0;
+  controller_.SetIdentifyControllerData(identify_ctrl);
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            translator::ReadCapacity16ToScsi(buffer_, geometry, controller_));
+  EXPECT_FALSE(Result().lbpme);
+  EXPECT_FALSE(Result().lbprz);
+}
+
+TEST_F(ReadCapacity16Test, ShouldTruncateToShortBuffers) {
+  translator::NamespaceGeometry geometry = {.block_count = 0x100,
+                                            .lba_shift = 9};
+  uint8_t buffer[12];
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            translator::ReadCapacity16ToScsi(buffer, geometry, controller_));
+  EXPECT_EQ(0, buffer[0]);
+  EXPECT_EQ(0xff, buffer[7]);
+  EXPECT_EQ(0x02, buffer[10]);
+}
+
+TEST_F(ReadCapacity16Test, ShouldRejectUnsupportedBlockSize) {
+  identify_ns_.lbaf[0].lbads = 8;
+  EXPECT_EQ(translator::StatusCode::kFailure,
+            translator::ReadCapacity16ToScsi(buffer_, identify_cmd_,
+                                             controller_));
+
+  identify_cmd_.dptr.prp.prp1 = 0;
+  EXPECT_EQ(translator::StatusCode::kFailure,
+            translator::ReadCapacity16ToScsi(buffer_, identify_cmd_,
+                                             controller_));
+}
+
+}  // namespace
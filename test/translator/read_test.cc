@@ -14,9 +14,6 @@
 
 #include "lib/translator/read.h"
 
-#include <byteswap.h>
-#include <netinet/in.h>
-
 #include "gtest/gtest.h"
 
 namespace {
@@ -28,20 +25,28 @@ constexpr uint8_t kPrinfo = 0b0111;  // expected transformation of kRdProtect
 constexpr uint8_t kUnsupportedRdProtect = 0b111;
 constexpr uint8_t kFua = 0b1;
 constexpr uint32_t kNsid = 0x1a2b3c4d;
-constexpr uint32_t kLbaSize = 64;
+constexpr uint8_t kLbaShift = 6;
+constexpr uint32_t kLbaSize = 1 << kLbaShift;
+constexpr uint32_t kPageSize = 4096;
+constexpr translator::Controller kController;
 constexpr uint32_t kHostTransferLen = 50;
 
-uint8_t buffer_in[256 * kLbaSize];  // Buffer large enough for all tests
+// Buffer large enough for all tests
+alignas(kPageSize) uint8_t buffer_in[256 * kLbaSize];
+// Backs the PRP list of transfers spanning more than two pages
+alignas(kPageSize) uint8_t prp_list[kPageSize];
+translator::DataSegment data_in[] = {
+    {.addr = reinterpret_cast<uint64_t>(buffer_in), .len = sizeof(buffer_in)}};
 
 class ReadTest : public ::testing::Test {
  protected:
   // Per-test-suite set-up.
   // Called before the first test in this test suite.
   static void SetUpTestSuite() {
-    // Mocks AllocPages to not return a null (0) value
+    // Mocks AllocPages to hand out the PRP list page
     auto alloc_callback = [](uint32_t page_size, uint16_t count) -> uint64_t {
-      if (count != 0) {
-        return 1337;
+      if (count == 1) {
+        return reinterpret_cast<uint64_t>(prp_list);
       } else {
         return 0;
       }
@@ -54,36 +59,35 @@ class ReadTest : public ::testing::Test {
 TEST_F(ReadTest, Read6ToNvmeShouldReturnInvalidInputStatus) {
   uint32_t alloc_len = 0;
   uint8_t scsi_cmd[sizeof(scsi::Read6Command) - 1];
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
+  translator::NvmeCmdChain chain;
 
   translator::StatusCode status_code =
-      translator::Read6ToNvme(scsi_cmd, nvme_wrapper, allocation, kNsid,
-                              kLbaSize, buffer_in, alloc_len);
+      translator::Read6ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                              data_in, alloc_len);
   EXPECT_EQ(translator::StatusCode::kInvalidInput, status_code);
 }
 
 TEST_F(ReadTest, Read6ToNvmeShouldReturnCorrectTranslation) {
   uint32_t alloc_len = 0;
-  uint8_t network_endian_lba_1 = 0x1a;
-  uint16_t network_endian_lba_2 = htons(0x2b3c);
+  uint8_t host_endian_lba_1 = 0x1a;
+  uint16_t host_endian_lba_2 = 0x2b3c;
   uint32_t cdw10 = 0x1a2b3c;
 
   uint32_t cdw12 = translator::htoll(kHostTransferLen - 1);
 
   scsi::Read6Command cmd = {
-      .logical_block_address_1 = network_endian_lba_1,
-      .logical_block_address_2 = network_endian_lba_2,
+      .logical_block_address_1 = host_endian_lba_1,
+      .logical_block_address_2 = host_endian_lba_2,
       .transfer_length = kHostTransferLen,
   };
   uint8_t scsi_cmd[sizeof(scsi::Read6Command)];
   translator::WriteValue(cmd, scsi_cmd);
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
+  translator::NvmeCmdChain chain;
 
   translator::StatusCode status_code =
-      translator::Read6ToNvme(scsi_cmd, nvme_wrapper, allocation, kNsid,
-                              kLbaSize, buffer_in, alloc_len);
+      translator::Read6ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                              data_in, alloc_len);
+  translator::NvmeCmdWrapper& nvme_wrapper = chain.wrapper(0);
 
   EXPECT_EQ(translator::StatusCode::kSuccess, status_code);
   EXPECT_EQ((uint8_t)nvme::NvmOpcode::kRead, nvme_wrapper.cmd.opc);
@@ -99,25 +103,25 @@ TEST_F(ReadTest, Read6ToNvmeShouldReturnCorrectTranslation) {
 
 TEST_F(ReadTest, Read6ToNvmeShouldRead256BlocksForZeroTransferLen) {
   uint32_t alloc_len = 0;
-  uint8_t network_endian_lba_1 = 0x1a;
-  uint16_t network_endian_lba_2 = htons(0x2b3c);
+  uint8_t host_endian_lba_1 = 0x1a;
+  uint16_t host_endian_lba_2 = 0x2b3c;
   uint32_t cdw10 = 0x1a2b3c;
 
   uint32_t cdw12 = translator::htoll(255);
 
   scsi::Read6Command cmd = {
-      .logical_block_address_1 = network_endian_lba_1,
-      .logical_block_address_2 = network_endian_lba_2,
+      .logical_block_address_1 = host_endian_lba_1,
+      .logical_block_address_2 = host_endian_lba_2,
       .transfer_length = 0,
   };
   uint8_t scsi_cmd[sizeof(scsi::Read6Command)];
   translator::WriteValue(cmd, scsi_cmd);
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
+  translator::NvmeCmdChain chain;
 
   translator::StatusCode status_code =
-      translator::Read6ToNvme(scsi_cmd, nvme_wrapper, allocation, kNsid,
-                              kLbaSize, buffer_in, alloc_len);
+      translator::Read6ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                              data_in, alloc_len);
+  translator::NvmeCmdWrapper& nvme_wrapper = chain.wrapper(0);
 
   EXPECT_EQ(translator::StatusCode::kSuccess, status_code);
   EXPECT_EQ((uint8_t)nvme::NvmOpcode::kRead, nvme_wrapper.cmd.opc);
@@ -134,19 +138,17 @@ TEST_F(ReadTest, Read6ToNvmeShouldRead256BlocksForZeroTransferLen) {
 TEST_F(ReadTest, Read10ToNvmeShouldReturnInvalidInputStatus) {
   uint32_t alloc_len = 0;
   uint8_t scsi_cmd[sizeof(scsi::Read10Command) - 1];
-  translator::NvmeCmdWrapper nvme_wrapper;
-
-  translator::Allocation allocation = {};
+  translator::NvmeCmdChain chain;
   translator::StatusCode status_code =
-      translator::Read10ToNvme(scsi_cmd, nvme_wrapper, allocation, kNsid,
-                               kLbaSize, buffer_in, alloc_len);
+      translator::Read10ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                               data_in, alloc_len);
   EXPECT_EQ(translator::StatusCode::kInvalidInput, status_code);
 }
 
 TEST_F(ReadTest, Read10ToNvmeShouldReturnCorrectTranslation) {
   uint32_t alloc_len = 0;
-  uint32_t network_endian_lba = 0x1a2b3c4d;
-  uint32_t cdw10 = bswap_32(network_endian_lba);
+  uint32_t host_endian_lba = 0x1a2b3c4d;
+  uint32_t cdw10 = translator::htoll(host_endian_lba);
 
   uint32_t cdw12 =
       translator::htoll((kHostTransferLen - 1) | kPrinfo << 26 | kFua << 30);
@@ -154,17 +156,17 @@ TEST_F(ReadTest, Read10ToNvmeShouldReturnCorrectTranslation) {
   scsi::Read10Command cmd = {
       .fua = kFua,
       .rd_protect = kRdProtect,
-      .logical_block_address = network_endian_lba,
-      .transfer_length = htons(static_cast<uint16_t>(kHostTransferLen)),
+      .logical_block_address = host_endian_lba,
+      .transfer_length = static_cast<uint16_t>(kHostTransferLen),
   };
   uint8_t scsi_cmd[sizeof(scsi::Read10Command)];
   translator::WriteValue(cmd, scsi_cmd);
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
+  translator::NvmeCmdChain chain;
 
   translator::StatusCode status_code =
-      translator::Read10ToNvme(scsi_cmd, nvme_wrapper, allocation, kNsid,
-                               kLbaSize, buffer_in, alloc_len);
+      translator::Read10ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                               data_in, alloc_len);
+  translator::NvmeCmdWrapper& nvme_wrapper = chain.wrapper(0);
 
   EXPECT_EQ(translator::StatusCode::kSuccess, status_code);
   EXPECT_EQ((uint8_t)nvme::NvmOpcode::kRead, nvme_wrapper.cmd.opc);
@@ -181,19 +183,18 @@ TEST_F(ReadTest, Read10ToNvmeShouldReturnCorrectTranslation) {
 TEST_F(ReadTest, Read12ToNvmeShouldReturnInvalidInputStatus) {
   uint32_t alloc_len = 0;
   uint8_t scsi_cmd[sizeof(scsi::Read12Command) - 1];
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
+  translator::NvmeCmdChain chain;
 
   translator::StatusCode status_code =
-      translator::Read12ToNvme(scsi_cmd, nvme_wrapper, allocation, kNsid,
-                               kLbaSize, buffer_in, alloc_len);
+      translator::Read12ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                               data_in, alloc_len);
   EXPECT_EQ(translator::StatusCode::kInvalidInput, status_code);
 }
 
 TEST_F(ReadTest, Read12ToNvmeShouldReturnCorrectTranslation) {
   uint32_t alloc_len = 0;
-  uint32_t network_endian_lba = 0x1a2b3c4d;
-  uint32_t cdw10 = bswap_32(network_endian_lba);
+  uint32_t host_endian_lba = 0x1a2b3c4d;
+  uint32_t cdw10 = translator::htoll(host_endian_lba);
 
   uint32_t cdw12 =
       translator::htoll((kHostTransferLen - 1) | kPrinfo << 26 | kFua << 30);
@@ -201,17 +202,17 @@ TEST_F(ReadTest, Read12ToNvmeShouldReturnCorrectTranslation) {
   scsi::Read12Command cmd = {
       .fua = kFua,
       .rd_protect = kRdProtect,
-      .logical_block_address = network_endian_lba,
-      .transfer_length = htonl(static_cast<uint32_t>(kHostTransferLen)),
+      .logical_block_address = host_endian_lba,
+      .transfer_length = static_cast<uint32_t>(kHostTransferLen),
   };
   uint8_t scsi_cmd[sizeof(scsi::Read12Command)];
   translator::WriteValue(cmd, scsi_cmd);
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
+  translator::NvmeCmdChain chain;
 
   translator::StatusCode status_code =
-      translator::Read12ToNvme(scsi_cmd, nvme_wrapper, allocation, kNsid,
-                               kLbaSize, buffer_in, alloc_len);
+      translator::Read12ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                               data_in, alloc_len);
+  translator::NvmeCmdWrapper& nvme_wrapper = chain.wrapper(0);
 
   EXPECT_EQ(translator::StatusCode::kSuccess, status_code);
   EXPECT_EQ((uint8_t)nvme::NvmOpcode::kRead, nvme_wrapper.cmd.opc);
@@ -228,40 +229,62 @@ TEST_F(ReadTest, Read12ToNvmeShouldReturnCorrectTranslation) {
 TEST_F(ReadTest, Read16ToNvmeShouldReturnInvalidInputStatus) {
   uint32_t alloc_len = 0;
   uint8_t scsi_cmd[sizeof(scsi::Read16Command) - 1];
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
+  translator::NvmeCmdChain chain;
 
   translator::StatusCode status_code =
-      translator::Read16ToNvme(scsi_cmd, nvme_wrapper, allocation, kNsid,
-                               kLbaSize, buffer_in, alloc_len);
+      translator::Read16ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                               data_in, alloc_len);
   EXPECT_EQ(translator::StatusCode::kInvalidInput, status_code);
 }
 
-TEST_F(ReadTest, Read16ToNvmeLongTransferLengthShouldReturnInvalidInputStatus) {
+TEST_F(ReadTest, Read16ToNvmeShouldSplitTransferLongerThanMdts) {
   uint32_t alloc_len = 0;
-  uint64_t network_endian_lba = 0x1a2b3c4d5e6f7f8f;
-  uint32_t transfer_len = 0xffff + 1;
+  uint64_t host_endian_lba = 0x1a2b3c4d5e6f7f8f;
+  uint32_t transfer_len = 200;
+
+  // MDTS of 2 pages allows 128 blocks per command
+  translator::Controller controller;
+  nvme::IdentifyControllerData identify_ctrl = {};
+  identify_ctrl.mdts = 1;
+  controller.SetIdentifyControllerData(identify_ctrl);
 
-  scsi::Read16Command cmd = {.fua = kFua,
-                             .rd_protect = kRdProtect,
-                             .logical_block_address = network_endian_lba,
-                             .transfer_length = htonl(transfer_len)};
+  scsi::Read16Command cmd = {
+      .fua = kFua,
+      .rd_protect = kRdProtect,
+      .logical_block_address = host_endian_lba,
+      .transfer_length = transfer_len};
   uint8_t scsi_cmd[sizeof(scsi::Read16Command)];
   translator::WriteValue(cmd, scsi_cmd);
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
+  translator::NvmeCmdChain chain;
 
   translator::StatusCode status_code =
-      translator::Read16ToNvme(scsi_cmd, nvme_wrapper, allocation, kNsid,
-                               kLbaSize, buffer_in, alloc_len);
+      translator::Read16ToNvme(scsi_cmd, chain, kNsid, kLbaShift, controller,
+                               data_in, alloc_len);
 
-  EXPECT_EQ(translator::StatusCode::kInvalidInput, status_code);
+  ASSERT_EQ(translator::StatusCode::kSuccess, status_code);
+  EXPECT_EQ(transfer_len * kLbaSize, alloc_len);
+  ASSERT_EQ(2, chain.size());
+
+  translator::NvmeCmdWrapper& first = chain.wrapper(0);
+  EXPECT_EQ(static_cast<uint32_t>(host_endian_lba), first.cmd.cdw[0]);
+  EXPECT_EQ(static_cast<uint32_t>(host_endian_lba >> 32), first.cmd.cdw[1]);
+  EXPECT_EQ(127 | kPrinfo << 26 | kFua << 30, first.cmd.cdw[2]);
+  EXPECT_EQ(128 * kLbaSize, first.buffer_len);
+  EXPECT_EQ(0, first.data_offset);
+  EXPECT_EQ(reinterpret_cast<uint64_t>(buffer_in), first.cmd.dptr.prp.prp1);
+
+  translator::NvmeCmdWrapper& second = chain.wrapper(1);
+  EXPECT_EQ(static_cast<uint32_t>(host_endian_lba + 128), second.cmd.cdw[0]);
+  EXPECT_EQ(71 | kPrinfo << 26 | kFua << 30, second.cmd.cdw[2]);
+  EXPECT_EQ(72 * kLbaSize, second.buffer_len);
+  EXPECT_EQ(128 * kLbaSize, second.data_offset);
+  EXPECT_EQ(reinterpret_cast<uint64_t>(buffer_in) + 128 * kLbaSize,
+            second.cmd.dptr.prp.prp1);
 }
 
 TEST_F(ReadTest, Read16ToNvmeShouldReturnCorrectTranslation) {
   uint32_t alloc_len = 0;
   uint64_t host_endian_lba = 0x1a2b3c4d5e6f7f8f;
-  uint64_t network_endian_lba = translator::htonll(host_endian_lba);
   uint32_t cdw10 = translator::htoll(host_endian_lba);
   uint32_t cdw11 = translator::htoll(host_endian_lba >> 32);
 
@@ -270,16 +293,16 @@ TEST_F(ReadTest, Read16ToNvmeShouldReturnCorrectTranslation) {
   scsi::Read16Command cmd = {
       .fua = kFua,
       .rd_protect = kRdProtect,
-      .logical_block_address = network_endian_lba,
-      .transfer_length = htonl(static_cast<uint32_t>(kHostTransferLen))};
+      .logical_block_address = host_endian_lba,
+      .transfer_length = static_cast<uint32_t>(kHostTransferLen)};
   uint8_t scsi_cmd[sizeof(scsi::Read16Command)];
   translator::WriteValue(cmd, scsi_cmd);
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
+  translator::NvmeCmdChain chain;
 
   translator::StatusCode status_code =
-      translator::Read16ToNvme(scsi_cmd, nvme_wrapper, allocation, kNsid,
-                               kLbaSize, buffer_in, alloc_len);
+      translator::Read16ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                               data_in, alloc_len);
+  translator::NvmeCmdWrapper& nvme_wrapper = chain.wrapper(0);
 
   EXPECT_EQ(translator::StatusCode::kSuccess, status_code);
   EXPECT_EQ((uint8_t)nvme::NvmOpcode::kRead, nvme_wrapper.cmd.opc);
@@ -303,12 +326,11 @@ TEST_F(ReadTest, NonRead6ToNvmeShouldReturnNoTranslationForZeroTransferLen) {
   };
   uint8_t scsi_cmd[sizeof(scsi::Read10Command)];
   translator::WriteValue(cmd, scsi_cmd);
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
+  translator::NvmeCmdChain chain;
 
   translator::StatusCode status_code =
-      translator::Read10ToNvme(scsi_cmd, nvme_wrapper, allocation, kNsid,
-                               kLbaSize, buffer_in, alloc_len);
+      translator::Read10ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                               data_in, alloc_len);
   EXPECT_EQ(translator::StatusCode::kNoTranslation, status_code);
 }
 
@@ -318,41 +340,41 @@ TEST_F(ReadTest, ShouldReturnInvalidInputStatusForUnsupportedRdprotect) {
       .fua = kFua,
       .rd_protect = kUnsupportedRdProtect,
       .logical_block_address = 100,
-      .transfer_length = htons(static_cast<uint16_t>(kHostTransferLen)),
+      .transfer_length = static_cast<uint16_t>(kHostTransferLen),
   };
   uint8_t scsi_cmd[sizeof(scsi::Read10Command)];
   translator::WriteValue(cmd, scsi_cmd);
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
+  translator::NvmeCmdChain chain;
 
   translator::StatusCode status_code =
-      translator::Read10ToNvme(scsi_cmd, nvme_wrapper, allocation, kNsid,
-                               kLbaSize, buffer_in, alloc_len);
+      translator::Read10ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                               data_in, alloc_len);
   EXPECT_EQ(translator::StatusCode::kInvalidInput, status_code);
 }
 
 TEST_F(ReadTest, InsufficientBufferShouldReturnFailure) {
   uint32_t alloc_len = 0;
   uint32_t host_transfer_length = 16;
-  uint32_t network_transfer_length = htonl(host_transfer_length);
   uint32_t transfer_length_bytes = host_transfer_length * kLbaSize;
 
   uint8_t small_buffer[1];
+  translator::DataSegment small_data_in[] = {
+      {.addr = reinterpret_cast<uint64_t>(small_buffer),
+       .len = sizeof(small_buffer)}};
 
   scsi::Read12Command cmd = {
       .fua = kFua,
       .rd_protect = kRdProtect,
       .logical_block_address = 0xffffffff,
-      .transfer_length = network_transfer_length,
+      .transfer_length = host_transfer_length,
   };
   uint8_t scsi_cmd[sizeof(scsi::Read12Command)];
   translator::WriteValue(cmd, scsi_cmd);
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
+  translator::NvmeCmdChain chain;
 
   translator::StatusCode status_code =
-      translator::Read12ToNvme(scsi_cmd, nvme_wrapper, allocation, kNsid,
-                               kLbaSize, small_buffer, alloc_len);
+      translator::Read12ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                               small_data_in, alloc_len);
 
   ASSERT_EQ(translator::StatusCode::kFailure, status_code);
 }
@@ -365,16 +387,16 @@ TEST_F(ReadTest, ShouldSuccessfullyReadToScsiDataInBuffer) {
       .fua = kFua,
       .rd_protect = kRdProtect,
       .logical_block_address = 0xffffffff,
-      .transfer_length = htonl(kHostTransferLen),
+      .transfer_length = kHostTransferLen,
   };
   uint8_t scsi_cmd[sizeof(scsi::Read12Command)];
   translator::WriteValue(cmd, scsi_cmd);
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
+  translator::NvmeCmdChain chain;
 
   translator::StatusCode status_code =
-      translator::Read12ToNvme(scsi_cmd, nvme_wrapper, allocation, kNsid,
-                               kLbaSize, buffer_in, alloc_len);
+      translator::Read12ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                               data_in, alloc_len);
+  translator::NvmeCmdWrapper& nvme_wrapper = chain.wrapper(0);
   ASSERT_EQ(translator::StatusCode::kSuccess, status_code);
   ASSERT_EQ(transfer_length_bytes, alloc_len);
 
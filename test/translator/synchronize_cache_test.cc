@@ -30,4 +30,16 @@ TEST(SynchronizeCache10Test, ShouldBuildNvmeFlushCommand) {
   EXPECT_EQ(false, nvme_wrapper.is_admin);
 }
 
+TEST(SynchronizeCache16Test, ShouldBuildNvmeFlushCommand) {
+  translator::NvmeCmdWrapper nvme_wrapper;
+  uint32_t nsid = 0x12345;
+
+  translator::SynchronizeCache16ToNvme(nvme_wrapper, nsid);
+
+  EXPECT_EQ(static_cast<uint8_t>(nvme::NvmOpcode::kFlush),
+            nvme_wrapper.cmd.opc);
+  EXPECT_EQ(nsid, nvme_wrapper.cmd.nsid);
+  EXPECT_EQ(false, nvme_wrapper.is_admin);
+}
+
 }  // namespace
@@ -0,0 +1,134 @@
+// Copyright 2020 Google LLC
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "lib/translator/trace.h"
+
+#include <stdlib.h>
+
+#include "gtest/gtest.h"
+
+// Tests the binary trace ring buffer
+namespace {
+
+constexpr uint32_t kPageSize = 4096;
+constexpr uint32_t kCpuCount = 2;
+constexpr uint32_t kRingSize = 8;
+
+uint32_t current_cpu;
+
+uint32_t CurrentCpu() { return current_cpu; }
+
+uint64_t BackingAlloc(uint32_t page_size, uint16_t count) {
+  void* addr = aligned_alloc(page_size, page_size * count);
+  return reinterpret_cast<uint64_t>(addr);
+}
+
+void BackingDealloc(uint64_t addr, uint16_t count) {
+  free(reinterpret_cast<void*>(addr));
+}
+
+class TraceTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    current_cpu = 0;
+    ASSERT_EQ(translator::StatusCode::kSuccess,
+              buffer_.Init(kPageSize, kCpuCount, kRingSize, CurrentCpu,
+                           BackingAlloc, BackingDealloc));
+    translator::SetTraceBuffer(&buffer_);
+  }
+
+  void TearDown() override {
+    translator::SetTraceBuffer(nullptr);
+    buffer_.Destroy();
+  }
+
+  translator::TraceBuffer buffer_;
+};
+
+TEST_F(TraceTest, ShouldRecordAndDecodeTraces) {
+  TRANSLATOR_TRACE("opcode %#x lba %llu blocks %u", 0x88, 1ull << 40, 8);
+  TRANSLATOR_TRACE("offset %d", -4);
+
+  translator::TraceRecord records[kRingSize];
+  uint64_t cursor = 0;
+  uint64_t lost = 0;
+  ASSERT_EQ(2, buffer_.Read(0, cursor, records, lost));
+  EXPECT_EQ(2, cursor);
+  EXPECT_EQ(0, lost);
+
+  char text[64];
+  translator::DecodeTraceRecord(records[0], text);
+  EXPECT_STREQ("opcode 0x88 lba 1099511627776 blocks 8", text);
+  translator::DecodeTraceRecord(records[1], text);
+  EXPECT_STREQ("offset -4", text);
+}
+
+TEST_F(TraceTest, ShouldKeepRecordsPerCpu) {
+  TRANSLATOR_TRACE("cpu 0");
+  current_cpu = 1;
+  TRANSLATOR_TRACE("cpu 1");
+  TRANSLATOR_TRACE("cpu 1");
+
+  translator::TraceRecord records[kRingSize];
+  uint64_t cursor = 0;
+  uint64_t lost = 0;
+  EXPECT_EQ(1, buffer_.Read(0, cursor, records, lost));
+  cursor = 0;
+  EXPECT_EQ(2, buffer_.Read(1, cursor, records, lost));
+  EXPECT_EQ(0, lost);
+}
+
+TEST_F(TraceTest, ShouldOverwriteOldestRecords) {
+  for (uint32_t i = 0; i < kRingSize + 3; ++i)
+    TRANSLATOR_TRACE("record %u", i);
+
+  translator::TraceRecord records[kRingSize];
+  uint64_t cursor = 0;
+  uint64_t lost = 0;
+  ASSERT_EQ(kRingSize, buffer_.Read(0, cursor, records, lost));
+  EXPECT_EQ(3, lost);
+  EXPECT_EQ(3, records[0].args[0]);
+  EXPECT_EQ(kRingSize + 2, records[kRingSize - 1].args[0]);
+
+  // Later reads continue from the cursor
+  TRANSLATOR_TRACE("record %u", 100);
+  ASSERT_EQ(1, buffer_.Read(0, cursor, records, lost));
+  EXPECT_EQ(100, records[0].args[0]);
+}
+
+TEST_F(TraceTest, ShouldTruncateDecodedText) {
+  TRANSLATOR_TRACE("value %u", 123456);
+
+  translator::TraceRecord record;
+  uint64_t cursor = 0;
+  uint64_t lost = 0;
+  ASSERT_EQ(1, buffer_.Read(0, cursor, translator::Span(&record, 1), lost));
+
+  char text[10];
+  EXPECT_EQ(9, translator::DecodeTraceRecord(record, text));
+  EXPECT_STREQ("value 123", text);
+}
+
+TEST(Trace, ShouldIgnoreTracesWithoutBuffer) {
+  TRANSLATOR_TRACE("dropped %u", 1);
+}
+
+TEST(Trace, ShouldRejectRingSizeNotPowerOfTwo) {
+  translator::TraceBuffer buffer;
+  EXPECT_EQ(translator::StatusCode::kFailure,
+            buffer.Init(kPageSize, kCpuCount, 6, CurrentCpu, BackingAlloc,
+                        BackingDealloc));
+}
+
+}  // namespace
@@ -14,6 +14,8 @@
 
 #include "lib/translator/translation.h"
 
+#include <netinet/in.h>
+
 #include "gtest/gtest.h"
 
 namespace {
@@ -21,7 +23,7 @@ namespace {
 /*
    Tests translation class
 */
-const uint32_t kPageSize = 4096;
+constexpr uint32_t kPageSize = 4096;
 
 TEST(Translation, ShouldHandleUnknownOpcode) {
   translator::Translation translation = {};
@@ -41,6 +43,556 @@ TEST(Translation, ShouldReturnInquirySuccess) {
   EXPECT_EQ(translator::ApiStatus::kSuccess, resp.status);
 }
 
+TEST(Translation, ShouldRejectTruncatedCdb) {
+  translator::Translation translation = {};
+  uint8_t read_cmd[sizeof(scsi::Read10Command)] = {
+      static_cast<uint8_t>(scsi::OpCode::kRead10)};
+  translator::Span<const uint8_t> buffer_out;
+  translator::BeginResponse resp = translation.Begin(read_cmd, buffer_out, 0);
+  EXPECT_EQ(translator::ApiStatus::kSuccess, resp.status);
+  EXPECT_EQ(0, translation.GetNvmeWrappers().size());
+
+  scsi::DescriptorFormatSenseData dfsd = {};
+  translator::Span<uint8_t> sense_buffer(reinterpret_cast<uint8_t*>(&dfsd),
+                                         sizeof(dfsd));
+  translator::CompleteResponse cpl_resp =
+      translation.Complete({}, {}, sense_buffer);
+  EXPECT_EQ(scsi::Status::kCheckCondition, cpl_resp.scsi_status);
+  EXPECT_EQ(scsi::SenseKey::kIllegalRequest, dfsd.sense_key);
+}
+
+TEST(Translation, ShouldAnswerReportSupportedOpCodesWithoutNvmeCommands) {
+  translator::Translation translation = {};
+  scsi::ReportOpCodesCommand cmd = {
+      .reporting_options = 0b001,
+      .requested_op_code = static_cast<uint8_t>(scsi::OpCode::kWriteSame16)};
+  uint8_t scsi_cmd[sizeof(scsi::ReportOpCodesCommand) + 1] = {
+      static_cast<uint8_t>(scsi::OpCode::kMaintenanceIn)};
+  ASSERT_TRUE(translator::WriteValue(
+      cmd, translator::Span(scsi_cmd + 1, sizeof(cmd))));
+  translator::Span<const uint8_t> buffer_out;
+  translator::BeginResponse resp = translation.Begin(scsi_cmd, buffer_out, 0);
+  ASSERT_EQ(translator::ApiStatus::kSuccess, resp.status);
+  EXPECT_EQ(sizeof(scsi::OneCommandParamData) + 16, resp.alloc_len);
+  EXPECT_EQ(0, translation.GetNvmeWrappers().size());
+
+  uint8_t buffer_in[sizeof(scsi::OneCommandParamData) + 16] = {};
+  uint8_t sense[sizeof(scsi::DescriptorFormatSenseData)] = {};
+  translator::CompleteResponse cpl_resp =
+      translation.Complete({}, buffer_in, sense);
+  EXPECT_EQ(translator::ApiStatus::kSuccess, cpl_resp.status);
+  EXPECT_EQ(scsi::Status::kGood, cpl_resp.scsi_status);
+}
+
+TEST(Translation, ShouldCountModeSenseCommands) {
+  translator::Translation translation = {};
+  // Without block descriptors only Get Features is needed
+  scsi::ModeSense6Command cmd = {.dbd = true,
+                                 .page_code = scsi::ModePageCode::kCacheMode,
+                                 .alloc_length = 255};
+  uint8_t scsi_cmd[sizeof(scsi::ModeSense6Command) + 1] = {
+      static_cast<uint8_t>(scsi::OpCode::kModeSense6)};
+  ASSERT_TRUE(translator::WriteValue(
+      cmd, translator::Span(scsi_cmd + 1, sizeof(cmd))));
+  translator::Span<const uint8_t> buffer_out;
+  translator::BeginResponse resp = translation.Begin(scsi_cmd, buffer_out, 0);
+  ASSERT_EQ(translator::ApiStatus::kSuccess, resp.status);
+  EXPECT_EQ(1, translation.GetNvmeWrappers().size());
+  translation.AbortPipeline();
+}
+
+TEST(Translation, ShouldSkipFlushWithoutVolatileWriteCache) {
+  translator::Controller controller;
+  uint8_t sync10[sizeof(scsi::SynchronizeCache10Command) + 1] = {
+      static_cast<uint8_t>(scsi::OpCode::kSync10)};
+  uint8_t sync16[sizeof(scsi::SynchronizeCache16Command) + 1] = {
+      static_cast<uint8_t>(scsi::OpCode::kSync16)};
+  translator::Span<const uint8_t> cmds[] = {sync10, sync16};
+  translator::Span<const uint8_t> buffer_out;
+  translator::Span<uint8_t> sense_buffer;
+
+  // Controllers are assumed to cache writes until identified
+  for (translator::Span<const uint8_t> cmd : cmds) {
+    translator::Translation translation(controller);
+    ASSERT_EQ(translator::ApiStatus::kSuccess,
+              translation.Begin(cmd, buffer_out, 0).status);
+    ASSERT_EQ(1, translation.GetNvmeWrappers().size());
+    EXPECT_EQ(static_cast<uint8_t>(nvme::NvmOpcode::kFlush),
+              translation.GetNvmeWrappers()[0].cmd.opc);
+    translation.AbortPipeline();
+  }
+
+  nvme::IdentifyControllerData identify_ctrl = {};
+  controller.SetIdentifyControllerData(identify_ctrl);
+  for (translator::Span<const uint8_t> cmd : cmds) {
+    translator::Translation translation(controller);
+    ASSERT_EQ(translator::ApiStatus::kSuccess,
+              translation.Begin(cmd, buffer_out, 0).status);
+    EXPECT_EQ(0, translation.GetNvmeWrappers().size());
+    translator::CompleteResponse cpl_resp =
+        translation.Complete({}, {}, sense_buffer);
+    ASSERT_EQ(translator::ApiStatus::kSuccess, cpl_resp.status);
+    EXPECT_EQ(scsi::Status::kGood, cpl_resp.scsi_status);
+  }
+}
+
+TEST(Translation, ShouldLearnVolatileWriteCacheStateFromModeSense) {
+  translator::Controller controller;
+  nvme::IdentifyControllerData identify_ctrl = {};
+  identify_ctrl.vwc.present = 1;
+  controller.SetIdentifyControllerData(identify_ctrl);
+
+  scsi::ModeSense6Command cmd = {.dbd = true,
+                                 .page_code = scsi::ModePageCode::kCacheMode,
+                                 .pc = scsi::PageControl::kCurrent,
+                                 .alloc_length = 255};
+  uint8_t scsi_cmd[sizeof(scsi::ModeSense6Command) + 1] = {
+      static_cast<uint8_t>(scsi::OpCode::kModeSense6)};
+  ASSERT_TRUE(translator::WriteValue(
+      cmd, translator::Span(scsi_cmd + 1, sizeof(cmd))));
+  uint8_t buffer[255] = {};
+  translator::Span<uint8_t> sense_buffer;
+
+  // Get Features reports WCE clear
+  translator::Translation translation(controller);
+  ASSERT_EQ(translator::ApiStatus::kSuccess,
+            translation.Begin(scsi_cmd, buffer, 0).status);
+  ASSERT_EQ(1, translation.GetNvmeWrappers().size());
+  nvme::GenericQueueEntryCpl cpl_data[1] = {};
+  ASSERT_EQ(translator::ApiStatus::kSuccess,
+            translation.Complete(cpl_data, buffer, sense_buffer).status);
+  EXPECT_FALSE(controller.VolatileWriteCacheEnabled());
+
+  // And set again
+  translator::Translation enabled(controller);
+  ASSERT_EQ(translator::ApiStatus::kSuccess,
+            enabled.Begin(scsi_cmd, buffer, 0).status);
+  cpl_data[0].cdw0 = 1;
+  ASSERT_EQ(translator::ApiStatus::kSuccess,
+            enabled.Complete(cpl_data, buffer, sense_buffer).status);
+  EXPECT_TRUE(controller.VolatileWriteCacheEnabled());
+}
+
+TEST(Translation, ShouldIdentifyDirectDataTransfers) {
+  uint8_t read_opc = static_cast<uint8_t>(scsi::OpCode::kRead10);
+  uint8_t write_opc = static_cast<uint8_t>(scsi::OpCode::kWrite16);
+  uint8_t inquiry_opc = static_cast<uint8_t>(scsi::OpCode::kInquiry);
+  EXPECT_TRUE(translator::IsDirectDataTransfer(translator::Span(&read_opc, 1)));
+  EXPECT_TRUE(
+      translator::IsDirectDataTransfer(translator::Span(&write_opc, 1)));
+  EXPECT_FALSE(
+      translator::IsDirectDataTransfer(translator::Span(&inquiry_opc, 1)));
+  EXPECT_FALSE(translator::IsDirectDataTransfer({}));
+}
+
+TEST(Translation, ShouldRejectDataSegmentsForBufferedCommand) {
+  translator::Translation translation = {};
+  uint8_t opc = static_cast<uint8_t>(scsi::OpCode::kInquiry);
+  translator::Span<const uint8_t> scsi_cmd = translator::Span(&opc, 1);
+  translator::Span<const translator::DataSegment> data_segments;
+  translator::BeginResponse resp =
+      translation.Begin(scsi_cmd, data_segments, 0);
+  EXPECT_EQ(translator::ApiStatus::kFailure, resp.status);
+}
+
+TEST(Translation, ShouldReadIntoDataSegments) {
+  translator::Translation translation = {};
+  scsi::Read10Command cmd = {.transfer_length = 2};
+  uint8_t scsi_cmd[sizeof(scsi::Read10Command) + 1] = {
+      static_cast<uint8_t>(scsi::OpCode::kRead10)};
+  ASSERT_TRUE(translator::WriteValue(cmd, translator::Span(scsi_cmd + 1,
+                                                           sizeof(cmd))));
+
+  // Each segment holds exactly one logical block
+  alignas(kPageSize) uint8_t page_1[kPageSize];
+  alignas(kPageSize) uint8_t page_2[kPageSize];
+  translator::DataSegment data_segments[] = {
+      {.addr = reinterpret_cast<uint64_t>(page_1), .len = sizeof(page_1)},
+      {.addr = reinterpret_cast<uint64_t>(page_2), .len = sizeof(page_2)}};
+  translator::BeginResponse resp =
+      translation.Begin(scsi_cmd, data_segments, 0);
+  ASSERT_EQ(translator::ApiStatus::kSuccess, resp.status);
+  EXPECT_EQ(2 * kPageSize, resp.alloc_len);
+
+  translator::Span<const translator::NvmeCmdWrapper> nvme_wrappers =
+      translation.GetNvmeWrappers();
+  ASSERT_EQ(1, nvme_wrappers.size());
+  EXPECT_EQ(reinterpret_cast<uint64_t>(page_1),
+            nvme_wrappers[0].cmd.dptr.prp.prp1);
+  EXPECT_EQ(reinterpret_cast<uint64_t>(page_2),
+            nvme_wrappers[0].cmd.dptr.prp.prp2);
+  EXPECT_EQ(2 * kPageSize, nvme_wrappers[0].buffer_len);
+  translation.AbortPipeline();
+}
+
+TEST(Translation, ShouldSplitReadAndCompleteWithFirstError) {
+  // MDTS of 2 pages allows 2 blocks per command
+  translator::Controller controller;
+  nvme::IdentifyControllerData identify_ctrl = {};
+  identify_ctrl.mdts = 1;
+  controller.SetIdentifyControllerData(identify_ctrl);
+
+  // Backs the command chain, which is too long to be held inline
+  alignas(kPageSize) static uint8_t chain_page[kPageSize];
+  auto alloc_callback = [](uint32_t page_size, uint16_t count) -> uint64_t {
+    return count == 1 ? reinterpret_cast<uint64_t>(chain_page) : 0;
+  };
+  static int dealloc_count;
+  auto dealloc_callback = [](uint64_t addr, uint16_t count) {
+    ++dealloc_count;
+  };
+  translator::SetAllocPageCallbacks(alloc_callback, dealloc_callback);
+
+  translator::Translation translation(controller);
+  scsi::Read12Command cmd = {.transfer_length = 7};
+  uint8_t scsi_cmd[sizeof(scsi::Read12Command) + 1] = {
+      static_cast<uint8_t>(scsi::OpCode::kRead12)};
+  ASSERT_TRUE(translator::WriteValue(cmd, translator::Span(scsi_cmd + 1,
+                                                           sizeof(cmd))));
+  alignas(kPageSize) static uint8_t data[7 * kPageSize];
+  translator::DataSegment data_segments[] = {
+      {.addr = reinterpret_cast<uint64_t>(data), .len = sizeof(data)}};
+  translator::BeginResponse resp =
+      translation.Begin(scsi_cmd, data_segments, 0);
+  ASSERT_EQ(translator::ApiStatus::kSuccess, resp.status);
+  EXPECT_EQ(sizeof(data), resp.alloc_len);
+
+  translator::Span<const translator::NvmeCmdWrapper> nvme_wrappers =
+      translation.GetNvmeWrappers();
+  ASSERT_EQ(4, nvme_wrappers.size());
+  for (uint32_t i = 0; i < nvme_wrappers.size(); ++i) {
+    EXPECT_EQ(2 * i, nvme_wrappers[i].cmd.cdw[0]);
+    EXPECT_EQ(2 * i * kPageSize, nvme_wrappers[i].data_offset);
+    EXPECT_EQ(reinterpret_cast<uint64_t>(data) + 2 * i * kPageSize,
+              nvme_wrappers[i].cmd.dptr.prp.prp1);
+  }
+  EXPECT_EQ(kPageSize, nvme_wrappers[3].buffer_len);
+
+  // The third command fails with Invalid Field in Command
+  nvme::GenericQueueEntryCpl cpl_data[4] = {};
+  cpl_data[2].cpl_status.sc =
+      static_cast<uint8_t>(nvme::GenericCommandStatusCode::kInvalidField);
+  translator::Span<uint8_t> buffer_in;
+  scsi::DescriptorFormatSenseData dfsd = {};
+  translator::Span<uint8_t> sense_buffer(reinterpret_cast<uint8_t*>(&dfsd),
+                                         sizeof(dfsd));
+  translator::CompleteResponse cpl_resp =
+      translation.Complete(cpl_data, buffer_in, sense_buffer);
+  ASSERT_EQ(translator::ApiStatus::kSuccess, cpl_resp.status);
+  EXPECT_EQ(scsi::Status::kCheckCondition, cpl_resp.scsi_status);
+  EXPECT_EQ(scsi::SenseKey::kIllegalRequest, dfsd.sense_key);
+
+  // The chain memory was returned
+  EXPECT_EQ(1, dealloc_count);
+  translator::SetAllocPageCallbacks(nullptr, nullptr);
+}
+
+TEST(Translation, ShouldTranslateWriteSameFromTheLinearBuffer) {
+  translator::Controller controller;
+  nvme::IdentifyControllerData identify_ctrl = {};
+  identify_ctrl.oncs.write_zeroes = 1;
+  controller.SetIdentifyControllerData(identify_ctrl);
+  translator::Translation translation(controller);
+
+  scsi::WriteSame16Command cmd = {.unmap = 1,
+                                  .logical_block_address = 0x20,
+                                  .number_of_logical_blocks = 0x20000};
+  uint8_t scsi_cmd[sizeof(scsi::WriteSame16Command) + 1] = {
+      static_cast<uint8_t>(scsi::OpCode::kWriteSame16)};
+  ASSERT_TRUE(translator::WriteValue(cmd, translator::Span(scsi_cmd + 1,
+                                                           sizeof(cmd))));
+  EXPECT_FALSE(translator::IsDirectDataTransfer(scsi_cmd));
+  // Namespaces default to 4 KiB blocks until their geometry is cached
+  uint8_t block[1 << translator::kDefaultLbaShift] = {};
+  translator::BeginResponse resp = translation.Begin(
+      scsi_cmd, translator::Span<const uint8_t>(block, sizeof(block)), 0);
+  ASSERT_EQ(translator::ApiStatus::kSuccess, resp.status);
+
+  translator::Span<const translator::NvmeCmdWrapper> nvme_wrappers =
+      translation.GetNvmeWrappers();
+  ASSERT_EQ(2, nvme_wrappers.size());
+  EXPECT_EQ(static_cast<uint8_t>(nvme::NvmOpcode::kWriteZeroes),
+            nvme_wrappers[1].cmd.opc);
+  EXPECT_EQ(0x10020, nvme_wrappers[1].cmd.cdw[0]);
+
+  nvme::GenericQueueEntryCpl cpl_data[2] = {};
+  uint8_t sense[sizeof(scsi::DescriptorFormatSenseData)] = {};
+  translator::CompleteResponse cpl_resp =
+      translation.Complete(cpl_data, {}, sense);
+  ASSERT_EQ(translator::ApiStatus::kSuccess, cpl_resp.status);
+  EXPECT_EQ(scsi::Status::kGood, cpl_resp.scsi_status);
+}
+
+TEST(Translation, ShouldCacheNamespaceGeometryFromReadCapacity) {
+  translator::Controller controller;
+  alignas(kPageSize) static nvme::IdentifyNamespace identify_ns;
+  identify_ns = {.nsze = 0x800};
+  identify_ns.lbaf[0].lbads = 9;
+  auto alloc_callback = [](uint32_t page_size, uint16_t count) -> uint64_t {
+    return reinterpret_cast<uint64_t>(&identify_ns);
+  };
+  auto dealloc_callback = [](uint64_t addr, uint16_t count) {};
+  translator::SetAllocPageCallbacks(alloc_callback, dealloc_callback);
+
+  uint8_t scsi_cmd[sizeof(scsi::ReadCapacity10Command) + 1] = {
+      static_cast<uint8_t>(scsi::OpCode::kReadCapacity10)};
+  scsi::ReadCapacity10Data result = {};
+  translator::Span<uint8_t> buffer_in(reinterpret_cast<uint8_t*>(&result),
+                                      sizeof(result));
+  translator::Span<uint8_t> sense_buffer;
+
+  // The first Read Capacity fetches Identify Namespace
+  translator::Translation translation(controller);
+  ASSERT_EQ(translator::ApiStatus::kSuccess,
+            translation.Begin(scsi_cmd, buffer_in, 0).status);
+  ASSERT_EQ(1, translation.GetNvmeWrappers().size());
+  nvme::GenericQueueEntryCpl cpl_data[1] = {};
+  ASSERT_EQ(translator::ApiStatus::kSuccess,
+            translation.Complete(cpl_data, buffer_in, sense_buffer).status);
+  EXPECT_EQ(0x7ff, result.returned_logical_block_address.value());
+  EXPECT_EQ(512, result.block_length.value());
+
+  // Later ones are answered from the cached geometry
+  result = {};
+  translator::Translation cached(controller);
+  ASSERT_EQ(translator::ApiStatus::kSuccess,
+            cached.Begin(scsi_cmd, buffer_in, 0).status);
+  EXPECT_EQ(0, cached.GetNvmeWrappers().size());
+  translator::CompleteResponse cpl_resp =
+      cached.Complete({}, buffer_in, sense_buffer);
+  ASSERT_EQ(translator::ApiStatus::kSuccess, cpl_resp.status);
+  EXPECT_EQ(scsi::Status::kGood, cpl_resp.scsi_status);
+  EXPECT_EQ(0x7ff, result.returned_logical_block_address.value());
+  EXPECT_EQ(512, result.block_length.value());
+  translator::SetAllocPageCallbacks(nullptr, nullptr);
+}
+
+TEST(Translation, ShouldReadCapacity16FromCachedGeometry) {
+  translator::Controller controller;
+  controller.SetNamespaceGeometry(1, {.block_count = 0x200000000,
+                                      .lba_shift = 9,
+                                      .physical_block_shift = 3});
+
+  scsi::ReadCapacity16Command cmd = {
+      .service_action =
+          static_cast<uint8_t>(scsi::ServiceActionIn16::kReadCapacity16),
+      .alloc_length = sizeof(scsi::ReadCapacity16Data)};
+  uint8_t scsi_cmd[sizeof(cmd) + 1] = {
+      static_cast<uint8_t>(scsi::OpCode::kServiceActionIn)};
+  ASSERT_TRUE(translator::WriteValue(cmd, translator::Span(scsi_cmd + 1,
+                                                           sizeof(cmd))));
+  scsi::ReadCapacity16Data result = {};
+  translator::Span<uint8_t> buffer_in(reinterpret_cast<uint8_t*>(&result),
+                                      sizeof(result));
+  translator::Span<uint8_t> sense_buffer;
+
+  translator::Translation translation(controller);
+  translator::BeginResponse resp = translation.Begin(scsi_cmd, buffer_in, 0);
+  ASSERT_EQ(translator::ApiStatus::kSuccess, resp.status);
+  EXPECT_EQ(sizeof(result), resp.alloc_len);
+  EXPECT_EQ(0, translation.GetNvmeWrappers().size());
+  translator::CompleteResponse cpl_resp =
+      translation.Complete({}, buffer_in, sense_buffer);
+  ASSERT_EQ(translator::ApiStatus::kSuccess, cpl_resp.status);
+  EXPECT_EQ(scsi::Status::kGood, cpl_resp.scsi_status);
+  EXPECT_EQ(0x1ffffffff, result.returned_logical_block_address.value());
+  EXPECT_EQ(512, result.block_length.value());
+  EXPECT_EQ(3, result.logical_blocks_per_physical_block_exponent);
+
+  // Other Service Action In service actions are rejected
+  scsi_cmd[1] = 0x11;
+  translator::Translation unsupported(controller);
+  ASSERT_EQ(translator::ApiStatus::kSuccess,
+            unsupported.Begin(scsi_cmd, buffer_in, 0).status);
+  scsi::DescriptorFormatSenseData dfsd = {};
+  cpl_resp = unsupported.Complete(
+      {}, buffer_in,
+      translator::Span<uint8_t>(reinterpret_cast<uint8_t*>(&dfsd),
+                                sizeof(dfsd)));
+  EXPECT_EQ(scsi::Status::kCheckCondition, cpl_resp.scsi_status);
+  EXPECT_EQ(scsi::AdditionalSenseCode::kInvalidFieldInCdb,
+            dfsd.additional_sense_code);
+}
+
+TEST(Translation, ShouldReadWithCachedBlockSize) {
+  translator::Controller controller;
+  controller.SetNamespaceGeometry(1, {.block_count = 0x800, .lba_shift = 9});
+
+  translator::Translation translation(controller);
+  scsi::Read10Command cmd = {.transfer_length = 8};
+  uint8_t scsi_cmd[sizeof(scsi::Read10Command) + 1] = {
+      static_cast<uint8_t>(scsi::OpCode::kRead10)};
+  ASSERT_TRUE(translator::WriteValue(cmd, translator::Span(scsi_cmd + 1,
+                                                           sizeof(cmd))));
+  alignas(kPageSize) static uint8_t data[kPageSize];
+  translator::DataSegment data_segments[] = {
+      {.addr = reinterpret_cast<uint64_t>(data), .len = sizeof(data)}};
+  translator::BeginResponse resp =
+      translation.Begin(scsi_cmd, data_segments, 0);
+  ASSERT_EQ(translator::ApiStatus::kSuccess, resp.status);
+  EXPECT_EQ(8 * 512, resp.alloc_len);
+
+  translator::Span<const translator::NvmeCmdWrapper> nvme_wrappers =
+      translation.GetNvmeWrappers();
+  ASSERT_EQ(1, nvme_wrappers.size());
+  EXPECT_EQ(8 * 512, nvme_wrappers[0].buffer_len);
+  EXPECT_EQ(7, nvme_wrappers[0].cmd.cdw[2] & 0xffff);
+  translation.AbortPipeline();
+}
+
+TEST(Translation, ShouldPlaceIdentifyDataInScratchPages) {
+  auto alloc_callback = [](uint32_t page_size, uint16_t count) -> uint64_t {
+    ADD_FAILURE() << "Scratch pages should be used";
+    return 0;
+  };
+  auto dealloc_callback = [](uint64_t addr, uint16_t count) {
+    ADD_FAILURE() << "Scratch pages should not be freed";
+  };
+  translator::SetAllocPageCallbacks(alloc_callback, dealloc_callback);
+
+  alignas(kPageSize) static uint8_t scratch[2][kPageSize];
+  translator::Translation translation;
+  translation.SetScratchPages(reinterpret_cast<uint64_t>(scratch), 2);
+  scsi::InquiryCommand cmd = {.allocation_length = htons(36)};
+  uint8_t scsi_cmd[sizeof(scsi::InquiryCommand) + 1] = {
+      static_cast<uint8_t>(scsi::OpCode::kInquiry)};
+  ASSERT_TRUE(translator::WriteValue(cmd, translator::Span(scsi_cmd + 1,
+                                                           sizeof(cmd))));
+  uint8_t buffer[36] = {};
+  translator::BeginResponse resp = translation.Begin(scsi_cmd, buffer, 0);
+  ASSERT_EQ(translator::ApiStatus::kSuccess, resp.status);
+
+  translator::Span<const translator::NvmeCmdWrapper> nvme_wrappers =
+      translation.GetNvmeWrappers();
+  ASSERT_EQ(2, nvme_wrappers.size());
+  EXPECT_EQ(reinterpret_cast<uint64_t>(scratch[0]),
+            nvme_wrappers[0].cmd.dptr.prp.prp1);
+  EXPECT_EQ(reinterpret_cast<uint64_t>(scratch[1]),
+            nvme_wrappers[1].cmd.dptr.prp.prp1);
+  translation.AbortPipeline();
+  translator::SetAllocPageCallbacks(nullptr, nullptr);
+}
+
+TEST(Translation, ShouldPlacePrpListsInScratchPages) {
+  static int alloc_count;
+  alloc_count = 0;
+  auto alloc_callback = [](uint32_t page_size, uint16_t count) -> uint64_t {
+    ++alloc_count;
+    return 0;
+  };
+  auto dealloc_callback = [](uint64_t addr, uint16_t count) {
+    ADD_FAILURE() << "Scratch pages should not be freed";
+  };
+  translator::SetAllocPageCallbacks(alloc_callback, dealloc_callback);
+
+  translator::Controller controller;
+  controller.SetNamespaceGeometry(1, {.block_count = 0x800, .lba_shift = 9});
+  alignas(kPageSize) static uint8_t scratch[kPageSize];
+  translator::Translation translation(controller);
+  translation.SetScratchPages(reinterpret_cast<uint64_t>(scratch), 1);
+  // Three pages need a PRP list
+  scsi::Read10Command cmd = {.transfer_length = 24};
+  uint8_t scsi_cmd[sizeof(scsi::Read10Command) + 1] = {
+      static_cast<uint8_t>(scsi::OpCode::kRead10)};
+  ASSERT_TRUE(translator::WriteValue(cmd, translator::Span(scsi_cmd + 1,
+                                                           sizeof(cmd))));
+  alignas(kPageSize) static uint8_t data[3 * kPageSize];
+  translator::DataSegment data_segments[] = {
+      {.addr = reinterpret_cast<uint64_t>(data), .len = sizeof(data)}};
+  translator::BeginResponse resp =
+      translation.Begin(scsi_cmd, data_segments, 0);
+  ASSERT_EQ(translator::ApiStatus::kSuccess, resp.status);
+
+  translator::Span<const translator::NvmeCmdWrapper> nvme_wrappers =
+      translation.GetNvmeWrappers();
+  ASSERT_EQ(1, nvme_wrappers.size());
+  EXPECT_EQ(reinterpret_cast<uint64_t>(data),
+            nvme_wrappers[0].cmd.dptr.prp.prp1);
+  EXPECT_EQ(reinterpret_cast<uint64_t>(scratch),
+            nvme_wrappers[0].cmd.dptr.prp.prp2);
+  EXPECT_EQ(0, alloc_count);
+  translation.AbortPipeline();
+  translator::SetAllocPageCallbacks(nullptr, nullptr);
+}
+
+TEST(Translation, ShouldTranslateBatchIntoOneCommandArray) {
+  translator::Controller controller;
+  controller.SetNamespaceGeometry(1, {.block_count = 0x800, .lba_shift = 9});
+
+  uint8_t test_unit_ready[7] = {
+      static_cast<uint8_t>(scsi::OpCode::kTestUnitReady)};
+  uint8_t sync[sizeof(scsi::SynchronizeCache10Command) + 1] = {
+      static_cast<uint8_t>(scsi::OpCode::kSync10)};
+  scsi::Read10Command read = {.transfer_length = 8};
+  uint8_t read_cmd[sizeof(scsi::Read10Command) + 1] = {
+      static_cast<uint8_t>(scsi::OpCode::kRead10)};
+  ASSERT_TRUE(translator::WriteValue(
+      read, translator::Span(read_cmd + 1, sizeof(read))));
+  alignas(kPageSize) static uint8_t data[kPageSize];
+  translator::DataSegment data_segments[] = {
+      {.addr = reinterpret_cast<uint64_t>(data), .len = sizeof(data)}};
+
+  translator::BatchEntry entries[] = {
+      {.scsi_cmd = sync, .lun = 0},
+      {.scsi_cmd = test_unit_ready, .lun = 0},
+      {.scsi_cmd = read_cmd, .data_segments = data_segments, .lun = 0}};
+  translator::BatchContext contexts[3] = {
+      {.translation = translator::Translation(controller)},
+      {.translation = translator::Translation(controller)},
+      {.translation = translator::Translation(controller)}};
+  translator::NvmeCmdWrapper nvme_cmds[4] = {};
+  translator::BatchBeginResponse resp =
+      translator::BeginBatch(entries, contexts, nvme_cmds);
+  ASSERT_EQ(translator::ApiStatus::kSuccess, resp.status);
+  EXPECT_EQ(3, resp.entry_count);
+  ASSERT_EQ(2, resp.nvme_cmd_count);
+  EXPECT_EQ(static_cast<uint8_t>(nvme::NvmOpcode::kFlush),
+            nvme_cmds[0].cmd.opc);
+  EXPECT_EQ(static_cast<uint8_t>(nvme::NvmOpcode::kRead),
+            nvme_cmds[1].cmd.opc);
+  EXPECT_EQ(8 * 512, contexts[2].response.alloc_len);
+  EXPECT_EQ(1, contexts[2].nvme_offset);
+  EXPECT_EQ(1, contexts[2].nvme_count);
+
+  // The Read fails, the other commands succeed
+  nvme::GenericQueueEntryCpl cpl_data[2] = {};
+  cpl_data[1].cpl_status.sc =
+      static_cast<uint8_t>(nvme::GenericCommandStatusCode::kInvalidField);
+  translator::CompleteResponse responses[3] = {};
+  ASSERT_EQ(translator::ApiStatus::kSuccess,
+            translator::CompleteBatch(entries, contexts, cpl_data, responses));
+  for (const translator::CompleteResponse& response : responses)
+    EXPECT_EQ(translator::ApiStatus::kSuccess, response.status);
+  EXPECT_EQ(scsi::Status::kGood, responses[0].scsi_status);
+  EXPECT_EQ(scsi::Status::kGood, responses[1].scsi_status);
+  EXPECT_EQ(scsi::Status::kCheckCondition, responses[2].scsi_status);
+}
+
+TEST(Translation, ShouldStopBatchWhenCommandArrayIsFull) {
+  uint8_t sync[sizeof(scsi::SynchronizeCache10Command) + 1] = {
+      static_cast<uint8_t>(scsi::OpCode::kSync10)};
+  translator::BatchEntry entries[] = {{.scsi_cmd = sync, .lun = 0},
+                                      {.scsi_cmd = sync, .lun = 1}};
+  translator::BatchContext contexts[2] = {};
+  translator::NvmeCmdWrapper nvme_cmds[1] = {};
+  translator::BatchBeginResponse resp =
+      translator::BeginBatch(entries, contexts, nvme_cmds);
+  ASSERT_EQ(translator::ApiStatus::kSuccess, resp.status);
+  EXPECT_EQ(1, resp.entry_count);
+  EXPECT_EQ(1, resp.nvme_cmd_count);
+  EXPECT_EQ(1, nvme_cmds[0].cmd.nsid);
+  EXPECT_EQ(0, contexts[1].translation.GetNvmeWrappers().size());
+}
+
+TEST(Translation, ShouldRejectBatchWithoutContexts) {
+  uint8_t sync[sizeof(scsi::SynchronizeCache10Command) + 1] = {
+      static_cast<uint8_t>(scsi::OpCode::kSync10)};
+  translator::BatchEntry entries[] = {{.scsi_cmd = sync, .lun = 0}};
+  translator::NvmeCmdWrapper nvme_cmds[1] = {};
+  EXPECT_EQ(translator::ApiStatus::kFailure,
+            translator::BeginBatch(entries, {}, nvme_cmds).status);
+}
+
 TEST(Translation, ShouldFailInvalidPipeline) {
   translator::Translation translation = {};
   translator::Span<const nvme::GenericQueueEntryCpl> cpl_data;
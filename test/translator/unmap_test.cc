@@ -14,9 +14,12 @@
 
 #include "lib/translator/unmap.h"
 
-#include "gtest/gtest.h"
+#include <cstdint>
+#include <cstdlib>
+#include <ostream>
+#include <vector>
 
-#include <netinet/in.h>
+#include "gtest/gtest.h"
 
 // Tests
 
@@ -24,73 +27,187 @@ namespace {
 
 constexpr uint32_t kPageSize = 4096;
 
-TEST(TranslateUnmap, ShouldFillBufferCorrectly) {
-  // Define basic test variables
-  uint32_t descriptor_count = 3;
-  uint32_t nsid = 323;
-  uint32_t addr_offset = 500;
-  uint32_t count_offset = 7;
-  uint16_t data_length = sizeof(scsi::UnmapParamList) +
-                         descriptor_count * sizeof(scsi::UnmapBlockDescriptor);
-  // Create command structures and buffers
-  uint8_t scsi_cmd_buffer[sizeof(scsi::UnmapCommand)];
-  scsi::UnmapCommand unmap_cmd = {.param_list_length = htons(data_length)};
-  uint8_t buf_out[data_length];
-  scsi::UnmapParamList param_list = {};
-  param_list.data_length =
-      htons(data_length - 2);  // total bytes - bytes in field
-  param_list.block_desc_data_length =
-      htons(data_length - sizeof(scsi::UnmapParamList));
-  scsi::UnmapBlockDescriptor descriptors[descriptor_count];
-  for (uint32_t i = 0; i < descriptor_count; ++i) {
-    descriptors[i].logical_block_addr = translator::htonll(i + addr_offset);
-    descriptors[i].logical_block_count = htonl(i + count_offset);
+struct Range {
+  uint64_t lba;
+  uint32_t count;
+};
+
+class UnmapTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    translator::SetAllocPageCallbacks(
+        [](uint32_t page_size, uint16_t count) -> uint64_t {
+          void* page = aligned_alloc(page_size, page_size * count);
+          return reinterpret_cast<uint64_t>(page);
+        },
+        [](uint64_t addr, uint16_t count) {
+          free(reinterpret_cast<void*>(addr));
+        });
   }
-  // Copy buffers to spans
-  translator::Span<uint8_t> scsi_cmd(scsi_cmd_buffer,
-                                     sizeof(scsi::UnmapCommand));
-  translator::WriteValue(unmap_cmd, scsi_cmd);
-  translator::Span<uint8_t> buffer_out(buf_out, data_length);
-  translator::WriteValue(param_list, buffer_out);
-  auto buf_descriptor_list = buffer_out.subspan(sizeof(param_list));
-  for (uint32_t i = 0; i < descriptor_count; ++i) {
-    translator::WriteValue(descriptors[i], buf_descriptor_list);
-    buf_descriptor_list = buf_descriptor_list.subspan(sizeof(descriptors[i]));
+
+  void TearDown() override { Release(); }
+
+  void Release() {
+    for (uint32_t i = 0; i < chain_.size(); ++i)
+      chain_.allocation(i).FreePages();
+    chain_.Release();
   }
 
-  translator::NvmeCmdWrapper nvme_wrapper = {};
-  translator::Allocation allocation = {};
+  // Translates an Unmap with the given block descriptors
+  translator::StatusCode Translate(
+      const std::vector<Range>& descriptors,
+      translator::DeallocAlignment alignment = {}) {
+    uint16_t data_length =
+        sizeof(scsi::UnmapParamList) +
+        descriptors.size() * sizeof(scsi::UnmapBlockDescriptor);
+    uint8_t cdb[sizeof(scsi::UnmapCommand)];
+    translator::WriteValue(
+        scsi::UnmapCommand{.param_list_length = data_length},
+        translator::Span<uint8_t>(cdb, sizeof(cdb)));
+    param_buf_.assign(data_length, 0);
+    translator::Span<uint8_t> buffer_out(param_buf_.data(), data_length);
+    scsi::UnmapParamList param_list = {};
+    param_list.data_length = data_length - 2;
+    param_list.block_desc_data_length =
+        data_length - sizeof(scsi::UnmapParamList);
+    translator::WriteValue(param_list, buffer_out);
+    buffer_out = buffer_out.subspan(sizeof(param_list));
+    for (const Range& range : descriptors) {
+      scsi::UnmapBlockDescriptor descriptor = {};
+      descriptor.logical_block_addr = range.lba;
+      descriptor.logical_block_count = range.count;
+      translator::WriteValue(descriptor, buffer_out);
+      buffer_out = buffer_out.subspan(sizeof(descriptor));
+    }
+    Release();
+    chain_.Resize(translator::kMaxCommandRatio, kPageSize);
+    nvme_cmd_count_ = 0xff;
+    return translator::UnmapToNvme(
+        translator::Span<const uint8_t>(cdb, sizeof(cdb)),
+        translator::Span<const uint8_t>(param_buf_.data(), data_length),
+        chain_, kPageSize, 1, alignment, nvme_cmd_count_);
+  }
 
-  auto alloc_callback = [](uint32_t page_size, uint16_t count) -> uint64_t {
-    void* ptr = malloc(4096);  // Minimum page size of 4096 bytes
-    return reinterpret_cast<uint64_t>(ptr);
-  };
-  void (*dealloc_callback)(uint64_t, uint16_t) = nullptr;
-  translator::SetAllocPageCallbacks(alloc_callback, dealloc_callback);
+  // The ranges of every Dataset Management command, in order
+  std::vector<Range> Ranges() {
+    std::vector<Range> ranges;
+    for (uint32_t i = 0; i < nvme_cmd_count_; ++i) {
+      const nvme::GenericQueueEntryCmd& cmd = chain_.wrapper(i).cmd;
+      uint32_t count = (cmd.cdw[0] & 0xff) + 1;
+      EXPECT_EQ(count * sizeof(nvme::DatasetManagmentRange),
+                chain_.wrapper(i).buffer_len);
+      const nvme::DatasetManagmentRange* dmr =
+          reinterpret_cast<const nvme::DatasetManagmentRange*>(
+              cmd.dptr.prp.prp1);
+      for (uint32_t j = 0; j < count; ++j)
+        ranges.push_back({dmr[j].lba.value(), dmr[j].lb_count.value()});
+    }
+    return ranges;
+  }
+
+  std::vector<uint8_t> param_buf_;
+  translator::NvmeCmdChain chain_;
+  uint32_t nvme_cmd_count_;
+};
+
+bool operator==(const Range& a, const Range& b) {
+  return a.lba == b.lba && a.count == b.count;
+}
+
+std::ostream& operator<<(std::ostream& os, const Range& range) {
+  return os << "{" << range.lba << ", " << range.count << "}";
+}
 
-  // Run function we're testing
-  translator::StatusCode status_code = translator::UnmapToNvme(
-      scsi_cmd, buffer_out, nvme_wrapper, kPageSize, nsid, allocation);
+TEST_F(UnmapTest, ShouldFillBufferCorrectly) {
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            Translate({{500, 7}, {600, 8}, {700, 9}}));
+  ASSERT_EQ(1, nvme_cmd_count_);
+
+  const translator::NvmeCmdWrapper& wrapper = chain_.wrapper(0);
+  EXPECT_EQ(false, wrapper.is_admin);
+  EXPECT_EQ(1, wrapper.cmd.nsid);
+  EXPECT_EQ(2, wrapper.cmd.cdw[0]);
+  EXPECT_EQ(0b100, wrapper.cmd.cdw[1]);
+  EXPECT_EQ(chain_.allocation(0).data_addr, wrapper.cmd.dptr.prp.prp1);
+  EXPECT_EQ(1, chain_.allocation(0).data_page_count);
+
+  std::vector<Range> expected = {{500, 7}, {600, 8}, {700, 9}};
+  EXPECT_EQ(expected, Ranges());
+  const nvme::DatasetManagmentRange* dmr =
+      reinterpret_cast<const nvme::DatasetManagmentRange*>(
+          wrapper.cmd.dptr.prp.prp1);
+  for (uint32_t i = 0; i < expected.size(); ++i)
+    EXPECT_EQ(0, dmr[i].context_attributes.value());
+}
 
-  // Validate outputs
-  ASSERT_EQ(status_code, translator::StatusCode::kSuccess);
+TEST_F(UnmapTest, ShouldSortAndMergeRanges) {
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            Translate({{300, 10}, {100, 50}, {120, 10}, {150, 5}, {0, 0},
+                       {500, 0}, {310, 1}, {200, 8}}));
+  EXPECT_EQ(1, nvme_cmd_count_);
+  std::vector<Range> expected = {{100, 55}, {200, 8}, {300, 11}};
+  EXPECT_EQ(expected, Ranges());
+}
 
-  EXPECT_EQ(true, nvme_wrapper.is_admin);
+TEST_F(UnmapTest, ShouldSplitMergedRangesAtTheRangeLimit) {
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            Translate({{0, UINT32_MAX}, {UINT32_MAX, UINT32_MAX}, {10, 5}}));
+  std::vector<Range> expected = {{0, UINT32_MAX}, {UINT32_MAX, UINT32_MAX}};
+  EXPECT_EQ(expected, Ranges());
+}
 
-  EXPECT_EQ(nsid, nvme_wrapper.cmd.nsid);
-  EXPECT_EQ(descriptor_count - 1, nvme_wrapper.cmd.cdw[0]);
-  EXPECT_EQ(0b100, nvme_wrapper.cmd.cdw[1]);
+TEST_F(UnmapTest, ShouldSkipTheDeviceWithoutBlocksToUnmap) {
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            Translate({{100, 0}, {200, 0}}));
+  EXPECT_EQ(0, nvme_cmd_count_);
+}
 
-  EXPECT_NE(0, allocation.data_addr);
-  EXPECT_EQ(1, allocation.data_page_count);
+TEST_F(UnmapTest, ShouldTrimRangesToTheDeallocGranularity) {
+  translator::DeallocAlignment alignment = {.granularity = 8,
+                                            .alignment = 16};
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            Translate({{3, 40}, {64, 7}, {90, 10}, {128, 64}}, alignment));
+  // [3, 43) starts at 16 and keeps three units, [64, 71) is too short and
+  // [90, 100) holds no aligned unit
+  std::vector<Range> expected = {{16, 24}, {128, 64}};
+  EXPECT_EQ(expected, Ranges());
+
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            Translate({{1, 14}}, alignment));
+  EXPECT_EQ(0, nvme_cmd_count_);
+}
 
-  nvme::DatasetManagmentRange* dmr_ptr =
-      reinterpret_cast<nvme::DatasetManagmentRange*>(
-          nvme_wrapper.cmd.dptr.prp.prp1);
-  for (uint32_t i = 0; i < descriptor_count; ++i) {
-    EXPECT_EQ(i + addr_offset, translator::ltohl(dmr_ptr[i].lba));
-    EXPECT_EQ(i + count_offset, translator::ltohl(dmr_ptr[i].lb_count));
+TEST_F(UnmapTest, ShouldSplitLongListsOverSeveralCommands) {
+  std::vector<Range> descriptors;
+  for (uint32_t i = 0; i < translator::kMaxUnmapBlockDescriptors; ++i)
+    descriptors.push_back({uint64_t{i} * 16, 8});
+  ASSERT_EQ(translator::StatusCode::kSuccess, Translate(descriptors));
+  ASSERT_EQ(16, nvme_cmd_count_);
+  for (uint32_t i = 0; i < nvme_cmd_count_; ++i) {
+    const translator::NvmeCmdWrapper& wrapper = chain_.wrapper(i);
+    EXPECT_EQ(i < 15 ? 255 : 254, wrapper.cmd.cdw[0]);
+    EXPECT_EQ(0, wrapper.cmd.dptr.prp.prp1 % kPageSize);
   }
+  EXPECT_EQ(descriptors, Ranges());
+}
+
+TEST_F(UnmapTest, ShouldSortLongListsInReverse) {
+  std::vector<Range> descriptors;
+  for (uint32_t i = 1000; i > 0; --i) descriptors.push_back({i * 10ull, 5});
+  ASSERT_EQ(translator::StatusCode::kSuccess, Translate(descriptors));
+  ASSERT_EQ(4, nvme_cmd_count_);
+  std::vector<Range> expected(descriptors.rbegin(), descriptors.rend());
+  EXPECT_EQ(expected, Ranges());
+}
+
+TEST_F(UnmapTest, ShouldAcceptAnEmptyDescriptorList) {
+  ASSERT_EQ(translator::StatusCode::kSuccess, Translate({}));
+  EXPECT_EQ(0, nvme_cmd_count_);
+}
+
+TEST_F(UnmapTest, ShouldRejectRangesPastTheLastLba) {
+  EXPECT_EQ(translator::StatusCode::kInvalidInput,
+            Translate({{UINT64_MAX - 1, 2}}));
 }
 
 }  // namespace
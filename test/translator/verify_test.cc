@@ -12,8 +12,6 @@
 // limitations under the License.
 
 #include "lib/translator/verify.h"
-#include <byteswap.h>
-#include <netinet/in.h>
 
 #include "gtest/gtest.h"
 
@@ -24,7 +22,7 @@ TEST(Verify, BasicSuccess) {
   translator::NvmeCmdWrapper nvme_wrapper;
   uint32_t lba = 0x12345;
   const scsi::Verify10Command verify_cmd = {
-      .verification_length = htons(1),
+      .verification_length = 1,
       .control_byte = {.naca = 0},
   };
   const uint8_t* ptr = reinterpret_cast<const uint8_t*>(&verify_cmd);
@@ -39,7 +37,7 @@ TEST(Verify, NoOp) {
   translator::NvmeCmdWrapper nvme_wrapper;
   uint32_t lba = 0x12345;
   const scsi::Verify10Command verify_cmd = {
-      .verification_length = htons(0),
+      .verification_length = 0,
       .control_byte = {.naca = 0},
   };
   const uint8_t* ptr = reinterpret_cast<const uint8_t*>(&verify_cmd);
@@ -77,8 +75,8 @@ TEST(Verify, Protect000) {
   const scsi::Verify10Command verify_cmd = {
       .bytchk = 0,
       .vr_protect = 0b000,
-      .logical_block_address = htonl(lba),
-      .verification_length = htons(1),
+      .logical_block_address = lba,
+      .verification_length = 1,
       .control_byte = {.naca = 0},
   };
   const uint8_t* ptr = reinterpret_cast<const uint8_t*>(&verify_cmd);
@@ -94,7 +92,7 @@ TEST(Verify, Protect000) {
   EXPECT_EQ(nvme_wrapper.cmd.cdw[0], translator::htoll(lba));
   EXPECT_EQ(nvme_wrapper.cmd.cdw[1], 0);
   EXPECT_EQ(nvme_wrapper.cmd.cdw[2],
-            translator::htoll((ntohs(verify_cmd.verification_length) - 1) |
+            translator::htoll((verify_cmd.verification_length.value() - 1) |
                               ((pr_info) << 26)));
   EXPECT_EQ(nvme_wrapper.is_admin, false);
 }
@@ -105,8 +103,8 @@ TEST(Verify, Protect001) {
   const scsi::Verify10Command verify_cmd = {
       .bytchk = 0,
       .vr_protect = 0b001,
-      .logical_block_address = htonl(lba),
-      .verification_length = htons(1),
+      .logical_block_address = lba,
+      .verification_length = 1,
       .control_byte = {.naca = 0},
   };
   const uint8_t* ptr = reinterpret_cast<const uint8_t*>(&verify_cmd);
@@ -122,7 +120,7 @@ TEST(Verify, Protect001) {
   EXPECT_EQ(nvme_wrapper.cmd.cdw[0], translator::htoll(lba));
   EXPECT_EQ(nvme_wrapper.cmd.cdw[1], 0);
   EXPECT_EQ(nvme_wrapper.cmd.cdw[2],
-            translator::htoll((ntohs(verify_cmd.verification_length) - 1) |
+            translator::htoll((verify_cmd.verification_length.value() - 1) |
                               ((pr_info) << 26)));
   EXPECT_EQ(nvme_wrapper.is_admin, false);
 }
@@ -133,8 +131,8 @@ TEST(Verify, Protect101) {
   const scsi::Verify10Command verify_cmd = {
       .bytchk = 0,
       .vr_protect = 0b101,
-      .logical_block_address = htonl(lba),
-      .verification_length = htons(1),
+      .logical_block_address = lba,
+      .verification_length = 1,
       .control_byte = {.naca = 0},
   };
   const uint8_t* ptr = reinterpret_cast<const uint8_t*>(&verify_cmd);
@@ -150,7 +148,7 @@ TEST(Verify, Protect101) {
   EXPECT_EQ(nvme_wrapper.cmd.cdw[0], translator::htoll(lba));
   EXPECT_EQ(nvme_wrapper.cmd.cdw[1], 0);
   EXPECT_EQ(nvme_wrapper.cmd.cdw[2],
-            translator::htoll((ntohs(verify_cmd.verification_length) - 1) |
+            translator::htoll((verify_cmd.verification_length.value() - 1) |
                               ((pr_info) << 26)));
   EXPECT_EQ(nvme_wrapper.is_admin, false);
 }
@@ -161,8 +159,8 @@ TEST(Verify, Protect010) {
   const scsi::Verify10Command verify_cmd = {
       .bytchk = 0,
       .vr_protect = 0b010,
-      .logical_block_address = htonl(lba),
-      .verification_length = htons(1),
+      .logical_block_address = lba,
+      .verification_length = 1,
       .control_byte = {.naca = 0},
   };
   const uint8_t* ptr = reinterpret_cast<const uint8_t*>(&verify_cmd);
@@ -178,7 +176,7 @@ TEST(Verify, Protect010) {
   EXPECT_EQ(nvme_wrapper.cmd.cdw[0], translator::htoll(lba));
   EXPECT_EQ(nvme_wrapper.cmd.cdw[1], 0);
   EXPECT_EQ(nvme_wrapper.cmd.cdw[2],
-            translator::htoll((ntohs(verify_cmd.verification_length) - 1) |
+            translator::htoll((verify_cmd.verification_length.value() - 1) |
                               ((pr_info) << 26)));
   EXPECT_EQ(nvme_wrapper.is_admin, false);
 }
@@ -189,8 +187,8 @@ TEST(Verify, Protect011) {
   const scsi::Verify10Command verify_cmd = {
       .bytchk = 0,
       .vr_protect = 0b011,
-      .logical_block_address = htonl(lba),
-      .verification_length = htons(1),
+      .logical_block_address = lba,
+      .verification_length = 1,
       .control_byte = {.naca = 0},
   };
   const uint8_t* ptr = reinterpret_cast<const uint8_t*>(&verify_cmd);
@@ -206,7 +204,7 @@ TEST(Verify, Protect011) {
   EXPECT_EQ(nvme_wrapper.cmd.cdw[0], translator::htoll(lba));
   EXPECT_EQ(nvme_wrapper.cmd.cdw[1], 0);
   EXPECT_EQ(nvme_wrapper.cmd.cdw[2],
-            translator::htoll((ntohs(verify_cmd.verification_length) - 1) |
+            translator::htoll((verify_cmd.verification_length.value() - 1) |
                               ((pr_info) << 26)));
   EXPECT_EQ(nvme_wrapper.is_admin, false);
 }
@@ -217,8 +215,8 @@ TEST(Verify, Protect100) {
   const scsi::Verify10Command verify_cmd = {
       .bytchk = 0,
       .vr_protect = 0b100,
-      .logical_block_address = htonl(lba),
-      .verification_length = htons(1),
+      .logical_block_address = lba,
+      .verification_length = 1,
       .control_byte = {.naca = 0},
   };
   const uint8_t* ptr = reinterpret_cast<const uint8_t*>(&verify_cmd);
@@ -234,7 +232,7 @@ TEST(Verify, Protect100) {
   EXPECT_EQ(nvme_wrapper.cmd.cdw[0], translator::htoll(lba));
   EXPECT_EQ(nvme_wrapper.cmd.cdw[1], 0);
   EXPECT_EQ(nvme_wrapper.cmd.cdw[2],
-            translator::htoll((ntohs(verify_cmd.verification_length) - 1) |
+            translator::htoll((verify_cmd.verification_length.value() - 1) |
                               ((pr_info) << 26)));
   EXPECT_EQ(nvme_wrapper.is_admin, false);
 }
@@ -245,8 +243,8 @@ TEST(Verify, Protect000Bytchk1) {
   const scsi::Verify10Command verify_cmd = {
       .bytchk = 1,
       .vr_protect = 0b000,
-      .logical_block_address = htonl(lba),
-      .verification_length = htons(1),
+      .logical_block_address = lba,
+      .verification_length = 1,
       .control_byte = {.naca = 0},
   };
   const uint8_t* ptr = reinterpret_cast<const uint8_t*>(&verify_cmd);
@@ -262,7 +260,7 @@ TEST(Verify, Protect000Bytchk1) {
   EXPECT_EQ(nvme_wrapper.cmd.cdw[0], translator::htoll(lba));
   EXPECT_EQ(nvme_wrapper.cmd.cdw[1], 0);
   EXPECT_EQ(nvme_wrapper.cmd.cdw[2],
-            translator::htoll((ntohs(verify_cmd.verification_length) - 1) |
+            translator::htoll((verify_cmd.verification_length.value() - 1) |
                               ((pr_info) << 26)));
   EXPECT_EQ(nvme_wrapper.is_admin, false);
 }
@@ -272,8 +270,8 @@ TEST(Verify, Protect001Bytchk1) {
   const scsi::Verify10Command verify_cmd = {
       .bytchk = 1,
       .vr_protect = 0b001,
-      .logical_block_address = htonl(lba),
-      .verification_length = htons(1),
+      .logical_block_address = lba,
+      .verification_length = 1,
       .control_byte = {.naca = 0},
   };
   const uint8_t* ptr = reinterpret_cast<const uint8_t*>(&verify_cmd);
@@ -289,7 +287,7 @@ TEST(Verify, Protect001Bytchk1) {
   EXPECT_EQ(nvme_wrapper.cmd.cdw[0], translator::htoll(lba));
   EXPECT_EQ(nvme_wrapper.cmd.cdw[1], 0);
   EXPECT_EQ(nvme_wrapper.cmd.cdw[2],
-            translator::htoll((ntohs(verify_cmd.verification_length) - 1) |
+            translator::htoll((verify_cmd.verification_length.value() - 1) |
                               ((pr_info) << 26)));
   EXPECT_EQ(nvme_wrapper.is_admin, false);
 }
@@ -300,8 +298,8 @@ TEST(Verify, Protect010Bytchk1) {
   const scsi::Verify10Command verify_cmd = {
       .bytchk = 1,
       .vr_protect = 0b010,
-      .logical_block_address = htonl(lba),
-      .verification_length = htons(1),
+      .logical_block_address = lba,
+      .verification_length = 1,
       .control_byte = {.naca = 0},
   };
   const uint8_t* ptr = reinterpret_cast<const uint8_t*>(&verify_cmd);
@@ -317,7 +315,7 @@ TEST(Verify, Protect010Bytchk1) {
   EXPECT_EQ(nvme_wrapper.cmd.cdw[0], translator::htoll(lba));
   EXPECT_EQ(nvme_wrapper.cmd.cdw[1], 0);
   EXPECT_EQ(nvme_wrapper.cmd.cdw[2],
-            translator::htoll((ntohs(verify_cmd.verification_length) - 1) |
+            translator::htoll((verify_cmd.verification_length.value() - 1) |
                               ((pr_info) << 26)));
   EXPECT_EQ(nvme_wrapper.is_admin, false);
 }
@@ -328,8 +326,8 @@ TEST(Verify, Protect011Bytchk1) {
   const scsi::Verify10Command verify_cmd = {
       .bytchk = 1,
       .vr_protect = 0b011,
-      .logical_block_address = htonl(lba),
-      .verification_length = htons(1),
+      .logical_block_address = lba,
+      .verification_length = 1,
       .control_byte = {.naca = 0},
   };
   const uint8_t* ptr = reinterpret_cast<const uint8_t*>(&verify_cmd);
@@ -345,7 +343,7 @@ TEST(Verify, Protect011Bytchk1) {
   EXPECT_EQ(nvme_wrapper.cmd.cdw[0], translator::htoll(lba));
   EXPECT_EQ(nvme_wrapper.cmd.cdw[1], 0);
   EXPECT_EQ(nvme_wrapper.cmd.cdw[2],
-            translator::htoll((ntohs(verify_cmd.verification_length) - 1) |
+            translator::htoll((verify_cmd.verification_length.value() - 1) |
                               ((pr_info) << 26)));
   EXPECT_EQ(nvme_wrapper.is_admin, false);
 }
@@ -356,8 +354,8 @@ TEST(Verify, Protect100Bytchk1) {
   const scsi::Verify10Command verify_cmd = {
       .bytchk = 1,
       .vr_protect = 0b100,
-      .logical_block_address = htonl(lba),
-      .verification_length = htons(1),
+      .logical_block_address = lba,
+      .verification_length = 1,
       .control_byte = {.naca = 0},
   };
   const uint8_t* ptr = reinterpret_cast<const uint8_t*>(&verify_cmd);
@@ -373,7 +371,7 @@ TEST(Verify, Protect100Bytchk1) {
   EXPECT_EQ(nvme_wrapper.cmd.cdw[0], translator::htoll(lba));
   EXPECT_EQ(nvme_wrapper.cmd.cdw[1], 0);
   EXPECT_EQ(nvme_wrapper.cmd.cdw[2],
-            translator::htoll((ntohs(verify_cmd.verification_length) - 1) |
+            translator::htoll((verify_cmd.verification_length.value() - 1) |
                               ((pr_info) << 26)));
   EXPECT_EQ(nvme_wrapper.is_admin, false);
 }
@@ -384,8 +382,8 @@ TEST(Verify, Protect101Bytchk1) {
   const scsi::Verify10Command verify_cmd = {
       .bytchk = 1,
       .vr_protect = 0b101,
-      .logical_block_address = htonl(lba),
-      .verification_length = htons(1),
+      .logical_block_address = lba,
+      .verification_length = 1,
       .control_byte = {.naca = 0},
   };
   const uint8_t* ptr = reinterpret_cast<const uint8_t*>(&verify_cmd);
@@ -401,7 +399,7 @@ TEST(Verify, Protect101Bytchk1) {
   EXPECT_EQ(nvme_wrapper.cmd.cdw[0], translator::htoll(lba));
   EXPECT_EQ(nvme_wrapper.cmd.cdw[1], 0);
   EXPECT_EQ(nvme_wrapper.cmd.cdw[2],
-            translator::htoll((ntohs(verify_cmd.verification_length) - 1) |
+            translator::htoll((verify_cmd.verification_length.value() - 1) |
                               ((pr_info) << 26)));
   EXPECT_EQ(nvme_wrapper.is_admin, false);
 }
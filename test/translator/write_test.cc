@@ -13,8 +13,9 @@
 // limitations under the License.
 
 #include "lib/translator/write.h"
-#include <byteswap.h>
-#include <netinet/in.h>
+
+#include <cstdlib>
+#include <cstring>
 
 #include "gtest/gtest.h"
 
@@ -33,149 +34,177 @@ constexpr bool kFua = 0b1;
 
 constexpr uint64_t kWrite16Lba = 0xFFFFFFFFFFFFFFFF;
 constexpr uint32_t kNsid = 0x1234abcd;
-constexpr uint32_t kLbaSize = 512;
+constexpr uint8_t kLbaShift = 9;
+constexpr uint32_t kLbaSize = 1 << kLbaShift;
+constexpr uint32_t kPageSize = 4096;
+constexpr translator::Controller kController;
 
 uint32_t BuildCdw12(uint16_t tl, uint8_t prinfo, bool fua) {
   uint32_t cdw12 = tl - 1 | prinfo << 26 | fua << 30;
   return cdw12;
 }
 
+// Transfer length of the longest write, which is split on NLB
+constexpr uint32_t kMaxTestTransferLength = 0x10001;
+
+// Buffer large enough for all tests. Write translation never touches it
+alignas(kPageSize) uint8_t buffer_out[kMaxTestTransferLength * kLbaSize];
+// Backs the PRP lists of transfers spanning more than two pages
+constexpr uint16_t kPrpListPages = 32;
+alignas(kPageSize) uint8_t prp_lists[kPrpListPages][kPageSize];
+translator::DataSegment data_out[] = {
+    {.addr = reinterpret_cast<uint64_t>(buffer_out),
+     .len = sizeof(buffer_out)}};
+
+class WriteTest : public ::testing::Test {
+ protected:
+  // Per-test-suite set-up.
+  // Called before the first test in this test suite.
+  static void SetUpTestSuite() {
+    // Mocks AllocPages to hand out the PRP list pages
+    auto alloc_callback = [](uint32_t page_size, uint16_t count) -> uint64_t {
+      if (count <= kPrpListPages) {
+        return reinterpret_cast<uint64_t>(prp_lists);
+      } else {
+        return 0;
+      }
+    };
+    void (*dealloc_callback)(uint64_t, uint16_t) = nullptr;
+    translator::SetAllocPageCallbacks(alloc_callback, dealloc_callback);
+  }
+};
+
 TEST(Write6Command, ShouldReturnInvalidStatusCode) {
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
-  translator::Span<uint8_t> buffer_out;
+  translator::NvmeCmdChain chain;
+  translator::Span<const translator::DataSegment> data_out;
   uint8_t write6_cmd[sizeof(scsi::Write6Command) - 1];
-  translator::StatusCode status_code = translator::Write6ToNvme(
-      write6_cmd, nvme_wrapper, allocation, kNsid, kLbaSize, buffer_out);
+  translator::StatusCode status_code =
+      translator::Write6ToNvme(write6_cmd, chain, kNsid, kLbaShift, kController,
+                               data_out);
   EXPECT_EQ(status_code, translator::StatusCode::kInvalidInput);
 }
 
 TEST(Write10Command, ShouldReturnInvalidStatusCode) {
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
+  translator::NvmeCmdChain chain;
   uint8_t write10_cmd[sizeof(scsi::Write10Command) - 1];
-  translator::Span<uint8_t> buffer_out;
-  translator::StatusCode status_code = translator::Write10ToNvme(
-      write10_cmd, nvme_wrapper, allocation, kNsid, kLbaSize, buffer_out);
+  translator::Span<const translator::DataSegment> data_out;
+  translator::StatusCode status_code =
+      translator::Write10ToNvme(write10_cmd, chain, kNsid, kLbaShift,
+                                kController, data_out);
   EXPECT_EQ(status_code, translator::StatusCode::kInvalidInput);
 }
 
 TEST(Write12Command, ShouldReturnInvalidStatusCode) {
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
+  translator::NvmeCmdChain chain;
 
   uint8_t write12_cmd[sizeof(scsi::Write12Command) - 1];
-  translator::Span<uint8_t> buffer_out;
-  translator::StatusCode status_code = translator::Write12ToNvme(
-      write12_cmd, nvme_wrapper, allocation, kNsid, kLbaSize, buffer_out);
+  translator::Span<const translator::DataSegment> data_out;
+  translator::StatusCode status_code =
+      translator::Write12ToNvme(write12_cmd, chain, kNsid, kLbaShift,
+                                kController, data_out);
   EXPECT_EQ(status_code, translator::StatusCode::kInvalidInput);
 }
 
 TEST(Write16Command, ShouldReturnInvalidStatusCode) {
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
+  translator::NvmeCmdChain chain;
 
   uint8_t write16_cmd[sizeof(scsi::Write16Command) - 1];
-  translator::Span<uint8_t> buffer_out;
-  translator::StatusCode status_code = translator::Write16ToNvme(
-      write16_cmd, nvme_wrapper, allocation, kNsid, kLbaSize, buffer_out);
+  translator::Span<const translator::DataSegment> data_out;
+  translator::StatusCode status_code =
+      translator::Write16ToNvme(write16_cmd, chain, kNsid, kLbaShift,
+                                kController, data_out);
   EXPECT_EQ(status_code, translator::StatusCode::kInvalidInput);
 }
 
-TEST(WriteTest, Write6ShouldReturnValidStatusCode) {
-  uint8_t network_endian_lba_1 = 0x1;
-  uint8_t network_endian_lba_2 = htons(0x1234);
-  scsi::Write6Command cmd = {.logical_block_address_1 = network_endian_lba_1,
-                             .logical_block_address_2 = network_endian_lba_2,
+TEST_F(WriteTest, Write6ShouldReturnValidStatusCode) {
+  uint8_t host_endian_lba_1 = 0x1;
+  uint16_t host_endian_lba_2 = 0x1234;
+  scsi::Write6Command cmd = {.logical_block_address_1 = host_endian_lba_1,
+                             .logical_block_address_2 = host_endian_lba_2,
                              .transfer_length = kWrite6TransferLength};
 
   uint8_t scsi_cmd[sizeof(scsi::Write6Command)];
   ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
-  translator::Span<uint8_t> buffer_out;
-  translator::StatusCode status_code = translator::Write6ToNvme(
-      scsi_cmd, nvme_wrapper, allocation, kNsid, kLbaSize, buffer_out);
+  translator::NvmeCmdChain chain;
+  translator::StatusCode status_code =
+      translator::Write6ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                               data_out);
   EXPECT_EQ(translator::StatusCode::kSuccess, status_code);
 }
 
-TEST(WriteTest, Write10ShouldReturnValidStatusCode) {
-  uint32_t network_lba = htonl(kLba);
-  uint16_t network_transfer_length = htons(kTransferLength);
+TEST_F(WriteTest, Write10ShouldReturnValidStatusCode) {
+  uint32_t host_lba = kLba;
+  uint16_t host_transfer_length = kTransferLength;
 
   scsi::Write10Command cmd = {.fua = kFua,
                               .wr_protect = kValidWriteProtect,
-                              .logical_block_address = network_lba,
-                              .transfer_length = network_transfer_length};
+                              .logical_block_address = host_lba,
+                              .transfer_length = host_transfer_length};
 
   uint8_t scsi_cmd[sizeof(scsi::Write10Command)];
   ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
-  translator::Span<uint8_t> buffer_out;
-  translator::StatusCode status_code = translator::Write10ToNvme(
-      scsi_cmd, nvme_wrapper, allocation, kNsid, kLbaSize, buffer_out);
+  translator::NvmeCmdChain chain;
+  translator::StatusCode status_code =
+      translator::Write10ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                                data_out);
 
   EXPECT_EQ(translator::StatusCode::kSuccess, status_code);
 }
 
-TEST(WriteTest, Write12ShouldReturnValidStatusCode) {
-  uint32_t network_lba = htonl(kLba);
-  uint16_t network_transfer_length = htons(kTransferLength);
+TEST_F(WriteTest, Write12ShouldReturnValidStatusCode) {
+  uint32_t host_lba = kLba;
+  uint32_t host_transfer_length = kTransferLength;
 
   scsi::Write12Command cmd = {.fua = kFua,
                               .wr_protect = kValidWriteProtect,
-                              .logical_block_address = network_lba,
-                              .transfer_length = network_transfer_length};
+                              .logical_block_address = host_lba,
+                              .transfer_length = host_transfer_length};
 
   uint8_t scsi_cmd[sizeof(scsi::Write12Command)];
   ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
-  translator::Span<uint8_t> buffer_out;
-  translator::StatusCode status_code = translator::Write12ToNvme(
-      scsi_cmd, nvme_wrapper, allocation, kNsid, kLbaSize, buffer_out);
+  translator::NvmeCmdChain chain;
+  translator::StatusCode status_code =
+      translator::Write12ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                                data_out);
   EXPECT_EQ(translator::StatusCode::kSuccess, status_code);
 }
 
-TEST(WriteTest, Write16ShouldReturnValidStatusCode) {
-  uint64_t network_lba = translator::htonll(kWrite16Lba);
-  uint32_t network_transfer_length = 0x2b1a0000;
+TEST_F(WriteTest, Write16ShouldReturnValidStatusCode) {
+  uint64_t host_lba = kWrite16Lba;
+  uint32_t host_transfer_length = 0x1a2b;
 
   scsi::Write16Command cmd = {.fua = kFua,
                               .wr_protect = kValidWriteProtect,
-                              .logical_block_address = network_lba,
-                              .transfer_length = network_transfer_length};
+                              .logical_block_address = host_lba,
+                              .transfer_length = host_transfer_length};
 
   uint8_t scsi_cmd[sizeof(scsi::Write16Command)];
   ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
-
-  translator::Span<uint8_t> buffer_out;
-  translator::StatusCode status_code = translator::Write16ToNvme(
-      scsi_cmd, nvme_wrapper, allocation, kNsid, kLbaSize, buffer_out);
+  translator::NvmeCmdChain chain;
+  translator::StatusCode status_code =
+      translator::Write16ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                                data_out);
   EXPECT_EQ(status_code, translator::StatusCode::kSuccess);
 }
 
-TEST(WriteTest, Write6ShouldBuildCorrectNvmeCommandStruct) {
-  uint8_t network_endian_lba_1 = 0x1;
-  uint8_t network_endian_lba_2 = htons(0x1234);
-  scsi::Write6Command cmd = {.logical_block_address_1 = network_endian_lba_1,
-                             .logical_block_address_2 = network_endian_lba_2,
+TEST_F(WriteTest, Write6ShouldBuildCorrectNvmeCommandStruct) {
+  uint8_t host_endian_lba_1 = 0x1;
+  uint16_t host_endian_lba_2 = 0x1234;
+  scsi::Write6Command cmd = {.logical_block_address_1 = host_endian_lba_1,
+                             .logical_block_address_2 = host_endian_lba_2,
                              .transfer_length = kWrite6TransferLength};
 
   uint8_t scsi_cmd[sizeof(scsi::Write6Command)];
   ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
 
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
-  translator::Span<uint8_t> buffer_out;
-  translator::StatusCode status_code = translator::Write6ToNvme(
-      scsi_cmd, nvme_wrapper, allocation, kNsid, kLbaSize, buffer_out);
+  translator::NvmeCmdChain chain;
+  translator::StatusCode status_code =
+      translator::Write6ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                               data_out);
+  translator::NvmeCmdWrapper& nvme_wrapper = chain.wrapper(0);
 
   uint32_t expected_lba_value =
-      (network_endian_lba_1 << 16) | ntohs(network_endian_lba_2);
+      (host_endian_lba_1 << 16) | host_endian_lba_2;
   uint32_t expected_cdw12 = translator::htoll(kWrite6TransferLength - 1);
 
   EXPECT_EQ(status_code, translator::StatusCode::kSuccess);
@@ -184,27 +213,27 @@ TEST(WriteTest, Write6ShouldBuildCorrectNvmeCommandStruct) {
   EXPECT_EQ(nvme_wrapper.cmd.psdt, 0);
   EXPECT_EQ(nvme_wrapper.cmd.cdw[2], expected_cdw12);
   EXPECT_EQ(nvme_wrapper.cmd.dptr.prp.prp1,
-            reinterpret_cast<uint64_t>(buffer_out.data()));
+            reinterpret_cast<uint64_t>(buffer_out));
   EXPECT_EQ(nvme_wrapper.is_admin, false);
-  EXPECT_EQ(nvme_wrapper.buffer_len, buffer_out.size());
+  EXPECT_EQ(nvme_wrapper.buffer_len, kWrite6TransferLength * kLbaSize);
 }
 
-TEST(WriteTest, Write10ShouldBuildCorrectNvmeCommandStruct) {
-  uint32_t network_lba = htonl(kLba);
-  uint16_t network_transfer_length = htons(kTransferLength);
+TEST_F(WriteTest, Write10ShouldBuildCorrectNvmeCommandStruct) {
+  uint32_t host_lba = kLba;
+  uint16_t host_transfer_length = kTransferLength;
   scsi::Write10Command cmd = {.fua = kFua,
                               .wr_protect = kValidWriteProtect,
-                              .logical_block_address = network_lba,
-                              .transfer_length = network_transfer_length};
+                              .logical_block_address = host_lba,
+                              .transfer_length = host_transfer_length};
 
   uint8_t scsi_cmd[sizeof(scsi::Write10Command)];
   ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
 
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
-  translator::Span<uint8_t> buffer_out;
-  translator::StatusCode status_code = translator::Write10ToNvme(
-      scsi_cmd, nvme_wrapper, allocation, kNsid, kLbaSize, buffer_out);
+  translator::NvmeCmdChain chain;
+  translator::StatusCode status_code =
+      translator::Write10ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                                data_out);
+  translator::NvmeCmdWrapper& nvme_wrapper = chain.wrapper(0);
 
   uint32_t expected_cdw12 =
       translator::htoll(BuildCdw12(kTransferLength, kPrInfo, kFua));
@@ -216,30 +245,30 @@ TEST(WriteTest, Write10ShouldBuildCorrectNvmeCommandStruct) {
   EXPECT_EQ(nvme_wrapper.cmd.psdt, 0);
   EXPECT_EQ(nvme_wrapper.cmd.cdw[2], expected_cdw12);
   EXPECT_EQ(nvme_wrapper.cmd.dptr.prp.prp1,
-            reinterpret_cast<uint64_t>(buffer_out.data()));
+            reinterpret_cast<uint64_t>(buffer_out));
   EXPECT_EQ(nvme_wrapper.is_admin, false);
-  EXPECT_EQ(nvme_wrapper.buffer_len, buffer_out.size());
+  EXPECT_EQ(nvme_wrapper.buffer_len, kTransferLength * kLbaSize);
 }
 
-TEST(WriteTest, Write12ShouldBuildCorrectNvmeCommandStruct) {
-  uint32_t network_lba = htonl(kLba);
-  uint32_t network_transfer_length = 0x2b1a0000;
+TEST_F(WriteTest, Write12ShouldBuildCorrectNvmeCommandStruct) {
+  uint32_t host_lba = kLba;
+  uint32_t host_transfer_length = 0x1a2b;
   scsi::Write12Command cmd = {.fua = kFua,
                               .wr_protect = kValidWriteProtect,
-                              .logical_block_address = network_lba,
-                              .transfer_length = network_transfer_length};
+                              .logical_block_address = host_lba,
+                              .transfer_length = host_transfer_length};
 
   uint8_t scsi_cmd[sizeof(scsi::Write12Command)];
   ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
 
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
-  translator::Span<uint8_t> buffer_out;
-  translator::StatusCode status_code = translator::Write12ToNvme(
-      scsi_cmd, nvme_wrapper, allocation, kNsid, kLba, buffer_out);
+  translator::NvmeCmdChain chain;
+  translator::StatusCode status_code =
+      translator::Write12ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                                data_out);
+  translator::NvmeCmdWrapper& nvme_wrapper = chain.wrapper(0);
 
   uint32_t expected_cdw12 = translator::htoll(
-      BuildCdw12(ntohl(network_transfer_length), kPrInfo, kFua));
+      BuildCdw12(host_transfer_length, kPrInfo, kFua));
   uint32_t expected_cdw10 = translator::htoll(kLba);
 
   EXPECT_EQ(status_code, translator::StatusCode::kSuccess);
@@ -248,33 +277,33 @@ TEST(WriteTest, Write12ShouldBuildCorrectNvmeCommandStruct) {
   EXPECT_EQ(nvme_wrapper.cmd.psdt, 0);
   EXPECT_EQ(nvme_wrapper.cmd.cdw[2], expected_cdw12);
   EXPECT_EQ(nvme_wrapper.cmd.dptr.prp.prp1,
-            reinterpret_cast<uint64_t>(buffer_out.data()));
+            reinterpret_cast<uint64_t>(buffer_out));
   EXPECT_EQ(nvme_wrapper.is_admin, false);
-  EXPECT_EQ(nvme_wrapper.buffer_len, buffer_out.size());
+  EXPECT_EQ(nvme_wrapper.buffer_len, host_transfer_length * kLbaSize);
 }
 
-TEST(WriteTest, Write16ShouldBuildCorrectNvmeCommandStruct) {
-  uint64_t network_lba = translator::htolll(kWrite16Lba);
-  uint32_t network_transfer_length = 0x2b1a0000;
+TEST_F(WriteTest, Write16ShouldBuildCorrectNvmeCommandStruct) {
+  uint64_t host_lba = translator::htolll(kWrite16Lba);
+  uint32_t host_transfer_length = 0x1a2b;
 
   scsi::Write16Command cmd = {.fua = kFua,
                               .wr_protect = kValidWriteProtect,
-                              .logical_block_address = network_lba,
-                              .transfer_length = network_transfer_length};
+                              .logical_block_address = host_lba,
+                              .transfer_length = host_transfer_length};
 
   uint8_t scsi_cmd[sizeof(scsi::Write16Command)];
   ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
 
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
-  translator::Span<uint8_t> buffer_out;
-  translator::StatusCode status_code = translator::Write16ToNvme(
-      scsi_cmd, nvme_wrapper, allocation, kNsid, kLba, buffer_out);
+  translator::NvmeCmdChain chain;
+  translator::StatusCode status_code =
+      translator::Write16ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                                data_out);
+  translator::NvmeCmdWrapper& nvme_wrapper = chain.wrapper(0);
 
   uint32_t expected_cdw10 = translator::htoll(kWrite16Lba);
   uint32_t expected_cdw11 = translator::htoll(kWrite16Lba >> 32);
   uint32_t expected_cdw12 = translator::htoll(
-      BuildCdw12(ntohl(network_transfer_length), kPrInfo, kFua));
+      BuildCdw12(host_transfer_length, kPrInfo, kFua));
 
   EXPECT_EQ(status_code, translator::StatusCode::kSuccess);
   EXPECT_EQ(nvme_wrapper.cmd.cdw[0], expected_cdw10);
@@ -283,12 +312,35 @@ TEST(WriteTest, Write16ShouldBuildCorrectNvmeCommandStruct) {
   EXPECT_EQ(nvme_wrapper.cmd.psdt, 0);
   EXPECT_EQ(nvme_wrapper.cmd.cdw[2], expected_cdw12);
   EXPECT_EQ(nvme_wrapper.cmd.dptr.prp.prp1,
-            reinterpret_cast<uint64_t>(buffer_out.data()));
+            reinterpret_cast<uint64_t>(buffer_out));
   EXPECT_EQ(nvme_wrapper.is_admin, false);
-  EXPECT_EQ(nvme_wrapper.buffer_len, buffer_out.size());
+  EXPECT_EQ(nvme_wrapper.buffer_len, host_transfer_length * kLbaSize);
 }
 
-TEST(WriteTest, Write10ShoudlFailOnWrongProtectBit) {
+TEST_F(WriteTest, ShouldDropFuaWithoutVolatileWriteCache) {
+  scsi::Write16Command cmd = {.fua = kFua, .transfer_length = 1};
+  uint8_t scsi_cmd[sizeof(scsi::Write16Command)];
+  ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
+  translator::Controller controller;
+  nvme::IdentifyControllerData identify_ctrl = {};
+  controller.SetIdentifyControllerData(identify_ctrl);
+
+  translator::NvmeCmdChain chain;
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            translator::Write16ToNvme(scsi_cmd, chain, kNsid, kLbaShift,
+                                      controller, data_out));
+  // FUA is bit 30 of cdw12
+  EXPECT_EQ(0, translator::ltohl(chain.wrapper(0).cmd.cdw[2]) >> 30 & 1);
+
+  identify_ctrl.vwc.present = 1;
+  controller.SetIdentifyControllerData(identify_ctrl);
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            translator::Write16ToNvme(scsi_cmd, chain, kNsid, kLbaShift,
+                                      controller, data_out));
+  EXPECT_EQ(1, translator::ltohl(chain.wrapper(0).cmd.cdw[2]) >> 30 & 1);
+}
+
+TEST_F(WriteTest, Write10ShoudlFailOnWrongProtectBit) {
   scsi::Write10Command cmd = {.fua = kFua,
                               .wr_protect = kInvalidWriteProtect,
                               .logical_block_address = kLba,
@@ -296,72 +348,72 @@ TEST(WriteTest, Write10ShoudlFailOnWrongProtectBit) {
 
   uint8_t scsi_cmd[sizeof(scsi::Write10Command)];
   ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
-  translator::Span<uint8_t> buffer_out;
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
-  translator::StatusCode status_code = translator::Write10ToNvme(
-      scsi_cmd, nvme_wrapper, allocation, kNsid, kLbaSize, buffer_out);
+  translator::Span<const translator::DataSegment> data_out;
+  translator::NvmeCmdChain chain;
+  translator::StatusCode status_code =
+      translator::Write10ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                                data_out);
 
   EXPECT_EQ(status_code, translator::StatusCode::kFailure);
 }
 
-TEST(WriteTest, Write12ShoudlFailOnWrongProtectBit) {
-  uint32_t network_lba = htonl(kLba);
-  uint32_t network_transfer_length = 0x2b1a0000;
+TEST_F(WriteTest, Write12ShoudlFailOnWrongProtectBit) {
+  uint32_t host_lba = kLba;
+  uint32_t host_transfer_length = 0x1a2b;
   scsi::Write12Command cmd = {.fua = kFua,
                               .wr_protect = kInvalidWriteProtect,
-                              .logical_block_address = network_lba,
-                              .transfer_length = network_transfer_length};
+                              .logical_block_address = host_lba,
+                              .transfer_length = host_transfer_length};
 
   uint8_t scsi_cmd[sizeof(scsi::Write12Command)];
   ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
 
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
-  translator::Span<uint8_t> buffer_out;
-  translator::StatusCode status_code = translator::Write12ToNvme(
-      scsi_cmd, nvme_wrapper, allocation, kNsid, kLbaSize, buffer_out);
+  translator::NvmeCmdChain chain;
+  translator::Span<const translator::DataSegment> data_out;
+  translator::StatusCode status_code =
+      translator::Write12ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                                data_out);
 
   EXPECT_EQ(status_code, translator::StatusCode::kFailure);
 }
 
-TEST(WriteTest, Write16ShoudlFailOnWrongProtectBit) {
-  uint64_t network_lba = translator::htolll(kWrite16Lba);
-  uint32_t network_transfer_length = 0x2b1a0000;
+TEST_F(WriteTest, Write16ShoudlFailOnWrongProtectBit) {
+  uint64_t host_lba = translator::htolll(kWrite16Lba);
+  uint32_t host_transfer_length = 0x1a2b;
 
   scsi::Write16Command cmd = {.fua = kFua,
                               .wr_protect = kInvalidWriteProtect,
-                              .logical_block_address = network_lba,
-                              .transfer_length = network_transfer_length};
+                              .logical_block_address = host_lba,
+                              .transfer_length = host_transfer_length};
 
   uint8_t scsi_cmd[sizeof(scsi::Write16Command)];
   ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
 
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
-  translator::Span<uint8_t> buffer_out;
-  translator::StatusCode status_code = translator::Write16ToNvme(
-      scsi_cmd, nvme_wrapper, allocation, kNsid, kLba, buffer_out);
+  translator::NvmeCmdChain chain;
+  translator::Span<const translator::DataSegment> data_out;
+  translator::StatusCode status_code =
+      translator::Write16ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                                data_out);
 
   EXPECT_EQ(status_code, translator::StatusCode::kFailure);
 }
 
-TEST(WriteTest, Write6ShouldWrite256BlocksOnZeroTransferLength) {
-  uint8_t network_endian_lba_1 = 0x1;
-  uint8_t network_endian_lba_2 = htons(0x1234);
+TEST_F(WriteTest, Write6ShouldWrite256BlocksOnZeroTransferLength) {
+  uint8_t host_endian_lba_1 = 0x1;
+  uint16_t host_endian_lba_2 = 0x1234;
   uint16_t transfer_length = 0;
-  scsi::Write6Command cmd = {.logical_block_address_1 = network_endian_lba_1,
-                             .logical_block_address_2 = network_endian_lba_2,
+  scsi::Write6Command cmd = {.logical_block_address_1 = host_endian_lba_1,
+                             .logical_block_address_2 = host_endian_lba_2,
                              .transfer_length = transfer_length};
 
   uint8_t scsi_cmd[sizeof(scsi::Write6Command)];
   ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
 
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
-  translator::Span<uint8_t> buffer_out;
-  translator::StatusCode status_code = translator::Write6ToNvme(
-      scsi_cmd, nvme_wrapper, allocation, kNsid, kLbaSize, buffer_out);
+  translator::NvmeCmdChain chain;
+  translator::StatusCode status_code =
+      translator::Write6ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                               data_out);
+  translator::NvmeCmdWrapper& nvme_wrapper = chain.wrapper(0);
 
   uint16_t expected_transfer_length = 256;
   uint32_t expected_cdw12 = translator::htoll(expected_transfer_length - 1);
@@ -369,65 +421,355 @@ TEST(WriteTest, Write6ShouldWrite256BlocksOnZeroTransferLength) {
   EXPECT_EQ(nvme_wrapper.cmd.cdw[2], expected_cdw12);
 }
 
-TEST(WriteTest, Write10ShouldWriteFailOnZeroTransferLength) {
-  uint32_t network_lba = htonl(kLba);
+TEST_F(WriteTest, Write10ShouldWriteFailOnZeroTransferLength) {
+  uint32_t host_lba = kLba;
   uint16_t transfer_length = 0;
   scsi::Write10Command cmd = {.fua = kFua,
                               .wr_protect = kValidWriteProtect,
-                              .logical_block_address = network_lba,
+                              .logical_block_address = host_lba,
                               .transfer_length = transfer_length};
 
   uint8_t scsi_cmd[sizeof(scsi::Write10Command)];
   ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
 
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
-  translator::Span<uint8_t> buffer_out;
-  translator::StatusCode status_code = translator::Write10ToNvme(
-      scsi_cmd, nvme_wrapper, allocation, kNsid, kLbaSize, buffer_out);
+  translator::NvmeCmdChain chain;
+  translator::Span<const translator::DataSegment> data_out;
+  translator::StatusCode status_code =
+      translator::Write10ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                                data_out);
 
   EXPECT_EQ(status_code, translator::StatusCode::kNoTranslation);
 }
 
-TEST(WriteTest, Write12ShouldWriteFailOnZeroTransferLength) {
-  uint32_t network_lba = htonl(kLba);
+TEST_F(WriteTest, Write12ShouldWriteFailOnZeroTransferLength) {
+  uint32_t host_lba = kLba;
   uint32_t transfer_length = 0;
   scsi::Write12Command cmd = {.fua = kFua,
                               .wr_protect = kValidWriteProtect,
-                              .logical_block_address = network_lba,
+                              .logical_block_address = host_lba,
                               .transfer_length = transfer_length};
 
   uint8_t scsi_cmd[sizeof(scsi::Write12Command)];
   ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
 
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
-  translator::Span<uint8_t> buffer_out;
-  translator::StatusCode status_code = translator::Write12ToNvme(
-      scsi_cmd, nvme_wrapper, allocation, kNsid, kLbaSize, buffer_out);
+  translator::NvmeCmdChain chain;
+  translator::Span<const translator::DataSegment> data_out;
+  translator::StatusCode status_code =
+      translator::Write12ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                                data_out);
 
   EXPECT_EQ(status_code, translator::StatusCode::kNoTranslation);
 }
 
-TEST(WriteTest, Write16ShouldWriteFailOnZeroTransferLength) {
-  uint64_t network_lba = translator::htolll(kWrite16Lba);
+TEST_F(WriteTest, Write16ShouldWriteFailOnZeroTransferLength) {
+  uint64_t host_lba = translator::htolll(kWrite16Lba);
   uint32_t transfer_length = 0;
 
   scsi::Write16Command cmd = {.fua = kFua,
                               .wr_protect = kValidWriteProtect,
-                              .logical_block_address = network_lba,
+                              .logical_block_address = host_lba,
                               .transfer_length = transfer_length};
 
   uint8_t scsi_cmd[sizeof(scsi::Write16Command)];
   ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
 
-  translator::NvmeCmdWrapper nvme_wrapper;
-  translator::Allocation allocation = {};
-  translator::Span<uint8_t> buffer_out;
-  translator::StatusCode status_code = translator::Write16ToNvme(
-      scsi_cmd, nvme_wrapper, allocation, kNsid, kLba, buffer_out);
+  translator::NvmeCmdChain chain;
+  translator::Span<const translator::DataSegment> data_out;
+  translator::StatusCode status_code =
+      translator::Write16ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                                data_out);
 
   EXPECT_EQ(status_code, translator::StatusCode::kNoTranslation);
 }
 
+TEST_F(WriteTest, ShouldTransferFromAllDataSegments) {
+  scsi::Write10Command cmd = {
+      .logical_block_address = kLba,
+      .transfer_length = 2 * kPageSize / kLbaSize};
+  uint8_t scsi_cmd[sizeof(scsi::Write10Command)];
+  ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
+
+  alignas(kPageSize) uint8_t page_1[kPageSize];
+  alignas(kPageSize) uint8_t page_2[kPageSize];
+  translator::DataSegment data_out[] = {
+      {.addr = reinterpret_cast<uint64_t>(page_1), .len = sizeof(page_1)},
+      {.addr = reinterpret_cast<uint64_t>(page_2), .len = sizeof(page_2)}};
+
+  translator::NvmeCmdChain chain;
+  translator::StatusCode status_code =
+      translator::Write10ToNvme(scsi_cmd, chain, kNsid, kLbaShift, kController,
+                                data_out);
+  translator::NvmeCmdWrapper& nvme_wrapper = chain.wrapper(0);
+
+  EXPECT_EQ(status_code, translator::StatusCode::kSuccess);
+  EXPECT_EQ(nvme_wrapper.cmd.dptr.prp.prp1, reinterpret_cast<uint64_t>(page_1));
+  EXPECT_EQ(nvme_wrapper.cmd.dptr.prp.prp2, reinterpret_cast<uint64_t>(page_2));
+  EXPECT_EQ(nvme_wrapper.buffer_len, 2 * kPageSize);
+}
+
+TEST_F(WriteTest, ShouldRejectShortDataOutBuffer) {
+  scsi::Write10Command cmd = {
+      .logical_block_address = kLba,
+      .transfer_length = 2 * kPageSize / kLbaSize};
+  uint8_t scsi_cmd[sizeof(scsi::Write10Command)];
+  ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
+
+  // One page short of the transfer length
+  translator::DataSegment short_data_out[] = {
+      {.addr = reinterpret_cast<uint64_t>(buffer_out), .len = kPageSize}};
+  translator::NvmeCmdChain chain;
+  EXPECT_EQ(translator::StatusCode::kFailure,
+            translator::Write10ToNvme(scsi_cmd, chain, kNsid, kLbaShift,
+                                      kController, short_data_out));
+}
+
+TEST_F(WriteTest, Write16ShouldSplitTransferLongerThanNlb) {
+  uint64_t host_lba = 0x1000;
+  uint32_t transfer_length = 0x10001;
+  scsi::Write16Command cmd = {
+      .fua = kFua,
+      .wr_protect = kValidWriteProtect,
+      .logical_block_address = host_lba,
+      .transfer_length = transfer_length};
+
+  uint8_t scsi_cmd[sizeof(scsi::Write16Command)];
+  ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
+  translator::NvmeCmdChain chain;
+  translator::StatusCode status_code = translator::Write16ToNvme(
+      scsi_cmd, chain, kNsid, kLbaShift, kController, data_out);
+
+  EXPECT_EQ(status_code, translator::StatusCode::kSuccess);
+  ASSERT_EQ(chain.size(), 2);
+  EXPECT_EQ(chain.wrapper(0).cmd.cdw[0], host_lba);
+  EXPECT_EQ(chain.wrapper(0).cmd.cdw[2], 0xffff | kPrInfo << 26 | kFua << 30);
+  EXPECT_EQ(chain.wrapper(1).cmd.cdw[0], host_lba + 0x10000);
+  EXPECT_EQ(chain.wrapper(1).cmd.cdw[2], BuildCdw12(1, kPrInfo, kFua));
+  EXPECT_EQ(chain.wrapper(1).data_offset, 0x10000 * kLbaSize);
+}
+
+// A controller that supports Write Zeroes
+translator::Controller WriteZeroesController() {
+  translator::Controller controller;
+  nvme::IdentifyControllerData data = {};
+  data.oncs.write_zeroes = 1;
+  controller.SetIdentifyControllerData(data);
+  return controller;
+}
+
+class WriteSameTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    translator::SetAllocPageCallbacks(
+        [](uint32_t page_size, uint16_t count) -> uint64_t {
+          void* pages = aligned_alloc(page_size, page_size * count);
+          memset(pages, 0, page_size * count);
+          return reinterpret_cast<uint64_t>(pages);
+        },
+        [](uint64_t addr, uint16_t count) {
+          free(reinterpret_cast<void*>(addr));
+        });
+  }
+
+  void TearDown() override {
+    for (uint32_t i = 0; i < chain_.size(); ++i)
+      chain_.allocation(i).FreePages();
+    chain_.Release();
+    translator::SetAllocPageCallbacks(nullptr, nullptr);
+  }
+
+  translator::NvmeCmdChain chain_;
+};
+
+TEST_F(WriteSameTest, ShouldUnmapZeroesWithWriteZeroes) {
+  uint64_t lba = 0x123456789;
+  uint32_t block_count = 0x18000;
+  scsi::WriteSame16Command cmd = {.unmap = 1,
+                                  .logical_block_address = lba,
+                                  .number_of_logical_blocks = block_count};
+  uint8_t scsi_cmd[sizeof(scsi::WriteSame16Command)];
+  ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
+  uint8_t block[kLbaSize] = {};
+
+  translator::Controller controller = WriteZeroesController();
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            translator::WriteSame16ToNvme(scsi_cmd, chain_, kNsid, kLbaShift,
+                                          controller, block));
+
+  // Write Zeroes is split on NLB only, with DEAC and PRACT set
+  ASSERT_EQ(2, chain_.size());
+  for (uint32_t i = 0; i < 2; ++i) {
+    const nvme::GenericQueueEntryCmd& nvme_cmd = chain_.wrapper(i).cmd;
+    uint64_t expected_lba = lba + i * 0x10000;
+    EXPECT_EQ(static_cast<uint8_t>(nvme::NvmOpcode::kWriteZeroes),
+              nvme_cmd.opc);
+    EXPECT_EQ(kNsid, nvme_cmd.nsid);
+    EXPECT_EQ(static_cast<uint32_t>(expected_lba), nvme_cmd.cdw[0]);
+    EXPECT_EQ(expected_lba >> 32, nvme_cmd.cdw[1]);
+    EXPECT_EQ(0, nvme_cmd.dptr.prp.prp1);
+    EXPECT_EQ(0, chain_.wrapper(i).buffer_len);
+    EXPECT_FALSE(chain_.wrapper(i).is_admin);
+  }
+  EXPECT_EQ(0xffff | 1 << 25 | 0b1000 << 26, chain_.wrapper(0).cmd.cdw[2]);
+  EXPECT_EQ(0x7fff | 1 << 25 | 0b1000 << 26, chain_.wrapper(1).cmd.cdw[2]);
+}
+
+TEST_F(WriteSameTest, ShouldOnlyDeallocateWithUnmap) {
+  scsi::WriteSame10Command cmd = {.logical_block_address = 8,
+                                  .number_of_logical_blocks = 16};
+  uint8_t scsi_cmd[sizeof(scsi::WriteSame10Command)];
+  ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
+  uint8_t block[kLbaSize] = {};
+
+  translator::Controller controller = WriteZeroesController();
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            translator::WriteSame10ToNvme(scsi_cmd, chain_, kNsid, kLbaShift,
+                                          controller, block));
+  ASSERT_EQ(1, chain_.size());
+  EXPECT_EQ(static_cast<uint8_t>(nvme::NvmOpcode::kWriteZeroes),
+            chain_.wrapper(0).cmd.opc);
+  EXPECT_EQ(8, chain_.wrapper(0).cmd.cdw[0]);
+  EXPECT_EQ(15 | 0b1000 << 26, chain_.wrapper(0).cmd.cdw[2]);
+}
+
+TEST_F(WriteSameTest, ShouldWriteZeroesWithoutDataOutBuffer) {
+  scsi::WriteSame16Command cmd = {.ndob = 1,
+                                  .unmap = 1,
+                                  .logical_block_address = 0,
+                                  .number_of_logical_blocks = 1};
+  uint8_t scsi_cmd[sizeof(scsi::WriteSame16Command)];
+  ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
+
+  translator::Controller controller = WriteZeroesController();
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            translator::WriteSame16ToNvme(scsi_cmd, chain_, kNsid, kLbaShift,
+                                          controller, {}));
+  ASSERT_EQ(1, chain_.size());
+  EXPECT_EQ(static_cast<uint8_t>(nvme::NvmOpcode::kWriteZeroes),
+            chain_.wrapper(0).cmd.opc);
+  EXPECT_EQ(1 << 25 | 0b1000 << 26, chain_.wrapper(0).cmd.cdw[2]);
+}
+
+TEST_F(WriteSameTest, ShouldWritePatternsFromOneRepeatedBuffer) {
+  // 128 KiB of the pattern holds 256 blocks
+  uint32_t block_count = 600;
+  scsi::WriteSame16Command cmd = {.unmap = 1,
+                                  .logical_block_address = 1000,
+                                  .number_of_logical_blocks = block_count};
+  uint8_t scsi_cmd[sizeof(scsi::WriteSame16Command)];
+  ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
+  uint8_t block[kLbaSize];
+  for (uint32_t i = 0; i < kLbaSize; ++i) block[i] = i * 7 + 1;
+
+  translator::Controller controller = WriteZeroesController();
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            translator::WriteSame16ToNvme(scsi_cmd, chain_, kNsid, kLbaShift,
+                                          controller, block));
+
+  ASSERT_EQ(3, chain_.size());
+  uint32_t expected_blocks[] = {256, 256, 88};
+  uint64_t pattern = chain_.wrapper(0).cmd.dptr.prp.prp1;
+  ASSERT_NE(0, pattern);
+  for (uint32_t i = 0; i < 3; ++i) {
+    const translator::NvmeCmdWrapper& wrapper = chain_.wrapper(i);
+    EXPECT_EQ(static_cast<uint8_t>(nvme::NvmOpcode::kWrite), wrapper.cmd.opc);
+    EXPECT_EQ(1000 + i * 256, wrapper.cmd.cdw[0]);
+    EXPECT_EQ(expected_blocks[i] - 1 | 0b1000 << 26, wrapper.cmd.cdw[2]);
+    EXPECT_EQ(pattern, wrapper.cmd.dptr.prp.prp1);
+    EXPECT_EQ(expected_blocks[i] * kLbaSize, wrapper.buffer_len);
+  }
+  const uint8_t* buffer = reinterpret_cast<const uint8_t*>(pattern);
+  for (uint32_t i = 0; i < 256; ++i)
+    ASSERT_EQ(0, memcmp(block, buffer + i * kLbaSize, kLbaSize)) << i;
+}
+
+TEST_F(WriteSameTest, ShouldWriteZeroPatternsWithoutWriteZeroes) {
+  scsi::WriteSame10Command cmd = {.unmap = 1,
+                                  .logical_block_address = 0,
+                                  .number_of_logical_blocks = 4};
+  uint8_t scsi_cmd[sizeof(scsi::WriteSame10Command)];
+  ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
+  uint8_t block[kLbaSize] = {};
+
+  // The default controller has no Write Zeroes, so zeroed pages are written
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            translator::WriteSame10ToNvme(scsi_cmd, chain_, kNsid, kLbaShift,
+                                          kController, block));
+  ASSERT_EQ(1, chain_.size());
+  EXPECT_EQ(static_cast<uint8_t>(nvme::NvmOpcode::kWrite),
+            chain_.wrapper(0).cmd.opc);
+  EXPECT_EQ(4 * kLbaSize, chain_.wrapper(0).buffer_len);
+  const uint8_t* buffer =
+      reinterpret_cast<const uint8_t*>(chain_.wrapper(0).cmd.dptr.prp.prp1);
+  uint8_t zeroes[4 * kLbaSize] = {};
+  EXPECT_EQ(0, memcmp(zeroes, buffer, sizeof(zeroes)));
+}
+
+TEST_F(WriteSameTest, ShouldSplitPatternWritesOnMdts) {
+  scsi::WriteSame10Command cmd = {.logical_block_address = 0,
+                                  .number_of_logical_blocks = 40};
+  uint8_t scsi_cmd[sizeof(scsi::WriteSame10Command)];
+  ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
+  uint8_t block[kLbaSize] = {0xab};
+
+  translator::Controller controller;
+  nvme::IdentifyControllerData data = {};
+  data.mdts = 1;
+  controller.SetIdentifyControllerData(data);
+  ASSERT_EQ(translator::StatusCode::kSuccess,
+            translator::WriteSame10ToNvme(scsi_cmd, chain_, kNsid, kLbaShift,
+                                          controller, block));
+  // MDTS of two pages holds 16 blocks
+  ASSERT_EQ(3, chain_.size());
+  EXPECT_EQ(16 * kLbaSize, chain_.wrapper(0).buffer_len);
+  EXPECT_EQ(16, chain_.wrapper(1).cmd.cdw[0]);
+  EXPECT_EQ(8 * kLbaSize, chain_.wrapper(2).buffer_len);
+}
+
+TEST_F(WriteSameTest, ShouldRejectUnsupportedFields) {
+  uint8_t block[kLbaSize] = {};
+  uint8_t scsi_cmd[sizeof(scsi::WriteSame16Command)];
+
+  // No blocks, which would mean the rest of the medium
+  scsi::WriteSame16Command cmd = {.logical_block_address = 0,
+                                  .number_of_logical_blocks = 0};
+  ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
+  EXPECT_EQ(translator::StatusCode::kInvalidInput,
+            translator::WriteSame16ToNvme(scsi_cmd, chain_, kNsid, kLbaShift,
+                                          kController, block));
+
+  cmd = {.anchor = 1, .number_of_logical_blocks = 1};
+  ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
+  EXPECT_EQ(translator::StatusCode::kInvalidInput,
+            translator::WriteSame16ToNvme(scsi_cmd, chain_, kNsid, kLbaShift,
+                                          kController, block));
+
+  cmd = {.lbdata = 1, .number_of_logical_blocks = 1};
+  ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
+  EXPECT_EQ(translator::StatusCode::kInvalidInput,
+            translator::WriteSame16ToNvme(scsi_cmd, chain_, kNsid, kLbaShift,
+                                          kController, block));
+
+  // The data out buffer must hold a block
+  cmd = {.number_of_logical_blocks = 1};
+  ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
+  EXPECT_EQ(translator::StatusCode::kInvalidInput,
+            translator::WriteSame16ToNvme(
+                scsi_cmd, chain_, kNsid, kLbaShift, kController,
+                translator::Span<const uint8_t>(block, kLbaSize - 1)));
+
+  cmd = {.wr_protect = kInvalidWriteProtect, .number_of_logical_blocks = 1};
+  ASSERT_TRUE(translator::WriteValue(cmd, scsi_cmd));
+  EXPECT_EQ(translator::StatusCode::kFailure,
+            translator::WriteSame16ToNvme(scsi_cmd, chain_, kNsid, kLbaShift,
+                                          kController, block));
+
+  // Write Same(10) has no NDOB bit and always needs a block
+  uint8_t scsi_cmd_10[sizeof(scsi::WriteSame10Command)];
+  ASSERT_TRUE(translator::WriteValue(
+      scsi::WriteSame10Command{.number_of_logical_blocks = 1}, scsi_cmd_10));
+  EXPECT_EQ(translator::StatusCode::kInvalidInput,
+            translator::WriteSame10ToNvme(scsi_cmd_10, chain_, kNsid,
+                                          kLbaShift, kController, {}));
+}
+
 }  // namespace
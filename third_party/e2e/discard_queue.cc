@@ -0,0 +1,231 @@
+// Copyright 2020 Google LLC
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// version 2 as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+
+#include "discard_queue.h"
+
+#include "util.h"
+
+namespace {
+
+constexpr uint32_t kPageSize = 4096;
+// NVM Command Set Specification 3.2.3: at most 256 ranges per command
+constexpr uint32_t kMaxBatchRanges = 256;
+static_assert(kMaxBatchRanges * sizeof(nvme::DatasetManagmentRange) <=
+              kPageSize);
+
+// NVM Command Set Specification Figure 38: Attribute - Deallocate
+constexpr uint32_t kDeallocate = 1 << 2;
+
+// Returns the first of the count elements of items whose end lies after
+// lba. end(item) must increase with the index
+template <typename T, typename EndFn>
+uint32_t FirstEndingAfter(const T* items, uint32_t count, uint64_t lba,
+                          EndFn end) {
+  uint32_t low = 0;
+  uint32_t high = count;
+  while (low < high) {
+    uint32_t mid = low + (high - low) / 2;
+    if (end(items[mid]) > lba) {
+      high = mid;
+    } else {
+      low = mid + 1;
+    }
+  }
+  return low;
+}
+
+}  // namespace
+
+bool DiscardQueue::Init(const DiscardQueueConfig& config) {
+  if (config.max_ranges == 0) return false;
+  uint64_t bytes = static_cast<uint64_t>(config.max_ranges) * sizeof(Interval);
+  uint64_t page_count = (bytes + kPageSize - 1) / kPageSize;
+  if (page_count > UINT16_MAX) return false;
+  config_ = config;
+  interval_page_count_ = page_count;
+  intervals_ =
+      reinterpret_cast<Interval*>(AllocPages(kPageSize, interval_page_count_));
+  batch_ = reinterpret_cast<nvme::DatasetManagmentRange*>(
+      AllocPages(kPageSize, 1));
+  lock_ = CreateSpinLock();
+  if (intervals_ == nullptr || batch_ == nullptr || lock_ == nullptr) {
+    Destroy();
+    return false;
+  }
+  size_ = 0;
+  batch_count_ = 0;
+  batch_submitted_ = false;
+  urgent_ = false;
+  last_batch_ns_ = 0;
+  outstanding_ = 0;
+  return true;
+}
+
+void DiscardQueue::Destroy() {
+  DeallocPages(reinterpret_cast<uint64_t>(intervals_), interval_page_count_);
+  DeallocPages(reinterpret_cast<uint64_t>(batch_), 1);
+  if (lock_ != nullptr) DestroySpinLock(lock_);
+  lock_ = nullptr;
+  intervals_ = nullptr;
+  interval_page_count_ = 0;
+  batch_ = nullptr;
+  size_ = 0;
+  batch_count_ = 0;
+  outstanding_ = 0;
+}
+
+bool DiscardQueue::Add(
+    translator::Span<const translator::NvmeCmdWrapper> wrappers) {
+  if (!enabled() || wrappers.empty()) return false;
+  uint32_t nsid = wrappers[0].cmd.nsid;
+  uint32_t range_count = 0;
+  for (uint32_t i = 0; i < wrappers.size(); ++i) {
+    const nvme::GenericQueueEntryCmd& cmd = wrappers[i].cmd;
+    if (wrappers[i].is_admin ||
+        cmd.opc !=
+            static_cast<uint8_t>(nvme::NvmOpcode::kDatasetManagement) ||
+        !(cmd.cdw[1] & kDeallocate) || cmd.nsid != nsid)
+      return false;
+    range_count += (cmd.cdw[0] & 0xff) + 1;
+  }
+
+  unsigned long flags = SpinLock(lock_);
+  // Every range may become an interval of its own
+  bool fits = (outstanding_ == 0 || nsid == nsid_) &&
+              range_count <= config_.max_ranges - size_;
+  if (fits) {
+    nsid_ = nsid;
+    for (uint32_t i = 0; i < wrappers.size(); ++i) {
+      const nvme::GenericQueueEntryCmd& cmd = wrappers[i].cmd;
+      const nvme::DatasetManagmentRange* ranges =
+          reinterpret_cast<const nvme::DatasetManagmentRange*>(
+              cmd.dptr.prp.prp1);
+      uint32_t count = (cmd.cdw[0] & 0xff) + 1;
+      for (uint32_t j = 0; j < count; ++j) {
+        uint64_t lba = ranges[j].lba.value();
+        uint32_t lb_count = ranges[j].lb_count.value();
+        if (lb_count != 0) Insert(lba, lba + lb_count);
+      }
+    }
+    UpdateOutstanding();
+  }
+  SpinUnlock(lock_, flags);
+  return fits;
+}
+
+bool DiscardQueue::Conflicts(uint64_t lba, uint64_t count) {
+  if (!Pending() || count == 0) return false;
+  uint64_t end = lba + count;
+  unsigned long flags = SpinLock(lock_);
+  uint32_t i = FirstEndingAfter(intervals_, size_, lba,
+                                [](const Interval& it) { return it.end; });
+  bool conflict = i < size_ && intervals_[i].start < end;
+  if (!conflict) {
+    // The batch holds ranges in LBA order, so their ends increase too
+    uint32_t j = FirstEndingAfter(
+        batch_, batch_count_, lba, [](const nvme::DatasetManagmentRange& r) {
+          return r.lba.value() + r.lb_count.value();
+        });
+    conflict = j < batch_count_ && batch_[j].lba.value() < end;
+  }
+  if (conflict) urgent_ = true;
+  SpinUnlock(lock_, flags);
+  return conflict;
+}
+
+void DiscardQueue::Drain() {
+  if (!enabled()) return;
+  unsigned long flags = SpinLock(lock_);
+  if (outstanding_ != 0) urgent_ = true;
+  SpinUnlock(lock_, flags);
+}
+
+translator::Span<const nvme::DatasetManagmentRange> DiscardQueue::NextBatch(
+    uint64_t now_ns, uint32_t& nsid) {
+  translator::Span<const nvme::DatasetManagmentRange> ranges;
+  if (!Pending()) return ranges;
+  unsigned long flags = SpinLock(lock_);
+  uint32_t foreground = __atomic_load_n(&foreground_, __ATOMIC_RELAXED);
+  bool due = urgent_ || foreground == 0 ||
+             (foreground <= config_.max_foreground &&
+              now_ns - last_batch_ns_ >= config_.batch_interval_ns);
+  if (!batch_submitted_ && due) {
+    if (batch_count_ == 0) FillBatch();
+    if (batch_count_ != 0) {
+      batch_submitted_ = true;
+      last_batch_ns_ = now_ns;
+      nsid = nsid_;
+      ranges = translator::Span<const nvme::DatasetManagmentRange>(
+          batch_, batch_count_);
+    }
+  }
+  SpinUnlock(lock_, flags);
+  return ranges;
+}
+
+void DiscardQueue::BatchSubmitFailed() {
+  unsigned long flags = SpinLock(lock_);
+  batch_submitted_ = false;
+  SpinUnlock(lock_, flags);
+}
+
+void DiscardQueue::BatchDone() {
+  unsigned long flags = SpinLock(lock_);
+  batch_count_ = 0;
+  batch_submitted_ = false;
+  UpdateOutstanding();
+  if (outstanding_ == 0) urgent_ = false;
+  SpinUnlock(lock_, flags);
+}
+
+void DiscardQueue::Insert(uint64_t start, uint64_t end) {
+  // Intervals that overlap or touch [start, end) are merged into it
+  uint32_t first = FirstEndingAfter(
+      intervals_, size_, start, [](const Interval& it) { return it.end + 1; });
+  uint32_t last = first;
+  while (last < size_ && intervals_[last].start <= end) {
+    if (intervals_[last].start < start) start = intervals_[last].start;
+    if (intervals_[last].end > end) end = intervals_[last].end;
+    ++last;
+  }
+  if (last == first) {
+    memmove(&intervals_[first + 1], &intervals_[first],
+            (size_ - first) * sizeof(Interval));
+    ++size_;
+  } else if (last > first + 1) {
+    memmove(&intervals_[first + 1], &intervals_[last],
+            (size_ - last) * sizeof(Interval));
+    size_ -= last - first - 1;
+  }
+  intervals_[first] = {start, end};
+}
+
+void DiscardQueue::FillBatch() {
+  uint32_t taken = 0;
+  while (batch_count_ < kMaxBatchRanges && taken < size_) {
+    Interval& interval = intervals_[taken];
+    uint64_t count = interval.end - interval.start;
+    if (count > UINT32_MAX) count = UINT32_MAX;
+    nvme::DatasetManagmentRange& range = batch_[batch_count_++];
+    range = {};
+    range.lba = interval.start;
+    range.lb_count = count;
+    interval.start += count;
+    if (interval.start == interval.end) ++taken;
+  }
+  memmove(&intervals_[0], &intervals_[taken],
+          (size_ - taken) * sizeof(Interval));
+  size_ -= taken;
+}
+
+void DiscardQueue::UpdateOutstanding() {
+  __atomic_store_n(&outstanding_, size_ + batch_count_, __ATOMIC_RELEASE);
+}
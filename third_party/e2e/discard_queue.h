@@ -0,0 +1,135 @@
+// Copyright 2020 Google LLC
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// version 2 as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+
+// Deallocations the engine acknowledged before the device performed them.
+// Unmap ranges are merged into a bounded set of LBA intervals and handed out
+// in Dataset Management batches of up to 256 ranges, one batch at a time,
+// while foreground commands leave the device room for them.
+//
+// Foreground commands that touch a queued or in-flight range must wait for
+// it, since they would otherwise read blocks that were reported unmapped or
+// have their writes discarded afterwards. Conflicts() detects them and sends
+// the queue without further delay.
+
+#ifndef DISCARD_QUEUE_H
+#define DISCARD_QUEUE_H
+
+#include <cstdint>
+
+#include "lib/translator/common.h"
+
+struct DiscardQueueConfig {
+  uint32_t max_ranges;  // Intervals held before Unmap waits for the device
+  // Batches are sent while at most max_foreground foreground commands are in
+  // flight, batch_interval_ns after the previous batch. Without foreground
+  // commands they are sent right away
+  uint32_t max_foreground;
+  uint64_t batch_interval_ns;
+};
+
+constexpr DiscardQueueConfig kDefaultDiscardQueueConfig = {
+    .max_ranges = 4096, .max_foreground = 8, .batch_interval_ns = 1000000};
+
+class DiscardQueue {
+ public:
+  DiscardQueue()
+      : lock_(nullptr),
+        intervals_(nullptr),
+        interval_page_count_(0),
+        batch_(nullptr),
+        config_(),
+        size_(0),
+        nsid_(0),
+        batch_count_(0),
+        batch_submitted_(false),
+        urgent_(false),
+        last_batch_ns_(0),
+        outstanding_(0),
+        foreground_(0) {}
+
+  // Allocates room for config.max_ranges intervals and a batch. Returns
+  // false if memory is unavailable
+  bool Init(const DiscardQueueConfig& config);
+
+  // Frees the queue, dropping ranges that were not sent. No batch may be in
+  // flight
+  void Destroy();
+
+  bool enabled() const { return lock_ != nullptr; }
+
+  // Queues the ranges of wrappers, which must all be deallocating Dataset
+  // Management commands for one namespace. Returns false, queuing nothing,
+  // if they are not or the queue has no room for them
+  bool Add(translator::Span<const translator::NvmeCmdWrapper> wrappers);
+
+  // Returns true if count blocks from lba overlap a range not yet
+  // deallocated, in which case every queued range is sent without waiting
+  // for foreground commands
+  bool Conflicts(uint64_t lba, uint64_t count);
+
+  // Sends every queued range without waiting for foreground commands
+  void Drain();
+
+  // Returns true while ranges are queued or being deallocated
+  bool Pending() const {
+    return __atomic_load_n(&outstanding_, __ATOMIC_ACQUIRE) != 0;
+  }
+
+  // Track the foreground commands in flight on the device
+  void ForegroundStarted() {
+    __atomic_add_fetch(&foreground_, 1, __ATOMIC_RELAXED);
+  }
+  void ForegroundDone() {
+    __atomic_sub_fetch(&foreground_, 1, __ATOMIC_RELAXED);
+  }
+
+  // Returns the ranges of the next batch for namespace nsid if one is due,
+  // or an empty span. The ranges stay valid until BatchDone()
+  translator::Span<const nvme::DatasetManagmentRange> NextBatch(
+      uint64_t now_ns, uint32_t& nsid);
+
+  // The batch from NextBatch() could not be submitted. It is handed out
+  // again by the next NextBatch() call that finds it due
+  void BatchSubmitFailed();
+
+  // The device completed the batch from NextBatch()
+  void BatchDone();
+
+ private:
+  // Blocks [start, end)
+  struct Interval {
+    uint64_t start;
+    uint64_t end;
+  };
+
+  // Merges [start, end) into the intervals. There must be room for one more
+  void Insert(uint64_t start, uint64_t end);
+  // Moves up to kMaxBatchRanges ranges from the front of the intervals into
+  // the batch
+  void FillBatch();
+  void UpdateOutstanding();
+
+  void* lock_;
+  Interval* intervals_;  // size_ disjoint, non-adjacent intervals by start
+  uint16_t interval_page_count_;
+  nvme::DatasetManagmentRange* batch_;  // One page
+  DiscardQueueConfig config_;
+  uint32_t size_;
+  uint32_t nsid_;
+  uint32_t batch_count_;
+  bool batch_submitted_;
+  bool urgent_;
+  uint64_t last_batch_ns_;
+  uint32_t outstanding_;  // size_ + batch_count_
+  uint32_t foreground_;
+};
+
+#endif
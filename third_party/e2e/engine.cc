@@ -1,92 +1,589 @@
 #include "engine.h"
 
+#include <linux/errno.h>
+
+#include <cstddef>
 #include <cstdint>
 
+#include "lib/translator/page_pool.h"
+#include "lib/translator/trace.h"
 #include "lib/translator/translation.h"
+#include "discard_queue.h"
+#include "flush_group.h"
+#include "latency.h"
 #include "nvme_driver.h"
+#include "scsi_trace.h"
 #include "util.h"
 
 namespace {
 
 constexpr uint8_t kTimeout = 60;
+constexpr uint32_t kPageSize = 4096;
+
+// Status reported for NVMe commands that could not be queued
+// NVMe Base Specification Figure 126: Internal Error
+constexpr uint16_t kSubmitFailedStatus =
+    static_cast<uint16_t>(nvme::GenericCommandStatusCode::kInternalDeviceError)
+    << 1;
+
+// The library and the driver share the data segment layout, so the SCSI
+// scatterlist is described once and handed to both
+static_assert(sizeof(NvmeDataSegment) == sizeof(translator::DataSegment));
+static_assert(offsetof(NvmeDataSegment, addr) ==
+              offsetof(translator::DataSegment, addr));
+static_assert(offsetof(NvmeDataSegment, len) ==
+              offsetof(translator::DataSegment, len));
+
+// Capabilities of the NVMe controller behind the SCSI host. Translations
+// update it from the Identify Controller data fetched for Inquiry.
+translator::Controller controller;
+
+// Caches the pages the library allocates for NVMe command buffers
+translator::PagePool page_pool;
+
+uint64_t PoolAllocPages(uint32_t page_size, uint16_t count) {
+  return page_pool.Alloc(page_size, count);
+}
+
+void PoolDeallocPages(uint64_t addr, uint16_t count) {
+  page_pool.Dealloc(addr, count);
+}
+
+// Records every translation without formatting; decoded by ReleaseEngine()
+translator::TraceBuffer trace_buffer;
+constexpr uint32_t kTraceRingSize = 256;
+
+void DumpTrace() {
+  translator::TraceRecord records[16];
+  char text[128];
+  for (uint32_t cpu = 0; cpu < trace_buffer.cpu_count(); ++cpu) {
+    uint64_t cursor = 0;
+    uint64_t lost = 0;
+    uint32_t count;
+    while ((count = trace_buffer.Read(cpu, cursor, records, lost)) != 0) {
+      for (uint32_t i = 0; i < count; ++i) {
+        translator::DecodeTraceRecord(records[i], text);
+        TRANSLATOR_LOG(kDebug, "trace cpu %u: %s", cpu, text);
+      }
+    }
+  }
+}
+
+// Time spent in each phase of ScsiToNvme()
+LatencyStats latency_stats;
+
+// Set by SetScsiToNvmeTraceHook()
+ScsiToNvmeTraceHook trace_hook;
+void* trace_hook_priv;
+
+// Describes an accepted command to trace_hook
+void CaptureCommand(uint64_t start_ns, const unsigned char* cmd_buf,
+                    unsigned short cmd_len, unsigned long long lun,
+                    const unsigned char* data_buf, unsigned int data_len,
+                    bool is_data_in) {
+  ScsiTraceRecord record = {};
+  record.timestamp_ns = start_ns;
+  record.lun = lun;
+  record.data_len = data_len;
+  record.direction = data_len == 0 ? SCSI_TRACE_NO_DATA
+                     : is_data_in  ? SCSI_TRACE_DATA_IN
+                                   : SCSI_TRACE_DATA_OUT;
+  record.cdb_len =
+      cmd_len < SCSI_TRACE_MAX_CDB_LEN ? cmd_len : SCSI_TRACE_MAX_CDB_LEN;
+  memcpy(record.cdb, cmd_buf, record.cdb_len);
+  // Read and Write data is not captured, even from a bounce buffer
+  if (!is_data_in && data_buf != nullptr &&
+      !ScsiToNvmeIsDirect(cmd_buf, cmd_len)) {
+    record.payload_len = data_len < SCSI_TRACE_MAX_PAYLOAD_LEN
+                             ? data_len
+                             : SCSI_TRACE_MAX_PAYLOAD_LEN;
+  }
+  trace_hook(trace_hook_priv, &record, data_buf);
+}
+
+// Unmap ranges acknowledged before the device deallocated them, and the
+// request that carries their batches
+DiscardQueue discard_queue;
+NvmeAsyncRequest discard_request;
+
+void OnDiscardDone(NvmeAsyncRequest* request);
+
+// Submits the next batch of queued ranges if it is due
+void PumpDiscards() {
+  uint32_t nsid;
+  translator::Span<const nvme::DatasetManagmentRange> ranges =
+      discard_queue.NextBatch(NowNs(), nsid);
+  if (ranges.empty()) return;
+  nvme::DatasetManagementCmd dataset_cmd = {
+      .opc = static_cast<uint8_t>(nvme::NvmOpcode::kDatasetManagement),
+      .nsid = nsid,
+      .nr = static_cast<uint8_t>(ranges.size() - 1),
+      .ad = 1};
+  void* buffer = const_cast<nvme::DatasetManagmentRange*>(ranges.data());
+  dataset_cmd.dptr.prp.prp1 = reinterpret_cast<uint64_t>(buffer);
+  discard_request = {};
+  memcpy(&discard_request.cmd, &dataset_cmd, sizeof(discard_request.cmd));
+  static_assert(sizeof(discard_request.cmd) == sizeof(dataset_cmd));
+  discard_request.done = OnDiscardDone;
+  unsigned bufflen = ranges.size() * sizeof(nvme::DatasetManagmentRange);
+  // Retried by the next command that completes
+  if (submit_io_command(&discard_request, buffer, bufflen, kTimeout,
+                        NVME_ANY_HW_QUEUE) != 0)
+    discard_queue.BatchSubmitFailed();
+}
+
+void OnDiscardDone(NvmeAsyncRequest* request) {
+  // Unmap already reported success, and unmapping is advisory
+  if (request->cpl.status >> 1 != 0) Print("Background deallocation failed");
+  discard_queue.BatchDone();
+  PumpDiscards();
+}
+
+// Synchronize Cache commands waiting for a shared Flush
+FlushGroup flush_group;
+// Group flushes under the broadcast NSID when the controller supports it
+bool broadcast_flush;
+
+void OnFlushDone(NvmeAsyncRequest* flush);
+
+// Submits a Flush for every group with waiters and none in flight
+void PumpFlushes() {
+  NvmeAsyncRequest* flush;
+  while ((flush = flush_group.NextFlush()) != nullptr) {
+    flush->done = OnFlushDone;
+    // Retried by the next command that is submitted or completes
+    if (submit_io_command(flush, nullptr, 0, kTimeout, NVME_ANY_HW_QUEUE) !=
+        0) {
+      flush_group.SubmitFailed(flush);
+      return;
+    }
+  }
+}
+
+void OnFlushDone(NvmeAsyncRequest* flush) {
+  // The group reuses the request once Done() returns
+  NvmeCompletion cpl = flush->cpl;
+  FlushWaiter* waiter = flush_group.Done(flush);
+  while (waiter != nullptr) {
+    // Completing the request may end the command that holds the waiter
+    FlushWaiter* next = waiter->next;
+    waiter->request->cpl = cpl;
+    waiter->request->done(waiter->request);
+    waiter = next;
+  }
+  PumpFlushes();
+}
+
+// Returns true if cmd reads or writes blocks, which it then sets lba and
+// count to. Read, Write, Compare, Write Zeroes and Verify share the layout
+// of the block range
+bool AccessedBlocks(const nvme::GenericQueueEntryCmd& cmd, uint64_t& lba,
+                    uint64_t& count) {
+  constexpr uint8_t kVerifyOpcode = 0x0c;
+  switch (cmd.opc) {
+    case static_cast<uint8_t>(nvme::NvmOpcode::kWrite):
+    case static_cast<uint8_t>(nvme::NvmOpcode::kRead):
+    case static_cast<uint8_t>(nvme::NvmOpcode::kWriteUncorrectable):
+    case static_cast<uint8_t>(nvme::NvmOpcode::kCompare):
+    case static_cast<uint8_t>(nvme::NvmOpcode::kWriteZeroes):
+    case kVerifyOpcode:
+      lba = cmd.cdw[0] | static_cast<uint64_t>(cmd.cdw[1]) << 32;
+      count = (cmd.cdw[2] & 0xffff) + 1;
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Returns true if an IO command of wrappers touches blocks that are queued
+// for deallocation or being deallocated
+bool ConflictsWithDiscards(
+    translator::Span<const translator::NvmeCmdWrapper> wrappers) {
+  for (uint32_t i = 0; i < wrappers.size(); ++i) {
+    uint64_t lba, count;
+    if (!wrappers[i].is_admin &&
+        AccessedBlocks(wrappers[i].cmd, lba, count) &&
+        discard_queue.Conflicts(lba, count))
+      return true;
+  }
+  return false;
+}
+
+// Per-command state that lives from ScsiToNvme() until the last NVMe
+// completion arrives
+struct EngineCommand {
+  translator::Translation translation;
+  NvmeAsyncRequest inline_requests[translator::kMaxCommandRatio];
+  // Points to inline_requests, or for split Read and Write commands with more
+  // NVMe commands to pages holding the requests followed by a completion
+  // array for Translation::Complete()
+  NvmeAsyncRequest* nvme_requests;
+  uint16_t request_page_count;
+  uint32_t nvme_count;
+  // NVMe commands not yet completed, plus one held by ScsiToNvme() while it
+  // is still submitting
+  uint32_t pending;
+  uint32_t alloc_len;
+  uint8_t opcode;
+  // Counted as a foreground command by discard_queue
+  bool foreground;
+  // Queues the command's Flush in flush_group
+  FlushWaiter flush_waiter;
+  uint64_t start_ns;  // ScsiToNvme() was called
+  uint64_t begin_ns;  // Translation::Begin() returned
+  unsigned char* sense_buf;
+  unsigned short sense_len;
+  unsigned char* data_buf;
+  const NvmeDataSegment* data_segments;
+  unsigned short segment_count;
+  bool is_data_in;
+  ScsiToNvmeDone done;
+  void* priv;
+};
+static_assert(alignof(EngineCommand) <= 8);
+
+void Finish(EngineCommand* engine_cmd, int return_code, int alloc_len) {
+  ScsiToNvmeResponse resp = {.return_code = return_code,
+                             .alloc_len = alloc_len};
+  engine_cmd->done(engine_cmd->priv, resp);
+}
+
+// Queues the lone Flush of engine_cmd in flush_group. Returns false if it
+// must be submitted on its own
+bool JoinFlushGroup(
+    EngineCommand* engine_cmd,
+    translator::Span<const translator::NvmeCmdWrapper> wrappers) {
+  if (!flush_group.enabled() || wrappers.size() != 1 || wrappers[0].is_admin ||
+      wrappers[0].cmd.opc != static_cast<uint8_t>(nvme::NvmOpcode::kFlush))
+    return false;
+  uint32_t nsid = broadcast_flush && controller.FlushBroadcastSupported()
+                      ? kBroadcastNsid
+                      : wrappers[0].cmd.nsid;
+  engine_cmd->flush_waiter = {.next = nullptr,
+                              .request = &engine_cmd->nvme_requests[0]};
+  return flush_group.Join(nsid, &engine_cmd->flush_waiter);
+}
+
+// Makes room for count NVMe requests. Returns false if memory is unavailable
+bool AllocRequests(EngineCommand* engine_cmd, uint32_t count) {
+  engine_cmd->nvme_requests = engine_cmd->inline_requests;
+  engine_cmd->request_page_count = 0;
+  if (count <= translator::kMaxCommandRatio) return true;
+
+  uint64_t bytes =
+      static_cast<uint64_t>(count) *
+      (sizeof(NvmeAsyncRequest) + sizeof(nvme::GenericQueueEntryCpl));
+  uint64_t page_count = (bytes + kPageSize - 1) / kPageSize;
+  if (page_count > UINT16_MAX) return false;
+  uint64_t addr = AllocPages(kPageSize, page_count);
+  if (addr == 0) return false;
+  engine_cmd->nvme_requests = reinterpret_cast<NvmeAsyncRequest*>(addr);
+  engine_cmd->request_page_count = page_count;
+  return true;
+}
+
+void FreeRequests(EngineCommand* engine_cmd) {
+  if (engine_cmd->request_page_count == 0) return;
+  DeallocPages(reinterpret_cast<uint64_t>(engine_cmd->nvme_requests),
+               engine_cmd->request_page_count);
+  engine_cmd->nvme_requests = engine_cmd->inline_requests;
+  engine_cmd->request_page_count = 0;
+}
+
+// Runs Translation::Complete() once every NVMe command has completed
+void CompleteCommand(EngineCommand* engine_cmd) {
+  nvme::GenericQueueEntryCpl inline_cpl_buf[translator::kMaxCommandRatio] = {};
+  nvme::GenericQueueEntryCpl* cpl_buf = inline_cpl_buf;
+  if (engine_cmd->request_page_count != 0) {
+    cpl_buf = reinterpret_cast<nvme::GenericQueueEntryCpl*>(
+        engine_cmd->nvme_requests + engine_cmd->nvme_count);
+  }
+  for (uint32_t i = 0; i < engine_cmd->nvme_count; ++i) {
+    memcpy(&cpl_buf[i], &engine_cmd->nvme_requests[i].cpl, sizeof(cpl_buf[i]));
+    static_assert(sizeof(cpl_buf[i]) == sizeof(NvmeCompletion));
+  }
+
+  uint64_t device_ns = NowNs();
+  latency_stats.Record(engine_cmd->opcode, LatencyPhase::kDevice,
+                       device_ns - engine_cmd->begin_ns);
+
+  // Use NVMe completion responses to Complete translation
+  translator::Span<nvme::GenericQueueEntryCpl> nvme_cpl(cpl_buf,
+                                                        engine_cmd->nvme_count);
+  translator::Span<uint8_t> buffer_in = {};
+  // Direct transfers already landed in the data segments
+  if (engine_cmd->is_data_in && engine_cmd->data_buf != nullptr)
+    buffer_in = translator::Span(engine_cmd->data_buf, engine_cmd->alloc_len);
+  translator::Span<uint8_t> sense_buffer(engine_cmd->sense_buf,
+                                         engine_cmd->sense_len);
+  translator::CompleteResponse cpl_resp =
+      engine_cmd->translation.Complete(nvme_cpl, buffer_in, sense_buffer);
+  FreeRequests(engine_cmd);
+  // The caller may reuse engine_cmd once Finish() has run the done callback
+  bool foreground = engine_cmd->foreground;
+
+  if (cpl_resp.status == translator::ApiStatus::kFailure) {
+    Print("Incorrect usage of Translation Library API");
+    Finish(engine_cmd, 0x40, 0);
+  } else {
+    uint64_t end_ns = NowNs();
+    latency_stats.Record(engine_cmd->opcode, LatencyPhase::kComplete,
+                         end_ns - device_ns);
+    latency_stats.Record(engine_cmd->opcode, LatencyPhase::kTotal,
+                         end_ns - engine_cmd->start_ns);
+    Finish(engine_cmd, static_cast<uint8_t>(cpl_resp.scsi_status),
+           engine_cmd->alloc_len);
+  }
+  if (foreground) {
+    discard_queue.ForegroundDone();
+    PumpDiscards();
+  }
+  if (flush_group.Queued()) PumpFlushes();
+}
+
+void PutPending(EngineCommand* engine_cmd) {
+  if (__atomic_sub_fetch(&engine_cmd->pending, 1, __ATOMIC_ACQ_REL) == 0)
+    CompleteCommand(engine_cmd);
+}
+
+void OnNvmeDone(NvmeAsyncRequest* request) {
+  PutPending(static_cast<EngineCommand*>(request->priv));
+}
 
 }  // namespace
 
 void SetEngineCallbacks(void) {
   translator::SetDebugCallback(Print);
+  if (page_pool.Init(kPageSize, PossibleCpuCount(), CurrentCpu, AllocPages,
+                     DeallocPages) == translator::StatusCode::kSuccess) {
+    translator::SetAllocPageCallbacks(PoolAllocPages, PoolDeallocPages);
+  } else {
+    Print("Failed to set up the page pool, allocating pages directly");
+    translator::SetAllocPageCallbacks(AllocPages, DeallocPages);
+  }
+  if (trace_buffer.Init(kPageSize, PossibleCpuCount(), kTraceRingSize,
+                        CurrentCpu, AllocPages,
+                        DeallocPages) == translator::StatusCode::kSuccess) {
+    translator::SetTraceBuffer(&trace_buffer);
+  } else {
+    Print("Failed to set up the trace buffer, tracing is off");
+  }
+  if (!latency_stats.Init(PossibleCpuCount()))
+    Print("Failed to set up the latency histograms");
+}
+
+void ReleaseEngine(void) {
+  translator::PagePoolStats stats = page_pool.GetStats();
+  TRANSLATOR_LOG(kInfo, "Page pool hits: %llu misses: %llu", stats.hits,
+                 stats.misses);
   translator::SetAllocPageCallbacks(AllocPages, DeallocPages);
+  page_pool.Destroy();
+  translator::SetTraceBuffer(nullptr);
+  DumpTrace();
+  trace_buffer.Destroy();
+  latency_stats.Destroy();
+  discard_queue.Destroy();
+  flush_group.Destroy();
 }
 
-ScsiToNvmeResponse ScsiToNvme(unsigned char* cmd_buf, unsigned short cmd_len,
-                              unsigned long long lun, unsigned char* sense_buf,
-                              unsigned short sense_len, unsigned char* data_buf,
-                              unsigned short data_len, bool is_data_in) {
-  // Create translation object
-  translator::Translation translation;
+unsigned int ScsiToNvmeLatencyLineCount(void) {
+  return latency_stats.LineCount();
+}
+
+bool ScsiToNvmeLatencyLine(unsigned int index, char* buf, unsigned int size) {
+  return latency_stats.FormatLine(index, buf, size);
+}
+
+void ScsiToNvmeResetLatency(void) { latency_stats.Reset(); }
+
+void SetScsiToNvmeTraceHook(ScsiToNvmeTraceHook hook, void* priv) {
+  trace_hook = hook;
+  trace_hook_priv = priv;
+}
+
+void ScsiToNvmePagePoolStats(unsigned long long* hits,
+                             unsigned long long* misses) {
+  translator::PagePoolStats stats = page_pool.GetStats();
+  *hits = stats.hits;
+  *misses = stats.misses;
+}
+
+int SetScsiToNvmeDiscardConfig(const struct ScsiToNvmeDiscardConfig* config) {
+  discard_queue.Destroy();
+  if (config == nullptr || !config->early_ack) return 0;
+  DiscardQueueConfig queue_config = {
+      .max_ranges = config->max_ranges,
+      .max_foreground = config->max_foreground,
+      .batch_interval_ns = config->batch_interval_ns};
+  return discard_queue.Init(queue_config) ? 0 : -ENOMEM;
+}
+
+void ScsiToNvmeDrainDiscards(void) {
+  discard_queue.Drain();
+  PumpDiscards();
+}
+
+bool ScsiToNvmeDiscardsPending(void) { return discard_queue.Pending(); }
+
+int SetScsiToNvmeFlushConfig(const struct ScsiToNvmeFlushConfig* config) {
+  flush_group.Destroy();
+  broadcast_flush = false;
+  if (config == nullptr || !config->group) return 0;
+  broadcast_flush = config->broadcast;
+  return flush_group.Init() ? 0 : -ENOMEM;
+}
+
+unsigned int ScsiToNvmeContextSize(void) { return sizeof(EngineCommand); }
+
+bool ScsiToNvmeIsDirect(const unsigned char* cmd_buf, unsigned short cmd_len) {
+  return translator::IsDirectDataTransfer(
+      translator::Span<const uint8_t>(cmd_buf, cmd_len));
+}
+
+int ScsiToNvme(void* context, void* scratch_page, unsigned char* cmd_buf,
+               unsigned short cmd_len, unsigned long long lun,
+               unsigned char* sense_buf, unsigned short sense_len,
+               unsigned char* data_buf,
+               const struct NvmeDataSegment* data_segments,
+               unsigned short segment_count, unsigned int data_len,
+               bool is_data_in, unsigned hw_queue, ScsiToNvmeDone done,
+               void* priv) {
+  uint64_t start_ns = NowNs();
+  // Create translation object in the caller provided context
+  EngineCommand* engine_cmd = new (context)
+      EngineCommand{.translation = translator::Translation(controller)};
+  engine_cmd->opcode = cmd_len != 0 ? cmd_buf[0] : 0;
+  engine_cmd->start_ns = start_ns;
+  engine_cmd->translation.SetScratchPages(
+      reinterpret_cast<uint64_t>(scratch_page), 1);
+  engine_cmd->sense_buf = sense_buf;
+  engine_cmd->sense_len = sense_len;
+  engine_cmd->data_buf = data_buf;
+  engine_cmd->data_segments = data_segments;
+  engine_cmd->segment_count = segment_count;
+  engine_cmd->is_data_in = is_data_in;
+  engine_cmd->done = done;
+  engine_cmd->priv = priv;
 
   // Package parameters and run translation begin
   translator::Span<uint8_t> scsi_cmd(cmd_buf, cmd_len);
-  translator::Span<uint8_t> buffer(data_buf, data_len);
-  translator::BeginResponse begin_resp =
-      translation.Begin(scsi_cmd, buffer, lun);
+  translator::BeginResponse begin_resp;
+  if (data_segments != nullptr) {
+    translator::Span<const translator::DataSegment> segments(
+        reinterpret_cast<const translator::DataSegment*>(data_segments),
+        segment_count);
+    begin_resp = engine_cmd->translation.Begin(scsi_cmd, segments, lun);
+  } else {
+    translator::Span<uint8_t> buffer(data_buf, data_len);
+    begin_resp = engine_cmd->translation.Begin(scsi_cmd, buffer, lun);
+  }
+
+  engine_cmd->begin_ns = NowNs();
+  latency_stats.Record(engine_cmd->opcode, LatencyPhase::kBegin,
+                       engine_cmd->begin_ns - start_ns);
 
   if (begin_resp.status == translator::ApiStatus::kFailure) {
     Print("Incorrect usage of Translation Library API");
-    ScsiToNvmeResponse resp = {
-        .return_code = static_cast<uint8_t>(scsi::Status::kTaskAborted),
-        .alloc_len = 0};
-    return resp;
+    if (trace_hook != nullptr)
+      CaptureCommand(start_ns, cmd_buf, cmd_len, lun, data_buf, data_len,
+                     is_data_in);
+    Finish(engine_cmd, static_cast<uint8_t>(scsi::Status::kTaskAborted), 0);
+    return 0;
   }
 
   if (begin_resp.alloc_len > data_len) {
     Print(
         "Specified allocation length exceeds buffer size. Possible malicious "
         "request?");
-    ScsiToNvmeResponse resp = {
-        .return_code = static_cast<uint8_t>(scsi::Status::kTaskAborted),
-        .alloc_len = 0};
-    return resp;
+    engine_cmd->translation.AbortPipeline();
+    if (trace_hook != nullptr)
+      CaptureCommand(start_ns, cmd_buf, cmd_len, lun, data_buf, data_len,
+                     is_data_in);
+    Finish(engine_cmd, static_cast<uint8_t>(scsi::Status::kTaskAborted), 0);
+    return 0;
   }
+  engine_cmd->alloc_len = begin_resp.alloc_len;
 
-  // Grab NVMe cmds and call NVMe interface
+  // Grab NVMe cmds and queue them without waiting for the device
   translator::Span<const translator::NvmeCmdWrapper> nvme_wrappers =
-      translation.GetNvmeWrappers();
-  nvme::GenericQueueEntryCpl cpl_buf[nvme_wrappers.size()] = {};
+      engine_cmd->translation.GetNvmeWrappers();
+  if (discard_queue.Pending() && ConflictsWithDiscards(nvme_wrappers)) {
+    // The blocks are being deallocated; retry once that has finished
+    engine_cmd->translation.AbortPipeline();
+    PumpDiscards();
+    return -EBUSY;
+  }
+  if (!AllocRequests(engine_cmd, nvme_wrappers.size())) {
+    // Let the caller retry once memory is available again
+    Print("Failed to allocate NVMe requests");
+    engine_cmd->translation.AbortPipeline();
+    return -ENOMEM;
+  }
+  engine_cmd->nvme_count = nvme_wrappers.size();
+  engine_cmd->pending = nvme_wrappers.size() + 1;
+  // Queued Unmap ranges complete without the device
+  bool discard_queued =
+      engine_cmd->opcode == static_cast<uint8_t>(scsi::OpCode::kUnmap) &&
+      discard_queue.Add(nvme_wrappers);
   for (uint32_t i = 0; i < nvme_wrappers.size(); ++i) {
-    NvmeCommand tmp_cmd;
-    NvmeCompletion tmp_cpl = {};
-    memcpy(&tmp_cmd, &nvme_wrappers[i].cmd, sizeof(tmp_cmd));
-    static_assert(sizeof(tmp_cmd) == sizeof(nvme_wrappers[i].cmd));
+    NvmeAsyncRequest* request = &engine_cmd->nvme_requests[i];
+    memcpy(&request->cmd, &nvme_wrappers[i].cmd, sizeof(request->cmd));
+    static_assert(sizeof(request->cmd) == sizeof(nvme_wrappers[i].cmd));
+    request->done = OnNvmeDone;
+    request->priv = engine_cmd;
+    if (discard_queued) {
+      request->cpl = {};
+      PutPending(engine_cmd);
+      continue;
+    }
+    // The request is set up before it joins, since the group's Flush may
+    // complete it right away
+    if (JoinFlushGroup(engine_cmd, nvme_wrappers)) continue;
     void* buffer = reinterpret_cast<void*>(nvme_wrappers[i].cmd.dptr.prp.prp1);
     unsigned bufflen = nvme_wrappers[i].buffer_len;
 
+    int ret;
     if (nvme_wrappers[i].is_admin) {
-      submit_admin_command(&tmp_cmd, buffer, bufflen, &tmp_cpl, kTimeout);
+      ret = submit_admin_command(request, buffer, bufflen, kTimeout);
+    } else if (data_segments != nullptr) {
+      ret = submit_io_command_segments(request, data_segments, segment_count,
+                                       nvme_wrappers[i].data_offset, bufflen,
+                                       kTimeout, hw_queue);
     } else {
-      submit_io_command(&tmp_cmd, buffer, bufflen, &tmp_cpl, kTimeout);
+      ret = submit_io_command(request, buffer, bufflen, kTimeout, hw_queue);
+    }
+    if (ret != 0 && i == 0) {
+      // Nothing is in flight yet, so let the caller retry the whole command
+      // once the NVMe queue has room again
+      engine_cmd->translation.AbortPipeline();
+      FreeRequests(engine_cmd);
+      return ret;
+    }
+    if (ret != 0) {
+      // Complete the command locally so Translation::Complete() reports it
+      Print("Failed to submit NVMe command");
+      request->cpl = {};
+      request->cpl.status = kSubmitFailedStatus;
+      PutPending(engine_cmd);
     }
-    memcpy(&cpl_buf[i], &tmp_cpl, sizeof(cpl_buf[i]));
-    static_assert(sizeof(cpl_buf[i]) == sizeof(tmp_cpl));
   }
 
-  // Use NVMe completion responses to Complete translation
-  translator::Span<nvme::GenericQueueEntryCpl> nvme_cpl(cpl_buf,
-                                                        nvme_wrappers.size());
-  translator::Span<uint8_t> buffer_in = {};
-  if (is_data_in) buffer_in = translator::Span(data_buf, begin_resp.alloc_len);
-  translator::Span<uint8_t> sense_buffer(sense_buf, sense_len);
-  translator::CompleteResponse cpl_resp =
-      translation.Complete(nvme_cpl, buffer_in, sense_buffer);
-
-  if (cpl_resp.status == translator::ApiStatus::kFailure) {
-    Print("Incorrect usage of Translation Library API");
-    ScsiToNvmeResponse resp = {.return_code = 0x40, .alloc_len = 0};
-    return resp;
+  latency_stats.Record(engine_cmd->opcode, LatencyPhase::kSubmit,
+                       NowNs() - engine_cmd->begin_ns);
+  if (discard_queue.enabled() && !discard_queued &&
+      engine_cmd->nvme_count != 0) {
+    engine_cmd->foreground = true;
+    discard_queue.ForegroundStarted();
   }
 
-  ScsiToNvmeResponse resp = {
-      .return_code = static_cast<uint8_t>(cpl_resp.scsi_status),
-      .alloc_len = begin_resp.alloc_len};
+  if (trace_hook != nullptr)
+    CaptureCommand(start_ns, cmd_buf, cmd_len, lun, data_buf, data_len,
+                   is_data_in);
 
-  return resp;
+  // Commands without NVMe counterparts complete here; otherwise the last
+  // NVMe completion finishes the SCSI command
+  PutPending(engine_cmd);
+  if (discard_queued) PumpDiscards();
+  if (flush_group.Queued()) PumpFlushes();
+  return 0;
 }
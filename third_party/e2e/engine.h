@@ -16,9 +16,10 @@
 // 1. scsi_mock_module.c receives a SCSI command calls ScsiToNvme()
 // 2. ScsiToNvme calls Translation::Begin()
 // 3. ScsiToNvme calls Translation::GetNvmeWrappers()
-// 4. ScsiToNvme sends NVMe commands to nvme_driver.c
-// 5. ScsiToNvme sends NVMe responses to Translation::Complete()
-// 6. ScsiToNVme returns a ScsiToNvmeResponse to scsi_mock_module.c
+// 4. ScsiToNvme queues NVMe commands to nvme_driver.c and returns
+// 5. The last NVMe completion sends NVMe responses to Translation::Complete()
+// 6. The completion path passes a ScsiToNvmeResponse to the done callback
+//    given to ScsiToNvme by scsi_mock_module.c
 
 #ifndef ENGINE_H
 #define ENGINE_H
@@ -36,12 +37,109 @@ struct ScsiToNvmeResponse {
   int alloc_len;
 };
 
+// Called exactly once per ScsiToNvme() call, possibly before ScsiToNvme()
+// returns and possibly from interrupt context
+typedef void (*ScsiToNvmeDone)(void* priv, struct ScsiToNvmeResponse resp);
+
+struct NvmeDataSegment;
+struct ScsiTraceRecord;
+
+// Receives every command ScsiToNvme() accepts, before its done callback is
+// called. payload holds record->payload_len bytes of data out
+typedef void (*ScsiToNvmeTraceHook)(void* priv,
+                                    const struct ScsiTraceRecord* record,
+                                    const unsigned char* payload);
+
 void SetEngineCallbacks(void);
 
-struct ScsiToNvmeResponse ScsiToNvme(
-    unsigned char* cmd_buf, unsigned short cmd_len, unsigned long long lun,
-    unsigned char* sense_buf, unsigned short sense_len, unsigned char* data_buf,
-    unsigned short data_len, bool isDataIn);
+// Frees the memory the engine cached. No command may be in flight
+void ReleaseEngine(void);
+
+// Latency histograms of ScsiToNvme() by SCSI opcode and phase, reported one
+// line at a time. ScsiToNvmeLatencyLine() writes line index into buf and
+// returns false, leaving buf empty, for histograms without values
+unsigned int ScsiToNvmeLatencyLineCount(void);
+bool ScsiToNvmeLatencyLine(unsigned int index, char* buf, unsigned int size);
+
+// Clears the latency histograms
+void ScsiToNvmeResetLatency(void);
+
+// Passes the commands ScsiToNvme() accepts to hook, or stops if hook is NULL.
+// Must not be called while commands are being submitted
+void SetScsiToNvmeTraceHook(ScsiToNvmeTraceHook hook, void* priv);
+
+// Page allocations the engine's page pool served from its cache and passed on
+// to AllocPages()
+void ScsiToNvmePagePoolStats(unsigned long long* hits,
+                             unsigned long long* misses);
+
+// Background deallocation. Unmap is normally sent to the device and
+// completed once the device finishes. With early_ack the engine instead
+// completes it once its ranges are queued and deallocates them in the
+// background, in Dataset Management batches sent over the IO queues while
+// at most max_foreground other commands are in flight, at most one per
+// batch_interval_ns. Queued ranges are lost if the host loses power.
+struct ScsiToNvmeDiscardConfig {
+  bool early_ack;
+  unsigned int max_ranges;  // Ranges queued before Unmap waits for the device
+  unsigned int max_foreground;
+  unsigned long long batch_interval_ns;
+};
+
+// Applies config, or turns background deallocation off if config is NULL.
+// Must not be called while commands are being submitted or discards are
+// pending. Returns 0 or -ENOMEM
+int SetScsiToNvmeDiscardConfig(const struct ScsiToNvmeDiscardConfig* config);
+
+// Sends queued ranges to the device without waiting for foreground commands.
+// ReleaseEngine() drops ranges still pending, so callers drain first and
+// wait until ScsiToNvmeDiscardsPending() returns false
+void ScsiToNvmeDrainDiscards(void);
+bool ScsiToNvmeDiscardsPending(void);
+
+// Flush group commit. Synchronize Cache normally sends a Flush of its own.
+// With group the engine keeps at most one Flush per namespace in flight and
+// completes every Synchronize Cache that arrives meanwhile with the single
+// Flush sent after it. With broadcast, and a controller that supports it,
+// that Flush uses NSID FFFFFFFFh and covers every namespace at once.
+struct ScsiToNvmeFlushConfig {
+  bool group;
+  bool broadcast;
+};
+
+// Applies config, or turns flush group commit off if config is NULL.
+// Must not be called while commands are being submitted or are in flight.
+// Returns 0 or -ENOMEM
+int SetScsiToNvmeFlushConfig(const struct ScsiToNvmeFlushConfig* config);
+
+// Returns true if the command's data can be passed to ScsiToNvme() as data
+// segments instead of a bounce buffer (Read and Write)
+bool ScsiToNvmeIsDirect(const unsigned char* cmd_buf, unsigned short cmd_len);
+
+// Returns the size of the per-command context ScsiToNvme() requires.
+// The context must be 8 byte aligned and stay valid until done is called.
+unsigned int ScsiToNvmeContextSize(void);
+
+// The data buffer of data_len bytes is either data_buf or, for commands where
+// ScsiToNvmeIsDirect() is true, the data_segments list. data_segments must
+// stay valid until done is called.
+// scratch_page is a page aligned 4 KiB page owned by the command until done
+// is called, or NULL. Identify data and PRP lists are placed there instead of
+// allocating memory.
+// hw_queue is the NVMe IO hardware queue IO commands are sent to.
+// Returns 0 if the command was accepted, in which case done will be called.
+// Returns a negative errno if the device had no room for the command, memory
+// for its NVMe requests was unavailable or, with background deallocation,
+// it touches blocks still being deallocated (-EBUSY); done is not called and
+// the caller should retry later.
+int ScsiToNvme(void* context, void* scratch_page, unsigned char* cmd_buf,
+               unsigned short cmd_len, unsigned long long lun,
+               unsigned char* sense_buf, unsigned short sense_len,
+               unsigned char* data_buf,
+               const struct NvmeDataSegment* data_segments,
+               unsigned short segment_count, unsigned int data_len,
+               bool is_data_in, unsigned hw_queue, ScsiToNvmeDone done,
+               void* priv);
 
 #ifdef __cplusplus
 }
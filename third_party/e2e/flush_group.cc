@@ -0,0 +1,116 @@
+// Copyright 2020 Google LLC
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// version 2 as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+
+#include "flush_group.h"
+
+#include "lib/translator/common.h"
+#include "util.h"
+
+bool FlushGroup::Init() {
+  lock_ = CreateSpinLock();
+  if (lock_ == nullptr) return false;
+  for (Group& group : groups_) group = {};
+  queued_ = 0;
+  outstanding_ = 0;
+  return true;
+}
+
+void FlushGroup::Destroy() {
+  if (lock_ != nullptr) DestroySpinLock(lock_);
+  lock_ = nullptr;
+  queued_ = 0;
+  outstanding_ = 0;
+}
+
+bool FlushGroup::Join(uint32_t nsid, FlushWaiter* waiter) {
+  if (!enabled()) return false;
+  Group* group = Find(nsid);
+  if (group == nullptr) return false;
+  unsigned long flags = SpinLock(lock_);
+  waiter->next = group->queued;
+  group->queued = waiter;
+  UpdateCounts();
+  SpinUnlock(lock_, flags);
+  return true;
+}
+
+NvmeAsyncRequest* FlushGroup::NextFlush() {
+  if (!Queued()) return nullptr;
+  NvmeAsyncRequest* flush = nullptr;
+  unsigned long flags = SpinLock(lock_);
+  for (uint32_t i = 0; i <= kMaxFlushGroupNsid; ++i) {
+    Group& group = groups_[i];
+    if (group.submitted || group.queued == nullptr) continue;
+    group.in_flight = group.queued;
+    group.queued = nullptr;
+    group.submitted = true;
+    group.request = {};
+    group.request.cmd.opcode = static_cast<uint8_t>(nvme::NvmOpcode::kFlush);
+    group.request.cmd.nsid = i == 0 ? kBroadcastNsid : i;
+    flush = &group.request;
+    break;
+  }
+  UpdateCounts();
+  SpinUnlock(lock_, flags);
+  return flush;
+}
+
+void FlushGroup::SubmitFailed(NvmeAsyncRequest* flush) {
+  Group* group = Owner(flush);
+  unsigned long flags = SpinLock(lock_);
+  // Waiters queued meanwhile share the retried Flush
+  FlushWaiter* waiter = group->in_flight;
+  while (waiter != nullptr) {
+    FlushWaiter* next = waiter->next;
+    waiter->next = group->queued;
+    group->queued = waiter;
+    waiter = next;
+  }
+  group->in_flight = nullptr;
+  group->submitted = false;
+  UpdateCounts();
+  SpinUnlock(lock_, flags);
+}
+
+FlushWaiter* FlushGroup::Done(NvmeAsyncRequest* flush) {
+  Group* group = Owner(flush);
+  unsigned long flags = SpinLock(lock_);
+  FlushWaiter* covered = group->in_flight;
+  group->in_flight = nullptr;
+  group->submitted = false;
+  UpdateCounts();
+  SpinUnlock(lock_, flags);
+  return covered;
+}
+
+FlushGroup::Group* FlushGroup::Find(uint32_t nsid) {
+  if (nsid == kBroadcastNsid) return &groups_[0];
+  if (nsid == 0 || nsid > kMaxFlushGroupNsid) return nullptr;
+  return &groups_[nsid];
+}
+
+FlushGroup::Group* FlushGroup::Owner(NvmeAsyncRequest* flush) {
+  for (Group& group : groups_) {
+    if (&group.request == flush) return &group;
+  }
+  return nullptr;
+}
+
+void FlushGroup::UpdateCounts() {
+  uint32_t queued = 0;
+  uint32_t outstanding = 0;
+  for (const Group& group : groups_) {
+    if (group.queued != nullptr) ++queued;
+    if (group.queued != nullptr || group.in_flight != nullptr) ++outstanding;
+  }
+  __atomic_store_n(&queued_, queued, __ATOMIC_RELEASE);
+  __atomic_store_n(&outstanding_, outstanding, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,103 @@
+// Copyright 2020 Google LLC
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// version 2 as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+
+// Group commit of NVMe Flush commands. Each namespace has at most one Flush
+// in flight. Flushes requested while it is in flight wait for it to
+// complete, since it may have started before writes they must cover
+// completed, and then share a single Flush that starts after all of them
+// were requested.
+//
+// Flushes of the broadcast NSID FFFFFFFFh form a group of their own that
+// covers every namespace.
+
+#ifndef FLUSH_GROUP_H
+#define FLUSH_GROUP_H
+
+#include <cstdint>
+
+#include "nvme_driver.h"
+
+// NVMe Base Specification: NSID FFFFFFFFh selects every namespace
+constexpr uint32_t kBroadcastNsid = 0xffffffff;
+
+// A Flush request that waits for a group. request is completed with the
+// status of the Flush that covers it
+struct FlushWaiter {
+  FlushWaiter* next;
+  NvmeAsyncRequest* request;
+};
+
+class FlushGroup {
+ public:
+  FlushGroup() : lock_(nullptr), groups_(), queued_(0), outstanding_(0) {}
+
+  // Returns false if memory is unavailable
+  bool Init();
+
+  // Frees the group. No waiter may be queued or in flight
+  void Destroy();
+
+  bool enabled() const { return lock_ != nullptr; }
+
+  // Queues waiter for the next Flush of namespace nsid, or of every
+  // namespace for kBroadcastNsid. Returns false, queuing nothing, if
+  // namespaces above kMaxFlushGroupNsid have no group
+  bool Join(uint32_t nsid, FlushWaiter* waiter);
+
+  // Returns a Flush to submit for the waiters of a namespace that has none
+  // in flight, or nullptr. The request belongs to the group and stays valid
+  // until Done() or SubmitFailed(); callers set its done callback
+  NvmeAsyncRequest* NextFlush();
+
+  // The Flush from NextFlush() could not be submitted. Its waiters join the
+  // next Flush of their namespace
+  void SubmitFailed(NvmeAsyncRequest* flush);
+
+  // The device completed the Flush from NextFlush(). Returns the waiters it
+  // covers, which the caller completes. The group may reuse flush once this
+  // returns, so its completion is read first
+  FlushWaiter* Done(NvmeAsyncRequest* flush);
+
+  // Returns true while waiters are queued for a Flush not yet submitted
+  bool Queued() const {
+    return __atomic_load_n(&queued_, __ATOMIC_ACQUIRE) != 0;
+  }
+
+  // Returns true while waiters are queued or their Flush is in flight
+  bool Pending() const {
+    return __atomic_load_n(&outstanding_, __ATOMIC_ACQUIRE) != 0;
+  }
+
+  // Namespaces 1 to kMaxFlushGroupNsid have a group
+  static constexpr uint32_t kMaxFlushGroupNsid = 16;
+
+ private:
+  struct Group {
+    NvmeAsyncRequest request;  // The Flush in flight
+    FlushWaiter* queued;       // Waiting for the next Flush
+    FlushWaiter* in_flight;    // Covered by request
+    bool submitted;
+  };
+
+  // Returns the group of nsid, or nullptr
+  Group* Find(uint32_t nsid);
+  // Returns the group that owns flush
+  Group* Owner(NvmeAsyncRequest* flush);
+  void UpdateCounts();
+
+  void* lock_;
+  // Index 0 holds broadcast flushes, index nsid the flushes of nsid
+  Group groups_[kMaxFlushGroupNsid + 1];
+  uint32_t queued_;       // Groups with queued waiters
+  uint32_t outstanding_;  // Groups with queued or in flight waiters
+};
+
+#endif
@@ -0,0 +1,173 @@
+// Copyright 2020 Google LLC
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// version 2 as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+
+#include "latency.h"
+
+#include <stdio.h>
+
+#include "lib/translator/common.h"
+#include "util.h"
+
+namespace {
+
+constexpr uint32_t kPageSize = 4096;
+constexpr uint8_t kOtherSlot = kLatencyOpcodeSlots - 1;
+
+constexpr scsi::OpCode kTrackedOpcodes[] = {
+    scsi::OpCode::kRead6,    scsi::OpCode::kRead10,   scsi::OpCode::kRead12,
+    scsi::OpCode::kRead16,   scsi::OpCode::kWrite6,   scsi::OpCode::kWrite10,
+    scsi::OpCode::kWrite12,  scsi::OpCode::kWrite16,  scsi::OpCode::kVerify10,
+    scsi::OpCode::kVerify12, scsi::OpCode::kVerify16, scsi::OpCode::kSync10,
+    scsi::OpCode::kSync16,   scsi::OpCode::kUnmap};
+constexpr uint32_t kTrackedCount =
+    sizeof(kTrackedOpcodes) / sizeof(kTrackedOpcodes[0]);
+static_assert(kTrackedCount < kLatencyOpcodeSlots);
+
+struct SlotTable {
+  uint8_t slots[256];
+};
+
+constexpr SlotTable MakeSlotTable() {
+  SlotTable table = {};
+  for (uint32_t opc = 0; opc < 256; ++opc) table.slots[opc] = kOtherSlot;
+  for (uint32_t slot = 0; slot < kTrackedCount; ++slot)
+    table.slots[static_cast<uint8_t>(kTrackedOpcodes[slot])] = slot;
+  return table;
+}
+
+constexpr SlotTable kSlotTable = MakeSlotTable();
+
+const char* const kPhaseNames[kLatencyPhaseCount] = {
+    "begin", "submit", "device", "complete", "total"};
+
+const char* SlotName(uint32_t slot) {
+  if (slot >= kTrackedCount) return "other";
+  return translator::ScsiOpcodeToString(kTrackedOpcodes[slot]);
+}
+
+void Add(uint64_t& counter, uint64_t value) {
+  __atomic_fetch_add(&counter, value, __ATOMIC_RELAXED);
+}
+
+uint64_t Load(const uint64_t& counter) {
+  return __atomic_load_n(&counter, __ATOMIC_RELAXED);
+}
+
+}  // namespace
+
+bool LatencyStats::Init(uint32_t cpu_count) {
+  uint64_t page_count = (sizeof(CpuStats) + kPageSize - 1) / kPageSize;
+  uint16_t pointer_pages =
+      (cpu_count * sizeof(CpuStats*) + kPageSize - 1) / kPageSize;
+  cpus_ = reinterpret_cast<CpuStats**>(AllocPages(kPageSize, pointer_pages));
+  if (cpus_ == nullptr) return false;
+  cpu_count_ = cpu_count;
+  cpu_page_count_ = page_count;
+  // Pages come zeroed, so every histogram starts out empty
+  for (uint32_t cpu = 0; cpu < cpu_count; ++cpu) {
+    cpus_[cpu] =
+        reinterpret_cast<CpuStats*>(AllocPages(kPageSize, cpu_page_count_));
+    if (cpus_[cpu] == nullptr) {
+      Destroy();
+      return false;
+    }
+  }
+  return true;
+}
+
+void LatencyStats::Destroy() {
+  if (cpus_ == nullptr) return;
+  for (uint32_t cpu = 0; cpu < cpu_count_; ++cpu)
+    DeallocPages(reinterpret_cast<uint64_t>(cpus_[cpu]), cpu_page_count_);
+  uint16_t pointer_pages =
+      (cpu_count_ * sizeof(CpuStats*) + kPageSize - 1) / kPageSize;
+  DeallocPages(reinterpret_cast<uint64_t>(cpus_), pointer_pages);
+  cpus_ = nullptr;
+  cpu_count_ = 0;
+}
+
+void LatencyStats::Record(uint8_t opcode, LatencyPhase phase, uint64_t ns) {
+  if (cpus_ == nullptr) return;
+  uint32_t cpu = CurrentCpu();
+  if (cpu >= cpu_count_) return;
+
+  // Completions may interrupt submissions on the same CPU, so the counters
+  // are updated atomically, but no cache line is shared between CPUs
+  Histogram& histogram = cpus_[cpu]->histograms[kSlotTable.slots[opcode]]
+                                               [static_cast<uint8_t>(phase)];
+  Add(histogram.count, 1);
+  Add(histogram.sum_ns, ns);
+  __atomic_fetch_add(&histogram.buckets[LatencyBuckets::Bucket(ns)], 1,
+                     __ATOMIC_RELAXED);
+  uint64_t max_ns = Load(histogram.max_ns);
+  while (ns > max_ns &&
+         !__atomic_compare_exchange_n(&histogram.max_ns, &max_ns, ns, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+  }
+}
+
+void LatencyStats::Reset() {
+  if (cpus_ == nullptr) return;
+  for (uint32_t cpu = 0; cpu < cpu_count_; ++cpu)
+    memset(cpus_[cpu], 0, sizeof(CpuStats));
+}
+
+bool LatencyStats::FormatLine(uint32_t index, char* buf, uint32_t size) const {
+  if (size == 0) return false;
+  buf[0] = '\0';
+  if (index == 0) {
+    snprintf(buf, size, "%-16s %-8s %10s %10s %10s %10s %10s %10s %10s\n",
+             "opcode", "phase", "count", "mean_ns", "p50_ns", "p90_ns",
+             "p99_ns", "p999_ns", "max_ns");
+    return true;
+  }
+  if (cpus_ == nullptr || index >= LineCount()) return false;
+
+  uint32_t slot = (index - 1) / kLatencyPhaseCount;
+  uint32_t phase = (index - 1) % kLatencyPhaseCount;
+  uint64_t count = 0;
+  uint64_t sum_ns = 0;
+  uint64_t max_ns = 0;
+  for (uint32_t cpu = 0; cpu < cpu_count_; ++cpu) {
+    const Histogram& histogram = cpus_[cpu]->histograms[slot][phase];
+    count += Load(histogram.count);
+    sum_ns += Load(histogram.sum_ns);
+    uint64_t cpu_max_ns = Load(histogram.max_ns);
+    if (cpu_max_ns > max_ns) max_ns = cpu_max_ns;
+  }
+  if (count == 0) return false;
+
+  // Bucket counts are summed again for each percentile instead of being
+  // copied, which keeps reports off the stack
+  auto bucket_count = [this, slot, phase](uint32_t bucket) {
+    uint64_t total = 0;
+    for (uint32_t cpu = 0; cpu < cpu_count_; ++cpu) {
+      total += __atomic_load_n(
+          &cpus_[cpu]->histograms[slot][phase].buckets[bucket],
+          __ATOMIC_RELAXED);
+    }
+    return total;
+  };
+  // uint64_t is unsigned long in userspace builds, so convert for %llu
+  unsigned long long values[] = {
+      count,
+      sum_ns / count,
+      LatencyBuckets::Percentile(bucket_count, count, 500),
+      LatencyBuckets::Percentile(bucket_count, count, 900),
+      LatencyBuckets::Percentile(bucket_count, count, 990),
+      LatencyBuckets::Percentile(bucket_count, count, 999),
+      max_ns};
+  snprintf(buf, size,
+           "%-16s %-8s %10llu %10llu %10llu %10llu %10llu %10llu %10llu\n",
+           SlotName(slot), kPhaseNames[phase], values[0], values[1], values[2],
+           values[3], values[4], values[5], values[6]);
+  return true;
+}
@@ -0,0 +1,82 @@
+// Copyright 2020 Google LLC
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// version 2 as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+
+// Latency histograms of the engine, by SCSI opcode and by phase of
+// ScsiToNvme(). Each CPU records into its own histograms; reports sum them.
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <cstdint>
+
+#include "lib/histogram.h"
+
+enum class LatencyPhase : uint8_t {
+  kBegin,     // Translation::Begin()
+  kSubmit,    // Queueing the NVMe commands
+  kDevice,    // First NVMe submission to last NVMe completion
+  kComplete,  // Translation::Complete()
+  kTotal,     // ScsiToNvme() to the done callback
+};
+constexpr uint32_t kLatencyPhaseCount = 5;
+
+// Nanoseconds, in buckets of at most 12.5% up to 2^36 ns (68 s)
+using LatencyBuckets = histogram::LogLinear<3, 36>;
+
+// Read, Write, Verify, Synchronize Cache and Unmap each have their own
+// histograms, every other opcode shares one
+constexpr uint32_t kLatencyOpcodeSlots = 16;
+
+class LatencyStats {
+ public:
+  LatencyStats() : cpus_(nullptr), cpu_count_(0), cpu_page_count_(0) {}
+
+  // Allocates the histograms of cpu_count CPUs. Returns false if memory is
+  // unavailable, in which case Record() does nothing
+  bool Init(uint32_t cpu_count);
+
+  // Frees the histograms. Nothing may be recording
+  void Destroy();
+
+  // Adds ns to the calling CPU's histogram of opcode and phase. Never waits
+  void Record(uint8_t opcode, LatencyPhase phase, uint64_t ns);
+
+  // Clears every histogram. Values recorded during the reset may be lost
+  void Reset();
+
+  // The report is a header line followed by one line per opcode slot and
+  // phase
+  uint32_t LineCount() const {
+    return 1 + kLatencyOpcodeSlots * kLatencyPhaseCount;
+  }
+
+  // Writes line index of the report into buf. Returns false, leaving buf
+  // empty, for histograms without values
+  bool FormatLine(uint32_t index, char* buf, uint32_t size) const;
+
+ private:
+  struct Histogram {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint32_t buckets[LatencyBuckets::kBucketCount];
+  };
+
+  struct CpuStats {
+    Histogram histograms[kLatencyOpcodeSlots][kLatencyPhaseCount];
+  };
+
+  CpuStats** cpus_;
+  uint32_t cpu_count_;
+  uint16_t cpu_page_count_;
+};
+
+#endif
@@ -0,0 +1,394 @@
+// Copyright 2020 Google LLC
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// version 2 as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+
+// Drives the engine in userspace against the NVMe emulator: scans the device
+// like the SCSI midlayer would, then keeps queue_depth random Read(10) and
+// Write(10) commands in flight and reports throughput and the engine's
+// latency histograms. Run it under perf to profile the SCSI to NVMe to SCSI
+// path, e.g.
+//   perf record -g load_generator --ops=1000000 --queue_depth=64
+// With --capture the commands are also written to a trace for trace_replay.
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lib/translator/common.h"
+#include "engine.h"
+#include "nvme_driver.h"
+#include "nvme_emulator.h"
+#include "trace_file.h"
+
+namespace {
+
+constexpr uint32_t kPageSize = 4096;
+constexpr uint32_t kSenseLen = 96;
+constexpr uint32_t kMaxCdbLen = 16;
+constexpr uint32_t kScanDataLen = 255;
+
+struct Options {
+  uint64_t ops = 100000;
+  uint32_t queue_depth = 32;
+  uint32_t block_size = 4096;  // Bytes per command
+  uint32_t read_percent = 70;
+  uint64_t seed = 1;
+  const char* capture_path = nullptr;
+  NvmeEmulatorConfig emulator = kDefaultNvmeEmulatorConfig;
+};
+
+void PrintUsage() {
+  fprintf(stderr,
+          "Usage: load_generator [--name=value]...\n"
+          "  --ops             SCSI Read and Write commands to run\n"
+          "  --queue_depth     Commands kept in flight\n"
+          "  --block_size      Bytes per command\n"
+          "  --read_percent    Share of Read commands\n"
+          "  --seed            Seed of the random LBAs\n"
+          "  --capture         Trace file to record the commands in\n"
+          "  --blocks          Namespace size in logical blocks\n"
+          "  --lba_shift       Logical block size is 1 << lba_shift\n"
+          "  --backing_file    Sparse file holding the namespace\n"
+          "  --latency_ns      Latency the emulator adds to each command\n"
+          "  --io_queues       NVMe IO queues\n"
+          "  --io_queue_depth  Depth of each NVMe IO queue\n");
+}
+
+bool ParseOptions(int argc, char** argv, Options& options) {
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    const char* value = strchr(arg, '=');
+    if (strncmp(arg, "--", 2) != 0 || value == nullptr) return false;
+    std::string name(arg + 2, value - arg - 2);
+    ++value;
+    uint64_t number = strtoull(value, nullptr, 0);
+    if (name == "ops") {
+      options.ops = number;
+    } else if (name == "queue_depth") {
+      options.queue_depth = number;
+    } else if (name == "block_size") {
+      options.block_size = number;
+    } else if (name == "read_percent") {
+      options.read_percent = number;
+    } else if (name == "seed") {
+      options.seed = number;
+    } else if (name == "capture") {
+      options.capture_path = value;
+    } else if (name == "blocks") {
+      options.emulator.block_count = number;
+    } else if (name == "lba_shift") {
+      options.emulator.lba_shift = number;
+    } else if (name == "backing_file") {
+      options.emulator.backing_path = value;
+    } else if (name == "latency_ns") {
+      options.emulator.latency_ns = number;
+    } else if (name == "io_queues") {
+      options.emulator.io_queue_count = number;
+    } else if (name == "io_queue_depth") {
+      options.emulator.io_queue_depth = number;
+    } else {
+      return false;
+    }
+  }
+  uint32_t lba_size = 1u << options.emulator.lba_shift;
+  return options.queue_depth != 0 && options.block_size >= lba_size &&
+         options.block_size % lba_size == 0 &&
+         options.block_size / lba_size <= UINT16_MAX &&
+         options.block_size / lba_size <= options.emulator.block_count &&
+         options.read_percent <= 100;
+}
+
+class LoadGenerator;
+
+// Everything one command in flight needs
+struct Slot {
+  LoadGenerator* generator;
+  std::unique_ptr<uint64_t[]> context;  // 8 byte aligned engine context
+  uint8_t* scratch_page;
+  uint8_t* data;
+  // data, one segment per page like a scatterlist
+  std::vector<NvmeDataSegment> segments;
+  unsigned char cdb[kMaxCdbLen];
+  unsigned char sense[kSenseLen];
+};
+
+class LoadGenerator {
+ public:
+  explicit LoadGenerator(const Options& options) : options_(options) {}
+  ~LoadGenerator();
+
+  // Allocates the slots. Returns false if memory is unavailable
+  bool Init();
+
+  // Runs Inquiry and Read Capacity(10) like a SCSI host scan, which also
+  // caches the namespace geometry in the engine. Returns false if either
+  // fails
+  bool Scan();
+
+  // Runs options.ops Read and Write commands. Returns the number that failed
+  uint64_t Run();
+
+ private:
+  static void Done(void* priv, ScsiToNvmeResponse resp);
+
+  // Passes the CDB in slot to ScsiToNvme(). Returns its result
+  int Submit(Slot* slot, uint8_t cdb_len, uint32_t data_len, bool is_data_in);
+  Slot* TakeSlot();
+  void WaitIdle();
+
+  // Runs one command with data_len bytes of data in to completion. Returns
+  // its SCSI status, or -1 if it could not be submitted
+  int RunSync(Slot* slot, uint8_t cdb_len, uint32_t data_len);
+
+  const Options& options_;
+  std::vector<Slot> slots_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<Slot*> free_slots_;
+  uint64_t failed_ = 0;
+  int last_status_ = 0;
+};
+
+LoadGenerator::~LoadGenerator() {
+  for (Slot& slot : slots_) {
+    free(slot.scratch_page);
+    free(slot.data);
+  }
+}
+
+bool LoadGenerator::Init() {
+  uint32_t context_words = (ScsiToNvmeContextSize() + 7) / 8;
+  uint32_t data_len = std::max(options_.block_size, kScanDataLen);
+  uint32_t data_pages = (data_len + kPageSize - 1) / kPageSize;
+  slots_.resize(options_.queue_depth);
+  for (Slot& slot : slots_) {
+    slot.generator = this;
+    slot.context.reset(new uint64_t[context_words]);
+    slot.scratch_page =
+        static_cast<uint8_t*>(aligned_alloc(kPageSize, kPageSize));
+    slot.data = static_cast<uint8_t*>(
+        aligned_alloc(kPageSize, data_pages * kPageSize));
+    if (slot.scratch_page == nullptr || slot.data == nullptr) return false;
+    // A pattern that is easy to spot in the backing file
+    for (uint32_t i = 0; i < data_pages * kPageSize; ++i) slot.data[i] = i;
+    for (uint32_t offset = 0; offset < options_.block_size;
+         offset += kPageSize) {
+      slot.segments.push_back(
+          {.addr = reinterpret_cast<uint64_t>(slot.data + offset),
+           .len = std::min(kPageSize, options_.block_size - offset)});
+    }
+    free_slots_.push_back(&slot);
+  }
+  return true;
+}
+
+void LoadGenerator::Done(void* priv, ScsiToNvmeResponse resp) {
+  Slot* slot = static_cast<Slot*>(priv);
+  LoadGenerator* generator = slot->generator;
+  {
+    std::lock_guard<std::mutex> lock(generator->mutex_);
+    if (resp.return_code != 0) ++generator->failed_;
+    generator->last_status_ = resp.return_code;
+    generator->free_slots_.push_back(slot);
+  }
+  generator->cv_.notify_one();
+}
+
+int LoadGenerator::Submit(Slot* slot, uint8_t cdb_len, uint32_t data_len,
+                          bool is_data_in) {
+  bool is_direct = ScsiToNvmeIsDirect(slot->cdb, cdb_len);
+  return ScsiToNvme(slot->context.get(), slot->scratch_page, slot->cdb,
+                    cdb_len, 0, slot->sense, kSenseLen,
+                    is_direct ? nullptr : slot->data,
+                    is_direct ? slot->segments.data() : nullptr,
+                    is_direct ? slot->segments.size() : 0, data_len,
+                    is_data_in, NVME_ANY_HW_QUEUE, Done, slot);
+}
+
+Slot* LoadGenerator::TakeSlot() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this] { return !free_slots_.empty(); });
+  Slot* slot = free_slots_.back();
+  free_slots_.pop_back();
+  return slot;
+}
+
+void LoadGenerator::WaitIdle() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this] { return free_slots_.size() == slots_.size(); });
+}
+
+int LoadGenerator::RunSync(Slot* slot, uint8_t cdb_len, uint32_t data_len) {
+  if (Submit(slot, cdb_len, data_len, true) != 0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_slots_.push_back(slot);
+    return -1;
+  }
+  WaitIdle();
+  std::lock_guard<std::mutex> lock(mutex_);
+  return last_status_;
+}
+
+bool LoadGenerator::Scan() {
+  Slot* slot = TakeSlot();
+  scsi::InquiryCommand inquiry = {
+      .allocation_length = htons(kScanDataLen)};
+  slot->cdb[0] = static_cast<uint8_t>(scsi::OpCode::kInquiry);
+  memcpy(slot->cdb + 1, &inquiry, sizeof(inquiry));
+  int status = RunSync(slot, sizeof(inquiry) + 1, kScanDataLen);
+  if (status != 0) {
+    fprintf(stderr, "Inquiry failed with status %d\n", status);
+    return false;
+  }
+
+  slot = TakeSlot();
+  scsi::ReadCapacity10Command read_capacity = {};
+  slot->cdb[0] = static_cast<uint8_t>(scsi::OpCode::kReadCapacity10);
+  memcpy(slot->cdb + 1, &read_capacity, sizeof(read_capacity));
+  status = RunSync(slot, sizeof(read_capacity) + 1,
+                   sizeof(scsi::ReadCapacity10Data));
+  if (status != 0) {
+    fprintf(stderr, "Read Capacity(10) failed with status %d\n", status);
+    return false;
+  }
+  scsi::ReadCapacity10Data capacity;
+  memcpy(&capacity, slot->data, sizeof(capacity));
+  printf("Read Capacity(10): last LBA %u, block length %u\n",
+         capacity.returned_logical_block_address.value(),
+         capacity.block_length.value());
+  return true;
+}
+
+uint64_t LoadGenerator::Run() {
+  uint32_t lba_shift = options_.emulator.lba_shift;
+  uint16_t blocks_per_cmd = options_.block_size >> lba_shift;
+  // Read(10) and Write(10) address the first 2^32 blocks
+  uint64_t block_count =
+      std::min<uint64_t>(options_.emulator.block_count, UINT32_MAX);
+  uint64_t cmd_slots = block_count / blocks_per_cmd;
+  std::mt19937_64 random(options_.seed);
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint64_t i = 0; i < options_.ops;) {
+    Slot* slot = TakeSlot();
+    uint32_t lba = random() % cmd_slots * blocks_per_cmd;
+    bool is_read = random() % 100 < options_.read_percent;
+    if (is_read) {
+      scsi::Read10Command read = {};
+      read.logical_block_address = lba;
+      read.transfer_length = blocks_per_cmd;
+      slot->cdb[0] = static_cast<uint8_t>(scsi::OpCode::kRead10);
+      memcpy(slot->cdb + 1, &read, sizeof(read));
+    } else {
+      scsi::Write10Command write = {};
+      write.logical_block_address = lba;
+      write.transfer_length = blocks_per_cmd;
+      slot->cdb[0] = static_cast<uint8_t>(scsi::OpCode::kWrite10);
+      memcpy(slot->cdb + 1, &write, sizeof(write));
+    }
+    if (Submit(slot, sizeof(scsi::Read10Command) + 1, options_.block_size,
+               is_read) != 0) {
+      // The NVMe queue is full; retry once a command completes
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        free_slots_.push_back(slot);
+      }
+      std::this_thread::yield();
+      continue;
+    }
+    ++i;
+  }
+  WaitIdle();
+  std::chrono::duration<double> seconds =
+      std::chrono::steady_clock::now() - start;
+
+  double mib = static_cast<double>(options_.ops) * options_.block_size /
+               (1024 * 1024);
+  printf("%llu commands in %.3f s: %.0f IOPS, %.1f MiB/s\n",
+         static_cast<unsigned long long>(options_.ops), seconds.count(),
+         options_.ops / seconds.count(), mib / seconds.count());
+  std::lock_guard<std::mutex> lock(mutex_);
+  return failed_;
+}
+
+void PrintLatency() {
+  char line[160];
+  for (uint32_t i = 0; i < ScsiToNvmeLatencyLineCount(); ++i) {
+    if (ScsiToNvmeLatencyLine(i, line, sizeof(line))) fputs(line, stdout);
+  }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!ParseOptions(argc, argv, options)) {
+    PrintUsage();
+    return 2;
+  }
+
+  ScsiTraceWriter capture;
+  if (options.capture_path != nullptr) {
+    if (!capture.Open(options.capture_path)) {
+      fprintf(stderr, "Failed to create %s\n", options.capture_path);
+      return 1;
+    }
+  }
+
+  int ret = nvme_emulator_init(options.emulator);
+  if (ret != 0) {
+    fprintf(stderr, "Failed to start the NVMe emulator: %s\n", strerror(-ret));
+    return 1;
+  }
+  SetEngineCallbacks();
+  // Per command debug messages would dominate a profile
+  translator::SetLogLevel(translator::LogLevel::kWarning);
+  if (options.capture_path != nullptr)
+    SetScsiToNvmeTraceHook(ScsiTraceWriter::Hook, &capture);
+
+  uint64_t failed = 0;
+  {
+    LoadGenerator generator(options);
+    if (!generator.Init()) {
+      fprintf(stderr, "Failed to allocate %u commands\n", options.queue_depth);
+      failed = 1;
+    } else if (!generator.Scan()) {
+      failed = 1;
+    } else {
+      ScsiToNvmeResetLatency();
+      failed = generator.Run();
+      PrintLatency();
+      if (failed != 0)
+        fprintf(stderr, "%llu commands failed\n",
+                static_cast<unsigned long long>(failed));
+    }
+  }
+
+  SetScsiToNvmeTraceHook(nullptr, nullptr);
+  if (!capture.Close()) {
+    fprintf(stderr, "Failed to write %s\n", options.capture_path);
+    failed = 1;
+  }
+  ReleaseEngine();
+  nvme_emulator_exit();
+  return failed == 0 ? 0 : 1;
+}
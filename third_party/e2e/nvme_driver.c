@@ -37,20 +37,18 @@ static inline struct nvme_request* nvme_req(struct request* request) {
   return blk_mq_rq_to_pdu(request);
 }
 
-static void submit_req_done(struct request* request) {
-  struct nvme_request* nvme_request = nvme_req(request);
-
-  if (request) {
-    blk_mq_free_request(request);
-  }
-}
-
 struct request* nvme_alloc_request(struct request_queue* queue,
-                                   struct nvme_command* cmd) {
+                                   struct nvme_command* cmd,
+                                   unsigned hw_queue) {
   struct request* request;
   unsigned op = nvme_is_write(cmd) ? REQ_OP_DRV_OUT : REQ_OP_DRV_IN;
 
-  request = blk_mq_alloc_request(queue, op, 0);
+  // Commands are submitted from queuecommand, which must not sleep
+  if (hw_queue == NVME_ANY_HW_QUEUE)
+    request = blk_mq_alloc_request(queue, op, BLK_MQ_REQ_NOWAIT);
+  else
+    request =
+        blk_mq_alloc_request_hctx(queue, op, BLK_MQ_REQ_NOWAIT, hw_queue);
 
   if (IS_ERR(request)) return request;
 
@@ -63,84 +61,189 @@ struct request* nvme_alloc_request(struct request_queue* queue,
   return request;
 }
 
-int nvme_submit_user_cmd(struct gendisk* disk, struct request_queue* queue,
-                         struct nvme_command* cmd, void* buffer,
-                         unsigned bufflen, struct NvmeCompletion* cpl,
-                         unsigned timeout) {
-  struct request* request;
-  struct bio* bio = NULL;
+// Runs from the NVMe completion path once the device has answered
+static void nvme_async_end_io(struct request* request, blk_status_t error) {
+  struct NvmeAsyncRequest* async_request = request->end_io_data;
+  struct NvmeCompletion* cpl = &async_request->cpl;
+  u16 status = nvme_req(request)->status;
+
+  // The block layer reports transport failures such as timeouts through
+  // error without an NVMe status; report those as internal device errors
+  if (status == 0 && error != BLK_STS_OK) status = NVME_SC_INTERNAL;
+
+  memset(cpl, 0, sizeof(*cpl));
+  cpl->result = le32_to_cpu(nvme_req(request)->result.u32);
+  // nvme_req() stores the status without the phase tag
+  cpl->status = status << 1;
+  cpl->command_id = async_request->cmd.command_id;
+
+  blk_mq_free_request(request);
+  async_request->done(async_request);
+}
+
+static void nvme_segments_end_io(struct bio* bio) { bio_put(bio); }
+
+// Builds a bio over the pages backing the data_len bytes of segments that
+// start data_offset bytes in, and attaches it to request, so the device
+// transfers straight to and from the caller's pages
+static int nvme_map_segments(struct request_queue* queue,
+                             struct request* request,
+                             const struct NvmeDataSegment* segments,
+                             unsigned segment_count, unsigned data_offset,
+                             unsigned data_len) {
+  unsigned nr_pages = 0;
+  unsigned skip = data_offset;
+  unsigned remaining = data_len;
+  struct bio* bio;
+  unsigned i;
   int ret;
 
+  for (i = 0; i < segment_count && remaining > 0; ++i) {
+    unsigned long addr = segments[i].addr;
+    unsigned len = segments[i].len;
+
+    if (skip >= len) {
+      skip -= len;
+      continue;
+    }
+    addr += skip;
+    len = min_t(unsigned, len - skip, remaining);
+    skip = 0;
+    remaining -= len;
+    nr_pages += (offset_in_page(addr) + len + PAGE_SIZE - 1) >> PAGE_SHIFT;
+  }
+
+  bio = bio_kmalloc(GFP_ATOMIC, nr_pages);
+  if (!bio) return -ENOMEM;
+
+  skip = data_offset;
+  remaining = data_len;
+  for (i = 0; i < segment_count && remaining > 0; ++i) {
+    unsigned long addr = segments[i].addr;
+    unsigned len = segments[i].len;
+
+    if (skip >= len) {
+      skip -= len;
+      continue;
+    }
+    addr += skip;
+    len = min_t(unsigned, len - skip, remaining);
+    skip = 0;
+    remaining -= len;
+
+    while (len > 0) {
+      unsigned offset = offset_in_page(addr);
+      unsigned bytes = min_t(unsigned, len, PAGE_SIZE - offset);
+
+      if (bio_add_pc_page(queue, bio, virt_to_page((void*)addr), bytes,
+                          offset) < bytes) {
+        printk("Data segments exceed the queue limits");
+        bio_put(bio);
+        return -EINVAL;
+      }
+      addr += bytes;
+      len -= bytes;
+    }
+  }
+
+  bio->bi_opf &= ~REQ_OP_MASK;
+  bio->bi_opf |= req_op(request);
+  bio->bi_end_io = nvme_segments_end_io;
+
+  ret = blk_rq_append_bio(request, &bio);
+  if (ret) bio_put(bio);
+  return ret;
+}
+
+// Queues async_request->cmd with either a kernel buffer or part of a list of
+// data segments attached. bufflen is the length of the data in either case
+int nvme_submit_async_cmd(struct gendisk* disk, struct request_queue* queue,
+                          struct NvmeAsyncRequest* async_request, void* buffer,
+                          unsigned bufflen,
+                          const struct NvmeDataSegment* segments,
+                          unsigned segment_count, unsigned data_offset,
+                          unsigned timeout, unsigned hw_queue) {
+  struct nvme_command* cmd = (struct nvme_command*)&async_request->cmd;
+  struct request* request;
+  int ret = 0;
+
   if (!queue) {
     printk("Request queue is nullptr");
     printk("Identification status: %u", ns->ctrl->identified);
     printk("Queue Count: %u", ns->ctrl->queue_count);
-    return ret;
+    return -ENODEV;
   }
 
-  request = nvme_alloc_request(queue, cmd);
+  request = nvme_alloc_request(queue, cmd, hw_queue);
   if (IS_ERR(request)) {
     printk("nvme_alloc_request failed?.");
     return PTR_ERR(request);
   }
 
   request->timeout = timeout ? timeout : 60 * HZ;
-  request->special = cpl;
+  request->end_io_data = async_request;
 
-  if (buffer && bufflen) {
-    ret = blk_rq_map_kern(queue, request, buffer, bufflen, GFP_KERNEL);
-    if (ret) {
-      printk("blk_rq_map_kern failed?.");
-      goto out;
-    }
-    bio = request->bio;
-
-    bio->bi_disk = disk;
-    if (!bio->bi_disk) {
-      printk("bdget_disk failed?.");
-      ret = -ENODEV;
-      goto out_unmap;
-    }
+  if (segments && segment_count && bufflen) {
+    ret = nvme_map_segments(queue, request, segments, segment_count,
+                            data_offset, bufflen);
+  } else if (buffer && bufflen) {
+    ret = blk_rq_map_kern(queue, request, buffer, bufflen, GFP_ATOMIC);
+  }
+  if (ret) {
+    printk("Failed to map NVMe data buffer: %d", ret);
+    blk_mq_free_request(request);
+    return ret;
   }
+  if (request->bio) request->bio->bi_disk = disk;
 
-  blk_execute_rq(request->q, disk, request, 0);
+  blk_execute_rq_nowait(request->q, disk, request, 0, nvme_async_end_io);
+  return 0;
+}
 
-  u16 status = nvme_req(request)->status;
-  if (status == 0) {
-    printk(KERN_INFO "status 0: SUCCESS");
-  } else if (status < 0) {
-    printk(KERN_INFO "Linux error code %d: ", status);
-  } else {
-    printk(KERN_INFO "NVMe error code %d: ", status);
-  }
-  printk(KERN_INFO "req flags %d ", nvme_req(request)->flags);
-  goto out;
+int submit_admin_command(struct NvmeAsyncRequest* request, void* buffer,
+                         unsigned bufflen, unsigned timeout) {
+  BUILD_BUG_ON(sizeof(struct NvmeCommand) != sizeof(struct nvme_command));
+  return nvme_submit_async_cmd(bd_disk, ns->ctrl->admin_q, request, buffer,
+                               bufflen, NULL, 0, 0, timeout,
+                               NVME_ANY_HW_QUEUE);
+}
 
-out_unmap:
-  if (bio) {
-    if (disk && bdev) bdput(bdev);
-  }
-out:
-  submit_req_done(request);
-  return ret;
+static unsigned nvme_valid_hw_queue(unsigned hw_queue) {
+  if (hw_queue != NVME_ANY_HW_QUEUE && hw_queue >= ns->queue->nr_hw_queues)
+    return NVME_ANY_HW_QUEUE;
+  return hw_queue;
+}
+
+int submit_io_command(struct NvmeAsyncRequest* request, void* buffer,
+                      unsigned bufflen, unsigned timeout, unsigned hw_queue) {
+  return nvme_submit_async_cmd(bd_disk, ns->queue, request, buffer, bufflen,
+                               NULL, 0, 0, timeout,
+                               nvme_valid_hw_queue(hw_queue));
 }
 
-int submit_admin_command(struct NvmeCommand* nvme_cmd, void* buffer,
-                         unsigned bufflen, struct NvmeCompletion* cpl,
-                         unsigned timeout) {
-  struct nvme_command kernel_nvme_cmd;
-  memcpy(&kernel_nvme_cmd, nvme_cmd, sizeof(kernel_nvme_cmd));
-  return nvme_submit_user_cmd(bd_disk, ns->ctrl->admin_q, &kernel_nvme_cmd,
-                              buffer, bufflen, cpl, timeout);
+int submit_io_command_segments(struct NvmeAsyncRequest* request,
+                               const struct NvmeDataSegment* segments,
+                               unsigned segment_count, unsigned data_offset,
+                               unsigned data_len, unsigned timeout,
+                               unsigned hw_queue) {
+  return nvme_submit_async_cmd(bd_disk, ns->queue, request, NULL, data_len,
+                               segments, segment_count, data_offset, timeout,
+                               nvme_valid_hw_queue(hw_queue));
 }
 
-int submit_io_command(struct NvmeCommand* nvme_cmd, void* buffer,
-                      unsigned bufflen, struct NvmeCompletion* cpl,
-                      unsigned timeout) {
-  struct nvme_command kernel_nvme_cmd;
-  memcpy(&kernel_nvme_cmd, nvme_cmd, sizeof(kernel_nvme_cmd));
-  return nvme_submit_user_cmd(bd_disk, ns->queue, &kernel_nvme_cmd, buffer,
-                              bufflen, cpl, timeout);
+unsigned nvme_io_queue_count(void) { return ns->queue->nr_hw_queues; }
+
+unsigned nvme_io_queue_depth(void) { return ns->queue->tag_set->queue_depth; }
+
+void nvme_copy_queue_map(unsigned int* mq_map) {
+  unsigned int cpu;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 0, 0)
+  const unsigned int* nvme_map =
+      ns->queue->tag_set->map[HCTX_TYPE_DEFAULT].mq_map;
+#else
+  const unsigned int* nvme_map = ns->queue->tag_set->mq_map;
+#endif
+  for_each_possible_cpu(cpu) mq_map[cpu] = nvme_map[cpu];
 }
 
 int nvme_driver_init(void) {
@@ -52,14 +52,55 @@ struct NvmeCompletion {
 // fixed device is enough for an MVP
 #define NVME_DEVICE_PATH "/dev/nvme0n1"
 
+// State of one asynchronously submitted NVMe command.
+// cmd must stay valid until done is called, since the block layer may not
+// dispatch the request until after the submit call returns.
+// The driver fills in cpl and then calls done from the completion path,
+// which may be interrupt context.
+struct NvmeAsyncRequest {
+  struct NvmeCommand cmd;
+  struct NvmeCompletion cpl;
+  void (*done)(struct NvmeAsyncRequest* request);
+  void* priv;  // owned by the caller
+};
+
+// A piece of a data buffer in the kernel direct mapping, such as one entry of
+// a SCSI scatterlist. IO commands given segments transfer straight to and
+// from their pages.
+struct NvmeDataSegment {
+  u64 addr;
+  u32 len;
+};
+
+// Lets the block layer pick the hardware queue of the submitting CPU
+#define NVME_ANY_HW_QUEUE ((unsigned)-1)
+
 int nvme_driver_init(void);
 
-int submit_admin_command(struct NvmeCommand* nvme_cmd, void* buffer,
-                         unsigned bufflen, struct NvmeCompletion* cpl,
-                         unsigned timeout);
-int submit_io_command(struct NvmeCommand* nvme_cmd, void* buffer,
-                      unsigned bufflen, struct NvmeCompletion* cpl,
-                      unsigned timeout);
+// Number of NVMe IO hardware queues and the depth of each of them
+unsigned nvme_io_queue_count(void);
+unsigned nvme_io_queue_depth(void);
+
+// Fills mq_map[cpu] with the NVMe IO hardware queue serving each possible CPU
+void nvme_copy_queue_map(unsigned int* mq_map);
+
+// Queues request->cmd without waiting for the device.
+// Returns 0 if the command was queued, in which case request->done will be
+// called exactly once. Returns a negative errno otherwise, in which case
+// request->done is never called.
+int submit_admin_command(struct NvmeAsyncRequest* request, void* buffer,
+                         unsigned bufflen, unsigned timeout);
+// hw_queue selects the NVMe IO hardware queue, or NVME_ANY_HW_QUEUE
+int submit_io_command(struct NvmeAsyncRequest* request, void* buffer,
+                      unsigned bufflen, unsigned timeout, unsigned hw_queue);
+// Same as submit_io_command() with the data_len bytes of segments that start
+// data_offset bytes in as the data buffer. segments must stay valid until
+// request->done is called
+int submit_io_command_segments(struct NvmeAsyncRequest* request,
+                               const struct NvmeDataSegment* segments,
+                               unsigned segment_count, unsigned data_offset,
+                               unsigned data_len, unsigned timeout,
+                               unsigned hw_queue);
 
 int send_sample_write_request(void);
 
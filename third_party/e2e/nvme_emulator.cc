@@ -0,0 +1,620 @@
+// Copyright 2020 Google LLC
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// version 2 as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+
+#include "nvme_emulator.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+#include "third_party/spdk/nvme.h"
+#include "nvme_driver.h"
+#include "util.h"
+
+namespace {
+
+constexpr uint32_t kPageSize = 4096;
+constexpr uint32_t kNsid = 1;
+// NVMe Base Specification: selects every namespace
+constexpr uint32_t kBroadcastNsid = 0xffffffff;
+constexpr uint32_t kAdminQueueDepth = 32;
+
+// Status field of a completion queue entry, which holds the phase tag in
+// bit 0. NVMe Base Specification Figure 124
+uint16_t Status(nvme::StatusCodeType sct, uint8_t sc) {
+  return static_cast<uint16_t>((static_cast<uint16_t>(sct) << 8) | sc) << 1;
+}
+
+uint16_t GenericStatus(nvme::GenericCommandStatusCode sc) {
+  return Status(nvme::StatusCodeType::kGeneric, static_cast<uint8_t>(sc));
+}
+
+const uint16_t kSuccess =
+    GenericStatus(nvme::GenericCommandStatusCode::kSuccess);
+const uint16_t kInvalidOpcode =
+    GenericStatus(nvme::GenericCommandStatusCode::kInvalidOpcode);
+const uint16_t kInvalidField =
+    GenericStatus(nvme::GenericCommandStatusCode::kInvalidField);
+const uint16_t kInvalidNamespace =
+    GenericStatus(nvme::GenericCommandStatusCode::kInvalidNamespaceOrFormat);
+const uint16_t kDataTransferError =
+    GenericStatus(nvme::GenericCommandStatusCode::kDataTransferError);
+const uint16_t kInternalError =
+    GenericStatus(nvme::GenericCommandStatusCode::kInternalDeviceError);
+const uint16_t kLbaOutOfRange =
+    GenericStatus(nvme::GenericCommandStatusCode::kLbaOutOfRange);
+const uint16_t kCompareFailure =
+    Status(nvme::StatusCodeType::kMediaError,
+           static_cast<uint8_t>(nvme::MediaErrorStatusCode::kCompareFailure));
+
+// The data buffer of a command: either buffer, or the bytes of segments that
+// start offset bytes in. len bytes long in both cases
+struct DataBuffer {
+  uint8_t* buffer;
+  const NvmeDataSegment* segments;
+  uint32_t segment_count;
+  uint32_t offset;
+  uint32_t len;
+};
+
+// Calls fn(chunk, chunk_len, position) for each contiguous piece of the
+// first len bytes of data, in order. Stops and returns false once fn does
+template <typename Fn>
+bool ForEachChunk(const DataBuffer& data, uint64_t len, Fn fn) {
+  len = std::min<uint64_t>(len, data.len);
+  if (data.segments == nullptr) return len == 0 || fn(data.buffer, len, 0);
+
+  uint64_t skip = data.offset;
+  uint64_t position = 0;
+  for (uint32_t i = 0; i < data.segment_count && position < len; ++i) {
+    uint64_t seg_len = data.segments[i].len;
+    if (skip >= seg_len) {
+      skip -= seg_len;
+      continue;
+    }
+    uint8_t* chunk = reinterpret_cast<uint8_t*>(data.segments[i].addr) + skip;
+    uint64_t chunk_len = std::min(seg_len - skip, len - position);
+    skip = 0;
+    if (!fn(chunk, chunk_len, position)) return false;
+    position += chunk_len;
+  }
+  return true;
+}
+
+// Namespace storage. Unwritten and deallocated blocks read as zeroes
+class Backing {
+ public:
+  // Keeps size bytes in the file at path, or in RAM if path is nullptr.
+  // Returns 0 or a negative errno
+  int Init(const char* path, uint64_t size);
+  void Destroy();
+
+  bool Read(uint64_t offset, uint8_t* out, uint64_t len) const;
+  bool Write(uint64_t offset, const uint8_t* in, uint64_t len);
+  // Zeroes the range and gives its storage back where possible
+  bool Zero(uint64_t offset, uint64_t len);
+  bool Flush();
+
+ private:
+  uint8_t* ram_ = nullptr;
+  uint64_t size_ = 0;
+  int fd_ = -1;
+};
+
+int Backing::Init(const char* path, uint64_t size) {
+  size_ = size;
+  if (path == nullptr) {
+    // Pages are only populated once written
+    void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (addr == MAP_FAILED) return -errno;
+    ram_ = static_cast<uint8_t*>(addr);
+    return 0;
+  }
+  fd_ = open(path, O_RDWR | O_CREAT, 0644);
+  if (fd_ < 0) return -errno;
+  // Extending the file leaves a hole rather than allocating blocks
+  if (ftruncate(fd_, size) != 0) {
+    int ret = -errno;
+    Destroy();
+    return ret;
+  }
+  return 0;
+}
+
+void Backing::Destroy() {
+  if (ram_ != nullptr) munmap(ram_, size_);
+  if (fd_ >= 0) close(fd_);
+  ram_ = nullptr;
+  fd_ = -1;
+}
+
+bool Backing::Read(uint64_t offset, uint8_t* out, uint64_t len) const {
+  if (ram_ != nullptr) {
+    memcpy(out, ram_ + offset, len);
+    return true;
+  }
+  while (len > 0) {
+    ssize_t ret = pread(fd_, out, len, offset);
+    if (ret < 0 && errno == EINTR) continue;
+    if (ret <= 0) return false;
+    out += ret;
+    offset += ret;
+    len -= ret;
+  }
+  return true;
+}
+
+bool Backing::Write(uint64_t offset, const uint8_t* in, uint64_t len) {
+  if (ram_ != nullptr) {
+    memcpy(ram_ + offset, in, len);
+    return true;
+  }
+  while (len > 0) {
+    ssize_t ret = pwrite(fd_, in, len, offset);
+    if (ret < 0 && errno == EINTR) continue;
+    if (ret <= 0) return false;
+    in += ret;
+    offset += ret;
+    len -= ret;
+  }
+  return true;
+}
+
+bool Backing::Zero(uint64_t offset, uint64_t len) {
+  if (fd_ >= 0) {
+    if (fallocate(fd_, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset,
+                  len) == 0)
+      return true;
+    // The file system cannot punch holes, so write the zeroes
+    static const uint8_t kZeroes[kPageSize] = {};
+    while (len > 0) {
+      uint64_t chunk_len = std::min<uint64_t>(len, sizeof(kZeroes));
+      if (!Write(offset, kZeroes, chunk_len)) return false;
+      offset += chunk_len;
+      len -= chunk_len;
+    }
+    return true;
+  }
+  // Whole pages are dropped and read back as zeroes, the rest is cleared
+  uint64_t end = offset + len;
+  uint64_t page_start = (offset + kPageSize - 1) / kPageSize * kPageSize;
+  uint64_t page_end = end / kPageSize * kPageSize;
+  if (page_start >= page_end) {
+    memset(ram_ + offset, 0, len);
+    return true;
+  }
+  memset(ram_ + offset, 0, page_start - offset);
+  memset(ram_ + page_end, 0, end - page_end);
+  if (madvise(ram_ + page_start, page_end - page_start, MADV_DONTNEED) != 0)
+    memset(ram_ + page_start, 0, page_end - page_start);
+  return true;
+}
+
+bool Backing::Flush() { return fd_ < 0 || fdatasync(fd_) == 0; }
+
+class Emulator {
+ public:
+  int Init(const NvmeEmulatorConfig& config);
+  void Exit();
+  bool initialized() const { return initialized_; }
+  uint32_t io_queue_count() const { return config_.io_queue_count; }
+  uint32_t io_queue_depth() const { return config_.io_queue_depth; }
+  uint64_t flush_count() const { return flush_count_; }
+
+  // Executes request->cmd and completes it. queue is an IO queue, or
+  // io_queue_count() for the admin queue
+  int Submit(NvmeAsyncRequest* request, uint32_t queue,
+             const DataBuffer& data);
+
+ private:
+  struct PendingCompletion {
+    std::chrono::steady_clock::time_point deadline;
+    NvmeAsyncRequest* request;
+    uint32_t queue;
+
+    bool operator>(const PendingCompletion& other) const {
+      return deadline > other.deadline;
+    }
+  };
+
+  // Each returns the completion status and may set result
+  uint16_t ExecuteAdmin(const NvmeCommand& cmd, const DataBuffer& data,
+                        uint32_t& result);
+  uint16_t Identify(const NvmeCommand& cmd, const DataBuffer& data);
+  uint16_t GetFeatures(const NvmeCommand& cmd, uint32_t& result);
+  uint16_t ExecuteIo(const NvmeCommand& cmd, const DataBuffer& data);
+  uint16_t ReadWrite(const NvmeCommand& cmd, const DataBuffer& data);
+  uint16_t DatasetManagement(const NvmeCommand& cmd, const DataBuffer& data);
+  uint16_t WriteZeroes(const NvmeCommand& cmd);
+
+  // Returns kSuccess if count blocks from slba lie in the namespace
+  uint16_t CheckRange(uint32_t nsid, uint64_t slba, uint64_t count) const;
+
+  void Finish(NvmeAsyncRequest* request, uint32_t queue);
+  void CompletionLoop();
+
+  NvmeEmulatorConfig config_ = {};
+  bool initialized_ = false;
+  Backing backing_;
+  std::atomic<uint64_t> flush_count_{0};
+  // Commands in flight on each IO queue, followed by the admin queue
+  std::unique_ptr<std::atomic<uint32_t>[]> in_flight_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::priority_queue<PendingCompletion, std::vector<PendingCompletion>,
+                      std::greater<PendingCompletion>>
+      pending_;
+  bool stopping_ = false;
+  std::thread completion_thread_;
+};
+
+int Emulator::Init(const NvmeEmulatorConfig& config) {
+  if (initialized_) return -EBUSY;
+  if (config.block_count == 0 || config.lba_shift < 9 ||
+      config.lba_shift > 16 || config.io_queue_count == 0 ||
+      config.io_queue_depth == 0)
+    return -EINVAL;
+  config_ = config;
+  int ret = backing_.Init(config.backing_path, config.block_count
+                                                   << config.lba_shift);
+  if (ret != 0) return ret;
+  in_flight_.reset(new std::atomic<uint32_t>[config.io_queue_count + 1]());
+  flush_count_ = 0;
+  stopping_ = false;
+  if (config.latency_ns != 0)
+    completion_thread_ = std::thread(&Emulator::CompletionLoop, this);
+  initialized_ = true;
+  return 0;
+}
+
+void Emulator::Exit() {
+  if (!initialized_) return;
+  if (completion_thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stopping_ = true;
+    }
+    cv_.notify_one();
+    completion_thread_.join();
+  }
+  backing_.Destroy();
+  in_flight_.reset();
+  initialized_ = false;
+}
+
+int Emulator::Submit(NvmeAsyncRequest* request, uint32_t queue,
+                     const DataBuffer& data) {
+  bool is_admin = queue == config_.io_queue_count;
+  uint32_t depth = is_admin ? kAdminQueueDepth : config_.io_queue_depth;
+  if (in_flight_[queue].fetch_add(1, std::memory_order_relaxed) >= depth) {
+    in_flight_[queue].fetch_sub(1, std::memory_order_relaxed);
+    return -EAGAIN;
+  }
+
+  uint32_t result = 0;
+  uint16_t status = is_admin ? ExecuteAdmin(request->cmd, data, result)
+                             : ExecuteIo(request->cmd, data);
+  request->cpl = {};
+  request->cpl.result = result;
+  request->cpl.sq_id = is_admin ? 0 : queue + 1;
+  request->cpl.command_id = request->cmd.command_id;
+  request->cpl.status = status;
+
+  if (config_.latency_ns == 0) {
+    Finish(request, queue);
+    return 0;
+  }
+  PendingCompletion completion = {
+      .deadline = std::chrono::steady_clock::now() +
+                  std::chrono::nanoseconds(config_.latency_ns),
+      .request = request,
+      .queue = queue};
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.push(completion);
+  }
+  cv_.notify_one();
+  return 0;
+}
+
+void Emulator::Finish(NvmeAsyncRequest* request, uint32_t queue) {
+  // The callback may submit again, so the slot is given back first
+  in_flight_[queue].fetch_sub(1, std::memory_order_relaxed);
+  request->done(request);
+}
+
+void Emulator::CompletionLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!stopping_ || !pending_.empty()) {
+    if (pending_.empty()) {
+      cv_.wait(lock);
+      continue;
+    }
+    PendingCompletion completion = pending_.top();
+    if (std::chrono::steady_clock::now() < completion.deadline) {
+      cv_.wait_until(lock, completion.deadline);
+      continue;
+    }
+    pending_.pop();
+    lock.unlock();
+    Finish(completion.request, completion.queue);
+    lock.lock();
+  }
+}
+
+uint16_t Emulator::CheckRange(uint32_t nsid, uint64_t slba,
+                              uint64_t count) const {
+  if (nsid != kNsid) return kInvalidNamespace;
+  if (slba > config_.block_count || count > config_.block_count - slba)
+    return kLbaOutOfRange;
+  return kSuccess;
+}
+
+uint16_t Emulator::ExecuteAdmin(const NvmeCommand& cmd, const DataBuffer& data,
+                                uint32_t& result) {
+  switch (static_cast<nvme::AdminOpcode>(cmd.opcode)) {
+    case nvme::AdminOpcode::kIdentify:
+      return Identify(cmd, data);
+    case nvme::AdminOpcode::kGetFeatures:
+      return GetFeatures(cmd, result);
+    default:
+      return kInvalidOpcode;
+  }
+}
+
+uint16_t Emulator::Identify(const NvmeCommand& cmd, const DataBuffer& data) {
+  if (data.segments != nullptr || data.len < kPageSize)
+    return kDataTransferError;
+  uint8_t cns = cmd.cdw3[0] & 0xff;
+  switch (cns) {
+    case 0x0: {
+      if (cmd.nsid != kNsid) return kInvalidNamespace;
+      nvme::IdentifyNamespace identify_ns = {
+          .nsze = config_.block_count,
+          .ncap = config_.block_count,
+          .nuse = config_.block_count};
+      // Deallocated blocks read as zeroes
+      identify_ns.dlfeat.bits.read_value = 0b001;
+      identify_ns.nguid[0] = 0x0123456789abcdef;
+      identify_ns.eui64 = 0x0123456789abcdef;
+      identify_ns.lbaf[0].lbads = config_.lba_shift;
+      memcpy(data.buffer, &identify_ns, sizeof(identify_ns));
+      return kSuccess;
+    }
+    case 0x1: {
+      nvme::IdentifyControllerData identify_ctrl = {};
+      memcpy(identify_ctrl.sn, "EMU00000000000000001",
+             sizeof(identify_ctrl.sn));
+      memcpy(identify_ctrl.mn, "scsi2nvme userspace emulator            ",
+             sizeof(identify_ctrl.mn));
+      memcpy(identify_ctrl.fr, "1.0     ", sizeof(identify_ctrl.fr));
+      identify_ctrl.mdts = config_.mdts;
+      identify_ctrl.nn = 1;
+      identify_ctrl.oncs.compare = 1;
+      identify_ctrl.oncs.dsm = 1;
+      identify_ctrl.oncs.write_zeroes = 1;
+      identify_ctrl.vwc.present = config_.volatile_write_cache;
+      // Flush accepts the broadcast NSID
+      identify_ctrl.vwc.flush_broadcast = 0b11;
+      memcpy(data.buffer, &identify_ctrl, sizeof(identify_ctrl));
+      return kSuccess;
+    }
+    case 0x2: {
+      // Active namespaces above cmd.nsid
+      nvme::IdentifyNamespaceList list = {};
+      if (cmd.nsid < kNsid) list.ids[0] = kNsid;
+      memcpy(data.buffer, &list, sizeof(list));
+      return kSuccess;
+    }
+    default:
+      return kInvalidField;
+  }
+}
+
+uint16_t Emulator::GetFeatures(const NvmeCommand& cmd, uint32_t& result) {
+  switch (static_cast<nvme::FeatureType>(cmd.cdw3[0] & 0xff)) {
+    case nvme::FeatureType::kVolatileWriteCache:
+      result = config_.volatile_write_cache;
+      return kSuccess;
+    case nvme::FeatureType::kNumberOfQueues: {
+      // 0's based submission and completion queue counts
+      uint32_t count = config_.io_queue_count - 1;
+      result = count << 16 | count;
+      return kSuccess;
+    }
+    default:
+      return kInvalidField;
+  }
+}
+
+uint16_t Emulator::ExecuteIo(const NvmeCommand& cmd, const DataBuffer& data) {
+  switch (static_cast<nvme::NvmOpcode>(cmd.opcode)) {
+    case nvme::NvmOpcode::kFlush:
+      if (cmd.nsid != kNsid && cmd.nsid != kBroadcastNsid)
+        return kInvalidNamespace;
+      ++flush_count_;
+      return backing_.Flush() ? kSuccess : kInternalError;
+    case nvme::NvmOpcode::kRead:
+    case nvme::NvmOpcode::kWrite:
+    case nvme::NvmOpcode::kCompare:
+      return ReadWrite(cmd, data);
+    case nvme::NvmOpcode::kDatasetManagement:
+      return DatasetManagement(cmd, data);
+    case nvme::NvmOpcode::kWriteZeroes:
+      return WriteZeroes(cmd);
+    default:
+      return kInvalidOpcode;
+  }
+}
+
+// Read, Write and Compare share their layout: the starting LBA in CDW10 and
+// CDW11 and the 0's based block count in CDW12 bits 15:0
+uint16_t Emulator::ReadWrite(const NvmeCommand& cmd, const DataBuffer& data) {
+  uint64_t slba = cmd.cdw3[0] | static_cast<uint64_t>(cmd.cdw3[1]) << 32;
+  uint64_t count = (cmd.cdw3[2] & 0xffff) + 1;
+  uint16_t status = CheckRange(cmd.nsid, slba, count);
+  if (status != kSuccess) return status;
+  uint64_t offset = slba << config_.lba_shift;
+  uint64_t len = count << config_.lba_shift;
+  if (config_.mdts != 0 &&
+      len > (static_cast<uint64_t>(kPageSize) << config_.mdts))
+    return kInvalidField;
+  if (data.len < len) return kDataTransferError;
+
+  switch (static_cast<nvme::NvmOpcode>(cmd.opcode)) {
+    case nvme::NvmOpcode::kRead:
+      return ForEachChunk(data, len,
+                          [&](uint8_t* chunk, uint64_t chunk_len,
+                              uint64_t position) {
+                            return backing_.Read(offset + position, chunk,
+                                                 chunk_len);
+                          })
+                 ? kSuccess
+                 : kInternalError;
+    case nvme::NvmOpcode::kWrite:
+      return ForEachChunk(data, len,
+                          [&](uint8_t* chunk, uint64_t chunk_len,
+                              uint64_t position) {
+                            return backing_.Write(offset + position, chunk,
+                                                  chunk_len);
+                          })
+                 ? kSuccess
+                 : kInternalError;
+    default: {
+      status = kSuccess;
+      ForEachChunk(data, len, [&](uint8_t* chunk, uint64_t chunk_len,
+                                  uint64_t position) {
+        uint8_t stored[kPageSize];
+        for (uint64_t done = 0; done < chunk_len; done += sizeof(stored)) {
+          uint64_t piece = std::min<uint64_t>(chunk_len - done, sizeof(stored));
+          if (!backing_.Read(offset + position + done, stored, piece)) {
+            status = kInternalError;
+            return false;
+          }
+          if (memcmp(stored, chunk + done, piece) != 0) {
+            status = kCompareFailure;
+            return false;
+          }
+        }
+        return true;
+      });
+      return status;
+    }
+  }
+}
+
+// The 0's based range count is in CDW10 bits 7:0 and the deallocate
+// attribute in CDW11 bit 2. Ranges without it are hints and ignored
+uint16_t Emulator::DatasetManagement(const NvmeCommand& cmd,
+                                     const DataBuffer& data) {
+  if (cmd.nsid != kNsid) return kInvalidNamespace;
+  uint32_t range_count = (cmd.cdw3[0] & 0xff) + 1;
+  if (data.segments != nullptr ||
+      data.len < range_count * sizeof(nvme::DatasetManagmentRange))
+    return kDataTransferError;
+  bool deallocate = cmd.cdw3[1] & (1u << 2);
+  if (!deallocate) return kSuccess;
+
+  for (uint32_t i = 0; i < range_count; ++i) {
+    nvme::DatasetManagmentRange range;
+    memcpy(&range, data.buffer + i * sizeof(range), sizeof(range));
+    uint64_t slba = range.lba.value();
+    uint64_t count = range.lb_count.value();
+    uint16_t status = CheckRange(cmd.nsid, slba, count);
+    if (status != kSuccess) return status;
+    if (!backing_.Zero(slba << config_.lba_shift, count << config_.lba_shift))
+      return kInternalError;
+  }
+  return kSuccess;
+}
+
+uint16_t Emulator::WriteZeroes(const NvmeCommand& cmd) {
+  uint64_t slba = cmd.cdw3[0] | static_cast<uint64_t>(cmd.cdw3[1]) << 32;
+  uint64_t count = (cmd.cdw3[2] & 0xffff) + 1;
+  uint16_t status = CheckRange(cmd.nsid, slba, count);
+  if (status != kSuccess) return status;
+  return backing_.Zero(slba << config_.lba_shift, count << config_.lba_shift)
+             ? kSuccess
+             : kInternalError;
+}
+
+Emulator emulator;
+
+// Matches the block layer, which picks a queue for out of range values
+uint32_t IoQueue(unsigned hw_queue) {
+  if (hw_queue < emulator.io_queue_count()) return hw_queue;
+  return CurrentCpu() % emulator.io_queue_count();
+}
+
+}  // namespace
+
+int nvme_emulator_init(const NvmeEmulatorConfig& config) {
+  return emulator.Init(config);
+}
+
+void nvme_emulator_exit() { emulator.Exit(); }
+
+uint64_t nvme_emulator_flush_count() { return emulator.flush_count(); }
+
+int nvme_driver_init(void) {
+  if (emulator.initialized()) return 0;
+  return emulator.Init(kDefaultNvmeEmulatorConfig);
+}
+
+unsigned nvme_io_queue_count(void) { return emulator.io_queue_count(); }
+
+unsigned nvme_io_queue_depth(void) { return emulator.io_queue_depth(); }
+
+void nvme_copy_queue_map(unsigned int* mq_map) {
+  for (uint32_t cpu = 0; cpu < PossibleCpuCount(); ++cpu)
+    mq_map[cpu] = cpu % emulator.io_queue_count();
+}
+
+int submit_admin_command(struct NvmeAsyncRequest* request, void* buffer,
+                         unsigned bufflen, unsigned timeout) {
+  if (!emulator.initialized()) return -ENODEV;
+  DataBuffer data = {.buffer = static_cast<uint8_t*>(buffer), .len = bufflen};
+  return emulator.Submit(request, emulator.io_queue_count(), data);
+}
+
+int submit_io_command(struct NvmeAsyncRequest* request, void* buffer,
+                      unsigned bufflen, unsigned timeout, unsigned hw_queue) {
+  if (!emulator.initialized()) return -ENODEV;
+  DataBuffer data = {.buffer = static_cast<uint8_t*>(buffer), .len = bufflen};
+  return emulator.Submit(request, IoQueue(hw_queue), data);
+}
+
+int submit_io_command_segments(struct NvmeAsyncRequest* request,
+                               const struct NvmeDataSegment* segments,
+                               unsigned segment_count, unsigned data_offset,
+                               unsigned data_len, unsigned timeout,
+                               unsigned hw_queue) {
+  if (!emulator.initialized()) return -ENODEV;
+  DataBuffer data = {.segments = segments,
+                     .segment_count = segment_count,
+                     .offset = data_offset,
+                     .len = data_len};
+  return emulator.Submit(request, IoQueue(hw_queue), data);
+}
@@ -0,0 +1,62 @@
+// Copyright 2020 Google LLC
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// version 2 as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+
+// A userspace NVMe controller that implements nvme_driver.h, so the engine
+// runs outside the kernel without a device.
+//
+// The controller has one namespace (nsid 1) backed by RAM or a sparse file,
+// and supports Identify (controller, namespace and active namespace list),
+// Get Features, Read, Write, Flush (also of the broadcast NSID), Dataset
+// Management, Compare and Write Zeroes. Commands are executed on the
+// submitting thread. Their completions are delivered there too, unless a
+// latency is configured, in which case a completion thread calls the done
+// callbacks once it has passed.
+
+#ifndef NVME_EMULATOR_H
+#define NVME_EMULATOR_H
+
+#include <cstdint>
+
+struct NvmeEmulatorConfig {
+  uint64_t block_count;  // Namespace size in logical blocks
+  uint8_t lba_shift;     // Logical block size is 1 << lba_shift bytes
+  // Sparse file holding the namespace, created if missing, or nullptr to
+  // keep it in RAM
+  const char* backing_path;
+  uint64_t latency_ns;  // Added to every command before it completes
+  uint32_t io_queue_count;
+  uint32_t io_queue_depth;
+  bool volatile_write_cache;  // Reported by Identify and Get Features
+  uint8_t mdts;  // Max transfer of 2^mdts pages, or 0 for no limit
+};
+
+// 1 GiB of 512 byte blocks in RAM, completed without added latency
+constexpr NvmeEmulatorConfig kDefaultNvmeEmulatorConfig = {
+    .block_count = 1 << 21,
+    .lba_shift = 9,
+    .backing_path = nullptr,
+    .latency_ns = 0,
+    .io_queue_count = 1,
+    .io_queue_depth = 128,
+    .volatile_write_cache = true,
+    .mdts = 5};
+
+// Starts the controller. nvme_driver_init() starts it with
+// kDefaultNvmeEmulatorConfig instead. Returns 0 or a negative errno
+int nvme_emulator_init(const NvmeEmulatorConfig& config);
+
+// Waits for commands in flight to complete and stops the controller
+void nvme_emulator_exit();
+
+// Flush commands executed since nvme_emulator_init()
+uint64_t nvme_emulator_flush_count();
+
+#endif
@@ -14,19 +14,63 @@
 #include "engine.h"
 #include "nvme_driver.h"
 
+#include <linux/blk-mq.h>
+#include <linux/cpumask.h>
+#include <linux/debugfs.h>
+#include <linux/delay.h>
 #include <linux/device.h>
+#include <linux/gfp.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/scatterlist.h>
+#include <linux/seq_file.h>
+#include <linux/version.h>
 #include <scsi/scsi.h>
 #include <scsi/scsi_cmnd.h>
 #include <scsi/scsi_host.h>
 
 static const char kName[] = "SCSI2NVMe SCSI Mock";
+// Queue geometry of the single queue mode
 static const int kQueueCount = 1;
-static const int kCanQueue = 1;
-static const int kCmdPerLun = 1;
+static const int kCanQueue = 256;
+static const int kCmdPerLun = 256;
+// Commands larger than the NVMe maximum data transfer size are split by the
+// translation library, so the host need not chunk IOs to the NVMe limit
+static const unsigned kMaxSectors = 0xFFFF;
+// Data segments held in each command's private area. Commands with longer
+// scatterlists allocate theirs
+static const unsigned kInlineSegments = 32;
+
+// In multi queue mode the host gets one hardware queue per NVMe IO queue,
+// each as deep as the NVMe queue, and hctx i submits to NVMe queue i
+static bool multi_queue = true;
+module_param(multi_queue, bool, 0444);
+MODULE_PARM_DESC(multi_queue,
+                 "Map each blk-mq hardware queue onto an NVMe IO queue");
+
+// Unmap completes once its ranges are queued, and they are deallocated in the
+// background through the NVMe IO queues
+static bool background_discard;
+module_param(background_discard, bool, 0444);
+MODULE_PARM_DESC(background_discard,
+                 "Acknowledge UNMAP early and deallocate in the background");
+static const struct ScsiToNvmeDiscardConfig kDiscardConfig = {
+    .early_ack = true,
+    .max_ranges = 4096,
+    .max_foreground = 8,
+    .batch_interval_ns = 1000000};
+
+// SYNCHRONIZE CACHE commands that arrive while a Flush is in flight share the
+// next one, optionally sent to every namespace at once
+static bool group_flush;
+module_param(group_flush, bool, 0444);
+MODULE_PARM_DESC(group_flush,
+                 "Complete concurrent SYNCHRONIZE CACHE with one NVMe Flush");
+static bool broadcast_flush;
+module_param(broadcast_flush, bool, 0444);
+MODULE_PARM_DESC(broadcast_flush,
+                 "Send grouped Flushes to every namespace when supported");
 
 static struct bus_type pseudo_bus;
 static struct device* pseudo_root_dev;
@@ -34,44 +78,216 @@ static struct device pseudo_adapter;
 static struct device_driver scsi_mock_driverfs = {.name = kName,
                                                   .bus = &pseudo_bus};
 
+// Per-command state carried from scsi_queuecommand to the engine's done
+// callback, held in the private area the midlayer reserves in each
+// scsi_cmnd. The engine context follows the fixed fields, and
+// kInlineSegments data segments follow the engine context.
+struct scsi_mock_cmd {
+  struct scsi_cmnd* cmd;
+  unsigned char* data_buf;  // bounce buffer, NULL for direct transfers
+  unsigned int data_len;
+  bool is_data_in;
+  struct NvmeDataSegment* segs;  // inline or allocated, NULL if unused
+  u8 engine_ctx[] __aligned(sizeof(u64));
+};
+
+// One page for each tag of every hardware queue, lent to the translation of
+// the command holding the tag so that it need not allocate memory
+static void** scratch_pages;
+static unsigned scratch_page_count;
+
+// debugfs directory of the module. Reading its latency file prints the
+// engine's latency histograms, writing to it clears them
+static struct dentry* debugfs_dir;
+
+static int scsi_mock_latency_show(struct seq_file* m, void* v) {
+  char line[160];
+  unsigned i;
+  for (i = 0; i < ScsiToNvmeLatencyLineCount(); ++i) {
+    if (ScsiToNvmeLatencyLine(i, line, sizeof(line))) seq_puts(m, line);
+  }
+  return 0;
+}
+
+static int scsi_mock_latency_open(struct inode* inode, struct file* file) {
+  return single_open(file, scsi_mock_latency_show, NULL);
+}
+
+static ssize_t scsi_mock_latency_write(struct file* file,
+                                       const char __user* buf, size_t count,
+                                       loff_t* ppos) {
+  ScsiToNvmeResetLatency();
+  return count;
+}
+
+static const struct file_operations scsi_mock_latency_fops = {
+    .owner = THIS_MODULE,
+    .open = scsi_mock_latency_open,
+    .read = seq_read,
+    .write = scsi_mock_latency_write,
+    .llseek = seq_lseek,
+    .release = single_release,
+};
+
+static unsigned int scsi_mock_segments_offset(void) {
+  return ALIGN(ScsiToNvmeContextSize(), sizeof(u64));
+}
+
+static unsigned int scsi_mock_cmd_size(void) {
+  return sizeof(struct scsi_mock_cmd) + scsi_mock_segments_offset() +
+         kInlineSegments * sizeof(struct NvmeDataSegment);
+}
+
+static struct NvmeDataSegment* scsi_mock_inline_segments(
+    struct scsi_mock_cmd* mock_cmd) {
+  return (struct NvmeDataSegment*)(mock_cmd->engine_ctx +
+                                   scsi_mock_segments_offset());
+}
+
+static void scsi_mock_free_scratch(void) {
+  unsigned i;
+  if (scratch_pages == NULL) return;
+  for (i = 0; i < scratch_page_count; ++i)
+    free_page((unsigned long)scratch_pages[i]);
+  kfree(scratch_pages);
+  scratch_pages = NULL;
+  scratch_page_count = 0;
+}
+
+static int scsi_mock_alloc_scratch(unsigned count) {
+  unsigned i;
+  scratch_pages = kcalloc(count, sizeof(*scratch_pages), GFP_KERNEL);
+  if (scratch_pages == NULL) return -ENOMEM;
+  scratch_page_count = count;
+  for (i = 0; i < count; ++i) {
+    scratch_pages[i] = (void*)__get_free_page(GFP_KERNEL);
+    if (scratch_pages[i] == NULL) {
+      scsi_mock_free_scratch();
+      return -ENOMEM;
+    }
+  }
+  return 0;
+}
+
+// Tags are unique per hardware queue, so the queue and tag pick the page
+static void* scsi_mock_scratch_page(struct scsi_cmnd* cmd) {
+  u32 unique_tag = blk_mq_unique_tag(cmd->request);
+  unsigned index = blk_mq_unique_tag_to_hwq(unique_tag) *
+                       cmd->device->host->can_queue +
+                   blk_mq_unique_tag_to_tag(unique_tag);
+  return index < scratch_page_count ? scratch_pages[index] : NULL;
+}
+
+// Describes the command's scatterlist as data segments, so that Read and
+// Write data moves between the device and the midlayer pages without a copy
+static unsigned short scsi_mock_fill_segments(struct scsi_cmnd* cmd,
+                                              struct NvmeDataSegment* segs) {
+  struct scatterlist* sg;
+  int i;
+
+  scsi_for_each_sg(cmd, sg, scsi_sg_count(cmd), i) {
+    segs[i].addr = (u64)(uintptr_t)sg_virt(sg);
+    segs[i].len = sg->length;
+  }
+  return scsi_sg_count(cmd);
+}
+
+static void scsi_mock_release(struct scsi_mock_cmd* mock_cmd) {
+  kfree(mock_cmd->data_buf);
+  mock_cmd->data_buf = NULL;
+  if (mock_cmd->segs != scsi_mock_inline_segments(mock_cmd))
+    kfree(mock_cmd->segs);
+  mock_cmd->segs = NULL;
+}
+
 static int respond(struct scsi_cmnd* cmd, u32 resp_code) {
   cmd->result = resp_code;
   cmd->scsi_done(cmd);
   return 0;
 }
 
+// Runs once the engine has completed translation, possibly from the NVMe
+// completion interrupt
+static void scsi_mock_done(void* priv, struct ScsiToNvmeResponse resp) {
+  struct scsi_mock_cmd* mock_cmd = priv;
+  struct scsi_cmnd* cmd = mock_cmd->cmd;
+  if (mock_cmd->is_data_in && mock_cmd->data_buf) {
+    // Copy response to SGL buffer
+    struct scsi_data_buffer* sdb = &cmd->sdb;
+    int sdb_len = sg_copy_from_buffer(sdb->table.sgl, sdb->table.nents,
+                                      mock_cmd->data_buf, resp.alloc_len);
+    scsi_set_resid(cmd, mock_cmd->data_len - sdb_len);
+  } else if (mock_cmd->is_data_in && mock_cmd->data_len > 0) {
+    // The device wrote straight into the SGL buffer
+    scsi_set_resid(cmd, mock_cmd->data_len - resp.alloc_len);
+  }
+  scsi_mock_release(mock_cmd);
+  respond(cmd, resp.return_code);
+}
+
 static int scsi_queuecommand(struct Scsi_Host* host, struct scsi_cmnd* cmd) {
   u64 lun = cmd->device->lun;
   unsigned char* cmd_buf = cmd->cmnd;
   u16 cmd_len = cmd->cmd_len;
-  u16 data_len = scsi_bufflen(cmd);
+  unsigned int data_len = scsi_bufflen(cmd);
   unsigned char* sense_buf = cmd->sense_buffer;
   unsigned short sense_len = SCSI_SENSE_BUFFERSIZE;
   bool is_data_in = cmd->sc_data_direction == DMA_FROM_DEVICE;
-  unsigned char* data_buf;
-  printk("RECIEVED COMMAND");
-  if (data_len > 0) {
-    data_buf = kzalloc(data_len, GFP_ATOMIC | GFP_KERNEL);
-    if (data_buf == NULL) {
-      printk("OUT OF MEMORY!!");
-      return respond(cmd, 23);
+  bool is_direct = data_len > 0 && ScsiToNvmeIsDirect(cmd_buf, cmd_len);
+  unsigned hw_queue = NVME_ANY_HW_QUEUE;
+  unsigned char* data_buf = NULL;
+  struct NvmeDataSegment* segs = NULL;
+  unsigned short seg_count = 0;
+  struct scsi_mock_cmd* mock_cmd = scsi_cmd_priv(cmd);
+  int ret;
+
+  if (multi_queue)
+    hw_queue = blk_mq_unique_tag_to_hwq(blk_mq_unique_tag(cmd->request));
+
+  if (is_direct) {
+    segs = scsi_mock_inline_segments(mock_cmd);
+    if (scsi_sg_count(cmd) > kInlineSegments) {
+      segs = kmalloc_array(scsi_sg_count(cmd), sizeof(*segs), GFP_ATOMIC);
+      if (segs == NULL) return SCSI_MLQUEUE_HOST_BUSY;
     }
-    printk("Data Length of SCSI Buffer: %u", data_len);
+    seg_count = scsi_mock_fill_segments(cmd, segs);
+  } else if (data_len > 0) {
+    // Commands answered by the translation library need a linear buffer
+    data_buf = kzalloc(data_len, GFP_ATOMIC);
+    if (data_buf == NULL) return SCSI_MLQUEUE_HOST_BUSY;
     if (!is_data_in) scsi_sg_copy_to_buffer(cmd, data_buf, data_len);
   }
-  struct ScsiToNvmeResponse resp =
-      ScsiToNvme(cmd_buf, cmd_len, lun, sense_buf, sense_len, data_buf,
-                 data_len, is_data_in);
-  // Copy response to SGL buffer
-  if (is_data_in && data_len > 0) {
-    printk("ALLOC_LEN %u", resp.alloc_len);
-    struct scsi_data_buffer* sdb = &cmd->sdb;
-    int sdb_len = sg_copy_from_buffer(sdb->table.sgl, sdb->table.nents,
-                                      data_buf, resp.alloc_len);
-    scsi_set_resid(cmd, data_len - sdb_len);
+  mock_cmd->cmd = cmd;
+  mock_cmd->data_buf = data_buf;
+  mock_cmd->data_len = data_len;
+  mock_cmd->is_data_in = is_data_in;
+  mock_cmd->segs = segs;
+
+  // Completion is reported through scsi_mock_done
+  ret = ScsiToNvme(mock_cmd->engine_ctx, scsi_mock_scratch_page(cmd), cmd_buf,
+                   cmd_len, lun, sense_buf, sense_len, data_buf, segs,
+                   seg_count, data_len, is_data_in, hw_queue, scsi_mock_done,
+                   mock_cmd);
+  if (ret != 0) {
+    // The NVMe queue is full; the midlayer requeues the command
+    scsi_mock_release(mock_cmd);
+    return SCSI_MLQUEUE_HOST_BUSY;
   }
-  if (data_len > 0) kfree(data_buf);
-  return respond(cmd, resp.return_code);
+  return 0;
+}
+
+// Makes hctx i serve the same CPUs as NVMe IO queue i, so that commands and
+// their NVMe completions stay on the submitting CPU
+static int scsi_mock_map_queues(struct Scsi_Host* host) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 0, 0)
+  struct blk_mq_queue_map* qmap = &host->tag_set.map[HCTX_TYPE_DEFAULT];
+  if (!multi_queue) return blk_mq_map_queues(qmap);
+  nvme_copy_queue_map(qmap->mq_map);
+#else
+  if (!multi_queue) return blk_mq_map_queues(&host->tag_set);
+  nvme_copy_queue_map(host->tag_set.mq_map);
+#endif
+  return 0;
 }
 
 static int scsi_abort(struct scsi_cmnd* cmd) { return SUCCESS; }
@@ -85,11 +301,13 @@ static struct scsi_host_template scsi_mock_template = {
     .module = THIS_MODULE,
     .name = kName,
     .queuecommand = scsi_queuecommand,
+    .map_queues = scsi_mock_map_queues,
     .eh_abort_handler = scsi_abort,
     .proc_name = kName,
     .can_queue = kCanQueue,
     .this_id = 7,
     .sg_tablesize = SG_MAX_SEGMENTS,
+    .max_sectors = kMaxSectors,
     .cmd_per_lun = kCmdPerLun};
 
 static int bus_match(struct device* dev, struct device_driver* driver) {
@@ -107,17 +325,40 @@ static int bus_driver_probe(struct device* dev) {
 
   printk("REGISTER CONTINUE!");
 
+  if (multi_queue) {
+    // The host's tag space per hctx mirrors the NVMe queue it feeds
+    scsi_mock_template.can_queue = nvme_io_queue_depth();
+    scsi_mock_template.cmd_per_lun = scsi_mock_template.can_queue;
+  }
+  // Commands carry their engine context instead of allocating it
+  scsi_mock_template.cmd_size = scsi_mock_cmd_size();
+
   scsi_host = scsi_host_alloc(&scsi_mock_template, 0);
   if (!scsi_host) {
     printk("SCSI Host failed to allocate");
     return -ENODEV;
   }
   scsi_host->nr_hw_queues = kQueueCount;
+  if (multi_queue) {
+    // One hctx per NVMe IO queue; the NVMe driver allocates one queue per CPU
+    // when the controller supports enough of them
+    scsi_host->nr_hw_queues = clamp_t(unsigned, nvme_io_queue_count(), 1,
+                                      num_possible_cpus());
+    printk("Multi queue mode: %u hw queues of depth %d",
+           scsi_host->nr_hw_queues, scsi_host->can_queue);
+  }
   scsi_host->max_id = 1;
   scsi_host->max_lun = 1;
+  err = scsi_mock_alloc_scratch(scsi_host->nr_hw_queues * scsi_host->can_queue);
+  if (err) {
+    printk("Failed to allocate scratch pages");
+    scsi_host_put(scsi_host);
+    return err;
+  }
   err = scsi_add_host(scsi_host, NULL);
   if (err) {
     scsi_host_put(scsi_host);
+    scsi_mock_free_scratch();
     return err;
   }
   dev_set_drvdata(dev, scsi_host);
@@ -130,6 +371,7 @@ static int bus_remove(struct device* dev) {
   struct Scsi_Host* scsi_host = dev_get_drvdata(dev);
   scsi_remove_host(scsi_host);
   scsi_host_put(scsi_host);
+  scsi_mock_free_scratch();
   return 0;
 }
 
@@ -153,10 +395,19 @@ static int __init scsi_mock_init(void) {
   int err;
   SetEngineCallbacks();
   nvme_driver_init();
+  if (background_discard && SetScsiToNvmeDiscardConfig(&kDiscardConfig))
+    printk("Failed to set up background discard, UNMAP waits for the device");
+  if (group_flush) {
+    struct ScsiToNvmeFlushConfig flush_config = {.group = true,
+                                                 .broadcast = broadcast_flush};
+    if (SetScsiToNvmeFlushConfig(&flush_config))
+      printk("Failed to set up flush group commit");
+  }
   printk("Registering root device\n");
   pseudo_root_dev = root_device_register("pseudo_scsi_root");
   if (IS_ERR(pseudo_root_dev)) {
     printk("Error registering root dev\n");
+    ReleaseEngine();
     return -EINVAL;
   }
   printk("Registering bus\n");
@@ -164,6 +415,7 @@ static int __init scsi_mock_init(void) {
   if (err) {
     printk("Error registering bus\n");
     root_device_unregister(pseudo_root_dev);
+    ReleaseEngine();
     return -EINVAL;
   }
   printk("Registering mock driver\n");
@@ -172,6 +424,7 @@ static int __init scsi_mock_init(void) {
     printk("Error registering driver\n");
     root_device_unregister(pseudo_root_dev);
     bus_unregister(&pseudo_bus);
+    ReleaseEngine();
     return -EINVAL;
   }
   printk("Registering mock device\n");
@@ -181,17 +434,26 @@ static int __init scsi_mock_init(void) {
     root_device_unregister(pseudo_root_dev);
     bus_unregister(&pseudo_bus);
     driver_unregister(&scsi_mock_driverfs);
+    ReleaseEngine();
     return -EINVAL;
   }
+  debugfs_dir = debugfs_create_dir("scsi2nvme", NULL);
+  debugfs_create_file("latency", 0644, debugfs_dir, NULL,
+                      &scsi_mock_latency_fops);
   printk("SUCCESS!");
   return 0;
 }
 
 static void __exit scsi_mock_exit(void) {
+  debugfs_remove_recursive(debugfs_dir);
   device_unregister(&pseudo_adapter);
   driver_unregister(&scsi_mock_driverfs);
   bus_unregister(&pseudo_bus);
   root_device_unregister(pseudo_root_dev);
+  // The host is gone, so only acknowledged deallocations remain
+  ScsiToNvmeDrainDiscards();
+  while (ScsiToNvmeDiscardsPending()) msleep(1);
+  ReleaseEngine();
   printk("GOODBYE!\n");
 }
 
@@ -0,0 +1,67 @@
+// Copyright 2020 Google LLC
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// version 2 as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+
+// Capture format of the SCSI commands that reach ScsiToNvme().
+//
+// A trace file starts with a ScsiTraceFileHeader followed by one record per
+// command in arrival order. Each record is a ScsiTraceRecord followed by
+// payload_len bytes of data out, padded to a multiple of 8 bytes. The payload
+// is only kept for commands whose data the translation library parses, such
+// as Unmap parameter lists; Read and Write data is never captured. All fields
+// are in host byte order.
+
+#ifndef SCSI_TRACE_H
+#define SCSI_TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
+#define SCSI_TRACE_MAGIC "SCSITRC"
+#define SCSI_TRACE_VERSION 1
+#define SCSI_TRACE_MAX_CDB_LEN 16
+// Data out beyond this is dropped from the payload
+#define SCSI_TRACE_MAX_PAYLOAD_LEN 65536
+
+enum ScsiTraceDirection {
+  SCSI_TRACE_NO_DATA = 0,
+  SCSI_TRACE_DATA_IN = 1,
+  SCSI_TRACE_DATA_OUT = 2,
+};
+
+struct ScsiTraceFileHeader {
+  char magic[8];  // SCSI_TRACE_MAGIC, NUL terminated
+  uint32_t version;
+  uint32_t record_size;  // sizeof(struct ScsiTraceRecord)
+};
+
+struct ScsiTraceRecord {
+  uint64_t timestamp_ns;  // Arrival time on a monotonic clock
+  uint64_t lun;
+  uint32_t data_len;     // Length of the command's data buffer
+  uint32_t payload_len;  // Bytes of data out following the record
+  uint8_t direction;     // enum ScsiTraceDirection
+  uint8_t cdb_len;
+  uint8_t reserved[6];
+  uint8_t cdb[SCSI_TRACE_MAX_CDB_LEN];
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,226 @@
+// Copyright 2020 Google LLC
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// version 2 as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+
+#include "trace_file.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <memory>
+#include <sstream>
+#include <string>
+
+namespace {
+
+constexpr uint32_t kPayloadAlign = 8;
+
+uint32_t PaddedLen(uint32_t len) {
+  return (len + kPayloadAlign - 1) / kPayloadAlign * kPayloadAlign;
+}
+
+struct FileCloser {
+  void operator()(FILE* file) const { fclose(file); }
+};
+using UniqueFile = std::unique_ptr<FILE, FileCloser>;
+
+// Parses hex CDB bytes from stream into record. Returns false if a byte is
+// malformed or there are too many
+bool ParseCdb(std::istream& stream, ScsiTraceRecord& record) {
+  std::string byte;
+  while (stream >> byte) {
+    char* end;
+    unsigned long value = strtoul(byte.c_str(), &end, 16);
+    if (*end != '\0' || value > UINT8_MAX ||
+        record.cdb_len == SCSI_TRACE_MAX_CDB_LEN)
+      return false;
+    record.cdb[record.cdb_len++] = value;
+  }
+  return record.cdb_len != 0;
+}
+
+uint64_t SecondsToNs(const std::string& seconds) {
+  return static_cast<uint64_t>(strtod(seconds.c_str(), nullptr) * 1e9);
+}
+
+// Parses "<seconds> <lun> <in|out|none> <data_len> <CDB>". Returns false if
+// the line is not in this format
+bool ParseNativeLine(const std::string& line, ScsiTraceRecord& record,
+                     bool& bad_cdb) {
+  std::istringstream stream(line);
+  std::string seconds, direction;
+  uint64_t lun;
+  uint32_t data_len;
+  if (!(stream >> seconds >> lun >> direction >> data_len)) return false;
+  if (direction == "in") {
+    record.direction = SCSI_TRACE_DATA_IN;
+  } else if (direction == "out") {
+    record.direction = SCSI_TRACE_DATA_OUT;
+  } else if (direction == "none") {
+    record.direction = SCSI_TRACE_NO_DATA;
+  } else {
+    return false;
+  }
+  record.timestamp_ns = SecondsToNs(seconds);
+  record.lun = lun;
+  record.data_len = data_len;
+  bad_cdb = !ParseCdb(stream, record);
+  return true;
+}
+
+// Parses the blkparse line of a passthrough request issued to the driver:
+// "<dev> <cpu> <seq> <seconds> <pid> D <rwbs> <bytes> (<CDB>) [<comm>]".
+// Returns false for other lines
+bool ParseBlkparseLine(const std::string& line, ScsiTraceRecord& record,
+                       bool& bad_cdb) {
+  size_t open = line.find('(');
+  size_t close = line.find(')', open);
+  if (open == std::string::npos || close == std::string::npos) return false;
+  std::istringstream fields(line.substr(0, open));
+  std::string device, cpu, sequence, seconds, pid, action, rwbs;
+  uint32_t bytes;
+  if (!(fields >> device >> cpu >> sequence >> seconds >> pid >> action >>
+        rwbs >> bytes) ||
+      action != "D")
+    return false;
+  record.timestamp_ns = SecondsToNs(seconds);
+  record.data_len = bytes;
+  if (bytes == 0) {
+    record.direction = SCSI_TRACE_NO_DATA;
+  } else if (rwbs.find('W') != std::string::npos) {
+    record.direction = SCSI_TRACE_DATA_OUT;
+  } else {
+    record.direction = SCSI_TRACE_DATA_IN;
+  }
+  std::istringstream cdb(line.substr(open + 1, close - open - 1));
+  bad_cdb = !ParseCdb(cdb, record);
+  return true;
+}
+
+}  // namespace
+
+ScsiTraceWriter::~ScsiTraceWriter() { Close(); }
+
+bool ScsiTraceWriter::Open(const char* path) {
+  Close();
+  file_ = fopen(path, "wb");
+  if (file_ == nullptr) return false;
+  failed_ = false;
+  ScsiTraceFileHeader header = {.magic = SCSI_TRACE_MAGIC,
+                                .version = SCSI_TRACE_VERSION,
+                                .record_size = sizeof(ScsiTraceRecord)};
+  failed_ = fwrite(&header, sizeof(header), 1, file_) != 1;
+  return !failed_;
+}
+
+bool ScsiTraceWriter::Write(const ScsiTraceRecord& record,
+                            const uint8_t* payload) {
+  static const uint8_t kPadding[kPayloadAlign] = {};
+  if (file_ == nullptr || failed_) return false;
+  uint32_t padding = PaddedLen(record.payload_len) - record.payload_len;
+  failed_ = fwrite(&record, sizeof(record), 1, file_) != 1 ||
+            fwrite(payload, 1, record.payload_len, file_) !=
+                record.payload_len ||
+            fwrite(kPadding, 1, padding, file_) != padding;
+  return !failed_;
+}
+
+bool ScsiTraceWriter::Close() {
+  if (file_ == nullptr) return !failed_;
+  if (fclose(file_) != 0) failed_ = true;
+  file_ = nullptr;
+  return !failed_;
+}
+
+void ScsiTraceWriter::Hook(void* priv, const ScsiTraceRecord* record,
+                           const unsigned char* payload) {
+  static_cast<ScsiTraceWriter*>(priv)->Write(*record, payload);
+}
+
+bool ReadScsiTrace(const char* path, std::vector<ScsiTraceCommand>& commands) {
+  UniqueFile file(fopen(path, "rb"));
+  if (file == nullptr) {
+    fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  ScsiTraceFileHeader header;
+  if (fread(&header, sizeof(header), 1, file.get()) != 1 ||
+      strncmp(header.magic, SCSI_TRACE_MAGIC, sizeof(header.magic)) != 0) {
+    fprintf(stderr, "%s is not a SCSI trace\n", path);
+    return false;
+  }
+  if (header.version != SCSI_TRACE_VERSION ||
+      header.record_size != sizeof(ScsiTraceRecord)) {
+    fprintf(stderr, "%s has unsupported version %u\n", path, header.version);
+    return false;
+  }
+
+  ScsiTraceCommand command;
+  size_t read_len;
+  while ((read_len = fread(&command.record, 1, sizeof(command.record),
+                           file.get())) == sizeof(command.record)) {
+    const ScsiTraceRecord& record = command.record;
+    if (record.cdb_len == 0 || record.cdb_len > SCSI_TRACE_MAX_CDB_LEN ||
+        record.payload_len > SCSI_TRACE_MAX_PAYLOAD_LEN ||
+        record.payload_len > record.data_len) {
+      fprintf(stderr, "%s: record %zu is malformed\n", path, commands.size());
+      return false;
+    }
+    command.payload.resize(PaddedLen(record.payload_len));
+    if (fread(command.payload.data(), 1, command.payload.size(),
+              file.get()) != command.payload.size()) {
+      fprintf(stderr, "%s: record %zu is truncated\n", path, commands.size());
+      return false;
+    }
+    command.payload.resize(record.payload_len);
+    commands.push_back(command);
+  }
+  if (ferror(file.get())) {
+    fprintf(stderr, "Failed to read %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  if (read_len != 0) {
+    fprintf(stderr, "%s ends with a truncated record\n", path);
+    return false;
+  }
+  return true;
+}
+
+bool ImportTextTrace(const char* path,
+                     std::vector<ScsiTraceCommand>& commands) {
+  UniqueFile file(fopen(path, "r"));
+  if (file == nullptr) {
+    fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+  char* line_buf = nullptr;
+  size_t line_size = 0;
+  uint32_t line_number = 0;
+  bool ok = true;
+  while (getline(&line_buf, &line_size, file.get()) > 0) {
+    ++line_number;
+    std::string line(line_buf);
+    if (line[0] == '#') continue;
+    ScsiTraceCommand command = {};
+    bool bad_cdb = false;
+    if (!ParseBlkparseLine(line, command.record, bad_cdb) &&
+        !ParseNativeLine(line, command.record, bad_cdb))
+      continue;
+    if (bad_cdb) {
+      fprintf(stderr, "%s:%u: malformed CDB\n", path, line_number);
+      ok = false;
+      break;
+    }
+    commands.push_back(command);
+  }
+  free(line_buf);
+  return ok;
+}
@@ -0,0 +1,72 @@
+// Copyright 2020 Google LLC
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// version 2 as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+
+// Userspace reading and writing of the scsi_trace.h capture format, and
+// import of text command logs
+
+#ifndef TRACE_FILE_H
+#define TRACE_FILE_H
+
+#include <stdio.h>
+
+#include <cstdint>
+#include <vector>
+
+#include "scsi_trace.h"
+
+struct ScsiTraceCommand {
+  ScsiTraceRecord record;
+  std::vector<uint8_t> payload;  // record.payload_len bytes of data out
+};
+
+// Appends records to a new trace file. Safe to use from one thread at a time
+class ScsiTraceWriter {
+ public:
+  ScsiTraceWriter() = default;
+  ScsiTraceWriter(const ScsiTraceWriter&) = delete;
+  ScsiTraceWriter& operator=(const ScsiTraceWriter&) = delete;
+  ~ScsiTraceWriter();
+
+  // Creates or truncates path and writes the file header. Returns false if
+  // the file cannot be written
+  bool Open(const char* path);
+
+  // payload holds record.payload_len bytes. Returns false on a write error
+  bool Write(const ScsiTraceRecord& record, const uint8_t* payload);
+
+  // Flushes and closes the file. Returns false if any write failed
+  bool Close();
+
+  // Adapts the writer to SetScsiToNvmeTraceHook(), with the writer as priv
+  static void Hook(void* priv, const ScsiTraceRecord* record,
+                   const unsigned char* payload);
+
+ private:
+  FILE* file_ = nullptr;
+  bool failed_ = false;
+};
+
+// Appends the commands of the trace file at path to commands. Returns false,
+// printing the reason to stderr, if the file is not a valid trace
+bool ReadScsiTrace(const char* path, std::vector<ScsiTraceCommand>& commands);
+
+// Appends the commands of a text log to commands. Two line formats are
+// accepted, and lines that match neither are skipped:
+//  - "<seconds> <lun> <in|out|none> <data_len> <CDB bytes in hex>...", e.g.
+//    "0.000125 0 in 4096 28 00 00 00 10 00 00 00 08 00"
+//  - blkparse output for SCSI passthrough requests issued to the driver, e.g.
+//    "8,0 3 1 0.000125 4110 D R 255 (12 00 00 00 ff 00) [sg_inq]", which is
+//    how blktrace logs commands sent with SG_IO
+// Returns false, printing the reason to stderr, if path cannot be read or a
+// line has a malformed CDB
+bool ImportTextTrace(const char* path, std::vector<ScsiTraceCommand>& commands);
+
+#endif
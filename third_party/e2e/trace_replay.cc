@@ -0,0 +1,472 @@
+// Copyright 2020 Google LLC
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// version 2 as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+
+// Replays a captured SCSI command trace through the engine against the NVMe
+// emulator, either as fast as queue_depth allows or at a multiple of the
+// recorded arrival rate, and reports throughput, heap and page allocations
+// per command and the engine's latency histograms. Traces come from
+// load_generator --capture, SetScsiToNvmeTraceHook() or a text log, e.g.
+//   trace_replay --trace=prod.trace --queue_depth=64 --repeat=10
+//   trace_replay --text=blkparse.txt --convert=prod.trace
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "lib/translator/common.h"
+#include "engine.h"
+#include "nvme_driver.h"
+#include "nvme_emulator.h"
+#include "trace_file.h"
+
+namespace {
+
+constexpr uint32_t kPageSize = 4096;
+constexpr uint32_t kSenseLen = 96;
+constexpr uint32_t kScanDataLen = 255;
+// Bounds the data buffer of every slot
+constexpr uint32_t kMaxDataLen = 16 << 20;
+
+// Heap allocations made by this process, counted by operator new
+std::atomic<uint64_t> heap_allocs;
+
+struct Options {
+  const char* trace_path = nullptr;
+  const char* text_path = nullptr;
+  const char* convert_path = nullptr;
+  uint32_t queue_depth = 32;
+  // Multiple of the recorded arrival rate, or 0 to replay as fast as
+  // queue_depth allows
+  double speed = 0;
+  uint32_t repeat = 1;
+  bool scan = true;
+  ScsiToNvmeDiscardConfig discard = {.early_ack = false,
+                                     .max_ranges = 4096,
+                                     .max_foreground = 8,
+                                     .batch_interval_ns = 1000000};
+  ScsiToNvmeFlushConfig flush = {.group = false, .broadcast = false};
+  NvmeEmulatorConfig emulator = kDefaultNvmeEmulatorConfig;
+};
+
+void PrintUsage() {
+  fprintf(stderr,
+          "Usage: trace_replay (--trace=path | --text=path) [--name=value]...\n"
+          "  --trace           Trace file written by the capture hook\n"
+          "  --text            Text log to import, see trace_file.h\n"
+          "  --convert         Write the commands to this trace file and exit\n"
+          "  --queue_depth     Commands kept in flight\n"
+          "  --speed           Multiple of the recorded rate, 0 for as fast\n"
+          "                    as possible\n"
+          "  --repeat          Times to replay the trace\n"
+          "  --scan            Run Inquiry and Read Capacity(10) first (0|1)\n"
+          "  --early_unmap     Acknowledge Unmap once its ranges are queued\n"
+          "                    and deallocate them in the background (0|1)\n"
+          "  --group_flush     Share one Flush among Synchronize Cache\n"
+          "                    commands that arrive together (0|1)\n"
+          "  --broadcast_flush Send grouped Flushes to every namespace (0|1)\n"
+          "  --blocks          Namespace size in logical blocks\n"
+          "  --lba_shift       Logical block size is 1 << lba_shift\n"
+          "  --backing_file    Sparse file holding the namespace\n"
+          "  --latency_ns      Latency the emulator adds to each command\n"
+          "  --io_queues       NVMe IO queues\n"
+          "  --io_queue_depth  Depth of each NVMe IO queue\n");
+}
+
+bool ParseOptions(int argc, char** argv, Options& options) {
+  for (int i = 1; i < argc; ++i) {
+    const char* arg = argv[i];
+    const char* value = strchr(arg, '=');
+    if (strncmp(arg, "--", 2) != 0 || value == nullptr) return false;
+    std::string name(arg + 2, value - arg - 2);
+    ++value;
+    uint64_t number = strtoull(value, nullptr, 0);
+    if (name == "trace") {
+      options.trace_path = value;
+    } else if (name == "text") {
+      options.text_path = value;
+    } else if (name == "convert") {
+      options.convert_path = value;
+    } else if (name == "queue_depth") {
+      options.queue_depth = number;
+    } else if (name == "speed") {
+      options.speed = strtod(value, nullptr);
+    } else if (name == "repeat") {
+      options.repeat = number;
+    } else if (name == "scan") {
+      options.scan = number != 0;
+    } else if (name == "early_unmap") {
+      options.discard.early_ack = number != 0;
+    } else if (name == "group_flush") {
+      options.flush.group = number != 0;
+    } else if (name == "broadcast_flush") {
+      options.flush.broadcast = number != 0;
+    } else if (name == "blocks") {
+      options.emulator.block_count = number;
+    } else if (name == "lba_shift") {
+      options.emulator.lba_shift = number;
+    } else if (name == "backing_file") {
+      options.emulator.backing_path = value;
+    } else if (name == "latency_ns") {
+      options.emulator.latency_ns = number;
+    } else if (name == "io_queues") {
+      options.emulator.io_queue_count = number;
+    } else if (name == "io_queue_depth") {
+      options.emulator.io_queue_depth = number;
+    } else {
+      return false;
+    }
+  }
+  return (options.trace_path == nullptr) != (options.text_path == nullptr) &&
+         options.queue_depth != 0 && options.speed >= 0;
+}
+
+class TraceReplay;
+
+// Everything one command in flight needs
+struct Slot {
+  TraceReplay* replay;
+  std::unique_ptr<uint64_t[]> context;  // 8 byte aligned engine context
+  uint8_t* scratch_page;
+  uint8_t* data;
+  // data, one segment per page like a scatterlist
+  std::vector<NvmeDataSegment> segments;
+  unsigned char cdb[SCSI_TRACE_MAX_CDB_LEN];
+  unsigned char sense[kSenseLen];
+};
+
+class TraceReplay {
+ public:
+  TraceReplay(const Options& options,
+              const std::vector<ScsiTraceCommand>& commands)
+      : options_(options), commands_(commands) {}
+  ~TraceReplay();
+
+  // Allocates the slots. Returns false if memory is unavailable
+  bool Init();
+
+  // Runs Inquiry and Read Capacity(10) like a SCSI host scan. Returns false
+  // if either fails
+  bool Scan();
+
+  // Replays the trace options.repeat times
+  void Run();
+
+ private:
+  static void Done(void* priv, ScsiToNvmeResponse resp);
+
+  // Passes command to ScsiToNvme() in slot. Returns its result
+  int Submit(Slot* slot, const ScsiTraceCommand& command);
+  Slot* TakeSlot();
+  void ReturnSlot(Slot* slot);
+  void WaitIdle();
+
+  const Options& options_;
+  const std::vector<ScsiTraceCommand>& commands_;
+  uint32_t data_len_ = kScanDataLen;
+  std::vector<Slot> slots_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::vector<Slot*> free_slots_;
+  uint64_t not_good_ = 0;
+  int last_status_ = 0;
+};
+
+TraceReplay::~TraceReplay() {
+  for (Slot& slot : slots_) {
+    free(slot.scratch_page);
+    free(slot.data);
+  }
+}
+
+bool TraceReplay::Init() {
+  for (const ScsiTraceCommand& command : commands_)
+    data_len_ = std::max(data_len_, command.record.data_len);
+  if (data_len_ > kMaxDataLen) {
+    fprintf(stderr, "Commands with more than %u bytes of data are not "
+                    "supported\n", kMaxDataLen);
+    return false;
+  }
+  uint32_t context_words = (ScsiToNvmeContextSize() + 7) / 8;
+  uint32_t data_pages = (data_len_ + kPageSize - 1) / kPageSize;
+  slots_.resize(options_.queue_depth);
+  for (Slot& slot : slots_) {
+    slot.replay = this;
+    slot.context.reset(new uint64_t[context_words]);
+    slot.scratch_page =
+        static_cast<uint8_t*>(aligned_alloc(kPageSize, kPageSize));
+    slot.data = static_cast<uint8_t*>(
+        aligned_alloc(kPageSize, data_pages * kPageSize));
+    if (slot.scratch_page == nullptr || slot.data == nullptr) return false;
+    memset(slot.data, 0, data_pages * kPageSize);
+    slot.segments.reserve(data_pages);
+    free_slots_.push_back(&slot);
+  }
+  return true;
+}
+
+void TraceReplay::Done(void* priv, ScsiToNvmeResponse resp) {
+  Slot* slot = static_cast<Slot*>(priv);
+  TraceReplay* replay = slot->replay;
+  {
+    std::lock_guard<std::mutex> lock(replay->mutex_);
+    if (resp.return_code != 0) ++replay->not_good_;
+    replay->last_status_ = resp.return_code;
+    replay->free_slots_.push_back(slot);
+  }
+  replay->cv_.notify_one();
+}
+
+int TraceReplay::Submit(Slot* slot, const ScsiTraceCommand& command) {
+  const ScsiTraceRecord& record = command.record;
+  memcpy(slot->cdb, record.cdb, record.cdb_len);
+  bool is_data_in = record.direction == SCSI_TRACE_DATA_IN;
+  bool is_direct = record.data_len != 0 &&
+                   ScsiToNvmeIsDirect(slot->cdb, record.cdb_len);
+  if (is_direct) {
+    slot->segments.clear();
+    for (uint32_t offset = 0; offset < record.data_len; offset += kPageSize) {
+      slot->segments.push_back(
+          {.addr = reinterpret_cast<uint64_t>(slot->data + offset),
+           .len = std::min(kPageSize, record.data_len - offset)});
+    }
+  } else if (!is_data_in) {
+    // Parameter lists the capture did not keep are replayed as zeroes
+    memcpy(slot->data, command.payload.data(), command.payload.size());
+    memset(slot->data + command.payload.size(), 0,
+           record.data_len - command.payload.size());
+  }
+  return ScsiToNvme(slot->context.get(), slot->scratch_page, slot->cdb,
+                    record.cdb_len, record.lun, slot->sense, kSenseLen,
+                    is_direct ? nullptr : slot->data,
+                    is_direct ? slot->segments.data() : nullptr,
+                    is_direct ? slot->segments.size() : 0, record.data_len,
+                    is_data_in, NVME_ANY_HW_QUEUE, Done, slot);
+}
+
+Slot* TraceReplay::TakeSlot() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this] { return !free_slots_.empty(); });
+  Slot* slot = free_slots_.back();
+  free_slots_.pop_back();
+  return slot;
+}
+
+void TraceReplay::ReturnSlot(Slot* slot) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  free_slots_.push_back(slot);
+}
+
+void TraceReplay::WaitIdle() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  cv_.wait(lock, [this] { return free_slots_.size() == slots_.size(); });
+}
+
+bool TraceReplay::Scan() {
+  ScsiTraceCommand inquiry = {};
+  inquiry.record.direction = SCSI_TRACE_DATA_IN;
+  inquiry.record.data_len = kScanDataLen;
+  inquiry.record.cdb_len = 6;
+  inquiry.record.cdb[0] = static_cast<uint8_t>(scsi::OpCode::kInquiry);
+  inquiry.record.cdb[4] = kScanDataLen;
+
+  ScsiTraceCommand read_capacity = {};
+  read_capacity.record.direction = SCSI_TRACE_DATA_IN;
+  read_capacity.record.data_len = sizeof(scsi::ReadCapacity10Data);
+  read_capacity.record.cdb_len = 10;
+  read_capacity.record.cdb[0] =
+      static_cast<uint8_t>(scsi::OpCode::kReadCapacity10);
+
+  for (const ScsiTraceCommand* command : {&inquiry, &read_capacity}) {
+    Slot* slot = TakeSlot();
+    if (Submit(slot, *command) != 0) {
+      ReturnSlot(slot);
+      fprintf(stderr, "Failed to submit opcode 0x%02x\n",
+              command->record.cdb[0]);
+      return false;
+    }
+    WaitIdle();
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (last_status_ != 0) {
+      fprintf(stderr, "Opcode 0x%02x failed with status %d\n",
+              command->record.cdb[0], last_status_);
+      return false;
+    }
+  }
+  return true;
+}
+
+void TraceReplay::Run() {
+  uint64_t trace_start_ns = commands_.front().record.timestamp_ns;
+  uint64_t max_lag_ns = 0;
+  unsigned long long pool_hits, pool_misses;
+  ScsiToNvmePagePoolStats(&pool_hits, &pool_misses);
+  uint64_t start_allocs = heap_allocs.load(std::memory_order_relaxed);
+
+  auto start = std::chrono::steady_clock::now();
+  for (uint32_t pass = 0; pass < options_.repeat; ++pass) {
+    auto pass_start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < commands_.size();) {
+      const ScsiTraceCommand& command = commands_[i];
+      if (options_.speed != 0) {
+        // Open loop: submit at the recorded offset, scaled by speed
+        auto due = pass_start + std::chrono::nanoseconds(static_cast<int64_t>(
+                                    (command.record.timestamp_ns -
+                                     trace_start_ns) /
+                                    options_.speed));
+        std::this_thread::sleep_until(due);
+        auto lag = std::chrono::steady_clock::now() - due;
+        max_lag_ns = std::max<uint64_t>(
+            max_lag_ns,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(lag)
+                .count());
+      }
+      Slot* slot = TakeSlot();
+      if (Submit(slot, command) != 0) {
+        // The NVMe queue is full; retry once a command completes
+        ReturnSlot(slot);
+        std::this_thread::yield();
+        continue;
+      }
+      ++i;
+    }
+  }
+  WaitIdle();
+  // Deallocations acknowledged early still count towards the replay
+  ScsiToNvmeDrainDiscards();
+  while (ScsiToNvmeDiscardsPending()) std::this_thread::yield();
+  std::chrono::duration<double> seconds =
+      std::chrono::steady_clock::now() - start;
+
+  double count = static_cast<double>(commands_.size()) * options_.repeat;
+  uint64_t allocs =
+      heap_allocs.load(std::memory_order_relaxed) - start_allocs;
+  unsigned long long end_hits, end_misses;
+  ScsiToNvmePagePoolStats(&end_hits, &end_misses);
+  printf("%.0f commands in %.3f s: %.0f commands/s\n", count,
+         seconds.count(), count / seconds.count());
+  printf("Per command: %.3f heap allocations, %.3f pooled pages, "
+         "%.3f page allocations\n",
+         allocs / count, (end_hits - pool_hits) / count,
+         (end_misses - pool_misses) / count);
+  if (options_.speed != 0)
+    printf("Submissions trailed the schedule by up to %.1f us\n",
+           max_lag_ns / 1e3);
+  std::lock_guard<std::mutex> lock(mutex_);
+  printf("%llu commands completed without Good status\n",
+         static_cast<unsigned long long>(not_good_));
+}
+
+void PrintLatency() {
+  char line[160];
+  for (uint32_t i = 0; i < ScsiToNvmeLatencyLineCount(); ++i) {
+    if (ScsiToNvmeLatencyLine(i, line, sizeof(line))) fputs(line, stdout);
+  }
+}
+
+bool LoadCommands(const Options& options,
+                  std::vector<ScsiTraceCommand>& commands) {
+  if (options.trace_path != nullptr)
+    return ReadScsiTrace(options.trace_path, commands);
+  return ImportTextTrace(options.text_path, commands);
+}
+
+bool Convert(const char* path, const std::vector<ScsiTraceCommand>& commands) {
+  ScsiTraceWriter writer;
+  bool ok = writer.Open(path);
+  for (const ScsiTraceCommand& command : commands)
+    ok = ok && writer.Write(command.record, command.payload.data());
+  ok = writer.Close() && ok;
+  if (!ok) fprintf(stderr, "Failed to write %s\n", path);
+  return ok;
+}
+
+}  // namespace
+
+void* operator new(size_t size) {
+  heap_allocs.fetch_add(1, std::memory_order_relaxed);
+  void* ptr = malloc(size == 0 ? 1 : size);
+  if (ptr == nullptr) throw std::bad_alloc();
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept { free(ptr); }
+
+void operator delete(void* ptr, size_t) noexcept { free(ptr); }
+
+int main(int argc, char** argv) {
+  Options options;
+  if (!ParseOptions(argc, argv, options)) {
+    PrintUsage();
+    return 2;
+  }
+
+  std::vector<ScsiTraceCommand> commands;
+  if (!LoadCommands(options, commands)) return 1;
+  if (options.convert_path != nullptr)
+    return Convert(options.convert_path, commands) ? 0 : 1;
+  if (commands.empty()) {
+    fprintf(stderr, "The trace has no commands\n");
+    return 1;
+  }
+
+  int ret = nvme_emulator_init(options.emulator);
+  if (ret != 0) {
+    fprintf(stderr, "Failed to start the NVMe emulator: %s\n", strerror(-ret));
+    return 1;
+  }
+  SetEngineCallbacks();
+  if (SetScsiToNvmeDiscardConfig(&options.discard) != 0) {
+    fprintf(stderr, "Failed to set up background discard\n");
+    ReleaseEngine();
+    nvme_emulator_exit();
+    return 1;
+  }
+  if (SetScsiToNvmeFlushConfig(&options.flush) != 0) {
+    fprintf(stderr, "Failed to set up flush group commit\n");
+    ReleaseEngine();
+    nvme_emulator_exit();
+    return 1;
+  }
+  // Per command debug messages would dominate a profile
+  translator::SetLogLevel(translator::LogLevel::kWarning);
+
+  int status = 0;
+  {
+    TraceReplay replay(options, commands);
+    if (!replay.Init()) {
+      fprintf(stderr, "Failed to allocate %u commands\n", options.queue_depth);
+      status = 1;
+    } else if (options.scan && !replay.Scan()) {
+      status = 1;
+    } else {
+      ScsiToNvmeResetLatency();
+      replay.Run();
+      PrintLatency();
+    }
+  }
+
+  ReleaseEngine();
+  nvme_emulator_exit();
+  return status;
+}
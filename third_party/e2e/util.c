@@ -11,18 +11,47 @@
 
 #include "util.h"
 
+#include <linux/cpumask.h>
 #include <linux/slab.h>
+#include <linux/smp.h>
+#include <linux/spinlock.h>
+#include <linux/timekeeping.h>
 
 void Print(const char* msg) { printk(msg); }
 
 uint64_t AllocPages(uint32_t page_size, uint16_t count) {
+  void* addr;
   if (count == 0) return 0;
-  printk("Allocating %u bytes", page_size * count);
-  void* addr = kzalloc(page_size * count, GFP_ATOMIC | GFP_KERNEL);
-  if (addr == NULL) printk("NULLPTR ALLOC PAGES!!!!");
+  // Called from queuecommand and NVMe completions, which may not sleep
+  addr = kzalloc(page_size * count, GFP_ATOMIC);
+  if (addr == NULL) printk("Failed to allocate %u pages", count);
   return (unsigned long long)addr;
 }
 
 void DeallocPages(uint64_t addr, uint16_t count) {
   if (addr != 0) kfree((void*)addr);
 }
+
+uint32_t CurrentCpu(void) { return raw_smp_processor_id(); }
+
+uint32_t PossibleCpuCount(void) { return nr_cpu_ids; }
+
+uint64_t NowNs(void) { return ktime_get_ns(); }
+
+void* CreateSpinLock(void) {
+  spinlock_t* lock = kmalloc(sizeof(*lock), GFP_KERNEL);
+  if (lock != NULL) spin_lock_init(lock);
+  return lock;
+}
+
+void DestroySpinLock(void* lock) { kfree(lock); }
+
+unsigned long SpinLock(void* lock) {
+  unsigned long flags;
+  spin_lock_irqsave((spinlock_t*)lock, flags);
+  return flags;
+}
+
+void SpinUnlock(void* lock, unsigned long flags) {
+  spin_unlock_irqrestore((spinlock_t*)lock, flags);
+}
@@ -12,7 +12,11 @@
 #ifndef NVME2SCSI_UTIL_H
 #define NVME2SCSI_UTIL_H
 
+#ifdef __KERNEL__
 #include <linux/kernel.h>
+#else
+#include <stdint.h>
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -24,6 +28,23 @@ uint64_t AllocPages(uint32_t page_size, uint16_t count);
 
 void DeallocPages(uint64_t addr, uint16_t count);
 
+// CPU the caller runs on, which may change unless preemption is disabled
+uint32_t CurrentCpu(void);
+
+// CurrentCpu() is always below this
+uint32_t PossibleCpuCount(void);
+
+// Monotonic time in nanoseconds
+uint64_t NowNs(void);
+
+// A spinlock that may be taken from any context, including interrupts.
+// CreateSpinLock() returns NULL if memory is unavailable. SpinLock() returns
+// the flags SpinUnlock() restores
+void* CreateSpinLock(void);
+void DestroySpinLock(void* lock);
+unsigned long SpinLock(void* lock);
+void SpinUnlock(void* lock, unsigned long flags);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,80 @@
+// Copyright 2020 Google LLC
+//
+// This program is free software; you can redistribute it and/or
+// modify it under the terms of the GNU General Public License
+// version 2 as published by the Free Software Foundation.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+
+// Userspace implementation of util.h, used with the NVMe emulator
+
+#include "util.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sysinfo.h>
+#include <time.h>
+
+void Print(const char* msg) { fprintf(stderr, "%s\n", msg); }
+
+uint64_t AllocPages(uint32_t page_size, uint16_t count) {
+  if (count == 0) return 0;
+  void* addr = aligned_alloc(page_size, page_size * count);
+  if (addr == NULL) {
+    fprintf(stderr, "Failed to allocate %u pages\n", count);
+    return 0;
+  }
+  memset(addr, 0, page_size * count);
+  return (uint64_t)addr;
+}
+
+void DeallocPages(uint64_t addr, uint16_t count) { free((void*)addr); }
+
+uint32_t CurrentCpu(void) {
+  int cpu = sched_getcpu();
+  if (cpu < 0 || (uint32_t)cpu >= PossibleCpuCount()) return 0;
+  return cpu;
+}
+
+uint32_t PossibleCpuCount(void) {
+  static const uint32_t count = get_nprocs_conf();
+  return count;
+}
+
+uint64_t NowNs(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void* CreateSpinLock(void) {
+  // glibc's pthread_spinlock_t is volatile, which void* cannot hold
+  pthread_spinlock_t* lock =
+      (pthread_spinlock_t*)malloc(sizeof(pthread_spinlock_t));
+  if (lock != NULL && pthread_spin_init(lock, PTHREAD_PROCESS_PRIVATE) != 0) {
+    free((void*)lock);
+    return NULL;
+  }
+  return (void*)lock;
+}
+
+void DestroySpinLock(void* lock) {
+  if (lock == NULL) return;
+  pthread_spin_destroy((pthread_spinlock_t*)lock);
+  free(lock);
+}
+
+unsigned long SpinLock(void* lock) {
+  pthread_spin_lock((pthread_spinlock_t*)lock);
+  return 0;
+}
+
+void SpinUnlock(void* lock, unsigned long flags) {
+  pthread_spin_unlock((pthread_spinlock_t*)lock);
+}
@@ -4,10 +4,13 @@
 #include <cstdint>
 
 #include "absl/base/attributes.h"
+#include "lib/endian.h"
 
 // https://github.com/spdk/spdk/blob/master/include/spdk/nvme_spec.h
 namespace nvme {
 
+using endian::LittleEndian;
+
 static const int kIdentifyNsListMaxLength = 1024;
 
 // NVMe Base Specification Figure 125
@@ -283,6 +286,8 @@ enum class SglDescriptorSubtype : uint8_t {
 
 // NVMe Base Specification Figure 114 to Figure 119
 // https://nvmexpress.org/wp-content/uploads/NVM-Express-1_4-2019.06.10-Ratified.pdf
+// Command dptr unions hold this descriptor, so it keeps raw little endian
+// integers: endian wrappers are not POD and would unpack those unions
 struct SglDescriptor {
   uint64_t address : 64;
   union {
@@ -408,9 +413,9 @@ static_assert(sizeof(DatasetManagementCmd) == 64);
 // NVMe Base Specification Figure 366
 // https://nvmexpress.org/wp-content/uploads/NVM-Express-1_4-2019.06.10-Ratified.pdf
 struct DatasetManagmentRange {
-  uint32_t context_attributes : 32;
-  uint32_t lb_count : 32;  // length in logical blocks
-  uint64_t lba : 64;       // starting lba
+  LittleEndian<uint32_t> context_attributes;
+  LittleEndian<uint32_t> lb_count;  // length in logical blocks
+  LittleEndian<uint64_t> lba;       // starting lba
 } ABSL_ATTRIBUTE_PACKED;
 static_assert(sizeof(DatasetManagmentRange) == 16);
 
@@ -711,7 +716,9 @@ struct IdentifyNamespace {
     uint8_t dealloc_or_unwritten_err : 1;
     // Non-zero NGUID and EUI64 for namespace are never reused
     uint8_t guid_never_reused : 1;
-    uint8_t reserved1 : 4;
+    // NPWG, NPWA, NPDG, NPDA, and NOWS are defined for this namespace
+    uint8_t opt_perf : 1;
+    uint8_t reserved1 : 3;
   } nsfeat;  // namespace features
 
   uint8_t nlbaf : 8;  // number of lba formats
@@ -804,7 +811,12 @@ struct IdentifyNamespace {
   uint16_t nabspf : 16;    // namespace atomic boundary size power fail
   uint16_t noiob : 16;     // namespace optimal I/O boundary in logical blocks
   uint64_t nvmcap[2];      // NVM capacity
-  uint8_t reserved64[40];  // includes fields added in NVMe Revision 1.4
+  uint16_t npwg : 16;      // namespace preferred write granularity
+  uint16_t npwa : 16;      // namespace preferred write alignment
+  uint16_t npdg : 16;      // namespace preferred deallocate granularity
+  uint16_t npda : 16;      // namespace preferred deallocate alignment
+  uint16_t nows : 16;      // namespace optimal write size
+  uint8_t reserved74[30];  // includes fields added in NVMe Revision 1.4
   uint64_t nguid[2];       // namespace globally unique identifier
   uint64_t eui64 : 64;     // IEEE extended unique identifier
 